@@ -50,6 +50,30 @@ pub fn print_semihosting_caps() {
     );
 }
 
+/// Saves the kernel trace to a file on the host, in the binary format described in
+/// `p1c0_kernel::trace`.
+#[cfg(feature = "emulator")]
+pub fn save_trace(path: &str) {
+    let mut file = match arm_semihosting::io::create(path, arm_semihosting::io::AccessType::Binary)
+    {
+        Ok(file) => file,
+        Err(_) => {
+            log_error!("Error creating trace file {}", path);
+            return;
+        }
+    };
+
+    let mut write_failed = false;
+    if let Err(e) = p1c0_kernel::trace::export(|bytes| {
+        write_failed |= file.write(bytes).is_err();
+    }) {
+        log_error!("Error draining trace: {:?}", e);
+    }
+    if write_failed {
+        log_error!("Error saving trace data");
+    }
+}
+
 #[no_mangle]
 #[cfg(test)]
 pub extern "C" fn kernel_main() {
@@ -13,6 +13,7 @@ use p1c0_kernel::{
     arch::get_exception_level,
     boot_args::get_boot_args,
     drivers::display::Display,
+    memory,
     prelude::*,
     syscall::Syscall,
     thread::{self, print_thread_info},
@@ -43,6 +44,7 @@ fn kernel_entry() {
 
     thread::spawn(move || {
         print_thread_info();
+        memory::print_statistics();
 
         let mut count = 0;
         loop {
@@ -77,19 +79,7 @@ fn kernel_entry() {
     });
 
     thread::spawn(move || {
-        let filename = "/bin/virtio";
-        let mut file = p1c0_kernel::filesystem::VirtualFileSystem::open(
-            filename,
-            p1c0_kernel::filesystem::OpenMode::Read,
-        )
-        .unwrap();
-
-        let mut elf_data = vec![];
-        elf_data.resize(file.size, 0);
-        p1c0_kernel::filesystem::VirtualFileSystem::read(&mut file, &mut elf_data[..]).unwrap();
-        p1c0_kernel::filesystem::VirtualFileSystem::close(file);
-        let builder =
-            p1c0_kernel::process::Builder::new_from_elf_data(filename, elf_data, 0).unwrap();
+        let builder = p1c0_kernel::process::Builder::new_from_file("/bin/virtio", 0).unwrap();
         builder.start().unwrap();
     });
 
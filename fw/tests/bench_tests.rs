@@ -0,0 +1,140 @@
+#![no_std]
+#![no_main]
+#![feature(custom_test_frameworks)]
+#![test_runner(test_fwk::runner)]
+#![reexport_test_harness_main = "test_main"]
+#![feature(default_alloc_error_handler)]
+
+use p1c0 as _; // needed to link libentry (and _start)
+
+use core::{
+    alloc::Layout,
+    sync::atomic::{AtomicBool, Ordering},
+};
+
+use p1c0_kernel::{
+    crc::crc32c,
+    memory::{AllocPolicy, MemoryManager},
+    prelude::*,
+    process,
+    syscall::Syscall,
+    thread,
+};
+
+use test_fwk::bench::{bench, black_box};
+
+#[panic_handler]
+fn panic_handler(panic_info: &core::panic::PanicInfo) -> ! {
+    test_fwk::panic_handler(panic_info)
+}
+
+#[no_mangle]
+pub extern "C" fn kernel_main() {
+    thread::Builder::new().name("Test").spawn(|| {
+        test_main();
+    });
+
+    thread::initialize();
+}
+
+#[test_case]
+fn bench_noop_syscall() {
+    bench("syscall_noop", 10_000, || Syscall::noop());
+}
+
+#[test_case]
+fn bench_yield_ping_pong() {
+    static STOP: AtomicBool = AtomicBool::new(false);
+    STOP.store(false, Ordering::Relaxed);
+
+    let partner = thread::spawn(|| {
+        while !STOP.load(Ordering::Relaxed) {
+            Syscall::yield_exec();
+        }
+    });
+
+    // Every iteration switches to the partner thread and back
+    bench("yield_ping_pong", 10_000, || Syscall::yield_exec());
+
+    STOP.store(true, Ordering::Relaxed);
+    partner.join();
+}
+
+#[test_case]
+fn bench_kalloc() {
+    const SIZES: [usize; 5] = [16, 64, 256, 1024, 4096];
+
+    for size in SIZES {
+        let layout = Layout::from_size_align(size, 8).unwrap();
+        let name = alloc::format!("kalloc_{}", size);
+        bench(&name, 10_000, || unsafe {
+            let ptr = alloc::alloc::alloc(layout);
+            assert!(!ptr.is_null());
+            alloc::alloc::dealloc(black_box(ptr), layout);
+        });
+    }
+
+    // Sizes that are freed in a different order from the one they were allocated in
+    bench("kalloc_mix", 2_000, || unsafe {
+        let mut ptrs = [core::ptr::null_mut(); SIZES.len()];
+        for (ptr, size) in ptrs.iter_mut().zip(SIZES) {
+            *ptr = alloc::alloc::alloc(Layout::from_size_align(size, 8).unwrap());
+            assert!(!ptr.is_null());
+        }
+        for (ptr, size) in ptrs.iter().zip(SIZES).rev() {
+            alloc::alloc::dealloc(black_box(*ptr), Layout::from_size_align(size, 8).unwrap());
+        }
+    });
+}
+
+#[test_case]
+fn bench_request_zeroed_page() {
+    bench("request_any_pages_zero_fill", 1_000, || {
+        let mut mm = MemoryManager::instance();
+        let pages = mm.request_any_pages(1, AllocPolicy::ZeroFill).unwrap();
+        mm.release_pages(black_box(pages)).unwrap();
+    });
+}
+
+#[test_case]
+fn bench_process_spawn_and_exit() {
+    // Exited processes are kept as zombies, so this runs few iterations
+    bench("process_spawn_exit", 32, || {
+        let pid = process::Builder::new_from_file("/bin/true", 0)
+            .unwrap()
+            .start()
+            .unwrap();
+        assert_eq!(Syscall::wait_pid(pid.get_raw()), 0);
+    });
+}
+
+#[test_case]
+fn bench_flat_map() {
+    const NUM_KEYS: u64 = 256;
+
+    bench("flat_map_insert_256", 500, || {
+        let mut map = FlatMap::new();
+        for key in 0..NUM_KEYS {
+            map.insert(key, key);
+        }
+        black_box(map);
+    });
+
+    let mut map = FlatMap::new();
+    for key in 0..NUM_KEYS {
+        map.insert(key, key);
+    }
+    let mut key = 0;
+    bench("flat_map_lookup", 10_000, || {
+        assert_eq!(map.lookup(black_box(&key)), Some(&key));
+        key = (key + 1) % NUM_KEYS;
+    });
+}
+
+#[test_case]
+fn bench_crc32c() {
+    let data: Vec<u8> = (0..4096).map(|i| i as u8).collect();
+    bench("crc32c_4k", 5_000, || {
+        black_box(crc32c(black_box(&data[..])));
+    });
+}
@@ -8,7 +8,7 @@
 use p1c0 as _; // needed to link libentry (and _start)
 
 use p1c0_kernel::{
-    filesystem::{OpenMode, VirtualFileSystem},
+    filesystem::{self, OpenMode, VirtualFileSystem},
     prelude::*,
     process,
     syscall::Syscall,
@@ -70,3 +70,130 @@ fn test_process_crash() {
     let pid = builder.start().unwrap();
     assert_eq!(Syscall::wait_pid(pid.get_raw()), 0xdeadc0de);
 }
+
+#[test_case]
+fn test_processes_share_static_image() {
+    // Both processes map the text pages of the initfs image through the page cache
+    let first = process::Builder::new_from_file("/bin/true", 0)
+        .unwrap()
+        .start()
+        .unwrap();
+    let second = process::Builder::new_from_file("/bin/true", 0)
+        .unwrap()
+        .start()
+        .unwrap();
+    assert_eq!(Syscall::wait_pid(first.get_raw()), 0);
+    assert_eq!(Syscall::wait_pid(second.get_raw()), 0);
+}
+
+#[test_case]
+fn test_initfs_reads_in_chunks() {
+    assert!(matches!(
+        VirtualFileSystem::open("/bin/missing", OpenMode::Read),
+        Err(filesystem::Error::FileNotFound)
+    ));
+
+    let mut file = VirtualFileSystem::open("/bin/true", OpenMode::Read).unwrap();
+    let expected = VirtualFileSystem::static_data(&file).unwrap();
+    assert_eq!(expected.len(), file.size);
+
+    let mut data = vec![];
+    let mut chunk = [0u8; 100];
+    loop {
+        let read = VirtualFileSystem::read(&mut file, &mut chunk).unwrap();
+        if read == 0 {
+            break;
+        }
+        data.extend_from_slice(&chunk[..read]);
+    }
+    VirtualFileSystem::close(file);
+
+    assert_eq!(&data[..], expected);
+}
+
+#[test_case]
+fn test_executable_images_are_cached() {
+    let first = process::image::load("/bin/true").unwrap();
+    let second = process::image::load("/bin/true").unwrap();
+    assert!(Arc::ptr_eq(&first, &second));
+}
+
+#[test_case]
+fn test_spawn_syscall() {
+    let path = "/bin/true";
+    let pid = Syscall::spawn(
+        path.as_ptr(),
+        path.len(),
+        core::ptr::null(),
+        core::ptr::null(),
+    );
+    assert_ne!(pid, u64::MAX);
+    assert_eq!(Syscall::wait_pid(pid), 0);
+
+    let path = "/bin/missing";
+    let pid = Syscall::spawn(
+        path.as_ptr(),
+        path.len(),
+        core::ptr::null(),
+        core::ptr::null(),
+    );
+    assert_eq!(pid, u64::MAX);
+}
+
+#[test_case]
+fn test_exited_process_releases_its_pipe_ends() {
+    let pipe = Syscall::pipe_create();
+    let mut builder = process::Builder::new_from_file("/bin/pipe_writer", 0).unwrap();
+    builder.push_argument(&pipe.to_string());
+    let pid = builder.start().unwrap();
+
+    let mut buffer = [0u8; 64];
+    let read = Syscall::pipe_read(pipe, buffer.as_mut_ptr(), buffer.len());
+    assert_eq!(&buffer[..read as usize], b"Hello from pipe_writer");
+
+    // The writer never closes its end, it is released when the process exits. Otherwise the
+    // reader would block forever after the test drops its own write end.
+    assert_eq!(Syscall::pipe_close(pipe, 1), 0);
+    assert_eq!(
+        Syscall::pipe_read(pipe, buffer.as_mut_ptr(), buffer.len()),
+        0
+    );
+    assert_eq!(Syscall::wait_pid(pid.get_raw()), 0);
+    assert_eq!(Syscall::pipe_close(pipe, 0), 0);
+}
+
+fn free_pages() -> u64 {
+    p1c0_kernel::memory::statistics().pages.free_pages
+}
+
+#[test_case]
+fn test_exited_process_returns_its_pages() {
+    // Both the exit and the fault paths release the memory of the process
+    let spawn_and_wait = || {
+        for path in ["/bin/true", "/bin/crash"] {
+            let pid = process::Builder::new_from_file(path, 0)
+                .unwrap()
+                .start()
+                .unwrap();
+            Syscall::wait_pid(pid.get_raw());
+        }
+    };
+
+    // The first run fills the executable image and page caches
+    spawn_and_wait();
+    let baseline = free_pages();
+
+    spawn_and_wait();
+
+    // The page zeroer may be zeroing a free page when the statistics are taken, so it gets a few
+    // chances to put it back into the pool
+    let mut after = free_pages();
+    for _ in 0..10 {
+        if after >= baseline {
+            break;
+        }
+        Syscall::sleep_us(1_000);
+        after = free_pages();
+    }
+    assert!(after >= baseline);
+}
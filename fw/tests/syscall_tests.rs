@@ -7,7 +7,12 @@
 
 use p1c0 as _; // needed to link libentry (and _start)
 
-use p1c0_kernel::syscall::Syscall;
+use p1c0_kernel::{
+    arch::mmu::PAGE_SIZE,
+    memory::{self, address::Address, kalloc},
+    prelude::*,
+    syscall::{IoVec, Syscall},
+};
 
 #[panic_handler]
 fn panic_handler(panic_info: &core::panic::PanicInfo) -> ! {
@@ -28,3 +33,171 @@ fn test_noop_syscall() {
 fn test_multiply_syscall() {
     assert_eq!(Syscall::multiply(12, 14), 168);
 }
+
+#[test_case]
+fn test_writev_syscall() {
+    let segments = [
+        IoVec::new(b"Hello "),
+        IoVec::new(b"from "),
+        IoVec::new(b"writev\n"),
+    ];
+    Syscall::writev(segments.as_ptr(), segments.len());
+}
+
+#[test_case]
+fn test_writev_syscall_with_many_segments() {
+    let mut segments = [IoVec::new(b"."); 40];
+    segments[39] = IoVec::new(b"\n");
+    Syscall::writev(segments.as_ptr(), segments.len());
+}
+
+#[test_case]
+fn test_print_memory_statistics_syscall() {
+    Syscall::print_memory_statistics();
+}
+
+#[test_case]
+fn test_memory_statistics_syscall() {
+    let mut before = memory::Statistics::default();
+    Syscall::memory_statistics(&mut before as *mut _);
+
+    // Served by the 64 byte size class
+    let allocation = Box::new([0u8; 64]);
+
+    let mut after = memory::Statistics::default();
+    Syscall::memory_statistics(&mut after as *mut _);
+    drop(allocation);
+
+    assert!(after.heap.allocations[2] > before.heap.allocations[2]);
+    assert!(after.heap.peak_bytes >= after.heap.live_bytes);
+    assert!(after.heap.largest_free_block <= after.heap.heap_free_bytes);
+    assert!(after.pages.free_pages > 0);
+}
+
+#[test_case]
+fn test_tagged_frees_are_accounted() {
+    let live_bytes = || {
+        kalloc::tag_statistics()
+            .iter()
+            .find(|tag| tag.name == "syscall_tests")
+            .map(|tag| tag.live_bytes)
+    };
+
+    let allocation = {
+        let _tag = kalloc::AllocationTag::enter("syscall_tests");
+        Box::new([0u8; 64])
+    };
+    assert_eq!(live_bytes(), Some(64));
+
+    drop(allocation);
+    assert_eq!(live_bytes(), Some(0));
+}
+
+#[test_case]
+fn test_zero_filled_pages_are_counted() {
+    let before = memory::statistics().pages;
+
+    let pmr = memory::MemoryManager::instance()
+        .request_any_pages(1, memory::AllocPolicy::ZeroFill)
+        .unwrap();
+    let page = unsafe {
+        core::slice::from_raw_parts(pmr.base_address().direct_mapped().as_ptr(), PAGE_SIZE)
+    };
+    assert!(page.iter().all(|byte| *byte == 0));
+    memory::MemoryManager::instance()
+        .release_pages(pmr)
+        .unwrap();
+
+    let after = memory::statistics().pages;
+    assert_eq!(
+        after.clean_page_hits + after.clean_page_misses,
+        before.clean_page_hits + before.clean_page_misses + 1
+    );
+}
+
+#[test_case]
+fn test_zeroed_pages_outside_of_the_pool() {
+    // Dirty some pages first, so that a zeroed request is likely to get them back
+    let pmr = memory::MemoryManager::instance()
+        .request_any_pages(3, memory::AllocPolicy::None)
+        .unwrap();
+    unsafe {
+        core::ptr::write_bytes(
+            pmr.base_address().direct_mapped().as_mut_ptr(),
+            0xA5,
+            3 * PAGE_SIZE,
+        )
+    };
+    memory::MemoryManager::instance()
+        .release_pages(pmr)
+        .unwrap();
+
+    // Requests of several pages are never served by the pool
+    let pmr = memory::request_zeroed_pages(3).unwrap();
+    let pages = unsafe {
+        core::slice::from_raw_parts(pmr.base_address().direct_mapped().as_ptr(), 3 * PAGE_SIZE)
+    };
+    assert!(pages.iter().all(|byte| *byte == 0));
+    memory::MemoryManager::instance()
+        .release_pages(pmr)
+        .unwrap();
+}
+
+#[test_case]
+fn test_pipe_syscalls() {
+    let pipe = Syscall::pipe_create();
+    assert_ne!(pipe, u64::MAX);
+
+    let message = b"Hello through a pipe";
+    assert_eq!(
+        Syscall::pipe_write(pipe, message.as_ptr(), message.len()),
+        message.len() as u64
+    );
+
+    let mut buffer = [0u8; 64];
+    let read = Syscall::pipe_read(pipe, buffer.as_mut_ptr(), buffer.len());
+    assert_eq!(&buffer[..read as usize], message);
+
+    // Closing the write end makes the reader see the end of the stream instead of blocking
+    assert_eq!(Syscall::pipe_close(pipe, 1), 0);
+    assert_eq!(
+        Syscall::pipe_read(pipe, buffer.as_mut_ptr(), buffer.len()),
+        0
+    );
+
+    // The pipe is released once both ends are closed
+    assert_eq!(Syscall::pipe_close(pipe, 0), 0);
+    assert_eq!(
+        Syscall::pipe_read(pipe, buffer.as_mut_ptr(), buffer.len()),
+        u64::MAX
+    );
+}
+
+#[test_case]
+fn test_shared_memory_syscalls() {
+    let region = Syscall::shared_memory_create(3 * PAGE_SIZE);
+    assert_ne!(region, u64::MAX);
+
+    // Only processes can map shared memory
+    assert_eq!(Syscall::shared_memory_map(region), u64::MAX);
+
+    assert_eq!(Syscall::shared_memory_release(region), 0);
+    assert_eq!(Syscall::shared_memory_release(region), u64::MAX);
+}
+
+#[test_case]
+fn test_anonymous_memory_syscalls() {
+    // Only processes have an address space to map anonymous memory into
+    assert_eq!(Syscall::map_anonymous(2 * PAGE_SIZE), u64::MAX);
+    assert_eq!(Syscall::map_anonymous(0), u64::MAX);
+    assert_eq!(Syscall::unmap(0xE000_0000_0000), u64::MAX);
+}
+
+#[test_case]
+fn test_process_thread_syscalls() {
+    // Threads can only be added to processes, and futexes live in the memory of a process
+    let word = 0u32;
+    assert_eq!(Syscall::thread_create(0x1000, 0, 0), u64::MAX);
+    assert_eq!(Syscall::futex_wait(&word, 0), u64::MAX);
+    assert_eq!(Syscall::futex_wake(&word, 1), u64::MAX);
+}
@@ -7,12 +7,16 @@
 
 use p1c0 as _; // needed to link libentry (and _start)
 
-use core::time::Duration;
+use core::{
+    sync::atomic::{AtomicBool, AtomicUsize, Ordering},
+    time::Duration,
+};
 
 use p1c0_kernel::{
     drivers::{generic_timer::get_timer, interfaces::timer::Timer},
-    sync::spinlock::SpinLock,
-    thread,
+    sync::{spinlock::SpinLock, wait_queue::WaitQueue},
+    syscall::Syscall,
+    thread::{self, Priority},
 };
 
 #[panic_handler]
@@ -124,3 +128,50 @@ fn test_join_thread() {
     t2.join();
     assert_eq!(*NUM_THREADS.lock(), 2);
 }
+
+#[test_case]
+fn test_wait_queue() {
+    static QUEUE: WaitQueue = WaitQueue::new();
+    static READY: AtomicBool = AtomicBool::new(false);
+    *NUM_THREADS.lock() = 0;
+
+    let waiter = thread::spawn(|| {
+        QUEUE.wait_until(|| READY.load(Ordering::Acquire));
+        *NUM_THREADS.lock() += 1;
+    });
+
+    // Give the waiter a chance to block
+    Syscall::yield_exec();
+    assert_eq!(*NUM_THREADS.lock(), 0);
+
+    READY.store(true, Ordering::Release);
+    QUEUE.notify_all();
+
+    waiter.join();
+    assert_eq!(*NUM_THREADS.lock(), 1);
+}
+
+#[test_case]
+fn test_higher_priority_thread_runs_first() {
+    static ORDER: SpinLock<[u8; 2]> = SpinLock::new([0; 2]);
+    static NUM_RUN: AtomicUsize = AtomicUsize::new(0);
+
+    fn record(priority: Priority) {
+        ORDER.lock()[NUM_RUN.fetch_add(1, Ordering::Relaxed)] = priority.level();
+    }
+
+    let normal = thread::Builder::new()
+        .priority(Priority::DEFAULT)
+        .spawn(|| record(Priority::DEFAULT));
+    let high = thread::Builder::new()
+        .priority(Priority::HIGHEST)
+        .spawn(|| record(Priority::HIGHEST));
+
+    high.join();
+    normal.join();
+
+    assert_eq!(
+        *ORDER.lock(),
+        [Priority::HIGHEST.level(), Priority::DEFAULT.level()]
+    );
+}
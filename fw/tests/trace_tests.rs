@@ -0,0 +1,123 @@
+#![no_std]
+#![no_main]
+#![feature(custom_test_frameworks)]
+#![test_runner(test_fwk::runner)]
+#![reexport_test_harness_main = "test_main"]
+#![feature(default_alloc_error_handler)]
+
+use p1c0 as _; // needed to link libentry (and _start)
+
+use p1c0_kernel::{
+    prelude::*,
+    syscall::Syscall,
+    thread,
+    trace::{self, Category, Event, Header, Record},
+};
+
+use test_fwk::bench::black_box;
+
+#[panic_handler]
+fn panic_handler(panic_info: &core::panic::PanicInfo) -> ! {
+    test_fwk::panic_handler(panic_info)
+}
+
+#[no_mangle]
+pub extern "C" fn kernel_main() {
+    thread::Builder::new().name("Test").spawn(|| {
+        test_main();
+    });
+
+    thread::initialize();
+}
+
+/// Runs `f` with the category enabled and returns the records it produced
+fn trace_with<F: FnOnce()>(category: Category, f: F) -> Vec<Record> {
+    trace::drain(|_| {}).unwrap();
+
+    trace::enable(category);
+    f();
+    trace::disable(category);
+
+    let mut records = vec![];
+    trace::drain(|record| records.push(*record)).unwrap();
+    records
+}
+
+fn find(records: &[Record], event: Event) -> impl Iterator<Item = &Record> {
+    records
+        .iter()
+        .filter(move |record| record.event == event as u16)
+}
+
+#[test_case]
+fn test_disabled_categories_record_nothing() {
+    trace::drain(|_| {}).unwrap();
+
+    Syscall::noop();
+    drop(black_box(Box::new(0u64)));
+
+    let mut num_records = 0;
+    trace::drain(|_| num_records += 1).unwrap();
+    assert_eq!(num_records, 0);
+}
+
+#[test_case]
+fn test_syscalls_are_traced() {
+    let records = trace_with(Category::Syscall, || Syscall::noop());
+
+    let enter = find(&records, Event::SyscallEnter)
+        .find(|record| record.arg0 == Syscall::Noop as u64)
+        .expect("No syscall entry recorded");
+    let exit = find(&records, Event::SyscallExit)
+        .find(|record| record.arg0 == Syscall::Noop as u64)
+        .expect("No syscall exit recorded");
+    assert_eq!(exit.arg1 as u32, enter.tid);
+    assert!(exit.timestamp >= enter.timestamp);
+}
+
+#[test_case]
+fn test_context_switches_are_traced() {
+    let mut tid = 0;
+    let records = trace_with(Category::Scheduler, || {
+        let partner = thread::spawn(|| {});
+        tid = partner.get_raw();
+        partner.join();
+    });
+    assert!(find(&records, Event::ContextSwitch).any(|record| record.arg1 == tid));
+}
+
+#[test_case]
+fn test_allocations_are_traced() {
+    let mut address = 0;
+    let records = trace_with(Category::Alloc, || {
+        let allocation = black_box(Box::new([0u8; 64]));
+        address = allocation.as_ptr() as u64;
+    });
+
+    assert!(find(&records, Event::Alloc).any(|record| record.arg0 == 64 && record.arg1 == address));
+    assert!(find(&records, Event::Free).any(|record| record.arg1 == address));
+}
+
+#[test_case]
+fn test_export_format() {
+    trace::drain(|_| {}).unwrap();
+    trace::enable(Category::Syscall);
+    Syscall::noop();
+    trace::disable(Category::Syscall);
+
+    let mut chunks: Vec<Vec<u8>> = vec![];
+    trace::export(|bytes| chunks.push(bytes.to_vec())).unwrap();
+
+    let header = &chunks[0];
+    assert_eq!(header.len(), Header::SIZE);
+    assert_eq!(header[..8], Header::MAGIC);
+    assert_eq!(
+        u32::from_le_bytes(header[12..16].try_into().unwrap()),
+        Record::SIZE as u32
+    );
+
+    assert!(chunks.len() >= 3);
+    assert!(chunks[1..]
+        .iter()
+        .all(|record| record.len() == Record::SIZE));
+}
@@ -2,7 +2,7 @@ use crate::memory::address::{Address, VirtualAddress};
 
 use cortex_a::asm::barrier::{dmb, SY};
 
-const CACHE_LINE_SIZE: usize = 64;
+pub const CACHE_LINE_SIZE: usize = 64;
 
 pub fn invalidate_va_range(mut va: VirtualAddress, size_bytes: usize) {
     let mut num_lines = (size_bytes + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE;
@@ -41,3 +41,42 @@ pub fn clean_va_range(mut va: VirtualAddress, size_bytes: usize) {
     // Add barrier operation to ensure the data cache clean completes before the next instructions
     unsafe { dmb(SY) };
 }
+
+/// Returns the size of the blocks zeroed by `dc zva`, or None if the instruction is prohibited
+fn zero_block_size() -> Option<usize> {
+    #[cfg(target_arch = "aarch64")]
+    {
+        const DZP: u64 = 1 << 4;
+        const BS_MASK: u64 = 0xF;
+
+        let dczid: u64;
+        unsafe { core::arch::asm!("mrs {}, dczid_el0", out(reg) dczid) };
+        if (dczid & DZP) != 0 {
+            return None;
+        }
+        // The block size is given as log2 of the number of 4-byte words
+        Some(4 << (dczid & BS_MASK))
+    }
+
+    #[cfg(not(target_arch = "aarch64"))]
+    None
+}
+
+/// Zeroes the given range with `dc zva`, which allocates whole cache lines without reading them
+/// from memory first. Falls back to a regular memset if the range is not aligned to the zeroing
+/// block size or the instruction is not available.
+///
+/// # Safety
+///   The range must be mapped as normal memory and writable.
+pub unsafe fn zero_va_range(va: VirtualAddress, size_bytes: usize) {
+    match zero_block_size() {
+        Some(block_size) if (va.as_usize() % block_size) == 0 && (size_bytes % block_size) == 0 => {
+            for offset in (0..size_bytes).step_by(block_size) {
+                let _va = va.offset(offset).as_usize();
+                #[cfg(target_arch = "aarch64")]
+                core::arch::asm!("dc zva, {}", in(reg) _va);
+            }
+        }
+        _ => core::ptr::write_bytes(va.as_mut_ptr(), 0, size_bytes),
+    }
+}
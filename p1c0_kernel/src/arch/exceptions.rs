@@ -2,11 +2,12 @@ use crate::{
     arch::StackType,
     backtrace,
     drivers::{generic_timer, interfaces::interrupt_controller, interfaces::timer::Timer},
-    memory::address::VirtualAddress,
+    memory::{address::VirtualAddress, address_space::FaultKind},
     prelude::*,
     process::{self, ProcessSymbolicator},
     syscall::syscall_handler,
     thread::{self, StackValidator},
+    trace::{self, IrqSource},
 };
 
 #[cfg(all(target_os = "none", target_arch = "aarch64", not(test)))]
@@ -103,10 +104,11 @@ fn handle_fiq(e: &mut ExceptionContext) {
     let timer = generic_timer::get_timer();
 
     if timer.is_irq_active() {
+        trace::record(trace::Event::Irq, IrqSource::Timer as u64, 0);
         timer.handle_irq();
 
         // Run scheduler and maybe do context switch
-        thread::run_scheduler(e);
+        thread::handle_timer_tick(e);
 
         // FIXME(javier-varez): This is a workaround for m1n1 HV. m1n1 triggers a Virtual FIQ that
         // p1c0 handles when the timer expires, but it doesn't get notified by writes to TVAL or CTL
@@ -136,11 +138,50 @@ enum ExceptionOrigin {
     LowerAarch64EL,
 }
 
+/// Populates lazily mapped process pages on their first access and resolves copy-on-write faults.
+/// The kernel itself can fault on them while accessing user buffers during a syscall. Returns false
+/// if the fault is not caused by a lazily mapped page, in which case it is fatal.
+fn handle_page_fault(e: &ExceptionContext) -> bool {
+    let kind = match e.esr_el1.fault_kind() {
+        Some(kind) => kind,
+        None => return false,
+    };
+
+    let far = FAR_EL1.get() as usize;
+    if (far >> 48) != 0 {
+        // Kernel addresses are never mapped lazily
+        return false;
+    }
+
+    let is_write = !matches!(
+        e.exception_class(),
+        Some(ESR_EL1::EC::Value::InstrAbortLowerEL)
+    ) && e.esr_el1.is_write_fault();
+
+    process::handle_page_fault(
+        VirtualAddress::new_unaligned(far as *const _),
+        kind,
+        is_write,
+    )
+    .is_ok()
+}
+
 unsafe fn handle_synchronous(e: &mut ExceptionContext, origin: ExceptionOrigin) {
-    match e.esr_el1.exception_class() {
+    let class = e.esr_el1.exception_class();
+    if !matches!(class, Some(ESR_EL1::EC::Value::SVC64)) {
+        // Syscalls are traced by their own category
+        trace::record(trace::Event::Exception, e.esr_el1.as_raw(), FAR_EL1.get());
+    }
+
+    match class {
         Some(ESR_EL1::EC::Value::SVC64) => {
             syscall_handler(e.esr_el1.instruction_specific_syndrome(), e);
         }
+        Some(
+            ESR_EL1::EC::Value::DataAbortLowerEL
+            | ESR_EL1::EC::Value::InstrAbortLowerEL
+            | ESR_EL1::EC::Value::DataAbortCurrentEL,
+        ) if handle_page_fault(e) => {}
         _ => {
             match origin {
                 ExceptionOrigin::SameELStackFromEL0 => {
@@ -311,6 +352,11 @@ impl fmt::Display for SpsrEL1 {
 }
 
 impl EsrEL1 {
+    #[inline(always)]
+    fn as_raw(&self) -> u64 {
+        self.0.get()
+    }
+
     #[inline(always)]
     fn exception_class(&self) -> Option<ESR_EL1::EC::Value> {
         self.0.read_as_enum(ESR_EL1::EC)
@@ -320,6 +366,28 @@ impl EsrEL1 {
     fn instruction_specific_syndrome(&self) -> u32 {
         self.0.read(ESR_EL1::ISS) as u32
     }
+
+    /// Only meaningful for data and instruction aborts. Translation and permission faults at any
+    /// level are reported with a fault status code of 0b0001LL and 0b0011LL respectively.
+    #[inline(always)]
+    fn fault_kind(&self) -> Option<FaultKind> {
+        const FAULT_STATUS_CODE_MASK: u32 = 0b111100;
+        const TRANSLATION_FAULT: u32 = 0b000100;
+        const PERMISSION_FAULT: u32 = 0b001100;
+
+        match self.instruction_specific_syndrome() & FAULT_STATUS_CODE_MASK {
+            TRANSLATION_FAULT => Some(FaultKind::Translation),
+            PERMISSION_FAULT => Some(FaultKind::Permission),
+            _ => None,
+        }
+    }
+
+    /// Only meaningful for data aborts. Set if the abort was caused by a write.
+    #[inline(always)]
+    fn is_write_fault(&self) -> bool {
+        const WRITE_NOT_READ: u32 = 1 << 6;
+        (self.instruction_specific_syndrome() & WRITE_NOT_READ) != 0
+    }
 }
 
 #[rustfmt::skip]
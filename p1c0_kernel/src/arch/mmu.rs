@@ -1,3 +1,4 @@
+mod asid;
 mod early_alloc;
 
 use crate::{
@@ -7,6 +8,7 @@ use crate::{
     },
     prelude::*,
 };
+pub use asid::AddressSpaceId;
 use early_alloc::{AllocRef, EarlyAllocator};
 
 use core::ops::{Deref, DerefMut};
@@ -156,6 +158,8 @@ impl DescriptorEntry {
     const VALID_BIT: u64 = 1 << 0;
     const TABLE_BIT: u64 = 1 << 1;
     const ACCESS_FLAG: u64 = 1 << 10;
+    /// TLB entries of non-global mappings are tagged with the current ASID
+    const NOT_GLOBAL: u64 = 1 << 11;
     const PAGE_BIT: u64 = 1 << 55;
     const EARLY_BIT: u64 = 1 << 56;
     const SHAREABILITY: u64 = 0b10 << 8; // Output shareable
@@ -183,7 +187,17 @@ impl DescriptorEntry {
         Self(Self::VALID_BIT | Self::TABLE_BIT | (table_addr as u64 & PA_MASK) | early_bit)
     }
 
+    /// Mappings of the lower half belong to a process, or to the kernel threads when under ASID 0
+    fn global_bit(virtual_addr: VirtualAddress) -> u64 {
+        if virtual_addr.is_high_address() {
+            0
+        } else {
+            Self::NOT_GLOBAL
+        }
+    }
+
     fn new_block_desc(
+        virtual_addr: VirtualAddress,
         physical_addr: PhysicalAddress,
         attributes: Attributes,
         permissions: GlobalPermissions,
@@ -194,11 +208,13 @@ impl DescriptorEntry {
                 | (physical_addr.as_usize() as u64 & PA_MASK)
                 | mair_index_from_attrs(attributes)
                 | Self::SHAREABILITY
+                | Self::global_bit(virtual_addr)
                 | permission_bits(permissions)?,
         ))
     }
 
     fn new_page_desc(
+        virtual_addr: VirtualAddress,
         physical_addr: PhysicalAddress,
         attributes: Attributes,
         permissions: GlobalPermissions,
@@ -211,6 +227,7 @@ impl DescriptorEntry {
                 | (physical_addr.as_u64() & PA_MASK)
                 | mair_index_from_attrs(attributes)
                 | Self::SHAREABILITY
+                | Self::global_bit(virtual_addr)
                 | permission_bits(permissions)?,
         ))
     }
@@ -553,9 +570,9 @@ impl LevelTable {
                 && !matches!(descriptor_entry.ty(), DescriptorType::Table)
             {
                 *descriptor_entry = if level.is_last() {
-                    DescriptorEntry::new_page_desc(pa, attributes, permissions)?
+                    DescriptorEntry::new_page_desc(va, pa, attributes, permissions)?
                 } else {
-                    DescriptorEntry::new_block_desc(pa, attributes, permissions)?
+                    DescriptorEntry::new_block_desc(va, pa, attributes, permissions)?
                 };
             } else {
                 if matches!(descriptor_entry.ty(), DescriptorType::Invalid) {
@@ -586,35 +603,66 @@ impl LevelTable {
     }
 }
 
-pub fn switch_process_translation_table(low_table: &mut LevelTable) {
-    unsafe {
-        let va = LogicalAddress::try_from_ptr(low_table.as_ptr() as *mut _)
-            .expect("Level table not aligned!!");
-        let pa = va.into_physical();
+pub fn switch_process_translation_table(low_table: &mut LevelTable, asid: &AddressSpaceId) {
+    let asid = asid.activate();
+    set_low_translation_table(low_table, asid);
+}
 
-        TTBR0_EL1.set_baddr(pa.as_u64());
+pub fn switch_kernel_translation_table(low_table: &mut LevelTable) {
+    set_low_translation_table(low_table, asid::KERNEL_ASID);
+}
+
+fn set_low_translation_table(low_table: &mut LevelTable, asid: u16) {
+    let va = LogicalAddress::try_from_ptr(low_table.as_ptr() as *mut _)
+        .expect("Level table not aligned!!");
+    let pa = va.into_physical();
 
+    // TLB entries are tagged with the ASID, so they stay valid across switches
+    let ttbr = ((asid as u64) << 48) | pa.as_u64();
+    if TTBR0_EL1.get() == ttbr {
+        return;
+    }
+    TTBR0_EL1.set(ttbr);
+
+    unsafe {
         barrier::dsb(barrier::ISHST);
         barrier::isb(barrier::SY);
     }
-
-    // TODO(javier-varez): We need better granularity here for performance
-    flush_tlb()
 }
 
+/// The inner shareable variants of TLBI are broadcast to all cores, so no IPIs are needed to keep
+/// the TLBs of other cores coherent.
 pub fn flush_tlb() {
     #[cfg(all(not(test), target_arch = "aarch64"))]
     unsafe {
-        core::arch::asm!("dsb ishst\n", "tlbi vmalle1\n", "dsb ish\n", "isb\n");
+        core::arch::asm!("dsb ishst\n", "tlbi vmalle1is\n", "dsb ish\n", "isb\n");
     }
 }
 
+/// TLBI operands hold bits 55:12 of the address, regardless of the translation granule
+fn tlbi_page_operand(addr: VirtualAddress) -> u64 {
+    (addr.as_u64() >> 12) & ((1 << 44) - 1)
+}
+
+/// Invalidates the TLB entries of a page for all ASIDs
 pub fn flush_tlb_page(addr: VirtualAddress) {
     assert!(addr.is_page_aligned());
 
+    let _operand = tlbi_page_operand(addr);
     #[cfg(all(not(test), target_arch = "aarch64"))]
     unsafe {
-        core::arch::asm!("dsb ishst\n", "tlbi vaae1, x0\n", "dsb ish\n", "isb\n", in("x0") addr.page_number());
+        core::arch::asm!("dsb ishst\n", "tlbi vaae1is, x0\n", "dsb ish\n", "isb\n", in("x0") _operand);
+    }
+}
+
+/// Invalidates the TLB entries of a page for a single ASID. Global entries are invalidated too.
+fn flush_tlb_page_asid(addr: VirtualAddress, asid: u16) {
+    assert!(addr.is_page_aligned());
+
+    let _operand = ((asid as u64) << 48) | tlbi_page_operand(addr);
+    #[cfg(all(not(test), target_arch = "aarch64"))]
+    unsafe {
+        core::arch::asm!("dsb ishst\n", "tlbi vae1is, x0\n", "dsb ish\n", "isb\n", in("x0") _operand);
     }
 }
 
@@ -641,7 +689,13 @@ pub fn initialize(high_table: &mut LevelTable, low_table: &mut LevelTable) {
             + TCR_EL1::IRGN0::WriteBack_ReadAlloc_WriteAlloc_Cacheable
             + TCR_EL1::IRGN1::WriteBack_ReadAlloc_WriteAlloc_Cacheable
             + TCR_EL1::T0SZ.val(16)
-            + TCR_EL1::T1SZ.val(16),
+            + TCR_EL1::T1SZ.val(16)
+            + TCR_EL1::A1::TTBR0
+            + if asid::asid_bits() == 16 {
+                TCR_EL1::AS::ASID16Bits
+            } else {
+                TCR_EL1::AS::ASID8Bits
+            },
     );
 
     TTBR0_EL1.set_baddr(low_table.table.as_ptr() as u64);
@@ -0,0 +1,221 @@
+//! Address space identifiers (ASIDs) for the lower half translation tables.
+//!
+//! TLB entries of non-global mappings are tagged with the ASID in TTBR0_EL1, so switching between
+//! process address spaces does not need to invalidate the TLB. ASIDs are handed out from a counter
+//! that belongs to a generation. When the counter runs out a new generation starts, the whole TLB
+//! is invalidated and every address space is given a new ASID the next time it is activated. The
+//! ASIDs that are active on a CPU during the rollover are reserved, so that CPU can keep running
+//! with it until it switches to another address space.
+//!
+//! ASID 0 is never handed out. It is used by kernel threads, which run with the lower half table of
+//! the kernel.
+
+use crate::{
+    smp::{self, PerCpu},
+    sync::spinlock::SpinLock,
+};
+
+use core::sync::atomic::{AtomicU64, Ordering};
+
+/// The context of an address space holds its ASID in the low bits and its generation above them
+const GENERATION_SHIFT: u32 = 16;
+const ASID_MASK: u64 = (1 << GENERATION_SHIFT) - 1;
+
+pub const KERNEL_ASID: u16 = 0;
+const FIRST_ASID: u64 = KERNEL_ASID as u64 + 1;
+
+static GENERATION: AtomicU64 = AtomicU64::new(1 << GENERATION_SHIFT);
+
+#[allow(clippy::declare_interior_mutable_const)]
+const NO_CONTEXT: AtomicU64 = AtomicU64::new(0);
+
+/// Context of the process address space last activated on each CPU. A rollover clears it, so that
+/// the CPU goes through the slow path on its next switch.
+static ACTIVE_CONTEXTS: PerCpu<AtomicU64> = PerCpu::new([NO_CONTEXT; smp::MAX_CPUS]);
+
+static ALLOCATOR: SpinLock<AsidAllocator> = SpinLock::new(AsidAllocator::new());
+
+/// Returns the number of ASID bits implemented by the CPU
+pub(super) fn asid_bits() -> u32 {
+    #[cfg(all(not(test), target_arch = "aarch64"))]
+    {
+        let mmfr0: u64;
+        unsafe { core::arch::asm!("mrs {}, ID_AA64MMFR0_EL1", out(reg) mmfr0) };
+        if (mmfr0 >> 4) & 0xf == 0b0010 {
+            return 16;
+        }
+    }
+    8
+}
+
+fn is_current(context: u64) -> bool {
+    (context & !ASID_MASK) == GENERATION.load(Ordering::Relaxed)
+}
+
+fn asid_of(context: u64) -> u16 {
+    (context & ASID_MASK) as u16
+}
+
+struct AsidAllocator {
+    next_asid: u64,
+    /// Contexts that were active on each CPU during the last rollover
+    reserved: [u64; smp::MAX_CPUS],
+}
+
+impl AsidAllocator {
+    const fn new() -> Self {
+        Self {
+            next_asid: FIRST_ASID,
+            reserved: [0; smp::MAX_CPUS],
+        }
+    }
+
+    /// Returns a context of the current generation for an address space with the given context
+    fn new_context(&mut self, old_context: u64) -> u64 {
+        if old_context != 0 {
+            // An address space that was active during a rollover keeps its ASID
+            let generation = GENERATION.load(Ordering::Relaxed);
+            let asid = old_context & ASID_MASK;
+            let mut was_reserved = false;
+            for reserved in self.reserved.iter_mut() {
+                if *reserved == old_context {
+                    *reserved = generation | asid;
+                    was_reserved = true;
+                }
+            }
+            if was_reserved {
+                return generation | asid;
+            }
+        }
+
+        let asid = self.allocate_asid();
+        GENERATION.load(Ordering::Relaxed) | asid
+    }
+
+    fn allocate_asid(&mut self) -> u64 {
+        loop {
+            if self.next_asid == 1 << asid_bits() {
+                self.rollover();
+            }
+
+            let asid = self.next_asid;
+            self.next_asid += 1;
+
+            let is_reserved = self
+                .reserved
+                .iter()
+                .any(|reserved| *reserved != 0 && (*reserved & ASID_MASK) == asid);
+            if !is_reserved {
+                return asid;
+            }
+        }
+    }
+
+    fn rollover(&mut self) {
+        for (cpu, reserved) in self.reserved.iter_mut().enumerate() {
+            // A CPU that has not switched address spaces since the last rollover is still running
+            // with its reserved ASID
+            let active = ACTIVE_CONTEXTS.get_for(cpu).swap(0, Ordering::Relaxed);
+            if active != 0 {
+                *reserved = active;
+            }
+        }
+
+        GENERATION.fetch_add(1 << GENERATION_SHIFT, Ordering::Relaxed);
+        self.next_asid = FIRST_ASID;
+
+        // Entries tagged with ASIDs of the previous generation cannot be told apart from those of
+        // the new one
+        super::flush_tlb();
+    }
+}
+
+/// ASID of a process address space
+pub struct AddressSpaceId {
+    context: AtomicU64,
+}
+
+impl Default for AddressSpaceId {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl AddressSpaceId {
+    /// The ASID is allocated when the address space is first activated
+    pub const fn new() -> Self {
+        Self {
+            context: AtomicU64::new(0),
+        }
+    }
+
+    /// Returns the ASID to use for this address space on the current CPU, allocating a new one if
+    /// the current is from a previous generation. Must be called with exceptions masked.
+    pub(super) fn activate(&self) -> u16 {
+        let active = ACTIVE_CONTEXTS.get();
+        let context = self.context.load(Ordering::Relaxed);
+
+        // The compare exchange fails if another CPU started a rollover in the meantime
+        let old_active = active.load(Ordering::Relaxed);
+        if old_active != 0
+            && is_current(context)
+            && active
+                .compare_exchange(old_active, context, Ordering::Relaxed, Ordering::Relaxed)
+                .is_ok()
+        {
+            return asid_of(context);
+        }
+
+        let mut allocator = ALLOCATOR.lock();
+        let mut context = self.context.load(Ordering::Relaxed);
+        if !is_current(context) {
+            context = allocator.new_context(context);
+            self.context.store(context, Ordering::Relaxed);
+        }
+        active.store(context, Ordering::Relaxed);
+        asid_of(context)
+    }
+
+    /// Invalidates the TLB entries for a page of this address space on all CPUs
+    pub fn flush_tlb_page(&self, addr: crate::memory::address::VirtualAddress) {
+        let context = self.context.load(Ordering::Relaxed);
+        if is_current(context) {
+            super::flush_tlb_page_asid(addr, asid_of(context));
+        } else {
+            // The ASID may still be reserved on a CPU, so invalidate the page for all ASIDs
+            super::flush_tlb_page(addr);
+        }
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    #[test]
+    fn asids_are_reused_after_rollover() {
+        let mut allocator = AsidAllocator::new();
+        let num_asids = 1 << asid_bits();
+
+        let first = allocator.new_context(0);
+        assert!(is_current(first));
+        assert_eq!(asid_of(first), FIRST_ASID as u16);
+
+        for asid in FIRST_ASID + 1..num_asids {
+            assert_eq!(asid_of(allocator.new_context(0)) as u64, asid);
+        }
+
+        // The counter ran out, so the next allocation starts a new generation
+        ACTIVE_CONTEXTS.get_for(0).store(first, Ordering::Relaxed);
+        let second = allocator.new_context(0);
+        assert!(!is_current(first));
+        assert!(is_current(second));
+
+        // The ASID that was active during the rollover is not handed out again, but the address
+        // space that owns it keeps it
+        assert_eq!(asid_of(second), FIRST_ASID as u16 + 1);
+        let first = allocator.new_context(first);
+        assert!(is_current(first));
+        assert_eq!(asid_of(first), FIRST_ASID as u16);
+    }
+}
@@ -1,5 +1,6 @@
 pub mod flat_map;
 pub mod intrusive_list;
+pub mod min_heap;
 pub mod ring_buffer;
 
 use crate::prelude::*;
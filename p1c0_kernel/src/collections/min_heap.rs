@@ -0,0 +1,155 @@
+use crate::prelude::*;
+
+/// Binary min-heap backed by a Vec. Unlike alloc::collections::BinaryHeap it can be constructed in
+/// a const context, so it can be placed in a static.
+pub struct MinHeap<T: Ord> {
+    elements: Vec<T>,
+}
+
+impl<T: Ord> Default for MinHeap<T> {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl<T: Ord> MinHeap<T> {
+    pub const fn new() -> Self {
+        Self { elements: vec![] }
+    }
+
+    pub fn len(&self) -> usize {
+        self.elements.len()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.elements.is_empty()
+    }
+
+    /// Returns the smallest element without removing it from the heap
+    pub fn peek(&self) -> Option<&T> {
+        self.elements.first()
+    }
+
+    pub fn push(&mut self, element: T) {
+        self.elements.push(element);
+        self.sift_up(self.elements.len() - 1);
+    }
+
+    /// Removes and returns the smallest element
+    pub fn pop(&mut self) -> Option<T> {
+        if self.elements.is_empty() {
+            return None;
+        }
+
+        let element = self.elements.swap_remove(0);
+        if !self.elements.is_empty() {
+            self.sift_down(0);
+        }
+        Some(element)
+    }
+
+    /// Removes and returns the first element found matching the predicate. This is a linear
+    /// operation.
+    pub fn remove_first<F>(&mut self, mut predicate: F) -> Option<T>
+    where
+        F: FnMut(&T) -> bool,
+    {
+        let index = self
+            .elements
+            .iter()
+            .position(|element| predicate(element))?;
+        let element = self.elements.swap_remove(index);
+        if index < self.elements.len() {
+            // The element moved into the hole can be either smaller than its new parent or larger
+            // than its new children
+            self.sift_up(index);
+            self.sift_down(index);
+        }
+        Some(element)
+    }
+
+    /// Iterates over all elements in no particular order
+    pub fn iter(&self) -> core::slice::Iter<'_, T> {
+        self.elements.iter()
+    }
+
+    fn sift_up(&mut self, mut index: usize) {
+        while index > 0 {
+            let parent = (index - 1) / 2;
+            if self.elements[index] >= self.elements[parent] {
+                break;
+            }
+            self.elements.swap(index, parent);
+            index = parent;
+        }
+    }
+
+    fn sift_down(&mut self, mut index: usize) {
+        let len = self.elements.len();
+        loop {
+            let left = 2 * index + 1;
+            let right = left + 1;
+
+            let mut smallest = index;
+            if left < len && self.elements[left] < self.elements[smallest] {
+                smallest = left;
+            }
+            if right < len && self.elements[right] < self.elements[smallest] {
+                smallest = right;
+            }
+
+            if smallest == index {
+                break;
+            }
+            self.elements.swap(index, smallest);
+            index = smallest;
+        }
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    #[test]
+    fn test_empty_heap() {
+        let mut heap: MinHeap<u32> = MinHeap::new();
+        assert!(heap.is_empty());
+        assert_eq!(heap.peek(), None);
+        assert_eq!(heap.pop(), None);
+    }
+
+    #[test]
+    fn test_pops_in_order() {
+        let mut heap = MinHeap::new();
+        for value in [5, 3, 9, 1, 7, 3, 8, 2] {
+            heap.push(value);
+        }
+        assert_eq!(heap.len(), 8);
+        assert_eq!(heap.peek(), Some(&1));
+
+        let mut sorted = vec![];
+        while let Some(value) = heap.pop() {
+            sorted.push(value);
+        }
+        assert_eq!(sorted, [1, 2, 3, 3, 5, 7, 8, 9]);
+    }
+
+    #[test]
+    fn test_remove_first() {
+        let mut heap = MinHeap::new();
+        for value in [10, 4, 6, 1, 8, 2, 9] {
+            heap.push(value);
+        }
+
+        assert_eq!(heap.remove_first(|value| *value == 4), Some(4));
+        assert_eq!(heap.remove_first(|value| *value == 4), None);
+        assert_eq!(heap.remove_first(|value| *value == 1), Some(1));
+
+        let mut sorted = vec![];
+        while let Some(value) = heap.pop() {
+            sorted.push(value);
+        }
+        assert_eq!(sorted, [2, 6, 8, 9, 10]);
+    }
+}
@@ -100,6 +100,30 @@ impl<const SIZE: usize> RingBuffer<SIZE> {
         Ok(())
     }
 
+    fn push_slice(&self, data: &[u8]) -> Result<(), Error> {
+        if self.free_space() < data.len() {
+            return Err(Error::WouldBlock);
+        }
+
+        let write_index = self.write_index.load(Ordering::Relaxed);
+        let (first, second) = data.split_at(data.len().min(SIZE - write_index));
+
+        // # Safety:
+        //   Same reasoning as in push. The whole range was verified to be free, and it is split
+        //   in two chunks at the end of the buffer so that no copy goes out of bounds.
+        //   UnsafeCell<MaybeUninit<u8>> has the same layout as u8.
+        unsafe {
+            let base = UnsafeCell::raw_get(self.data.as_ptr()) as *mut u8;
+            core::ptr::copy_nonoverlapping(first.as_ptr(), base.add(write_index), first.len());
+            core::ptr::copy_nonoverlapping(second.as_ptr(), base, second.len());
+        }
+
+        // Only the writer modifies the write index, so there is no need for a CAS loop here
+        let write_index = (write_index + data.len()) % SIZE;
+        self.write_index.store(write_index, Ordering::Release);
+        Ok(())
+    }
+
     fn pop(&self) -> Result<u8, Error> {
         if self.fill_level() < 1 {
             return Err(Error::WouldBlock);
@@ -116,6 +140,42 @@ impl<const SIZE: usize> RingBuffer<SIZE> {
         Ok(data)
     }
 
+    fn readable_slices(&self) -> (&[u8], &[u8]) {
+        let read_index = self.read_index.load(Ordering::Relaxed);
+        let write_index = self.write_index.load(Ordering::Acquire);
+
+        // # Safety:
+        //   The writer never touches the range between the read index and the write index, so
+        //   handing out shared references to it is fine until the reader consumes it.
+        //   UnsafeCell<MaybeUninit<u8>> has the same layout as u8 and all bytes in the range have
+        //   been initialized by the writer.
+        unsafe {
+            let base = UnsafeCell::raw_get(self.data.as_ptr()) as *const u8;
+            if read_index <= write_index {
+                (
+                    core::slice::from_raw_parts(base.add(read_index), write_index - read_index),
+                    &[],
+                )
+            } else {
+                (
+                    core::slice::from_raw_parts(base.add(read_index), SIZE - read_index),
+                    core::slice::from_raw_parts(base, write_index),
+                )
+            }
+        }
+    }
+
+    fn consume(&self, count: usize) -> Result<(), Error> {
+        if self.fill_level() < count {
+            return Err(Error::WouldBlock);
+        }
+
+        // Only the reader modifies the read index, so there is no need for a CAS loop here
+        let read_index = (self.read_index.load(Ordering::Relaxed) + count) % SIZE;
+        self.read_index.store(read_index, Ordering::Release);
+        Ok(())
+    }
+
     pub fn split(&self) -> Result<(Writer<'_, SIZE>, Reader<'_, SIZE>), Error> {
         let split = self.split.load(Ordering::Relaxed);
         if (split & (READER_SPLIT_TOK | WRITER_SPLIT_TOK)) != 0 {
@@ -219,12 +279,38 @@ impl<'a, const SIZE: usize> Writer<'a, SIZE> {
     pub fn push(&mut self, data: u8) -> Result<(), Error> {
         self.buffer.push(data)
     }
+
+    /// Pushes the whole slice or nothing at all if there is not enough space for it.
+    pub fn push_slice(&mut self, data: &[u8]) -> Result<(), Error> {
+        self.buffer.push_slice(data)
+    }
+
+    /// Number of bytes that can be pushed before the buffer is full
+    pub fn free_space(&self) -> usize {
+        self.buffer.free_space()
+    }
 }
 
 impl<'a, const SIZE: usize> Reader<'a, SIZE> {
     pub fn pop(&mut self) -> Result<u8, Error> {
         self.buffer.pop()
     }
+
+    /// Number of bytes ready to be popped
+    pub fn fill_level(&self) -> usize {
+        self.buffer.fill_level()
+    }
+
+    /// Borrows all readable data without copying it. The second slice is only non-empty if the
+    /// data wraps around the end of the buffer. Call `consume` afterwards to release the bytes.
+    pub fn readable_slices(&self) -> (&[u8], &[u8]) {
+        self.buffer.readable_slices()
+    }
+
+    /// Releases `count` bytes to the writer, as if they had been popped
+    pub fn consume(&mut self, count: usize) -> Result<(), Error> {
+        self.buffer.consume(count)
+    }
 }
 
 /// # Safety
@@ -330,6 +416,52 @@ mod test {
         assert!(matches!(reader.pop(), Err(Error::WouldBlock)));
     }
 
+    #[test]
+    fn test_can_push_slices() {
+        let ring_buffer: RingBuffer<8> = RingBuffer::new();
+        let (mut writer, mut reader) = ring_buffer.split().unwrap();
+
+        writer.push_slice(&[0, 1, 2, 3, 4]).unwrap();
+        assert_eq!(writer.free_space(), 2);
+        assert_eq!(reader.fill_level(), 5);
+        assert!(matches!(
+            writer.push_slice(&[5, 6, 7]),
+            Err(Error::WouldBlock)
+        ));
+
+        for i in 0..5 {
+            assert_eq!(reader.pop().unwrap(), i);
+        }
+
+        // This one wraps around the end of the buffer
+        writer.push_slice(&[5, 6, 7, 8, 9, 10]).unwrap();
+        for i in 5..11 {
+            assert_eq!(reader.pop().unwrap(), i);
+        }
+        assert!(matches!(reader.pop(), Err(Error::WouldBlock)));
+    }
+
+    #[test]
+    fn test_readable_slices() {
+        let ring_buffer: RingBuffer<8> = RingBuffer::new();
+        let (mut writer, mut reader) = ring_buffer.split().unwrap();
+
+        assert_eq!(reader.readable_slices(), (&[][..], &[][..]));
+
+        writer.push_slice(&[0, 1, 2, 3, 4]).unwrap();
+        assert_eq!(reader.readable_slices(), (&[0, 1, 2, 3, 4][..], &[][..]));
+        reader.consume(4).unwrap();
+        assert_eq!(reader.readable_slices(), (&[4][..], &[][..]));
+
+        // Wraps around
+        writer.push_slice(&[5, 6, 7, 8]).unwrap();
+        assert_eq!(reader.readable_slices(), (&[4, 5, 6, 7][..], &[8][..]));
+        assert!(matches!(reader.consume(6), Err(Error::WouldBlock)));
+        reader.consume(5).unwrap();
+        assert_eq!(reader.readable_slices(), (&[][..], &[][..]));
+        assert!(matches!(reader.pop(), Err(Error::WouldBlock)));
+    }
+
     #[test]
     fn test_works_across_threads() {
         let ring_buffer: RingBuffer<20> = RingBuffer::new();
@@ -1,3 +1,5 @@
+mod console;
+
 use crate::{
     boot_args::get_boot_args,
     font::FIRA_CODE_30,
@@ -9,16 +11,17 @@ use crate::{
     sync::spinlock::SpinLock,
 };
 
+use console::{GlyphCache, TextGrid};
+
 use core::fmt::{self, Write};
 
 use embedded_graphics::{
     draw_target::DrawTarget,
     image::Image,
-    mono_font::{ascii::FONT_7X14, MonoFont, MonoTextStyle},
+    mono_font::{ascii::FONT_7X14, MonoFont},
     pixelcolor::Rgb888,
     prelude::*,
     primitives::Rectangle,
-    text::{Baseline, Text},
 };
 
 const RETINA_DEPTH_FLAG: usize = 1 << 16;
@@ -28,17 +31,141 @@ const COL_MARGIN: u32 = 10;
 
 static DISPLAY: LockedDisplay = LockedDisplay::new();
 
-pub struct Display {
+/// Converts a color to the 30-bit format of the framebuffer, with 10 bits per channel.
+fn native_color(color: Rgb888) -> u32 {
+    (color.r() as u32) << 22 | (color.g() as u32) << 12 | (color.b() as u32) << 2
+}
+
+struct Framebuffer {
     width: u32,
     height: u32,
+    /// Distance between the start of consecutive rows, in pixels
     stride: u32,
     hwbase: *mut u32,
+}
+
+impl Framebuffer {
+    fn pixels(&mut self) -> &mut [u32] {
+        // Safety:
+        //   The framebuffer is mapped for the lifetime of the kernel and only accessed through the
+        //   display, which is behind a lock.
+        unsafe {
+            &mut *core::ptr::slice_from_raw_parts_mut(
+                self.hwbase,
+                (self.stride * self.height) as usize,
+            )
+        }
+    }
+
+    /// Returns `len` pixels of row `y`, starting at column `x`.
+    fn span_mut(&mut self, x: u32, y: u32, len: u32) -> &mut [u32] {
+        let start = (y * self.stride + x) as usize;
+        &mut self.pixels()[start..start + len as usize]
+    }
+
+    /// Moves the whole framebuffer up by `lines` rows of pixels and clears all rows from
+    /// `clear_from` to the bottom.
+    fn scroll_up(&mut self, lines: u32, clear_from: u32) {
+        let row_bytes = (self.stride as usize) * core::mem::size_of::<u32>();
+        let count = (self.height - lines) as usize * row_bytes;
+        let pixels = self.pixels();
+        let destination = pixels.as_mut_ptr();
+        let source = pixels[(lines * self.stride) as usize..].as_ptr();
+
+        if row_bytes % 16 == 0 {
+            // Safety:
+            //   * source and destination are aligned to 128 bits, the framebuffer is page aligned
+            //     and rows are a multiple of 128 bits
+            //   * size is a multiple of 128 bits
+            //   * destination is < source
+            unsafe { _memcpy128_aligned(destination, source, count) };
+        } else {
+            pixels.copy_within((lines * self.stride) as usize.., 0);
+        }
+
+        pixels[(clear_from * self.stride) as usize..].fill(0);
+    }
+}
+
+impl DrawTarget for Framebuffer {
+    type Color = Rgb888;
+    type Error = core::convert::Infallible;
+
+    fn draw_iter<I>(&mut self, pixels: I) -> Result<(), Self::Error>
+    where
+        I: IntoIterator<Item = Pixel<Self::Color>>,
+    {
+        let (width, height, stride) = (self.width as i32, self.height as i32, self.stride as i32);
+        let hw = self.pixels();
+        for Pixel(coord, color) in pixels.into_iter() {
+            let Point { x, y } = coord;
+
+            // Ignore whatever falls outside of the display
+            if x >= width || x < 0 || y >= height || y < 0 {
+                continue;
+            }
+
+            hw[(x + y * stride) as usize] = native_color(color);
+        }
+
+        Ok(())
+    }
+
+    fn fill_contiguous<I>(&mut self, area: &Rectangle, colors: I) -> Result<(), Self::Error>
+    where
+        I: IntoIterator<Item = Self::Color>,
+    {
+        // Clipped areas skip pixels in the middle of the rows, which the slow path handles
+        if area.intersection(&self.bounding_box()) != *area {
+            let pixels = area
+                .points()
+                .zip(colors)
+                .map(|(pos, color)| Pixel(pos, color));
+            return self.draw_iter(pixels);
+        }
+
+        let Point { x, y } = area.top_left;
+        let mut colors = colors.into_iter();
+        for row in 0..area.size.height {
+            let span = self.span_mut(x as u32, y as u32 + row, area.size.width);
+            for (pixel, color) in span.iter_mut().zip(&mut colors) {
+                *pixel = native_color(color);
+            }
+        }
+
+        Ok(())
+    }
+
+    fn fill_solid(&mut self, area: &Rectangle, color: Self::Color) -> Result<(), Self::Error> {
+        let area = area.intersection(&self.bounding_box());
+        if area.is_zero_sized() {
+            return Ok(());
+        }
+
+        let Point { x, y } = area.top_left;
+        let color = native_color(color);
+        for row in 0..area.size.height {
+            self.span_mut(x as u32, y as u32 + row, area.size.width)
+                .fill(color);
+        }
+
+        Ok(())
+    }
+}
+
+impl OriginDimensions for Framebuffer {
+    fn size(&self) -> Size {
+        Size::new(self.width, self.height)
+    }
+}
+
+pub struct Display {
+    framebuffer: Framebuffer,
 
     // Console members
-    font: &'static MonoFont<'static>,
-    current_row: u32,
-    current_col: u32,
-    max_rows: u32,
+    cell_size: Size,
+    grid: TextGrid,
+    glyphs: GlyphCache,
 }
 
 struct LockedDisplay(SpinLock<Option<Display>>);
@@ -93,25 +220,33 @@ impl Display {
     pub fn init<T: ImageDrawable<Color = Rgb888>>(logo: &T) {
         let video_args = &get_boot_args().boot_video;
         let retina = (video_args.depth & RETINA_DEPTH_FLAG) != 0;
-        let font = if retina { &FIRA_CODE_30 } else { &FONT_7X14 };
-        let max_rows = (video_args.height as u32 - ROW_MARGIN * 2) / font.character_size.height;
+        let font: &'static MonoFont = if retina { &FIRA_CODE_30 } else { &FONT_7X14 };
+        let cell_size = Size::new(
+            font.character_size.width + font.character_spacing,
+            font.character_size.height,
+        );
+
+        let width = video_args.width as u32;
+        let height = video_args.height as u32;
+        let columns = (width - COL_MARGIN * 2) / cell_size.width;
+        let rows = (height - ROW_MARGIN * 2) / cell_size.height;
 
         let size = video_args.height * video_args.stride;
         let video_base = Self::map_fb(video_args.base as *mut u32, size).unwrap();
 
         let mut display = Self {
-            hwbase: video_base,
-            width: video_args.width as u32,
-            height: video_args.height as u32,
-            stride: video_args.stride as u32 / 4,
-            font,
-            current_row: 0,
-            current_col: 0,
-            max_rows,
+            framebuffer: Framebuffer {
+                hwbase: video_base,
+                width,
+                height,
+                stride: video_args.stride as u32 / 4,
+            },
+            cell_size,
+            grid: TextGrid::new(columns as usize, rows as usize),
+            glyphs: GlyphCache::new(font, Rgb888::WHITE, Rgb888::BLACK),
         };
 
-        let rect = Rectangle::new(Point::new(0, 0), Size::new(display.width, display.height));
-        display.fill_solid(&rect, Rgb888::BLACK).unwrap();
+        display.framebuffer.clear(Rgb888::BLACK).unwrap();
         display.draw_logo(logo);
 
         DISPLAY.lock().replace(display);
@@ -119,108 +254,74 @@ impl Display {
 
     fn draw_logo<T: ImageDrawable<Color = Rgb888>>(&mut self, logo: &T) {
         let logo_size = logo.bounding_box().size;
+        let width = self.framebuffer.width;
+        let height = self.framebuffer.height;
 
-        let x_pos = (self.width - logo_size.width) / 2;
-        let y_pos = (self.height - logo_size.height) / 2;
+        let x_pos = (width - logo_size.width) / 2;
+        let y_pos = (height - logo_size.height) / 2;
 
         Image::new(logo, Point::new(x_pos as i32, y_pos as i32))
-            .draw(self)
+            .draw(&mut self.framebuffer)
             .ok();
     }
 
-    fn scroll_up(&mut self) {
-        let hw = unsafe {
-            &mut *core::ptr::slice_from_raw_parts_mut(
-                self.hwbase,
-                (self.width * self.height) as usize,
-            )
-        };
-        let offset = (self.width * self.font.character_size.height) as usize;
-        let count = (self.height * self.width) as usize - offset;
-        let source = &hw[offset] as *const u32;
-        let destination = hw.as_mut_ptr();
-
-        // Use memcpy128 for speed. This over
-        // Safety:
-        //   * source is aligned to 128 bits
-        //   * destination is also aligned to 128 bits
-        //   * size is a multiple of 128 bits
-        //   * destination is < source
-        unsafe { _memcpy128_aligned(destination, source, count * core::mem::size_of::<u32>()) };
+    /// Brings the framebuffer up to date with the text written since the last flush.
+    pub fn flush(&mut self) {
+        let scrolled = self.grid.take_scroll() as u32;
+        if scrolled != 0 {
+            // The logo scrolls away with the text, so the whole screen moves. Everything from the
+            // first row that scrolled in to the bottom of the screen is blank.
+            let first_new_row = self.grid.rows() as u32 - scrolled;
+            self.framebuffer.scroll_up(
+                scrolled * self.cell_size.height,
+                ROW_MARGIN + first_new_row * self.cell_size.height,
+            );
+        }
 
-        // Clear last lines
-        hw.iter_mut().skip(count).for_each(|val| *val = 0);
+        let cell_size = self.cell_size;
+        let framebuffer = &mut self.framebuffer;
+        let glyphs = &mut self.glyphs;
+        self.grid.drain_dirty(|row, first_col, cells| {
+            let y = ROW_MARGIN + row as u32 * cell_size.height;
+            for (col, &c) in (first_col..).zip(cells) {
+                let x = COL_MARGIN + col as u32 * cell_size.width;
+                Self::draw_cell(framebuffer, glyphs, cell_size, x, y, c);
+            }
+        });
     }
-}
 
-impl DrawTarget for Display {
-    type Color = Rgb888;
-    type Error = core::convert::Infallible;
-
-    fn draw_iter<I>(&mut self, pixels: I) -> Result<(), Self::Error>
-    where
-        I: IntoIterator<Item = Pixel<Self::Color>>,
-    {
-        for Pixel(coord, color) in pixels.into_iter() {
-            let Point { x, y } = coord;
-
-            // Ignore whatever falls outside of the display
-            if x >= self.width as i32 || x < 0 || y >= self.height as i32 || y < 0 {
-                continue;
+    fn draw_cell(
+        framebuffer: &mut Framebuffer,
+        glyphs: &mut GlyphCache,
+        cell_size: Size,
+        x: u32,
+        y: u32,
+        c: char,
+    ) {
+        let Size { width, height } = cell_size;
+        if c == ' ' {
+            let background = glyphs.background();
+            for line in 0..height {
+                framebuffer.span_mut(x, y + line, width).fill(background);
             }
-
-            // Calculate the index in the framebuffer.
-            let pix_offset = (x + y * self.stride as i32) as usize;
-            let color =
-                (color.r() as u32) << 22 | (color.g() as u32) << 12 | (color.b() as u32) << 2;
-            let hw = unsafe {
-                &mut *core::ptr::slice_from_raw_parts_mut(
-                    self.hwbase,
-                    (self.width * self.height) as usize,
-                )
-            };
-            hw[pix_offset] = color;
+            return;
         }
 
-        Ok(())
-    }
-}
-
-impl OriginDimensions for Display {
-    fn size(&self) -> Size {
-        Size::new(self.width, self.height)
+        // Any spacing between characters is left untouched, the glyph is narrower than the cell
+        let glyph = glyphs.get(c);
+        let glyph_width = glyph.len() as u32 / height;
+        for (line, pixels) in (0..height).zip(glyph.chunks_exact(glyph_width as usize)) {
+            framebuffer
+                .span_mut(x, y + line, glyph_width)
+                .copy_from_slice(pixels);
+        }
     }
 }
 
 impl Write for Display {
+    /// Only updates the text grid, the framebuffer is updated by `flush`.
     fn write_str(&mut self, s: &str) -> Result<(), fmt::Error> {
-        let splits = s.split_inclusive('\n');
-
-        let style = MonoTextStyle::new(self.font, Rgb888::WHITE);
-        for sub in splits {
-            let x_pos = COL_MARGIN + self.current_col * self.font.character_size.width;
-            let y_pos = ROW_MARGIN + self.current_row * self.font.character_size.height;
-            Text::with_baseline(
-                sub,
-                Point::new(x_pos as i32, y_pos as i32),
-                style,
-                Baseline::Top,
-            )
-            .draw(self)
-            .expect("draw is infallible");
-
-            if sub.ends_with('\n') {
-                self.current_row += 1;
-                self.current_col = 0;
-                if self.current_row >= self.max_rows {
-                    self.scroll_up();
-                    self.current_row = self.max_rows - 1;
-                }
-            } else {
-                self.current_col += sub.len() as u32;
-            }
-        }
-
+        s.chars().for_each(|c| self.grid.write_char(c));
         Ok(())
     }
 }
@@ -232,6 +333,7 @@ pub fn _print(args: fmt::Arguments) {
     if crate::arch::mmu::is_initialized() {
         if let Some(display) = DISPLAY.lock().as_mut() {
             display.write_fmt(args).expect("Printing to display failed");
+            display.flush();
         }
     }
 }
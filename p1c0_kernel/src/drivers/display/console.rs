@@ -0,0 +1,282 @@
+//! Text-mode state of the display console.
+//!
+//! Characters are written to a grid of cells rather than to the framebuffer. The grid is a ring of
+//! rows, so scrolling it only moves the index of the first row. The display later brings the
+//! framebuffer up to date in a single pass: it scrolls the pixels once for all the rows that
+//! scrolled since the last flush and then redraws only the cells that changed.
+
+use crate::prelude::*;
+
+use core::ops::Range;
+
+use embedded_graphics::{
+    draw_target::DrawTarget,
+    image::ImageDrawable,
+    mono_font::{mapping::GlyphMapping, MonoFont},
+    pixelcolor::{BinaryColor, Rgb888},
+    prelude::*,
+    primitives::Rectangle,
+};
+
+const BLANK: char = ' ';
+
+pub struct TextGrid {
+    columns: usize,
+    rows: usize,
+    cells: Vec<char>,
+    /// Columns changed since the last flush, indexed by the physical row in `cells`
+    dirty: Vec<Range<usize>>,
+    /// Physical row shown at the top of the screen
+    first_row: usize,
+    cursor_row: usize,
+    cursor_col: usize,
+    /// Rows scrolled since the last flush, saturated to the number of rows
+    pending_scroll: usize,
+}
+
+impl TextGrid {
+    pub fn new(columns: usize, rows: usize) -> Self {
+        assert!(columns > 0 && rows > 0);
+        Self {
+            columns,
+            rows,
+            cells: vec![BLANK; columns * rows],
+            dirty: vec![0..0; rows],
+            first_row: 0,
+            cursor_row: 0,
+            cursor_col: 0,
+            pending_scroll: 0,
+        }
+    }
+
+    pub fn rows(&self) -> usize {
+        self.rows
+    }
+
+    pub fn write_char(&mut self, c: char) {
+        match c {
+            '\n' => self.new_line(),
+            '\r' => self.cursor_col = 0,
+            c => {
+                // Lines longer than the screen wrap to the next row
+                if self.cursor_col >= self.columns {
+                    self.new_line();
+                }
+
+                let row = self.physical_row(self.cursor_row);
+                let col = self.cursor_col;
+                self.cells[row * self.columns + col] = c;
+
+                let dirty = &mut self.dirty[row];
+                *dirty = if dirty.start == dirty.end {
+                    col..col + 1
+                } else {
+                    dirty.start.min(col)..dirty.end.max(col + 1)
+                };
+                self.cursor_col += 1;
+            }
+        }
+    }
+
+    /// Returns the number of rows scrolled since the last call. It is never larger than the number
+    /// of rows, in which case nothing of the previous contents of the screen is left.
+    pub fn take_scroll(&mut self) -> usize {
+        core::mem::take(&mut self.pending_scroll)
+    }
+
+    /// Calls `draw` with the screen row, the first column and the cells of every span that changed
+    /// since the last call, and marks them as clean.
+    ///
+    /// Rows are only ever written after being recycled, so once the screen has scrolled by all of
+    /// its rows every visible cell is dirty.
+    pub fn drain_dirty(&mut self, mut draw: impl FnMut(usize, usize, &[char])) {
+        for screen_row in 0..self.rows {
+            let row = self.physical_row(screen_row);
+            let span = core::mem::replace(&mut self.dirty[row], 0..0);
+            if !span.is_empty() {
+                let cells = &self.cells[row * self.columns..][span.clone()];
+                draw(screen_row, span.start, cells);
+            }
+        }
+    }
+
+    fn physical_row(&self, screen_row: usize) -> usize {
+        (self.first_row + screen_row) % self.rows
+    }
+
+    fn new_line(&mut self) {
+        self.cursor_col = 0;
+        if self.cursor_row + 1 < self.rows {
+            self.cursor_row += 1;
+            return;
+        }
+
+        // The top row is recycled as the new bottom row. Scrolling the framebuffer clears its
+        // pixels, so it starts out clean.
+        let recycled = self.first_row;
+        self.first_row = (self.first_row + 1) % self.rows;
+        self.cells[recycled * self.columns..][..self.columns].fill(BLANK);
+        self.dirty[recycled] = 0..0;
+        self.pending_scroll = (self.pending_scroll + 1).min(self.rows);
+    }
+}
+
+/// Glyphs of a font rendered in the pixel format of the framebuffer. Each glyph is rendered the
+/// first time it is drawn, and from then on drawing it is a copy of one span per pixel row.
+pub struct GlyphCache {
+    font: &'static MonoFont<'static>,
+    foreground: u32,
+    background: u32,
+    glyphs: Vec<Option<Box<[u32]>>>,
+}
+
+impl GlyphCache {
+    pub fn new(font: &'static MonoFont<'static>, foreground: Rgb888, background: Rgb888) -> Self {
+        let image_size = font.image.size();
+        let glyphs_per_row = image_size.width / font.character_size.width;
+        let num_glyphs = glyphs_per_row * (image_size.height / font.character_size.height);
+
+        Self {
+            font,
+            foreground: super::native_color(foreground),
+            background: super::native_color(background),
+            glyphs: vec![None; num_glyphs as usize],
+        }
+    }
+
+    pub fn background(&self) -> u32 {
+        self.background
+    }
+
+    /// Returns the pixels of the glyph for `c` in row-major order, `character_size.width` pixels
+    /// per row.
+    pub fn get(&mut self, c: char) -> &[u32] {
+        let index = self.font.glyph_mapping.index(c);
+        if self.glyphs[index].is_none() {
+            self.glyphs[index] = Some(self.render(index));
+        }
+        self.glyphs[index].as_deref().unwrap()
+    }
+
+    fn render(&self, index: usize) -> Box<[u32]> {
+        // Glyphs are laid out in rows in the image of the font
+        let size = self.font.character_size;
+        let glyphs_per_row = self.font.image.size().width / size.width;
+        let index = index as u32;
+        let origin = Point::new(
+            ((index % glyphs_per_row) * size.width) as i32,
+            ((index / glyphs_per_row) * size.height) as i32,
+        );
+
+        let mut canvas = GlyphCanvas {
+            size,
+            foreground: self.foreground,
+            pixels: vec![self.background; (size.width * size.height) as usize],
+        };
+        self.font
+            .image
+            .draw_sub_image(&mut canvas, &Rectangle::new(origin, size))
+            .expect("draw is infallible");
+        canvas.pixels.into_boxed_slice()
+    }
+}
+
+struct GlyphCanvas {
+    size: Size,
+    foreground: u32,
+    pixels: Vec<u32>,
+}
+
+impl DrawTarget for GlyphCanvas {
+    type Color = BinaryColor;
+    type Error = core::convert::Infallible;
+
+    fn draw_iter<I>(&mut self, pixels: I) -> Result<(), Self::Error>
+    where
+        I: IntoIterator<Item = Pixel<Self::Color>>,
+    {
+        for Pixel(Point { x, y }, color) in pixels {
+            if x < 0 || y < 0 || x >= self.size.width as i32 || y >= self.size.height as i32 {
+                continue;
+            }
+            if color.is_on() {
+                self.pixels[(x + y * self.size.width as i32) as usize] = self.foreground;
+            }
+        }
+        Ok(())
+    }
+}
+
+impl OriginDimensions for GlyphCanvas {
+    fn size(&self) -> Size {
+        self.size
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    fn drain(grid: &mut TextGrid) -> Vec<(usize, usize, String)> {
+        let mut spans = vec![];
+        grid.drain_dirty(|row, col, cells| spans.push((row, col, cells.iter().collect())));
+        spans
+    }
+
+    #[test]
+    fn test_only_changed_cells_are_dirty() {
+        let mut grid = TextGrid::new(8, 3);
+        "ab\ncd".chars().for_each(|c| grid.write_char(c));
+        assert_eq!(
+            drain(&mut grid),
+            vec![(0, 0, "ab".to_string()), (1, 0, "cd".to_string())]
+        );
+
+        "ef".chars().for_each(|c| grid.write_char(c));
+        assert_eq!(drain(&mut grid), vec![(1, 2, "ef".to_string())]);
+        assert!(drain(&mut grid).is_empty());
+        assert_eq!(grid.take_scroll(), 0);
+    }
+
+    #[test]
+    fn test_scrolling_rotates_rows() {
+        let mut grid = TextGrid::new(4, 2);
+        "a\nb\nc".chars().for_each(|c| grid.write_char(c));
+        assert_eq!(grid.take_scroll(), 1);
+
+        // The row that scrolled off the screen is recycled for the new bottom row
+        assert_eq!(
+            drain(&mut grid),
+            vec![(0, 0, "b".to_string()), (1, 0, "c".to_string())]
+        );
+        assert_eq!(grid.take_scroll(), 0);
+    }
+
+    #[test]
+    fn test_rows_scrolled_out_are_not_drawn() {
+        let mut grid = TextGrid::new(4, 2);
+        "a\nb\nc\nd".chars().for_each(|c| grid.write_char(c));
+        assert_eq!(grid.take_scroll(), 2);
+        assert_eq!(
+            drain(&mut grid),
+            vec![(0, 0, "c".to_string()), (1, 0, "d".to_string())]
+        );
+    }
+
+    #[test]
+    fn test_scroll_saturates_to_rows() {
+        let mut grid = TextGrid::new(4, 2);
+        "\n\n\n\n\n".chars().for_each(|c| grid.write_char(c));
+        assert_eq!(grid.take_scroll(), 2);
+    }
+
+    #[test]
+    fn test_long_lines_wrap() {
+        let mut grid = TextGrid::new(2, 2);
+        "abc".chars().for_each(|c| grid.write_char(c));
+        assert_eq!(
+            drain(&mut grid),
+            vec![(0, 0, "ab".to_string()), (1, 0, "c".to_string())]
+        );
+    }
+}
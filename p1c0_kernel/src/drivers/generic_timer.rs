@@ -1,21 +1,58 @@
 use super::interfaces::{self, TimerResolution};
+use crate::registers::CNTKCTL_EL1;
 
-use core::sync::atomic::{AtomicU32, Ordering};
+use core::sync::atomic::{AtomicU32, AtomicU64, Ordering};
 
 use cortex_a::{
     asm::barrier,
     registers::{CNTFRQ_EL0, CNTVCT_EL0, CNTV_CTL_EL0, CNTV_TVAL_EL0},
 };
-use tock_registers::interfaces::{Readable, Writeable};
+use tock_registers::interfaces::{ReadWriteable, Readable, Writeable};
 
 pub struct GenericTimer {
     ticks_per_cycle: AtomicU32,
+    deadline: AtomicU64,
+    boot_counter: AtomicU64,
 }
 
 impl GenericTimer {
+    const NO_DEADLINE: u64 = u64::MAX;
+
     const fn new() -> Self {
         Self {
             ticks_per_cycle: AtomicU32::new(0),
+            deadline: AtomicU64::new(Self::NO_DEADLINE),
+            boot_counter: AtomicU64::new(0),
+        }
+    }
+
+    /// Value of the virtual counter when the timer was initialized. Userspace reads the counter
+    /// directly and uses this as the origin of its clock.
+    pub fn boot_counter(&self) -> u64 {
+        self.boot_counter.load(Ordering::Relaxed)
+    }
+
+    fn raw_ticks(&self) -> u64 {
+        // Ensures that we don't get an out of order value by adding an instruction barrier
+        // (flushing the instruction pipeline)
+        unsafe { barrier::isb(barrier::SY) };
+        CNTVCT_EL0.get()
+    }
+
+    /// Number of ticks until the next interrupt must fire, taking the one-shot deadline into
+    /// account. Clears the deadline once it is reached.
+    fn next_interval(&self, max_interval: u64) -> u64 {
+        let deadline = self.deadline.load(Ordering::Relaxed);
+        if deadline == Self::NO_DEADLINE {
+            return max_interval;
+        }
+
+        let now = self.raw_ticks();
+        if deadline <= now {
+            self.deadline.store(Self::NO_DEADLINE, Ordering::Relaxed);
+            max_interval
+        } else {
+            max_interval.min(deadline - now)
         }
     }
 }
@@ -28,7 +65,11 @@ impl interfaces::timer::Timer for GenericTimer {
         CNTV_CTL_EL0.write(CNTV_CTL_EL0::IMASK::CLEAR + CNTV_CTL_EL0::ENABLE::SET);
 
         self.ticks_per_cycle
-            .store(ticks_per_cycle, Ordering::Relaxed)
+            .store(ticks_per_cycle, Ordering::Relaxed);
+        self.boot_counter.store(self.raw_ticks(), Ordering::Relaxed);
+
+        // Let processes read the virtual counter, so that taking a timestamp needs no syscall
+        CNTKCTL_EL1.modify(CNTKCTL_EL1::EL0VCTEN::SET);
     }
 
     fn resolution(&self) -> TimerResolution {
@@ -36,17 +77,33 @@ impl interfaces::timer::Timer for GenericTimer {
     }
 
     fn ticks(&self) -> interfaces::Ticks {
-        // Ensures that we don't get an out of order value by adding an instruction barrier
-        // (flushing the instruction pipeline)
-        unsafe { barrier::isb(barrier::SY) };
-        interfaces::Ticks::new(CNTVCT_EL0.get())
+        interfaces::Ticks::new(self.raw_ticks())
     }
 
     fn handle_irq(&self) {
-        CNTV_TVAL_EL0.set(self.ticks_per_cycle.load(Ordering::Relaxed) as u64);
+        let interval = self.next_interval(self.ticks_per_cycle.load(Ordering::Relaxed) as u64);
+        CNTV_TVAL_EL0.set(interval);
         CNTV_CTL_EL0.write(CNTV_CTL_EL0::IMASK::CLEAR + CNTV_CTL_EL0::ENABLE::SET);
     }
 
+    fn set_oneshot_deadline(&self, deadline: Option<interfaces::Ticks>) {
+        let deadline = deadline.map(|ticks| ticks.0).unwrap_or(Self::NO_DEADLINE);
+        self.deadline.store(deadline, Ordering::Relaxed);
+
+        // TVAL holds the signed number of ticks left until the pending interrupt. Only bring the
+        // interrupt forward, the jiffy interval is restored when it fires.
+        let remaining = CNTV_TVAL_EL0.get() as u32 as i32;
+        if remaining <= 0 {
+            // Already pending, the deadline will be taken into account in handle_irq
+            return;
+        }
+
+        let interval = self.next_interval(remaining as u64).max(1);
+        if interval < remaining as u64 {
+            CNTV_TVAL_EL0.set(interval);
+        }
+    }
+
     fn is_irq_active(&self) -> bool {
         CNTV_CTL_EL0.matches_all(
             CNTV_CTL_EL0::IMASK::CLEAR + CNTV_CTL_EL0::ENABLE::SET + CNTV_CTL_EL0::ISTATUS::SET,
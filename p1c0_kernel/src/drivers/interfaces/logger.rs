@@ -2,4 +2,13 @@ use crate::print;
 
 pub trait Logger {
     fn write_u8(&mut self, c: u8) -> Result<(), print::Error>;
+
+    /// Writes a whole buffer at once. Drivers should override this if the hardware can accept
+    /// more than a single byte at a time.
+    fn write_bytes(&mut self, data: &[u8]) -> Result<(), print::Error> {
+        for &c in data {
+            self.write_u8(c)?;
+        }
+        Ok(())
+    }
 }
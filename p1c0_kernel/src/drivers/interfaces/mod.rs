@@ -7,7 +7,7 @@ use core::time::Duration;
 
 /// The current number of ticks the timer has made since boot
 #[derive(Debug, Ord, PartialOrd, Eq, PartialEq, Copy, Clone)]
-pub struct Ticks(u64);
+pub struct Ticks(pub(super) u64);
 
 impl Ticks {
     /// This method is only recommended for implementors of the Timer trait. If you REALLY insist in
@@ -11,6 +11,10 @@ pub trait Timer {
     fn handle_irq(&self);
     fn is_irq_active(&self) -> bool;
 
+    /// Requests an additional one-shot interrupt at the given deadline, on top of the fixed jiffy
+    /// interval. Only the latest deadline is kept, and passing `None` cancels it.
+    fn set_oneshot_deadline(&self, deadline: Option<Ticks>);
+
     /// Delays execution for the given duration. Currently this is a blocking routine that does not
     /// sleep, just simply spins
     fn delay(&self, time: core::time::Duration) {
@@ -12,13 +12,23 @@ register_bitfields![u32,
         /// Whether the current transfer buffer is empty or not
         TXBE OFFSET(1) NUMBITS(1) [],
     ],
+    /// Defines the FIFO control register bitfield for the UART
+    FifoControl [
+        /// Whether the FIFOs are enabled. When they are, TXBE means the TX FIFO is empty
+        FIFO_EN OFFSET(0) NUMBITS(1) [],
+    ],
 ];
 
+/// Depth of the transmit FIFO of the UART, in bytes
+const TX_FIFO_DEPTH: usize = 16;
+
 #[repr(C)]
 struct UartRegs {
-    reserved1: [u32; 4],
+    reserved1: [u32; 2],
+    fifo_control: ReadOnly<u32, FifoControl::Register>,
+    reserved2: u32,
     status: ReadOnly<u32, Status::Register>,
-    reserved2: [u32; 3],
+    reserved3: [u32; 3],
     tx: ReadWrite<u32>,
 }
 
@@ -73,7 +83,7 @@ mod early_uart {
 }
 
 mod late_uart {
-    use super::{Status, UartRegs};
+    use super::{FifoControl, Status, UartRegs, TX_FIFO_DEPTH};
     use crate::{
         adt::AdtNode,
         drivers::{Dev, DeviceRef},
@@ -131,6 +141,25 @@ mod late_uart {
             self.putchar(c);
             Ok(())
         }
+
+        fn write_bytes(&mut self, data: &[u8]) -> Result<(), print::Error> {
+            // With the FIFO enabled we can fill it completely every time it becomes empty instead
+            // of polling the status register for every byte.
+            let burst_size = if self.regs.fifo_control.read(FifoControl::FIFO_EN) != 0 {
+                TX_FIFO_DEPTH
+            } else {
+                1
+            };
+
+            for burst in data.chunks(burst_size) {
+                while self.regs.status.read(Status::TXBE) == 0 {}
+
+                for &c in burst {
+                    self.regs.tx.set(c as u32);
+                }
+            }
+            Ok(())
+        }
     }
 }
 
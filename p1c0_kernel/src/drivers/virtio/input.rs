@@ -34,6 +34,8 @@ const EVENTQ_IDX: u32 = 0;
 const STATUSQ_IDX: u32 = 1;
 const QUEUE_SIZE: usize = 16;
 const DESC_BUFFER_SIZE: usize = 32;
+/// Size of `struct virtio_input_event`
+const EVENT_SIZE: usize = 8;
 
 type InputVirtQueue = VirtQueue<QUEUE_SIZE, DESC_BUFFER_SIZE>;
 
@@ -56,10 +58,20 @@ impl InputSubdevice {
             }
         };
 
+        // Event indices were negotiated with the features
+        eventq.enable_event_idx();
+        statusq.enable_event_idx();
+
         for _ in 0..QUEUE_SIZE {
-            eventq.post_event();
-            statusq.post_event();
+            eventq
+                .post_event()
+                .expect("Queue has a descriptor per event");
+            statusq
+                .post_event()
+                .expect("Queue has a descriptor per event");
         }
+        eventq.publish();
+        statusq.publish();
         regs.queue_notify.set(EVENTQ_IDX);
         regs.queue_notify.set(STATUSQ_IDX);
 
@@ -90,6 +102,11 @@ impl InputSubdevice {
                         .write(super::Interrupt::USED_BUFFER_NOTIFICATION::SET);
 
                     instance.eventq.handle_events(|data| {
+                        if data.len() < EVENT_SIZE {
+                            log_warning!("Event is too short ({} bytes)", data.len());
+                            return;
+                        }
+
                         let event_type = u16::from_le_bytes([data[0], data[1]]);
                         let event_type: EventType = match event_type.try_into() {
                             Ok(EventType::Key) => EventType::Key,
@@ -133,7 +150,8 @@ impl InputSubdevice {
                         log_debug!("User pressed {:?}", event);
                     });
 
-                    if instance.eventq.should_notify() {
+                    // All the buffers of the burst are returned to the device at once
+                    if instance.eventq.publish() {
                         instance.regs.queue_notify.set(EVENTQ_IDX);
                     }
                 }
@@ -170,7 +188,7 @@ impl InputSubdevice {
         }
 
         // Accept just required features
-        feature_bits_1.write(FeatureBits1::RING_EVENT_IDX::CLEAR);
+        feature_bits_1.write(FeatureBits1::RING_EVENT_IDX::SET);
         feature_bits_2.write(FeatureBits2::VERSION_1::SET);
 
         regs.driver_features_sel.set(0);
@@ -1,5 +1,13 @@
+//! Split virtqueues, as described in section 2.7 of the virtio 1.1 specification.
+//!
+//! Every descriptor owns a buffer of `C` bytes. Requests are chains of descriptors, with the
+//! buffers the device reads followed by the buffers it writes. Buffers are made available and
+//! recycled in batches: the index of the available ring is published once per batch, and with
+//! `VIRTIO_F_EVENT_IDX` the device is only notified, or notifies the driver, when the other side
+//! has not seen the new entries yet.
+
 use crate::{
-    arch::mmu::PAGE_SIZE,
+    arch::{cache::CACHE_LINE_SIZE, mmu::PAGE_SIZE},
     memory::{
         address::{Address, LogicalAddress, PhysicalAddress, VirtualAddress},
         physical_page_allocator::PhysicalMemoryRegion,
@@ -12,12 +20,21 @@ use core::{
     ptr::NonNull,
 };
 
+use cortex_a::asm::barrier::{dmb, SY};
+
 use tock_registers::{
     interfaces::{Readable, Writeable},
     register_bitfields,
     registers::InMemoryRegister,
 };
 
+#[derive(Debug)]
+pub enum Error {
+    NoFreeDescriptors,
+    EmptyChain,
+    BufferTooLarge(usize),
+}
+
 register_bitfields! {u16,
     DescriptorFlags [
         Next OFFSET(0) NUMBITS(1) [],
@@ -35,6 +52,17 @@ register_bitfields! {u16,
     ]
 }
 
+/// Orders the accesses to the rings and buffers with respect to those of the device.
+fn memory_barrier() {
+    unsafe { dmb(SY) };
+}
+
+/// Returns true if moving an index from `old` to `new` crossed `event`, that is, if the other side
+/// asked to be notified when the entry at `event` was added. All indices wrap around.
+fn crossed_event(event: u16, new: u16, old: u16) -> bool {
+    new.wrapping_sub(event).wrapping_sub(1) < new.wrapping_sub(old)
+}
+
 #[repr(C)]
 struct Descriptor {
     addr: InMemoryRegister<u64>,
@@ -69,7 +97,10 @@ impl UsedElement {
     }
 }
 
-#[repr(C, align(16))]
+// The tables and rings are aligned to cache lines (CACHE_LINE_SIZE), which is more than the
+// specification requires. This keeps the available ring, written by the driver, and the used
+// ring, written by the device, from sharing lines.
+#[repr(C, align(64))]
 pub struct DescriptorTable<const N: usize> {
     descriptors: [Descriptor; N],
 }
@@ -85,7 +116,7 @@ impl<const N: usize> DescriptorTable<N> {
     }
 }
 
-#[repr(C, align(2))]
+#[repr(C, align(64))]
 pub struct AvailableRing<const N: usize> {
     flags: InMemoryRegister<u16, AvailableFlags::Register>,
     idx: InMemoryRegister<u16>,
@@ -107,7 +138,7 @@ impl<const N: usize> AvailableRing<N> {
     }
 }
 
-#[repr(C, align(4))]
+#[repr(C, align(64))]
 pub struct UsedRing<const N: usize> {
     flags: InMemoryRegister<u16, UsedFlags::Register>,
     idx: InMemoryRegister<u16>,
@@ -129,7 +160,8 @@ impl<const N: usize> UsedRing<N> {
     }
 }
 
-#[repr(C)]
+/// Buffers are aligned to cache lines, so that invalidating one never discards data of another.
+#[repr(C, align(64))]
 struct DescriptorBuffer<const C: usize>([u8; C]);
 
 impl<const C: usize> DescriptorBuffer<C> {
@@ -168,29 +200,76 @@ impl<const N: usize, const C: usize> VirtQueueImpl<N, C> {
     }
 }
 
+/// A chain of descriptors returned by the device.
+pub struct UsedChain<'a, const N: usize, const C: usize> {
+    queue: &'a VirtQueue<N, C>,
+    head: u16,
+    len: usize,
+}
+
+// Chains of several buffers are not used by any device yet
+#[allow(dead_code)]
+impl<'a, const N: usize, const C: usize> UsedChain<'a, N, C> {
+    /// Index of the first descriptor, as returned by `VirtQueue::submit`.
+    pub fn head(&self) -> u16 {
+        self.head
+    }
+
+    /// Number of bytes written by the device.
+    pub fn len(&self) -> usize {
+        self.len
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.len == 0
+    }
+
+    /// Returns the data written by the device, one slice per writeable buffer of the chain.
+    pub fn buffers(&self) -> impl Iterator<Item = &'a [u8]> + 'a {
+        let queue = self.queue;
+        let mut remaining = self.len;
+        queue
+            .chain(self.head)
+            .filter(move |&idx| queue.is_writeable(idx))
+            .map(move |idx| {
+                let len = remaining.min(C);
+                remaining -= len;
+                &queue.descriptor_data[idx as usize][..len]
+            })
+    }
+}
+
 // TODO(javier-varez): Need to impl Drop for VirtQueue in order to free the pages and not leak them
 pub struct VirtQueue<const N: usize, const C: usize> {
     inner: Box<VirtQueueImpl<N, C>, DeviceMemoryAllocator>,
-    current_desc_idx: u16,
-    last_used_idx: u16,
     descriptor_data: Box<[DescriptorBuffer<C>; N]>,
+    /// Head of the list of free descriptors, linked through their `next` field
+    free_head: u16,
+    num_free: usize,
+    /// Index of the available ring including the entries that are not published yet
+    avail_idx: u16,
+    /// Index of the available ring last seen by the device
+    published_idx: u16,
+    last_used_idx: u16,
+    event_idx: bool,
 }
 
 impl<const N: usize, const C: usize> VirtQueue<N, C> {
     fn init_descriptors(&mut self) {
-        for (desc, buffer) in self
+        for (idx, (desc, buffer)) in self
             .inner
             .descriptor_table
             .descriptors
             .iter_mut()
             .zip(self.descriptor_data.iter_mut())
+            .enumerate()
         {
             let buffer_pa =
                 LogicalAddress::new_unaligned(buffer.as_mut_ptr() as *mut u8).into_physical();
 
             desc.addr.set(buffer_pa.as_u64());
             desc.len.set(buffer.len() as u32);
-            desc.next.set(0);
+            desc.next.set((idx + 1) as u16);
             desc.flags.set(0);
         }
     }
@@ -201,73 +280,226 @@ impl<const N: usize, const C: usize> VirtQueue<N, C> {
 
         let mut queue = Self {
             inner,
-            current_desc_idx: 0,
-            last_used_idx: 0,
             descriptor_data: Box::new([Self::DESC_BUFFER; N]),
+            free_head: 0,
+            num_free: N,
+            avail_idx: 0,
+            published_idx: 0,
+            last_used_idx: 0,
+            event_idx: false,
         };
         queue.init_descriptors();
 
         queue
     }
 
-    pub fn add_desc_to_available_ring(&mut self, dsc_idx: usize) {
-        let inner = &mut *self.inner;
+    /// Uses the `used_event` and `avail_event` fields of the rings to suppress notifications. Must
+    /// only be enabled if `VIRTIO_F_EVENT_IDX` was negotiated with the device.
+    pub fn enable_event_idx(&mut self) {
+        self.event_idx = true;
+    }
 
-        inner.available_ring.flags.set(0);
+    /// Adds a chain with a copy of each of the `readable` buffers, followed by `writeable`
+    /// buffers of `C` bytes for the device to write. The chain is only visible to the device after
+    /// the next `publish`.
+    ///
+    /// Returns the index of the head of the chain.
+    pub fn submit(&mut self, readable: &[&[u8]], writeable: usize) -> Result<u16, Error> {
+        let count = readable.len() + writeable;
+        if count == 0 {
+            return Err(Error::EmptyChain);
+        }
+        if count > self.num_free {
+            return Err(Error::NoFreeDescriptors);
+        }
+        if let Some(buffer) = readable.iter().find(|buffer| buffer.len() > C) {
+            return Err(Error::BufferTooLarge(buffer.len()));
+        }
 
-        let index = inner.available_ring.idx.get() as usize % N;
-        inner.available_ring.ring[index].set(dsc_idx as u16);
+        let head = self.free_head;
+        let mut idx = head;
+        for i in 0..count {
+            let is_last = i + 1 == count;
+            let permissions = if let Some(data) = readable.get(i) {
+                let buffer = &mut self.descriptor_data[idx as usize];
+                buffer[..data.len()].copy_from_slice(data);
+                crate::arch::cache::clean_va_range(
+                    VirtualAddress::new_unaligned(buffer.as_ptr()),
+                    data.len(),
+                );
+                self.inner.descriptor_table.descriptors[idx as usize]
+                    .len
+                    .set(data.len() as u32);
+                DescriptorFlags::DEVICE_PERMISSIONS::Readable
+            } else {
+                self.inner.descriptor_table.descriptors[idx as usize]
+                    .len
+                    .set(C as u32);
+                DescriptorFlags::DEVICE_PERMISSIONS::Writeable
+            };
+
+            // The last descriptor keeps the link to the rest of the free list, which the device
+            // ignores without the Next flag
+            let desc = &self.inner.descriptor_table.descriptors[idx as usize];
+            if is_last {
+                desc.flags.write(permissions);
+                self.free_head = desc.next.get();
+            } else {
+                desc.flags.write(permissions + DescriptorFlags::Next::SET);
+                idx = desc.next.get();
+            }
+        }
 
-        inner
-            .available_ring
-            .idx
-            .set(inner.available_ring.idx.get().wrapping_add(1));
+        self.num_free -= count;
+        self.push_available(head);
+        Ok(head)
     }
 
-    pub fn post_event(&mut self) {
-        let idx = self.current_desc_idx;
-        self.current_desc_idx = idx + 1;
-
-        // Mark descriptor as writeable
-        self.inner.descriptor_table.descriptors[idx as usize]
-            .flags
-            .write(DescriptorFlags::DEVICE_PERMISSIONS::Writeable);
-        self.add_desc_to_available_ring(idx as usize);
+    /// Submits a chain of a single buffer for the device to write.
+    pub fn post_event(&mut self) -> Result<u16, Error> {
+        self.submit(&[], 1)
     }
 
-    // Returns the descriptor index and used len
-    fn pop_event(&mut self) -> Option<usize> {
-        let inner = &*self.inner;
-        if self.last_used_idx >= inner.used_ring.idx.get() {
-            return None;
+    /// Makes all chains added since the last call visible to the device with a single update of
+    /// the available index.
+    ///
+    /// Returns true if the device must be notified.
+    pub fn publish(&mut self) -> bool {
+        let old = self.published_idx;
+        let new = self.avail_idx;
+        if old == new {
+            return false;
         }
 
-        let used_ev = &inner.used_ring.ring[self.last_used_idx as usize % N];
+        // The ring entries must be visible before the index, and the index before reading whether
+        // the device wants to be notified.
+        memory_barrier();
+        self.inner.available_ring.idx.set(new);
+        self.published_idx = new;
+        memory_barrier();
+
+        if self.event_idx {
+            crossed_event(self.inner.used_ring.avail_event.get(), new, old)
+        } else {
+            self.inner.used_ring.flags.read(UsedFlags::NO_NOTIFY) == 0
+        }
+    }
 
-        let idx = used_ev.idx.get();
+    /// Passes the data written by the device to `handler` for each returned chain and makes the
+    /// chains available again, to receive more data. Used by queues where the device sends data to
+    /// the driver. The recycled chains are visible to the device after the next `publish`.
+    pub fn handle_events(&mut self, mut handler: impl FnMut(&[u8])) {
+        self.drain_used(|queue, head, len| {
+            let chain = UsedChain {
+                queue: &*queue,
+                head,
+                len,
+            };
+            if let Some(data) = chain.buffers().next() {
+                handler(data);
+            }
+            queue.push_available(head);
+        });
+    }
 
-        self.last_used_idx = self.last_used_idx.wrapping_add(1);
-        Some(idx as usize)
+    /// Passes each chain returned by the device to `handler`, then frees its descriptors. Used by
+    /// queues of requests from the driver to the device.
+    #[allow(dead_code)]
+    pub fn complete(&mut self, mut handler: impl FnMut(&UsedChain<N, C>)) {
+        self.drain_used(|queue, head, len| {
+            handler(&UsedChain {
+                queue: &*queue,
+                head,
+                len,
+            });
+            queue.free_chain(head);
+        });
     }
 
-    pub fn handle_events(&mut self, mut handler: impl FnMut(&[u8])) {
-        while let Some(dsc_index) = self.pop_event() {
-            let dsc = &self.descriptor_data[dsc_index];
+    /// Calls `f` with the head and the written length of each used chain, after invalidating the
+    /// data the device wrote. With event indices the device is then asked to interrupt again for
+    /// the next used chain.
+    fn drain_used(&mut self, mut f: impl FnMut(&mut Self, u16, usize)) {
+        loop {
+            let used_idx = self.inner.used_ring.idx.get();
+            // Entries must not be read before the index that covers them
+            memory_barrier();
+
+            while self.last_used_idx != used_idx {
+                let used_ev = &self.inner.used_ring.ring[self.last_used_idx as usize % N];
+                let head = used_ev.idx.get() as u16;
+                let len = used_ev.len.get() as usize;
+                self.last_used_idx = self.last_used_idx.wrapping_add(1);
+
+                self.invalidate_chain(head, len);
+                f(self, head, len);
+            }
+
+            if !self.event_idx {
+                return;
+            }
+
+            // The device may have used more buffers before it saw the new event index, and then it
+            // would not interrupt for them
+            self.inner.available_ring.used_event.set(self.last_used_idx);
+            memory_barrier();
+            if self.inner.used_ring.idx.get() == self.last_used_idx {
+                return;
+            }
+        }
+    }
 
-            // For this to be truly safe we need to invalidate the cache here
+    fn invalidate_chain(&self, head: u16, len: usize) {
+        let mut remaining = len;
+        for idx in self.chain(head).filter(|&idx| self.is_writeable(idx)) {
+            if remaining == 0 {
+                break;
+            }
+            let buffer = &self.descriptor_data[idx as usize];
+            let len = remaining.min(C);
             crate::arch::cache::invalidate_va_range(
-                VirtualAddress::new_unaligned(dsc.as_ptr()),
-                dsc.len(),
+                VirtualAddress::new_unaligned(buffer.as_ptr()),
+                len,
             );
-            handler(&dsc.0);
-
-            // We can add the desc back to the queue
-            self.add_desc_to_available_ring(dsc_index);
+            remaining -= len;
         }
     }
 
-    pub fn should_notify(&self) -> bool {
-        self.inner.used_ring.flags.read(UsedFlags::NO_NOTIFY) == 0
+    /// Returns the indices of the descriptors of the chain that starts at `head`.
+    fn chain(&self, head: u16) -> impl Iterator<Item = u16> + '_ {
+        let descriptors = &self.inner.descriptor_table.descriptors;
+        let mut next = Some(head);
+        core::iter::from_fn(move || {
+            let idx = next?;
+            let desc = &descriptors[idx as usize];
+            next = (desc.flags.read(DescriptorFlags::Next) != 0).then(|| desc.next.get());
+            Some(idx)
+        })
+    }
+
+    fn is_writeable(&self, idx: u16) -> bool {
+        self.inner.descriptor_table.descriptors[idx as usize]
+            .flags
+            .is_set(DescriptorFlags::DEVICE_PERMISSIONS)
+    }
+
+    fn free_chain(&mut self, head: u16) {
+        let (count, tail) = self
+            .chain(head)
+            .fold((0, head), |(count, _), idx| (count + 1, idx));
+
+        self.inner.descriptor_table.descriptors[tail as usize]
+            .next
+            .set(self.free_head);
+        self.free_head = head;
+        self.num_free += count;
+    }
+
+    /// Writes the next entry of the available ring, without publishing it.
+    fn push_available(&mut self, head: u16) {
+        let index = self.avail_idx as usize % N;
+        self.inner.available_ring.ring[index].set(head);
+        self.avail_idx = self.avail_idx.wrapping_add(1);
     }
 
     pub fn descriptor_table(&self) -> PhysicalAddress {
@@ -295,6 +527,8 @@ impl<const N: usize, const C: usize> VirtQueue<N, C> {
     }
 }
 
+const _: () = assert!(core::mem::align_of::<AvailableRing<1>>() == CACHE_LINE_SIZE);
+
 // This is a horrible allocator, but sometimes you gotta do what you gotta do!
 struct DeviceMemoryAllocator();
 
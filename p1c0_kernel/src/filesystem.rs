@@ -138,7 +138,8 @@ pub struct FileDescription {
     pub group_id: u32,
     pub size: usize,
     _inode_number: u64,
-    block_offset: usize,
+    /// Offset of the file data within the device, resolved when the file is opened
+    data_offset: usize,
     read_offset: usize,
 }
 
@@ -152,6 +153,14 @@ pub trait FilesystemDevice {
     fn open(&self, path: &str, mode: OpenMode) -> Result<FileDescription>;
     fn read(&self, fd: &mut FileDescription, buffer: &mut [u8]) -> Result<usize>;
     fn close(&self, fd: FileDescription);
+
+    /// Returns the contents of the file if they stay resident in memory for the lifetime of the
+    /// kernel, so that they can be used without copying them.
+    ///
+    /// The default implementation returns None.
+    fn static_data(&self, _fd: &FileDescription) -> Option<&'static [u8]> {
+        None
+    }
 }
 
 pub struct VirtualFileSystem {
@@ -181,6 +190,30 @@ impl VirtualFileSystem {
         VFS.lock_read().rootfs.as_ref().unwrap().read(fd, buffer)
     }
 
+    /// Reads from `offset` into `buffer` until it is full or the end of the file is reached.
+    /// Returns the number of bytes read. The read offset of the file is left untouched.
+    pub fn read_at(fd: &mut FileDescription, offset: usize, buffer: &mut [u8]) -> Result<usize> {
+        let read_offset = fd.read_offset;
+        Self::fseek(fd, SeekMode::Start(offset))?;
+
+        let mut total = 0;
+        let result = loop {
+            match Self::read(fd, &mut buffer[total..]) {
+                Ok(0) => break Ok(total),
+                Ok(bytes) => {
+                    total += bytes;
+                    if total == buffer.len() {
+                        break Ok(total);
+                    }
+                }
+                Err(e) => break Err(e),
+            }
+        };
+
+        fd.read_offset = read_offset;
+        result
+    }
+
     pub fn fseek(file: &mut FileDescription, seek_mode: SeekMode) -> Result<()> {
         let requested_offset = match seek_mode {
             SeekMode::Start(offset) => offset,
@@ -199,6 +232,10 @@ impl VirtualFileSystem {
     pub fn close(fd: FileDescription) {
         VFS.lock_read().rootfs.as_ref().unwrap().close(fd);
     }
+
+    pub fn static_data(fd: &FileDescription) -> Option<&'static [u8]> {
+        VFS.lock_read().rootfs.as_ref().unwrap().static_data(fd)
+    }
 }
 
 pub struct Path<'a> {
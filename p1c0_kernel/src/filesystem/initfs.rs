@@ -6,63 +6,86 @@ use super::{
 };
 use crate::prelude::*;
 
-/// This filesystem assumes that the order of records within the archive is depth first.
-/// That ensures that we can find all the children of a directory node without iterating the
-/// whole tree.
+/// Metadata of an entry of the archive, parsed once when the filesystem is mounted
+struct EntryInfo {
+    data_offset: usize,
+    size: usize,
+    filetype: FileType,
+    mode: u32,
+    user_id: u32,
+    group_id: u32,
+    inode_number: u64,
+}
+
+/// The archive is indexed by path when it is mounted, so that opening a file is a single lookup
+/// and reading it is a copy from the archive, regardless of the number of entries.
 struct InitFsDevice {
     data: &'static [u8],
+    index: FlatMap<&'static str, EntryInfo>,
 }
 
-impl InitFsDevice {
-    const fn new(data: &'static [u8]) -> Self {
-        Self { data }
+fn filetype_from_cpio_hdr(header: &CpioHeader) -> Result<FileType> {
+    match header.mode & super::permissions::S_IFMT {
+        super::permissions::S_IFIFO => Ok(FileType::Fifo),
+        super::permissions::S_IFDIR => Ok(FileType::Directory),
+        super::permissions::S_IFREG => Ok(FileType::RegularFile),
+        super::permissions::S_IFCHR => Ok(FileType::CharDevice),
+        super::permissions::S_IFBLK => Ok(FileType::BlockDevice),
+        super::permissions::S_IFLNK => Ok(FileType::SymbolicLink),
+        super::permissions::S_IFSOCK => Ok(FileType::Socket),
+        _ => {
+            log_warning!("Invalid file mode found 0o{:o}", header.mode);
+            Err(Error::InvalidFileDescription)
+        }
     }
+}
 
-    fn filetype_from_cpio_hdr(&self, header: &CpioHeader) -> Result<FileType> {
-        match header.mode & super::permissions::S_IFMT {
-            super::permissions::S_IFIFO => Ok(FileType::Fifo),
-            super::permissions::S_IFDIR => Ok(FileType::Directory),
-            super::permissions::S_IFREG => Ok(FileType::RegularFile),
-            super::permissions::S_IFCHR => Ok(FileType::CharDevice),
-            super::permissions::S_IFBLK => Ok(FileType::BlockDevice),
-            super::permissions::S_IFLNK => Ok(FileType::SymbolicLink),
-            super::permissions::S_IFSOCK => Ok(FileType::Socket),
-            _ => {
-                log_warning!("Invalid file mode found 0o{:o}", header.mode);
-                Err(Error::InvalidFileDescription)
+impl InitFsDevice {
+    fn new(data: &'static [u8]) -> Result<Self> {
+        let mut index = FlatMap::new();
+
+        let mut offset = 0;
+        while let Some(entry) =
+            cpio::parse_entry(&data[offset..]).map_err(|_| Error::InvalidFilesystem)?
+        {
+            // Entries with an invalid mode cannot be opened
+            if let Ok(filetype) = filetype_from_cpio_hdr(&entry) {
+                let info = EntryInfo {
+                    data_offset: offset + entry.data_offset,
+                    size: entry.filesize as usize,
+                    filetype,
+                    mode: entry.mode,
+                    user_id: entry.uid,
+                    group_id: entry.gid,
+                    inode_number: entry.inode as _,
+                };
+                index.insert(entry.name, info);
             }
+            offset += entry.next_entry_offset;
+        }
+
+        if index.is_empty() {
+            log_warning!("Empty initfs!");
+            return Err(Error::InvalidFilesystem);
         }
+
+        Ok(Self { data, index })
     }
 
     fn find_node(&self, path: &str) -> Option<FileDescription> {
         let path = path.strip_prefix('/').unwrap_or(path);
 
-        let mut offset = 0;
-        loop {
-            match cpio::parse_entry(&self.data[offset..]) {
-                Ok(Some(entry)) if entry.name == path => {
-                    return Some(FileDescription {
-                        block_offset: offset,
-                        _inode_number: entry.inode as _,
-                        filetype: self.filetype_from_cpio_hdr(&entry).ok()?,
-                        mode: entry.mode,
-                        group_id: entry.gid,
-                        user_id: entry.uid,
-                        size: entry.filesize as usize,
-                        read_offset: 0,
-                    });
-                }
-                Ok(Some(entry)) => {
-                    offset += entry.next_entry_offset;
-                }
-                Ok(None) => {
-                    return None;
-                }
-                Err(error) => {
-                    panic!("Error parsing cpio entry: {:?}", error);
-                }
-            }
-        }
+        let info = self.index.lookup(path)?;
+        Some(FileDescription {
+            data_offset: info.data_offset,
+            _inode_number: info.inode_number,
+            filetype: info.filetype,
+            mode: info.mode,
+            group_id: info.group_id,
+            user_id: info.user_id,
+            size: info.size,
+            read_offset: 0,
+        })
     }
 }
 
@@ -76,25 +99,15 @@ impl FilesystemDevice for InitFsDevice {
     }
 
     fn read(&self, fd: &mut FileDescription, buffer: &mut [u8]) -> Result<usize> {
-        let header = cpio::parse_entry(&self.data[fd.block_offset..])
-            .unwrap()
-            .unwrap();
-        let data_offset = fd.block_offset + header.data_offset;
-
         if fd.read_offset > fd.size {
             return Err(Error::EndOfFile);
         }
 
         let available_bytes = fd.size - fd.read_offset;
+        let copy_size = core::cmp::min(buffer.len(), available_bytes);
 
-        let copy_size = if buffer.len() > available_bytes {
-            available_bytes
-        } else {
-            buffer.len()
-        };
-
-        let offset = data_offset + fd.read_offset;
-        buffer.copy_from_slice(&self.data[offset..offset + copy_size]);
+        let offset = fd.data_offset + fd.read_offset;
+        buffer[..copy_size].copy_from_slice(&self.data[offset..offset + copy_size]);
 
         fd.read_offset += copy_size;
         Ok(copy_size)
@@ -103,6 +116,10 @@ impl FilesystemDevice for InitFsDevice {
     fn close(&self, _fd: FileDescription) {
         // Nothing to do here
     }
+
+    fn static_data(&self, fd: &FileDescription) -> Option<&'static [u8]> {
+        self.data.get(fd.data_offset..fd.data_offset + fd.size)
+    }
 }
 
 struct InitFsDriver {}
@@ -118,13 +135,7 @@ impl FilesystemDriver for InitFsDriver {
     }
 
     fn mount_from_static_data(&self, data: &'static [u8]) -> Result<Box<dyn FilesystemDevice>> {
-        match cpio::parse_entry(data).map_err(|_| Error::InvalidFilesystem)? {
-            Some(_) => Ok(Box::new(InitFsDevice::new(data))),
-            None => {
-                log_warning!("Empty initfs!");
-                Err(Error::InvalidFilesystem)
-            }
-        }
+        Ok(Box::new(InitFsDevice::new(data)?))
     }
 }
 
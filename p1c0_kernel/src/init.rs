@@ -12,6 +12,7 @@ use crate::{
     },
     prelude::*,
     registers::CPACR,
+    smp,
 };
 
 use p1c0_macros::initcall;
@@ -183,6 +184,9 @@ pub extern "C" fn start_rust(boot_args: &BootArgs, base: *const u8, stack_bottom
     // of the operations will not work or will not be compatible (e.g.: addresses) with the
     // relocated kernel.
 
+    // Spinlocks rely on the CPU index, so it must be set before anything else runs.
+    smp::init_boot_cpu();
+
     // SAFETY
     // This is safe because at this point there is only one thread running and no one has accessed
     // the boot args yet.
@@ -0,0 +1,314 @@
+//! Objects that let processes exchange data: shared memory regions and pipes.
+//!
+//! Both are referred to by global IDs, so a process can hand them to the processes it spawns
+//! through their arguments. Shared memory moves data without any copy by the kernel, while pipes
+//! copy it through a bounded ring buffer and block readers and writers until they can progress.
+//!
+//! A process holds the IDs of the regions it creates, both ends of the pipes it creates and the
+//! ends of the pipes it reads from or writes to. They are released when the process is killed,
+//! like its open files. An end of a pipe is closed once all its holders closed it or exited, so a
+//! process has to use an end it was handed before the other holders of that end let go of it.
+
+use crate::{
+    memory::{self, address::VirtualAddress, shared_memory::SharedMemory},
+    prelude::*,
+    process,
+    sync::{spinlock::SpinLock, wait_queue::WaitQueue},
+    thread,
+};
+
+use core::{
+    ptr::NonNull,
+    sync::atomic::{AtomicBool, AtomicU64, AtomicUsize, Ordering},
+};
+
+/// Capacity of a pipe in bytes. The ring buffer keeps one byte free.
+pub const PIPE_SIZE: usize = 4096;
+
+#[derive(Debug)]
+pub enum Error {
+    InvalidId,
+    MemoryError(memory::Error),
+    ProcessError(process::Error),
+    /// The pipe is empty or full, depending on the operation
+    WouldBlock,
+    /// The read end of the pipe was closed
+    BrokenPipe,
+    /// The end of the pipe was closed by all its holders, so it cannot be held again
+    EndClosed,
+}
+
+impl From<memory::Error> for Error {
+    fn from(e: memory::Error) -> Self {
+        Error::MemoryError(e)
+    }
+}
+
+impl From<process::Error> for Error {
+    fn from(e: process::Error) -> Self {
+        Error::ProcessError(e)
+    }
+}
+
+static NEXT_ID: AtomicU64 = AtomicU64::new(1);
+
+static SHARED_MEMORY: SpinLock<FlatMap<u64, Arc<SharedMemory>>> =
+    SpinLock::new(FlatMap::new_no_capacity());
+
+static PIPES: SpinLock<FlatMap<u64, Arc<Pipe>>> = SpinLock::new(FlatMap::new_no_capacity());
+
+/// An IPC object held by a process
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum Handle {
+    SharedMemory(u64),
+    Pipe(u64, PipeEnd),
+}
+
+/// Creates a zero-filled shared memory region of at least `size_bytes` and returns its ID
+pub fn create_shared_memory(size_bytes: usize) -> Result<u64, Error> {
+    let memory = Arc::new(SharedMemory::new(size_bytes)?);
+    let id = NEXT_ID.fetch_add(1, Ordering::Relaxed);
+    SHARED_MEMORY.lock().insert(id, memory);
+    process::hold_ipc_handle(Handle::SharedMemory(id));
+    Ok(id)
+}
+
+/// Maps the shared memory region read-write into the current process and returns its address
+pub fn map_shared_memory(id: u64) -> Result<VirtualAddress, Error> {
+    let memory = SHARED_MEMORY
+        .lock()
+        .lookup(&id)
+        .cloned()
+        .ok_or(Error::InvalidId)?;
+    Ok(process::map_shared_memory(memory)?)
+}
+
+/// Releases the ID of the region. Existing mappings keep working, and the memory is freed once
+/// none of them are left.
+pub fn release_shared_memory(id: u64) -> Result<(), Error> {
+    process::drop_ipc_handle(&Handle::SharedMemory(id));
+    SHARED_MEMORY
+        .lock()
+        .remove(&id)
+        .map(|_| ())
+        .map_err(|_| Error::InvalidId)
+}
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum PipeEnd {
+    Read,
+    Write,
+}
+
+/// A bounded byte stream built on the single-producer, single-consumer ring buffer. Each end is
+/// locked while used, so any number of threads can share it.
+pub struct Pipe {
+    buffer: NonNull<RingBuffer<PIPE_SIZE>>,
+    writer: SpinLock<ring_buffer::Writer<'static, PIPE_SIZE>>,
+    reader: SpinLock<ring_buffer::Reader<'static, PIPE_SIZE>>,
+    writer_closed: AtomicBool,
+    reader_closed: AtomicBool,
+    /// Number of holders of each end. The end is closed when it drops to 0.
+    writers: AtomicUsize,
+    readers: AtomicUsize,
+    readable: WaitQueue,
+    writable: WaitQueue,
+}
+
+/// # Safety
+///   The buffer is only accessed through the reader and the writer, which are behind locks
+unsafe impl Send for Pipe {}
+unsafe impl Sync for Pipe {}
+
+impl Default for Pipe {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl Pipe {
+    pub fn new() -> Self {
+        let buffer = NonNull::new(Box::into_raw(Box::new(RingBuffer::new()))).unwrap();
+
+        // # Safety
+        //   The buffer is only freed when the pipe is dropped, so the reader and writer never
+        //   outlive it
+        let (writer, reader) = unsafe { &*buffer.as_ptr() }.split().unwrap();
+        Self {
+            buffer,
+            writer: SpinLock::new(writer),
+            reader: SpinLock::new(reader),
+            writer_closed: AtomicBool::new(false),
+            reader_closed: AtomicBool::new(false),
+            writers: AtomicUsize::new(1),
+            readers: AtomicUsize::new(1),
+            readable: WaitQueue::new(),
+            writable: WaitQueue::new(),
+        }
+    }
+
+    /// Queue notified when data is written or the write end is closed
+    pub fn readable(&self) -> &WaitQueue {
+        &self.readable
+    }
+
+    /// Queue notified when data is read or the read end is closed
+    pub fn writable(&self) -> &WaitQueue {
+        &self.writable
+    }
+
+    /// Writes as much of `data` as fits and returns the number of bytes written. Fails with
+    /// `WouldBlock` if the pipe is full.
+    pub fn write(&self, data: &[u8]) -> Result<usize, Error> {
+        if self.reader_closed.load(Ordering::Acquire) {
+            return Err(Error::BrokenPipe);
+        }
+
+        let mut writer = self.writer.lock();
+        let length = data.len().min(writer.free_space());
+        if length == 0 && !data.is_empty() {
+            return Err(Error::WouldBlock);
+        }
+
+        writer.push_slice(&data[..length]).unwrap();
+        drop(writer);
+
+        self.readable.notify_all();
+        Ok(length)
+    }
+
+    /// Reads as many bytes as available into `buffer`. Returns 0 once the write end is closed and
+    /// all data has been read. Fails with `WouldBlock` if the pipe is empty.
+    pub fn read(&self, buffer: &mut [u8]) -> Result<usize, Error> {
+        // Checked before looking at the data, so that nothing written before closing is missed
+        let writer_closed = self.writer_closed.load(Ordering::Acquire);
+
+        let mut reader = self.reader.lock();
+        let (first, second) = reader.readable_slices();
+        if first.is_empty() {
+            return if writer_closed || buffer.is_empty() {
+                Ok(0)
+            } else {
+                Err(Error::WouldBlock)
+            };
+        }
+
+        let mut length = 0;
+        for slice in [first, second] {
+            let chunk = slice.len().min(buffer.len() - length);
+            buffer[length..length + chunk].copy_from_slice(&slice[..chunk]);
+            length += chunk;
+        }
+        reader.consume(length).unwrap();
+        drop(reader);
+
+        self.writable.notify_all();
+        Ok(length)
+    }
+
+    fn holders(&self, end: PipeEnd) -> &AtomicUsize {
+        match end {
+            PipeEnd::Read => &self.readers,
+            PipeEnd::Write => &self.writers,
+        }
+    }
+
+    /// Adds a holder to one end of the pipe, unless the end is already closed
+    fn acquire(&self, end: PipeEnd) -> Result<(), Error> {
+        self.holders(end)
+            .fetch_update(Ordering::AcqRel, Ordering::Acquire, |holders| {
+                (holders > 0).then(|| holders + 1)
+            })
+            .map(|_| ())
+            .map_err(|_| Error::EndClosed)
+    }
+
+    /// Removes a holder from one end of the pipe, closing it if it was the last one. Returns true
+    /// if both ends are closed.
+    fn release(&self, end: PipeEnd) -> Result<bool, Error> {
+        let holders = self
+            .holders(end)
+            .fetch_update(Ordering::AcqRel, Ordering::Acquire, |holders| {
+                holders.checked_sub(1)
+            })
+            .map_err(|_| Error::EndClosed)?;
+        Ok(holders == 1 && self.close(end))
+    }
+
+    /// Closes one end of the pipe, waking up everyone blocked on the other end. Returns true if
+    /// both ends are closed.
+    fn close(&self, end: PipeEnd) -> bool {
+        match end {
+            PipeEnd::Read => self.reader_closed.store(true, Ordering::Release),
+            PipeEnd::Write => self.writer_closed.store(true, Ordering::Release),
+        }
+
+        self.readable.notify_all();
+        self.writable.notify_all();
+        self.reader_closed.load(Ordering::Acquire) && self.writer_closed.load(Ordering::Acquire)
+    }
+}
+
+impl Drop for Pipe {
+    fn drop(&mut self) {
+        // # Safety
+        //   The reader and writer are only dropped after this, but they do nothing when dropped
+        unsafe { drop(Box::from_raw(self.buffer.as_ptr())) };
+    }
+}
+
+/// Creates a pipe and returns its ID, which is used for both ends. The creator holds both of
+/// them.
+pub fn create_pipe() -> u64 {
+    let id = NEXT_ID.fetch_add(1, Ordering::Relaxed);
+    PIPES.lock().insert(id, Arc::new(Pipe::new()));
+    process::hold_ipc_handle(Handle::Pipe(id, PipeEnd::Read));
+    process::hold_ipc_handle(Handle::Pipe(id, PipeEnd::Write));
+    id
+}
+
+/// Returns the pipe in order to use the given end of it. The current process becomes a holder of
+/// that end if it was not already.
+pub fn pipe(id: u64, end: PipeEnd) -> Result<Arc<Pipe>, Error> {
+    let pipe = PIPES.lock().lookup(&id).cloned().ok_or(Error::InvalidId)?;
+    let handle = Handle::Pipe(id, end);
+    if process::hold_ipc_handle(handle) {
+        if let Err(e) = pipe.acquire(end) {
+            process::drop_ipc_handle(&handle);
+            return Err(e);
+        }
+    }
+    Ok(pipe)
+}
+
+/// Closes one end of the pipe for the current process, which must hold it. Kernel threads are not
+/// tracked, each of their calls releases one holder. The ID is released once both ends are
+/// closed.
+pub fn close_pipe(id: u64, end: PipeEnd) -> Result<(), Error> {
+    if thread::current_pid().is_some() && !process::drop_ipc_handle(&Handle::Pipe(id, end)) {
+        return Err(Error::InvalidId);
+    }
+    release_pipe_end(id, end)
+}
+
+fn release_pipe_end(id: u64, end: PipeEnd) -> Result<(), Error> {
+    let mut pipes = PIPES.lock();
+    let pipe = pipes.lookup(&id).ok_or(Error::InvalidId)?;
+    if pipe.release(end)? {
+        pipes.remove(&id).map_err(|_| Error::InvalidId)?;
+    }
+    Ok(())
+}
+
+/// Releases an object held by a process that was killed. IDs that are already gone, like regions
+/// released by another process, are ignored.
+pub(crate) fn release_handle(handle: Handle) {
+    match handle {
+        Handle::SharedMemory(id) => {
+            let _ = SHARED_MEMORY.lock().remove(&id);
+        }
+        Handle::Pipe(id, end) => {
+            let _ = release_pipe_end(id, end);
+        }
+    }
+}
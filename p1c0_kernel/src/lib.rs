@@ -18,6 +18,7 @@ pub mod filesystem;
 mod font;
 pub mod hash;
 pub mod init;
+pub mod ipc;
 pub mod log;
 pub mod macros;
 pub mod memory;
@@ -25,9 +26,11 @@ pub mod prelude;
 pub mod print;
 pub mod process;
 pub mod registers;
+pub mod smp;
 pub mod sync;
 pub mod syscall;
 pub mod thread;
+pub mod trace;
 
 #[doc(hidden)]
 pub fn _print(args: core::fmt::Arguments) {
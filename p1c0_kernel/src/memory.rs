@@ -2,18 +2,28 @@ pub mod address;
 pub mod address_space;
 pub mod kalloc;
 pub mod map;
+pub mod page_cache;
 pub mod physical_page_allocator;
+pub mod shared_memory;
 
 use crate::{
     arch::{
-        self,
+        self, cache,
         mmu::{PAGE_BITS, PAGE_SIZE},
     },
-    sync::spinlock::{SpinLock, SpinLockGuard},
+    prelude::*,
+    sync::{
+        spinlock::{SpinLock, SpinLockGuard},
+        wait_queue::WaitQueue,
+    },
+    syscall::Syscall,
+    thread, trace,
 };
 use address::{Address, LogicalAddress, PhysicalAddress, VirtualAddress};
 use address_space::MemoryRange;
-use physical_page_allocator::{PhysicalMemoryRegion, PhysicalPageAllocator};
+use physical_page_allocator::{PhysicalMemoryRegion, PhysicalPageAllocator, CLEAN_POOL_CAPACITY};
+
+use p1c0_macros::initcall;
 
 pub fn num_pages_from_bytes(bytes: usize) -> usize {
     if bytes & (PAGE_SIZE - 1) == 0 {
@@ -23,6 +33,48 @@ pub fn num_pages_from_bytes(bytes: usize) -> usize {
     }
 }
 
+/// Statistics of the kernel heap and the physical page allocator. The layout matches
+/// `libcxx::syscalls::MemoryStatistics`.
+#[repr(C)]
+#[derive(Debug, Clone, Copy, Default)]
+pub struct Statistics {
+    pub heap: kalloc::Statistics,
+    pub pages: physical_page_allocator::Statistics,
+}
+
+pub fn statistics() -> Statistics {
+    Statistics {
+        heap: kalloc::statistics(),
+        pages: MemoryManager::instance().page_statistics(),
+    }
+}
+
+/// Debug report of the memory usage of the kernel
+pub fn print_statistics() {
+    kalloc::print_statistics();
+
+    let pages = MemoryManager::instance().page_statistics();
+    log_info!(
+        "Physical memory: {} free pages in {} regions, largest region {} pages",
+        pages.free_pages,
+        pages.num_regions,
+        pages.largest_region_pages
+    );
+    log_info!(
+        "Clean page pool: {} pages, {} hits, {} misses",
+        pages.clean_pages,
+        pages.clean_page_hits,
+        pages.clean_page_misses
+    );
+
+    let cache = page_cache::statistics();
+    log_info!(
+        "Page cache: {} shared pages, {} mappings",
+        cache.cached_pages,
+        cache.mappings
+    );
+}
+
 #[derive(Clone, Debug)]
 pub enum Error {
     ArchitectureSpecific(arch::mmu::Error),
@@ -83,6 +135,22 @@ pub enum Permissions {
     RO,
 }
 
+impl Permissions {
+    pub fn is_writable(&self) -> bool {
+        matches!(self, Permissions::RWX | Permissions::RW)
+    }
+
+    /// Returns the same permissions without write access
+    #[must_use]
+    pub fn read_only(&self) -> Self {
+        match self {
+            Permissions::RWX => Permissions::RX,
+            Permissions::RW => Permissions::RO,
+            perm => *perm,
+        }
+    }
+}
+
 #[derive(Clone, Copy, Debug)]
 pub struct GlobalPermissions {
     pub unprivileged: Permissions,
@@ -107,6 +175,19 @@ impl GlobalPermissions {
             },
         }
     }
+
+    pub fn is_writable(&self) -> bool {
+        self.unprivileged.is_writable() || self.privileged.is_writable()
+    }
+
+    /// Returns the same permissions without write access for any exception level
+    #[must_use]
+    pub fn read_only(&self) -> Self {
+        Self {
+            unprivileged: self.unprivileged.read_only(),
+            privileged: self.privileged.read_only(),
+        }
+    }
 }
 
 static MEMORY_MANAGER: SpinLock<MemoryManager> = SpinLock::new(MemoryManager::new());
@@ -116,6 +197,10 @@ pub struct MemoryManager {
     physical_page_allocator: PhysicalPageAllocator,
 }
 
+fn trace_pages(event: trace::Event, pmr: &PhysicalMemoryRegion) {
+    trace::record(event, pmr.num_pages() as u64, pmr.base_address().as_u64());
+}
+
 impl MemoryManager {
     const fn new() -> Self {
         Self {
@@ -299,6 +384,9 @@ impl MemoryManager {
             .and_then(|prop| prop.usize_value().ok())
             .expect("There is a dram base");
 
+        self.add_direct_map(dram_base, dram_size)
+            .expect("DRAM cannot be mapped linearly");
+
         self.initialize_physical_page_allocator(
             dram_base,
             dram_size,
@@ -308,6 +396,26 @@ impl MemoryManager {
         .expect("Could not initialize physical_page_allocator");
     }
 
+    /// Maps all of DRAM at `map::DIRECT_MAP_BASE`. `map_region` uses block descriptors wherever
+    /// the alignment allows it, so this only needs a handful of tables.
+    fn add_direct_map(
+        &mut self,
+        dram_base: PhysicalAddress,
+        dram_size: usize,
+    ) -> Result<(), Error> {
+        assert!(dram_base.as_usize() + dram_size <= map::DIRECT_MAP_SIZE);
+
+        self.kernel_address_space.high_table().map_region(
+            dram_base.direct_mapped(),
+            dram_base,
+            dram_size,
+            Attributes::Normal,
+            GlobalPermissions::new_only_privileged(Permissions::RW),
+        )?;
+        arch::mmu::flush_tlb();
+        Ok(())
+    }
+
     pub fn map_logical(
         &mut self,
         name: &str,
@@ -317,11 +425,9 @@ impl MemoryManager {
         permissions: Permissions,
     ) -> Result<(), Error> {
         // Request pages from the PhysicalPageAllocator
-        let region = self.physical_page_allocator.request_pages(
-            la.into_physical(),
-            num_pages_from_bytes(size_bytes),
-            physical_page_allocator::Options::Default,
-        )?;
+        let region = self
+            .physical_page_allocator
+            .request_pages(la.into_physical(), num_pages_from_bytes(size_bytes))?;
 
         // Getting the logical range must succeed because we got ownership of the pages and this is
         // a logical mapping (one-to-one address)
@@ -398,37 +504,57 @@ impl MemoryManager {
         Ok(())
     }
 
+    /// Allocates physically contiguous pages. With `AllocPolicy::ZeroFill`, pages that do not
+    /// come from the clean pool are zeroed while the memory manager is locked, so callers that do
+    /// not hold the lock should use `request_zeroed_pages` instead.
     pub fn request_any_pages(
         &mut self,
         num_pages: usize,
         policy: AllocPolicy,
     ) -> Result<PhysicalMemoryRegion, Error> {
-        let pmr = self
-            .physical_page_allocator
-            .request_any_pages(num_pages, physical_page_allocator::Options::Default)?;
-
         if policy == AllocPolicy::ZeroFill {
-            for page_idx in 0..pmr.num_pages() {
-                let pa = unsafe { pmr.base_address().offset(page_idx * PAGE_SIZE) };
-                self.do_with_fast_map(
-                    pa,
-                    GlobalPermissions::new_only_privileged(Permissions::RW),
-                    |va| unsafe { core::ptr::write_bytes(va.as_mut_ptr(), 0u8, PAGE_SIZE) },
-                );
+            if let Some(pmr) = self.request_clean_pages(num_pages) {
+                return Ok(pmr);
             }
         }
 
+        let pmr = match self.physical_page_allocator.request_any_pages(num_pages) {
+            Err(physical_page_allocator::Error::NoMemoryAvailable) if num_pages == 1 => self
+                .physical_page_allocator
+                .reclaim_clean_page()
+                .ok_or(physical_page_allocator::Error::NoMemoryAvailable)?,
+            result => result?,
+        };
+
+        if policy == AllocPolicy::ZeroFill {
+            // The region is physically contiguous, so it is also contiguous in the direct map
+            let va = pmr.base_address().direct_mapped();
+            unsafe { cache::zero_va_range(va, pmr.num_pages() * PAGE_SIZE) };
+        }
+
+        trace_pages(trace::Event::PageAlloc, &pmr);
         Ok(pmr)
     }
 
+    /// Takes zero-filled pages from the clean pool, waking up the page zeroer if the pool runs low
+    fn request_clean_pages(&mut self, num_pages: usize) -> Option<PhysicalMemoryRegion> {
+        let pmr = self.physical_page_allocator.request_clean_pages(num_pages);
+        if self.physical_page_allocator.num_clean_pages() < CLEAN_POOL_LOW_WATERMARK {
+            CLEAN_POOL_LOW.notify_all();
+        }
+        if let Some(pmr) = &pmr {
+            trace_pages(trace::Event::PageAlloc, pmr);
+        }
+        pmr
+    }
+
     pub fn release_pages(
         &mut self,
         physical_memory_region: PhysicalMemoryRegion,
     ) -> Result<(), Error> {
-        self.physical_page_allocator.release_pages(
-            physical_memory_region,
-            physical_page_allocator::Options::Default,
-        )?;
+        trace_pages(trace::Event::PageFree, &physical_memory_region);
+        self.physical_page_allocator
+            .release_pages(physical_memory_region)?;
         Ok(())
     }
 
@@ -439,59 +565,41 @@ impl MemoryManager {
         device_tree_base: PhysicalAddress,
         device_tree_size: usize,
     ) -> Result<(), Error> {
-        // We initialize the physical page allocator with memory from the DRAM
-        let dram_pages = num_pages_from_bytes(dram_size);
-        self.physical_page_allocator.add_region(
-            dram_base,
-            dram_pages,
-            physical_page_allocator::Options::Default,
-        )?;
-
-        // Remove kernel pages
+        // The kernel sections and the ADT are already in use. They are passed to the allocator
+        // up front because it keeps its free lists in the free pages, so they never become free.
+        let mut reserved: heapless::Vec<PhysicalMemoryRegion, { map::ALL_SECTIONS.len() + 1 }> =
+            heapless::Vec::new();
         for section_id in map::ALL_SECTIONS.iter() {
             let section = map::KernelSection::from_id(*section_id);
-            let physical_addr = section.pa();
             let num_pages = num_pages_from_bytes(section.size_bytes());
-            self.physical_page_allocator.steal_region(
-                physical_addr,
-                num_pages,
-                physical_page_allocator::Options::Default,
-            )?;
+            reserved
+                .push(PhysicalMemoryRegion::new(section.pa(), num_pages))
+                .unwrap();
         }
-
-        // Remove ADT regions
         let device_tree_pages = num_pages_from_bytes(device_tree_size);
-        self.physical_page_allocator
-            .steal_region(
+        reserved
+            .push(PhysicalMemoryRegion::new(
                 device_tree_base,
                 device_tree_pages,
-                physical_page_allocator::Options::Default,
-            )
-            .expect("Cannot steal ADT region");
+            ))
+            .unwrap();
+
+        // We initialize the physical page allocator with memory from the DRAM
+        let dram_pages = num_pages_from_bytes(dram_size);
+        self.physical_page_allocator
+            .add_region(dram_base, dram_pages, &reserved)?;
 
         self.physical_page_allocator.print_regions();
 
         Ok(())
     }
 
-    pub fn do_with_fast_map<T>(
-        &mut self,
-        pa: PhysicalAddress,
-        permissions: GlobalPermissions,
-        mut f: impl FnMut(VirtualAddress) -> T,
-    ) -> T {
-        self.kernel_address_space
-            .fast_page_map(pa, permissions, Attributes::Normal)
-            .unwrap();
-
-        let val = f(map::FASTMAP_PAGE);
-
-        self.kernel_address_space.fast_page_unmap().unwrap();
-        val
+    pub fn page_statistics(&self) -> physical_page_allocator::Statistics {
+        self.physical_page_allocator.statistics()
     }
 
     pub fn map_kernel_low_pages(&mut self) {
-        arch::mmu::switch_process_translation_table(self.kernel_address_space.low_table());
+        arch::mmu::switch_kernel_translation_table(self.kernel_address_space.low_table());
     }
 
     pub fn translate_kernel_address(&self, va: VirtualAddress) -> Result<PhysicalAddress, Error> {
@@ -502,3 +610,95 @@ impl MemoryManager {
         Ok(self.kernel_address_space.resolve_address(va)?)
     }
 }
+
+/// Allocates physically contiguous zero-filled pages. Pages that do not come from the clean pool
+/// are zeroed after the memory manager lock is released. Only single pages are pooled, so larger
+/// requests are always zeroed here.
+pub fn request_zeroed_pages(num_pages: usize) -> Result<PhysicalMemoryRegion, Error> {
+    let pmr = {
+        let mut memory_manager = MemoryManager::instance();
+        if let Some(pmr) = memory_manager.request_clean_pages(num_pages) {
+            return Ok(pmr);
+        }
+        memory_manager.request_any_pages(num_pages, AllocPolicy::None)?
+    };
+
+    // The region is physically contiguous, so it is also contiguous in the direct map
+    let va = pmr.base_address().direct_mapped();
+    unsafe { cache::zero_va_range(va, pmr.num_pages() * PAGE_SIZE) };
+    Ok(pmr)
+}
+
+/// The page zeroer is woken up when the number of clean pages drops below this
+const CLEAN_POOL_LOW_WATERMARK: usize = CLEAN_POOL_CAPACITY / 2;
+
+/// Priority of the page zeroer while it refills the pool up to the low watermark. At the lowest
+/// priority it would never run while other threads keep the CPU busy. The boost ends at the
+/// watermark, the rest of the pool is only filled in idle time.
+const PAGE_ZEROER_BOOST: thread::Priority = thread::Priority::DEFAULT;
+
+static CLEAN_POOL_LOW: WaitQueue = WaitQueue::new();
+
+/// Zeroes free pages into the clean pool until it holds `target` pages. Returns false if it runs
+/// out of free pages or the pool is full.
+fn refill_clean_pool(target: usize) -> bool {
+    loop {
+        let pmr = {
+            let mut memory_manager = MemoryManager::instance();
+            let allocator = &mut memory_manager.physical_page_allocator;
+            if allocator.num_clean_pages() >= target {
+                return true;
+            }
+            match allocator.request_any_pages(1) {
+                Ok(pmr) => pmr,
+                Err(_) => return false,
+            }
+        };
+
+        // The lock is not held while zeroing
+        unsafe { cache::zero_va_range(pmr.base_address().direct_mapped(), PAGE_SIZE) };
+
+        let mut memory_manager = MemoryManager::instance();
+        let allocator = &mut memory_manager.physical_page_allocator;
+        if let Err(pmr) = allocator.release_clean_page(pmr) {
+            allocator.release_pages(pmr).expect("Cannot release page");
+            return false;
+        }
+    }
+}
+
+/// Keeps the pool of clean pages topped up, so that zero-filled allocations do not need to zero
+/// pages themselves.
+fn zero_pages_in_background() {
+    let mut boosted = true;
+    loop {
+        // Waits with the boosted priority, so that it runs as soon as the pool runs low
+        CLEAN_POOL_LOW.wait_until(|| {
+            MemoryManager::instance()
+                .physical_page_allocator
+                .num_clean_pages()
+                < CLEAN_POOL_LOW_WATERMARK
+        });
+
+        let refilled = refill_clean_pool(CLEAN_POOL_LOW_WATERMARK);
+        if boosted {
+            Syscall::set_priority(thread::Priority::LOWEST.level() as u64);
+            boosted = false;
+        }
+
+        // Without free pages the pool stays low, and it is retried in idle time only until a
+        // refill succeeds
+        if refilled && refill_clean_pool(CLEAN_POOL_CAPACITY) {
+            Syscall::set_priority(PAGE_ZEROER_BOOST.level() as u64);
+            boosted = true;
+        }
+    }
+}
+
+#[initcall]
+fn start_page_zeroer() {
+    thread::Builder::new()
+        .name("PageZeroer")
+        .priority(PAGE_ZEROER_BOOST)
+        .spawn(zero_pages_in_background);
+}
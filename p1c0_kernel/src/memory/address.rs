@@ -1,6 +1,6 @@
 use crate::{
     arch::mmu::{PAGE_BITS, PAGE_SIZE},
-    memory::map::{KERNEL_LOGICAL_BASE, KERNEL_LOGICAL_SIZE},
+    memory::map::{DIRECT_MAP_BASE, DIRECT_MAP_SIZE, KERNEL_LOGICAL_BASE, KERNEL_LOGICAL_SIZE},
 };
 
 pub trait Validator {
@@ -188,6 +188,18 @@ impl PhysicalAddress {
         }
     }
 
+    /// Returns the address of this physical address in the linear map of DRAM. Only valid for DRAM
+    /// addresses once the memory manager has been initialized.
+    #[must_use]
+    pub fn direct_mapped(&self) -> VirtualAddress {
+        if cfg!(test) {
+            VirtualAddress(self.0)
+        } else {
+            assert!(self.as_usize() < DIRECT_MAP_SIZE);
+            VirtualAddress(unsafe { DIRECT_MAP_BASE.as_ptr().add(self.as_usize()) })
+        }
+    }
+
     pub fn offset_from(&self, other: PhysicalAddress) -> isize {
         let self_isize = self.as_usize() as isize;
         let other_isize = other.as_usize() as isize;
@@ -1,8 +1,9 @@
 use super::{
     address::{Address, LogicalAddress, PhysicalAddress, VirtualAddress},
-    map::{FASTMAP_PAGE, MMIO_BASE, MMIO_SIZE},
+    map::{MMIO_BASE, MMIO_SIZE},
     num_pages_from_bytes,
     physical_page_allocator::PhysicalMemoryRegion,
+    shared_memory::SharedMemory,
     Attributes, GlobalPermissions, Permissions,
 };
 use crate::{
@@ -16,6 +17,11 @@ use heapless::String;
 
 const MAX_NAME_LENGTH: usize = 32;
 
+/// Process ranges that are mapped at runtime, like mapped files, are placed from this address up.
+/// It sits below the stack and the arguments of the process.
+const RUNTIME_MAPPINGS_BASE: usize = 0xE00000000000;
+const RUNTIME_MAPPINGS_END: usize = 0xF00000000000;
+
 #[derive(Clone, Debug)]
 pub enum Error {
     ArchSpecificError(mmu::Error),
@@ -24,6 +30,8 @@ pub enum Error {
     MemoryRangeOverlaps(String<MAX_NAME_LENGTH>),
     NameTooLong,
     InvalidAddress,
+    PageAllocationFailed,
+    PageReleaseFailed,
 }
 
 impl From<mmu::Error> for Error {
@@ -38,10 +46,114 @@ pub(super) struct VirtualMemoryRange {
     pub name: String<MAX_NAME_LENGTH>,
     pub _attributes: Attributes,
     pub _permissions: GlobalPermissions,
-    pub _pmr: PhysicalMemoryRegion,
+    pub pages: MappedPages,
     // We can later add operations based on backed descriptors here
 }
 
+/// Pages behind a range that is mapped as a whole
+pub(super) enum MappedPages {
+    /// Owned by the address space, and freed when the range is released
+    Owned(PhysicalMemoryRegion),
+    /// Shared with other address spaces, and kept alive while the range is mapped
+    Shared(Arc<SharedMemory>),
+}
+
+impl MappedPages {
+    fn base_address(&self) -> PhysicalAddress {
+        match self {
+            MappedPages::Owned(pmr) => pmr.base_address(),
+            MappedPages::Shared(memory) => memory.pmr().base_address(),
+        }
+    }
+}
+
+/// Describes where the contents of a lazily populated range come from
+#[derive(Clone, Copy, Debug)]
+pub enum Backing {
+    /// Anonymous memory, zero-filled on first access
+    Zero,
+    /// The first `len` bytes of the range are copied from `data` on first access, the rest of the
+    /// range is zero-filled like `.bss`. The data must outlive the address space.
+    File { data: *const u8, len: usize },
+    /// Like `File`, but the data is static, so pages are shared with every other address space
+    /// mapping the same data through the page cache. Writable ranges get a private copy of a page
+    /// the first time it is written.
+    SharedFile { data: *const u8, len: usize },
+}
+
+/// Whether the faulting access was blocked because the page is not mapped or because of its
+/// permissions
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum FaultKind {
+    Translation,
+    Permission,
+}
+
+enum PageState {
+    NotPresent,
+    /// Page owned by this address space
+    Private(PhysicalMemoryRegion),
+    /// Read-only page owned by the page cache
+    Shared,
+}
+
+/// A range whose pages are only allocated and mapped when they are first accessed
+pub(super) struct LazyMemoryRange {
+    pub va: VirtualAddress,
+    pub size_bytes: usize,
+    pub name: String<MAX_NAME_LENGTH>,
+    pub permissions: GlobalPermissions,
+    pub backing: Backing,
+    pages: Vec<PageState>,
+}
+
+impl LazyMemoryRange {
+    /// Returns true if `va` is inside one of the pages spanned by the range
+    fn contains_page(&self, va: VirtualAddress) -> bool {
+        let offset = va.offset_from(self.va);
+        offset >= 0 && (offset as usize) < self.pages.len() * PAGE_SIZE
+    }
+
+    /// Returns the file data that backs page `page_index`. The rest of the page is zero.
+    fn file_data(&self, page_index: usize) -> (*const u8, usize) {
+        match self.backing {
+            Backing::File { data, len } | Backing::SharedFile { data, len } => {
+                let offset = page_index * PAGE_SIZE;
+                let chunk = len.saturating_sub(offset).min(PAGE_SIZE);
+                (unsafe { data.add(offset.min(len)) }, chunk)
+            }
+            Backing::Zero => (core::ptr::null(), 0),
+        }
+    }
+
+    /// Allocates a private page and fills it with the contents of page `page_index`
+    fn populate_private_page(&self, page_index: usize) -> Result<PhysicalMemoryRegion, Error> {
+        let (data, len) = self.file_data(page_index);
+        if len == 0 {
+            // Likely served from the pool of pages zeroed in the background
+            return super::request_zeroed_pages(1).map_err(|_| Error::PageAllocationFailed);
+        }
+
+        let pmr = super::MemoryManager::instance()
+            .request_any_pages(1, super::AllocPolicy::None)
+            .map_err(|_| Error::PageAllocationFailed)?;
+        unsafe { fill_page(pmr.base_address().direct_mapped().as_mut_ptr(), data, len) };
+        Ok(pmr)
+    }
+}
+
+/// Copies `len` bytes from `src` into the page at `dst` and zeroes the rest of the page
+///
+/// # Safety
+///   `dst` must point to a writable page and `src` must be valid for reads of `len` bytes, which
+///   cannot exceed the page size.
+pub(super) unsafe fn fill_page(dst: *mut u8, src: *const u8, len: usize) {
+    if len != 0 {
+        core::ptr::copy_nonoverlapping(src, dst, len);
+    }
+    core::ptr::write_bytes(dst.add(len), 0, PAGE_SIZE - len);
+}
+
 pub(super) struct LogicalMemoryRange {
     pub la: LogicalAddress,
     pub size_bytes: usize,
@@ -121,6 +233,16 @@ impl MemoryRange for VirtualMemoryRange {
     }
 }
 
+impl MemoryRange for LazyMemoryRange {
+    fn virtual_address(&self) -> VirtualAddress {
+        self.va
+    }
+
+    fn size_bytes(&self) -> usize {
+        self.size_bytes
+    }
+}
+
 impl MemoryRange for MMIORange {
     fn virtual_address(&self) -> VirtualAddress {
         self.va
@@ -316,31 +438,6 @@ impl KernelAddressSpace {
         ))
     }
 
-    pub(super) fn fast_page_map(
-        &mut self,
-        pa: PhysicalAddress,
-        permissions: GlobalPermissions,
-        attributes: Attributes,
-    ) -> Result<(), Error> {
-        self.high_address_table
-            .map_region(FASTMAP_PAGE, pa, PAGE_SIZE, attributes, permissions)?;
-
-        // Ensure that the TLB discards any entries for the fast map page
-        mmu::flush_tlb_page(FASTMAP_PAGE);
-
-        Ok(())
-    }
-
-    pub(super) fn fast_page_unmap(&mut self) -> Result<(), Error> {
-        self.high_address_table
-            .unmap_region(FASTMAP_PAGE, PAGE_SIZE)?;
-
-        // Ensure that the TLB discards any entries for the fast map page
-        mmu::flush_tlb_page(FASTMAP_PAGE);
-
-        Ok(())
-    }
-
     pub(super) fn high_table(&mut self) -> &mut LevelTable {
         &mut self.high_address_table
     }
@@ -377,20 +474,33 @@ impl KernelAddressSpace {
 
 pub struct ProcessAddressSpace {
     address_table: Box<LevelTable>,
+    asid: mmu::AddressSpaceId,
     // FIXME(javier-varez): Using vec here is most likely not a good idea for performance reasons.
     // Find a better alternative with better insertion/removal/lookup performance
     memory_ranges: Vec<VirtualMemoryRange>,
+    lazy_ranges: Vec<LazyMemoryRange>,
+    /// Next free address for ranges mapped at runtime
+    next_runtime_va: usize,
 }
 
 impl Default for ProcessAddressSpace {
     fn default() -> Self {
         Self {
             address_table: Box::new(LevelTable::new()),
+            asid: mmu::AddressSpaceId::new(),
             memory_ranges: vec![],
+            lazy_ranges: vec![],
+            next_runtime_va: RUNTIME_MAPPINGS_BASE,
         }
     }
 }
 
+impl Drop for ProcessAddressSpace {
+    fn drop(&mut self) {
+        self.release_ranges();
+    }
+}
+
 impl ProcessAddressSpace {
     pub fn new() -> Self {
         Self::default()
@@ -405,6 +515,14 @@ impl ProcessAddressSpace {
             return Err(Error::MemoryRangeOverlaps(range.name.clone()));
         }
 
+        if let Some(range) = self
+            .lazy_ranges
+            .iter()
+            .find(|range| range.overlaps(va, size_bytes))
+        {
+            return Err(Error::MemoryRangeOverlaps(range.name.clone()));
+        }
+
         Ok(())
     }
 
@@ -417,6 +535,10 @@ impl ProcessAddressSpace {
             return Ok(range);
         }
 
+        if let Some(range) = self.lazy_ranges.iter_mut().find(|range| range.name == name) {
+            return Ok(range);
+        }
+
         Err(Error::MemoryRangeNotFound(
             String::from_str(name).map_err(|_| Error::NameTooLong)?,
         ))
@@ -426,7 +548,7 @@ impl ProcessAddressSpace {
         &mut self,
         name: &str,
         va: VirtualAddress,
-        pmr: PhysicalMemoryRegion,
+        pages: MappedPages,
         size_bytes: usize,
         attributes: Attributes,
         permissions: GlobalPermissions,
@@ -443,17 +565,35 @@ impl ProcessAddressSpace {
             size_bytes,
             _attributes: attributes,
             _permissions: permissions,
-            _pmr: pmr,
+            pages,
         };
         self.memory_ranges.push(memory_range);
 
         Ok(())
     }
 
-    pub(crate) fn address_table(&mut self) -> &mut LevelTable {
-        &mut *self.address_table
+    /// Picks the address of a new range of `size_bytes` mapped at runtime. Addresses are not reused,
+    /// and consecutive ranges are separated by an unmapped guard page.
+    pub fn reserve_runtime_range(&mut self, size_bytes: usize) -> Result<VirtualAddress, Error> {
+        let size_bytes = num_pages_from_bytes(size_bytes) * PAGE_SIZE;
+        let va = self.next_runtime_va;
+        let next_va = va
+            .checked_add(size_bytes + PAGE_SIZE)
+            .filter(|next_va| *next_va <= RUNTIME_MAPPINGS_END)
+            .ok_or(Error::InvalidAddress)?;
+
+        self.next_runtime_va = next_va;
+        VirtualAddress::try_from_ptr(va as *const _).map_err(|_| Error::InvalidAddress)
+    }
+
+    /// Makes this the lower half address space of the current CPU
+    pub(crate) fn activate(&mut self) {
+        mmu::switch_process_translation_table(&mut self.address_table, &self.asid);
     }
 
+    /// Maps all of `pmr` at `va`. The address space owns the pages from then on and frees them
+    /// when it is dropped or its ranges are released. On failure they are still owned by the
+    /// caller.
     pub fn map_section(
         &mut self,
         name: &str,
@@ -462,10 +602,340 @@ impl ProcessAddressSpace {
         size_bytes: usize,
         permissions: GlobalPermissions,
     ) -> Result<(), Error> {
-        let pa = pmr.base_address();
+        self.map_pages(name, va, MappedPages::Owned(pmr), size_bytes, permissions)
+    }
+
+    fn map_pages(
+        &mut self,
+        name: &str,
+        va: VirtualAddress,
+        pages: MappedPages,
+        size_bytes: usize,
+        permissions: GlobalPermissions,
+    ) -> Result<(), Error> {
+        // The range is validated before anything is mapped, so a failure leaves no translations
+        // to pages that the caller still owns
+        let pa = pages.base_address();
+        self.add_virtual_range(name, va, pages, size_bytes, Attributes::Normal, permissions)?;
         self.address_table
             .map_region(va, pa, size_bytes, Attributes::Normal, permissions)
             .unwrap();
-        self.add_virtual_range(name, va, pmr, size_bytes, Attributes::Normal, permissions)
+        Ok(())
+    }
+
+    /// Removes the range named `name` that was mapped with `map_section` and returns its pages,
+    /// which are no longer accessible through this address space and owned by the caller again.
+    pub fn unmap_section(&mut self, name: &str) -> Result<PhysicalMemoryRegion, Error> {
+        // Shared memory is not owned by the address space, so it cannot be handed to the caller
+        let index = self
+            .memory_ranges
+            .iter()
+            .position(|range| range.name == name && matches!(range.pages, MappedPages::Owned(_)));
+        let index = match index {
+            Some(index) => index,
+            None => {
+                return Err(Error::MemoryRangeNotFound(
+                    String::from_str(name).map_err(|_| Error::NameTooLong)?,
+                ))
+            }
+        };
+
+        let range = self.memory_ranges.remove(index);
+        self.unmap_range(&range)?;
+        match range.pages {
+            MappedPages::Owned(pmr) => Ok(pmr),
+            MappedPages::Shared(_) => unreachable!(),
+        }
+    }
+
+    fn unmap_range(&mut self, range: &VirtualMemoryRange) -> Result<(), Error> {
+        self.address_table
+            .unmap_region(range.va, range.size_bytes)?;
+        for page in 0..num_pages_from_bytes(range.size_bytes) {
+            self.asid
+                .flush_tlb_page(unsafe { range.va.offset(page * PAGE_SIZE) });
+        }
+        Ok(())
+    }
+
+    /// Maps all pages of `memory` at `va`. Other address spaces can map the same pages.
+    pub fn map_shared_memory(
+        &mut self,
+        name: &str,
+        va: VirtualAddress,
+        memory: Arc<SharedMemory>,
+        permissions: GlobalPermissions,
+    ) -> Result<(), Error> {
+        let size_bytes = memory.size_bytes();
+        self.map_pages(
+            name,
+            va,
+            MappedPages::Shared(memory),
+            size_bytes,
+            permissions,
+        )
+    }
+
+    /// Reserves a range that is populated page by page from `backing` when the process first
+    /// accesses it. Nothing is allocated or mapped until then.
+    pub fn map_lazy_section(
+        &mut self,
+        name: &str,
+        va: VirtualAddress,
+        size_bytes: usize,
+        backing: Backing,
+        permissions: GlobalPermissions,
+    ) -> Result<(), Error> {
+        if let Backing::File { len, .. } | Backing::SharedFile { len, .. } = backing {
+            assert!(len <= size_bytes);
+        }
+
+        self.check_overlaps(va, size_bytes)?;
+
+        if self.find_by_name(name).is_ok() {
+            return Err(Error::MemoryRangeAlreadyExists(name.into()));
+        }
+
+        let mut pages = vec![];
+        pages.resize_with(num_pages_from_bytes(size_bytes), || PageState::NotPresent);
+
+        self.lazy_ranges.push(LazyMemoryRange {
+            va,
+            size_bytes,
+            name: String::from_str(name).map_err(|_| Error::NameTooLong)?,
+            permissions,
+            backing,
+            pages,
+        });
+
+        Ok(())
+    }
+
+    /// Removes the lazy range named `name`, unmapping the pages it populated and giving them back
+    pub fn unmap_lazy_section(&mut self, name: &str) -> Result<(), Error> {
+        let index = match self.lazy_ranges.iter().position(|range| range.name == name) {
+            Some(index) => index,
+            None => {
+                return Err(Error::MemoryRangeNotFound(
+                    String::from_str(name).map_err(|_| Error::NameTooLong)?,
+                ))
+            }
+        };
+
+        let range = self.lazy_ranges.remove(index);
+        self.release_lazy_range(range)
+    }
+
+    /// Unmaps every range and gives back its pages. Exited processes are kept until their exit
+    /// code is collected, so this must not wait until the address space is dropped.
+    pub fn release_ranges(&mut self) {
+        for range in core::mem::take(&mut self.memory_ranges) {
+            let name = range.name.clone();
+            if let Err(e) = self.release_range(range) {
+                log_error!("Cannot release pages of range {}: {:?}", name, e);
+            }
+        }
+
+        for range in core::mem::take(&mut self.lazy_ranges) {
+            let name = range.name.clone();
+            if let Err(e) = self.release_lazy_range(range) {
+                log_error!("Cannot release pages of range {}: {:?}", name, e);
+            }
+        }
+    }
+
+    /// Owned pages are freed. Shared memory is freed with the last reference to it.
+    fn release_range(&mut self, range: VirtualMemoryRange) -> Result<(), Error> {
+        self.unmap_range(&range)?;
+        if let MappedPages::Owned(pmr) = range.pages {
+            super::MemoryManager::instance()
+                .release_pages(pmr)
+                .map_err(|_| Error::PageReleaseFailed)?;
+        }
+        Ok(())
+    }
+
+    /// Private pages are freed, and the references to pages of the page cache are dropped, so that
+    /// the cache can free them once they are not mapped anywhere else.
+    fn release_lazy_range(&mut self, mut range: LazyMemoryRange) -> Result<(), Error> {
+        for page_index in 0..range.pages.len() {
+            let state = core::mem::replace(&mut range.pages[page_index], PageState::NotPresent);
+            if let PageState::NotPresent = state {
+                continue;
+            }
+
+            let page_va = unsafe { range.va.offset(page_index * PAGE_SIZE) };
+            self.address_table.unmap_region(page_va, PAGE_SIZE)?;
+            self.asid.flush_tlb_page(page_va);
+
+            match state {
+                PageState::Private(pmr) => super::MemoryManager::instance()
+                    .release_pages(pmr)
+                    .map_err(|_| Error::PageReleaseFailed)?,
+                PageState::Shared => {
+                    let (data, len) = range.file_data(page_index);
+                    super::page_cache::release(data, len);
+                }
+                PageState::NotPresent => unreachable!(),
+            }
+        }
+        Ok(())
+    }
+
+    /// Populates the page containing `va` if it belongs to a lazy range, or gives it a private
+    /// copy of a shared page when it is written. Returns `Error::InvalidAddress` if the fault
+    /// cannot be resolved, in which case it is a genuine access violation.
+    pub fn handle_page_fault(
+        &mut self,
+        va: VirtualAddress,
+        kind: FaultKind,
+        is_write: bool,
+    ) -> Result<(), Error> {
+        let range = self
+            .lazy_ranges
+            .iter_mut()
+            .find(|range| range.contains_page(va))
+            .ok_or(Error::InvalidAddress)?;
+
+        let page_index = va.offset_from(range.va) as usize / PAGE_SIZE;
+        let page_va = unsafe { range.va.offset(page_index * PAGE_SIZE) };
+        let shared = matches!(range.backing, Backing::SharedFile { .. });
+        let writable = range.permissions.is_writable();
+
+        match (&range.pages[page_index], kind) {
+            (PageState::NotPresent, FaultKind::Translation)
+                if shared && !(is_write && writable) =>
+            {
+                let (data, len) = range.file_data(page_index);
+                let pa = unsafe { super::page_cache::acquire(data, len) }
+                    .map_err(|_| Error::PageAllocationFailed)?;
+                self.address_table.map_region(
+                    page_va,
+                    pa,
+                    PAGE_SIZE,
+                    Attributes::Normal,
+                    range.permissions.read_only(),
+                )?;
+                range.pages[page_index] = PageState::Shared;
+            }
+            (PageState::NotPresent, FaultKind::Translation) => {
+                let pmr = range.populate_private_page(page_index)?;
+                self.address_table.map_region(
+                    page_va,
+                    pmr.base_address(),
+                    PAGE_SIZE,
+                    Attributes::Normal,
+                    range.permissions,
+                )?;
+                range.pages[page_index] = PageState::Private(pmr);
+            }
+            (PageState::Shared, FaultKind::Permission) if is_write && writable => {
+                // Copy on write. The file data is the same as the contents of the shared page.
+                let pmr = range.populate_private_page(page_index)?;
+                self.address_table.unmap_region(page_va, PAGE_SIZE)?;
+                self.asid.flush_tlb_page(page_va);
+                self.address_table.map_region(
+                    page_va,
+                    pmr.base_address(),
+                    PAGE_SIZE,
+                    Attributes::Normal,
+                    range.permissions,
+                )?;
+                range.pages[page_index] = PageState::Private(pmr);
+
+                let (data, len) = range.file_data(page_index);
+                super::page_cache::release(data, len);
+            }
+            (PageState::Shared | PageState::Private(_), FaultKind::Translation) => {
+                // Another thread of the process populated the page while we were waiting for the
+                // lock
+                return Ok(());
+            }
+            (PageState::Private(_), FaultKind::Permission) if is_write && writable => {
+                // Another thread of the process copied the shared page on write while we were
+                // waiting for the lock. The access is retried with the private page mapped.
+                return Ok(());
+            }
+            _ => return Err(Error::InvalidAddress),
+        }
+
+        // Make sure the new entry is observed by the table walker
+        self.asid.flush_tlb_page(page_va);
+        Ok(())
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    fn lazy_range(size_bytes: usize, backing: Backing) -> LazyMemoryRange {
+        let mut pages = vec![];
+        pages.resize_with(num_pages_from_bytes(size_bytes), || PageState::NotPresent);
+        LazyMemoryRange {
+            va: VirtualAddress::new_unaligned(0x10000 as *const _),
+            size_bytes,
+            name: String::from_str(".data").unwrap(),
+            permissions: GlobalPermissions::new_for_process(Permissions::RW),
+            backing,
+            pages,
+        }
+    }
+
+    #[test]
+    fn lazy_range_contains_whole_pages() {
+        let range = lazy_range(PAGE_SIZE + 1, Backing::Zero);
+        let va = |addr: usize| VirtualAddress::new_unaligned(addr as *const _);
+
+        assert!(!range.contains_page(va(0xFFFF)));
+        assert!(range.contains_page(va(0x10000)));
+        // The last page is only partially used by the range, but it is still mapped as a whole
+        assert!(range.contains_page(va(0x10000 + 2 * PAGE_SIZE - 1)));
+        assert!(!range.contains_page(va(0x10000 + 2 * PAGE_SIZE)));
+    }
+
+    #[test]
+    fn lazy_range_fills_file_data_and_zeroes() {
+        let data: Vec<u8> = (0..PAGE_SIZE + 16).map(|i| (i % 251) as u8 + 1).collect();
+        let range = lazy_range(
+            3 * PAGE_SIZE,
+            Backing::File {
+                data: data.as_ptr(),
+                len: data.len(),
+            },
+        );
+
+        let mut page = vec![0xAAu8; PAGE_SIZE];
+        let fill = |page: &mut [u8], index| {
+            let (src, len) = range.file_data(index);
+            unsafe { fill_page(page.as_mut_ptr(), src, len) };
+        };
+
+        fill(&mut page, 0);
+        assert_eq!(&page[..], &data[..PAGE_SIZE]);
+
+        fill(&mut page, 1);
+        assert_eq!(&page[..16], &data[PAGE_SIZE..]);
+        assert!(page[16..].iter().all(|byte| *byte == 0));
+
+        page.fill(0xAA);
+        fill(&mut page, 2);
+        assert!(page.iter().all(|byte| *byte == 0));
+    }
+
+    #[test]
+    fn runtime_ranges_are_separated_by_guard_pages() {
+        let mut address_space = ProcessAddressSpace::new();
+
+        let first = address_space.reserve_runtime_range(1).unwrap();
+        let second = address_space.reserve_runtime_range(PAGE_SIZE + 1).unwrap();
+        let third = address_space.reserve_runtime_range(PAGE_SIZE).unwrap();
+        assert_eq!(first.as_usize(), RUNTIME_MAPPINGS_BASE);
+        assert_eq!(second.as_usize(), RUNTIME_MAPPINGS_BASE + 2 * PAGE_SIZE);
+        assert_eq!(third.as_usize(), RUNTIME_MAPPINGS_BASE + 5 * PAGE_SIZE);
+
+        assert!(address_space
+            .reserve_runtime_range(RUNTIME_MAPPINGS_END)
+            .is_err());
     }
 }
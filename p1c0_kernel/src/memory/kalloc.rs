@@ -1,9 +1,14 @@
-use crate::sync::spinlock::SpinLock;
+use crate::{
+    prelude::*,
+    smp::{self, PerCpu},
+    sync::spinlock::SpinLock,
+    trace,
+};
 
 use core::{
     alloc::{GlobalAlloc, Layout},
     mem::MaybeUninit,
-    ops::{Deref, DerefMut},
+    sync::atomic::{AtomicPtr, AtomicU16, AtomicU8, AtomicUsize, Ordering},
 };
 
 #[cfg(not(test))]
@@ -24,7 +29,8 @@ extern "C" {
 pub unsafe fn init() {
     let arena_size = (&_arena_size) as *const u8 as usize;
     let arena_start = (&_arena_start) as *const _ as *mut u8;
-    ALLOCATOR.lock().init(arena_start, arena_size);
+    let heap_size = ALLOCATOR.slab_table.init(arena_start, arena_size);
+    ALLOCATOR.heap.lock().init(arena_start, heap_size);
 }
 
 fn aligned_address_with_layout(
@@ -230,38 +236,641 @@ impl HeapAllocator {
         // once all memory is exhausted.
         self.head = new_entry;
     }
+
+    /// Returns the number of entries in the free list, the number of free bytes and the size of
+    /// the largest entry
+    fn free_list_info(&self) -> (usize, usize, usize) {
+        let mut length = 0;
+        let mut free_bytes = 0;
+        let mut largest = 0;
+
+        let mut entry = self.head;
+        while !entry.is_null() {
+            let size = unsafe { (*entry).size };
+            length += 1;
+            free_bytes += size;
+            largest = largest.max(size);
+            entry = unsafe { (*entry).next };
+        }
+        (length, free_bytes, largest)
+    }
+}
+
+const MIN_BLOCK_SHIFT: usize = 4;
+const MIN_BLOCK_SIZE: usize = 1 << MIN_BLOCK_SHIFT;
+const NUM_SIZE_CLASSES: usize = 8;
+const MAX_BLOCK_SIZE: usize = MIN_BLOCK_SIZE << (NUM_SIZE_CLASSES - 1);
+
+/// Slabs are carved into blocks of a single size class. Since slabs are aligned to their size,
+/// every block is aligned to its own size.
+const SLAB_SIZE: usize = 4096;
+const SLAB_LAYOUT: Layout = unsafe { Layout::from_size_align_unchecked(SLAB_SIZE, SLAB_SIZE) };
+
+/// Free blocks of a class, in slabs, that are kept before empty slabs are returned to the heap.
+/// Keeping one spare slab avoids bouncing a slab in and out of the heap when a single allocation
+/// comes and goes at a slab boundary.
+const RETAINED_FREE_SLABS: usize = 1;
+
+/// Bookkeeping of a slab, kept outside of the slab so that all of its bytes can be handed out
+struct SlabInfo {
+    /// CPU whose cache owns the slab. Blocks are always freed into the owner's cache, so the
+    /// free blocks of a slab are all in the same free list.
+    owner: AtomicU8,
+    /// Free blocks of the slab. Only updated with the owner's cache locked.
+    free_blocks: AtomicU16,
 }
 
-#[repr(transparent)]
-struct LockedHeapAllocator(SpinLock<HeapAllocator>);
+/// One `SlabInfo` for every slab sized chunk of the heap arena. The table itself is carved from
+/// the end of the arena.
+struct SlabTable {
+    base: AtomicUsize,
+    infos: AtomicPtr<SlabInfo>,
+}
 
-impl LockedHeapAllocator {
+impl SlabTable {
+    const fn new() -> Self {
+        Self {
+            base: AtomicUsize::new(0),
+            infos: AtomicPtr::new(core::ptr::null_mut()),
+        }
+    }
+
+    /// Places the table at the end of the arena and returns the size that is left for the heap
+    ///
+    /// # Safety
+    ///   The arena must be valid for writes and not in use yet.
+    unsafe fn init(&self, arena_start: *mut u8, arena_size: usize) -> usize {
+        let base = arena_start as usize & !(SLAB_SIZE - 1);
+        let arena_end = arena_start as usize + arena_size;
+        let num_slabs = (arena_end - base + SLAB_SIZE - 1) / SLAB_SIZE;
+
+        let table = (arena_end - num_slabs * core::mem::size_of::<SlabInfo>())
+            & !(core::mem::align_of::<SlabInfo>() - 1);
+        let infos = table as *mut SlabInfo;
+        for index in 0..num_slabs {
+            infos.add(index).write(SlabInfo {
+                owner: AtomicU8::new(0),
+                free_blocks: AtomicU16::new(0),
+            });
+        }
+
+        self.base.store(base, Ordering::Relaxed);
+        self.infos.store(infos, Ordering::Relaxed);
+        table - arena_start as usize
+    }
+
+    /// Returns the information of the slab containing `ptr`, which must be inside the arena
+    fn info(&self, ptr: *mut u8) -> &SlabInfo {
+        let base = self.base.load(Ordering::Relaxed);
+        let index = (ptr as usize - base) / SLAB_SIZE;
+        unsafe { &*self.infos.load(Ordering::Relaxed).add(index) }
+    }
+}
+
+/// Free blocks form a doubly linked list, so that the blocks of an empty slab can be unlinked
+/// without walking the list. Both pointers fit in the smallest block.
+struct FreeBlock {
+    next: *mut FreeBlock,
+    prev: *mut FreeBlock,
+}
+
+/// Free lists of power of two blocks from 16 bytes to 2 KiB. Both allocating and freeing a block
+/// are O(1). Once a slab has no allocated blocks it is returned to the heap, unless the class
+/// would be left with less than `RETAINED_FREE_SLABS` slabs worth of free blocks.
+struct SlabCache {
+    free_lists: [*mut FreeBlock; NUM_SIZE_CLASSES],
+    free_blocks: [usize; NUM_SIZE_CLASSES],
+}
+
+impl SlabCache {
+    const fn new() -> Self {
+        Self {
+            free_lists: [core::ptr::null_mut(); NUM_SIZE_CLASSES],
+            free_blocks: [0; NUM_SIZE_CLASSES],
+        }
+    }
+
+    /// Returns the size class serving the given layout, or None if it is too large for a slab
+    fn size_class(layout: Layout) -> Option<usize> {
+        let size = layout.size().max(layout.align()).max(MIN_BLOCK_SIZE);
+        if size > MAX_BLOCK_SIZE {
+            return None;
+        }
+        Some(size.next_power_of_two().trailing_zeros() as usize - MIN_BLOCK_SHIFT)
+    }
+
+    const fn block_size(class: usize) -> usize {
+        MIN_BLOCK_SIZE << class
+    }
+
+    const fn blocks_per_slab(class: usize) -> usize {
+        SLAB_SIZE / Self::block_size(class)
+    }
+
+    /// Allocates a block of the given class. If the class has no free blocks, a new slab is
+    /// requested through `alloc_slab` and owned by `cpu`.
+    unsafe fn alloc(
+        &mut self,
+        class: usize,
+        table: &SlabTable,
+        cpu: usize,
+        alloc_slab: impl FnOnce(Layout) -> *mut u8,
+    ) -> *mut u8 {
+        if self.free_lists[class].is_null() {
+            let slab = alloc_slab(SLAB_LAYOUT);
+            if slab.is_null() {
+                return core::ptr::null_mut();
+            }
+            self.add_slab(class, slab, table, cpu);
+        }
+
+        let block = self.free_lists[class];
+        self.unlink(class, block);
+        table
+            .info(block as *mut u8)
+            .free_blocks
+            .fetch_sub(1, Ordering::Relaxed);
+        block as *mut u8
+    }
+
+    /// Frees a block of a slab owned by this cache. If that leaves the slab empty and the class
+    /// has enough free blocks without it, the slab is handed to `free_slab`.
+    unsafe fn dealloc(
+        &mut self,
+        ptr: *mut u8,
+        class: usize,
+        table: &SlabTable,
+        free_slab: impl FnOnce(*mut u8, Layout),
+    ) {
+        self.push(class, ptr as *mut FreeBlock);
+        let free_blocks = table.info(ptr).free_blocks.fetch_add(1, Ordering::Relaxed) + 1;
+
+        // The free list holds the whole slab if it is empty, so the subtraction cannot underflow
+        let blocks_per_slab = Self::blocks_per_slab(class);
+        if free_blocks as usize == blocks_per_slab
+            && self.free_blocks[class] - blocks_per_slab >= RETAINED_FREE_SLABS * blocks_per_slab
+        {
+            let slab = (ptr as usize & !(SLAB_SIZE - 1)) as *mut u8;
+            for offset in (0..SLAB_SIZE).step_by(Self::block_size(class)) {
+                self.unlink(class, slab.add(offset) as *mut FreeBlock);
+            }
+            table.info(slab).free_blocks.store(0, Ordering::Relaxed);
+            free_slab(slab, SLAB_LAYOUT);
+        }
+    }
+
+    unsafe fn add_slab(&mut self, class: usize, slab: *mut u8, table: &SlabTable, cpu: usize) {
+        let block_size = Self::block_size(class);
+        // Push in reverse order so that blocks are handed out in increasing address order
+        for offset in (0..SLAB_SIZE).step_by(block_size).rev() {
+            self.push(class, slab.add(offset) as *mut FreeBlock);
+        }
+
+        let info = table.info(slab);
+        info.owner.store(cpu as u8, Ordering::Relaxed);
+        info.free_blocks
+            .store(Self::blocks_per_slab(class) as u16, Ordering::Relaxed);
+    }
+
+    unsafe fn push(&mut self, class: usize, block: *mut FreeBlock) {
+        let head = self.free_lists[class];
+        (*block).next = head;
+        (*block).prev = core::ptr::null_mut();
+        if !head.is_null() {
+            (*head).prev = block;
+        }
+        self.free_lists[class] = block;
+        self.free_blocks[class] += 1;
+    }
+
+    unsafe fn unlink(&mut self, class: usize, block: *mut FreeBlock) {
+        let FreeBlock { next, prev } = *block;
+        if prev.is_null() {
+            self.free_lists[class] = next;
+        } else {
+            (*prev).next = next;
+        }
+        if !next.is_null() {
+            (*next).prev = prev;
+        }
+        self.free_blocks[class] -= 1;
+    }
+
+    /// Bytes held in the free lists, available for small allocations only
+    fn free_bytes(&self) -> usize {
+        self.free_blocks
+            .iter()
+            .enumerate()
+            .map(|(class, blocks)| blocks * Self::block_size(class))
+            .sum()
+    }
+}
+
+/// Allocation counters are kept per size class, plus one bucket for the allocations that are too
+/// large for a slab
+pub const NUM_BUCKETS: usize = NUM_SIZE_CLASSES + 1;
+const LARGE_BUCKET: usize = NUM_SIZE_CLASSES;
+
+/// Maximum number of distinct allocation tags that are tracked
+const MAX_TAGS: usize = 16;
+
+/// Snapshot of the allocator state. The layout matches `libcxx::syscalls::HeapStatistics`.
+#[repr(C)]
+#[derive(Debug, Clone, Copy, Default)]
+pub struct Statistics {
+    /// Bytes currently allocated, including the rounding to the size class or heap granularity
+    pub live_bytes: u64,
+    pub peak_bytes: u64,
+    pub failed_allocations: u64,
+    /// Number of allocations served by each size class. The last bucket counts the allocations
+    /// served by the first-fit heap.
+    pub allocations: [u64; NUM_BUCKETS],
+    pub free_list_length: u64,
+    pub heap_free_bytes: u64,
+    pub largest_free_block: u64,
+    /// Bytes in the slab free lists. These are not available for large allocations.
+    pub slab_free_bytes: u64,
+}
+
+#[derive(Debug, Clone, Copy)]
+pub struct TagStatistics {
+    pub name: &'static str,
+    pub allocations: usize,
+    /// Bytes allocated with the tag that have not been freed yet
+    pub live_bytes: usize,
+    /// Allocations that could not be tracked, whose frees are not accounted to the tag. Their
+    /// bytes are not part of `live_bytes`.
+    pub untracked_allocations: usize,
+}
+
+struct Counters {
+    live_bytes: AtomicUsize,
+    peak_bytes: AtomicUsize,
+    failed_allocations: AtomicUsize,
+    allocations: [AtomicUsize; NUM_BUCKETS],
+}
+
+impl Counters {
     const fn new() -> Self {
-        Self(SpinLock::new(HeapAllocator::new()))
+        #[allow(clippy::declare_interior_mutable_const)]
+        const ZERO: AtomicUsize = AtomicUsize::new(0);
+        Self {
+            live_bytes: ZERO,
+            peak_bytes: ZERO,
+            failed_allocations: ZERO,
+            allocations: [ZERO; NUM_BUCKETS],
+        }
     }
+
+    fn record_alloc(&self, bucket: usize, size: usize) {
+        self.allocations[bucket].fetch_add(1, Ordering::Relaxed);
+        let live_bytes = self.live_bytes.fetch_add(size, Ordering::Relaxed) + size;
+        self.peak_bytes.fetch_max(live_bytes, Ordering::Relaxed);
+    }
+
+    fn record_dealloc(&self, size: usize) {
+        self.live_bytes.fetch_sub(size, Ordering::Relaxed);
+    }
+}
+
+#[allow(clippy::declare_interior_mutable_const)]
+const NO_TAG: AtomicUsize = AtomicUsize::new(0);
+
+/// Index + 1 of the tag active on each CPU, 0 if allocations are untagged
+static CURRENT_TAG: PerCpu<AtomicUsize> = PerCpu::new([NO_TAG; smp::MAX_CPUS]);
+
+/// Names of the registered tags. The lock is only taken when entering a tag, the counters of each
+/// tag are in `TAG_COUNTERS`.
+static TAG_NAMES: SpinLock<heapless::Vec<&'static str, MAX_TAGS>> =
+    SpinLock::new(heapless::Vec::new());
+
+struct TagCounters {
+    allocations: AtomicUsize,
+    live_bytes: AtomicUsize,
+    untracked_allocations: AtomicUsize,
 }
 
-impl Deref for LockedHeapAllocator {
-    type Target = SpinLock<HeapAllocator>;
-    fn deref(&self) -> &Self::Target {
-        &self.0
+impl TagCounters {
+    const fn new() -> Self {
+        Self {
+            allocations: AtomicUsize::new(0),
+            live_bytes: AtomicUsize::new(0),
+            untracked_allocations: AtomicUsize::new(0),
+        }
     }
 }
 
-impl DerefMut for LockedHeapAllocator {
-    fn deref_mut(&mut self) -> &mut Self::Target {
-        &mut self.0
+#[allow(clippy::declare_interior_mutable_const)]
+const ZERO_TAG_COUNTERS: TagCounters = TagCounters::new();
+static TAG_COUNTERS: [TagCounters; MAX_TAGS] = [ZERO_TAG_COUNTERS; MAX_TAGS];
+
+/// Number of slots of the set of tagged allocations. Must be a power of two.
+const MAX_TAGGED_ALLOCATIONS: usize = 1024;
+
+/// Slots probed to insert or find an allocation. Bounds the cost of a free while there are
+/// tagged allocations alive.
+const MAX_TAG_PROBES: usize = 16;
+
+/// Slot values that are never a valid address, since blocks are at least 8 byte aligned
+const EMPTY_SLOT: usize = 0;
+const REMOVED_SLOT: usize = 1;
+
+/// Open addressing set of the live tagged allocations, so that frees can be charged to the tag
+/// that made the allocation without taking a lock. The tag of the address in each slot is kept
+/// at the same index of `tags`.
+struct TaggedAllocations {
+    addresses: [AtomicUsize; MAX_TAGGED_ALLOCATIONS],
+    tags: [AtomicU8; MAX_TAGGED_ALLOCATIONS],
+    live: AtomicUsize,
+}
+
+impl TaggedAllocations {
+    const fn new() -> Self {
+        #[allow(clippy::declare_interior_mutable_const)]
+        const EMPTY: AtomicUsize = AtomicUsize::new(EMPTY_SLOT);
+        #[allow(clippy::declare_interior_mutable_const)]
+        const ZERO: AtomicU8 = AtomicU8::new(0);
+        Self {
+            addresses: [EMPTY; MAX_TAGGED_ALLOCATIONS],
+            tags: [ZERO; MAX_TAGGED_ALLOCATIONS],
+            live: AtomicUsize::new(0),
+        }
+    }
+
+    fn slots(address: usize) -> impl Iterator<Item = usize> {
+        // Fibonacci hashing spreads the aligned addresses over the whole table
+        let hash = (address >> MIN_BLOCK_SHIFT).wrapping_mul(0x9E37_79B9_7F4A_7C15)
+            >> (usize::BITS - MAX_TAGGED_ALLOCATIONS.trailing_zeros());
+        (0..MAX_TAG_PROBES).map(move |probe| (hash + probe) & (MAX_TAGGED_ALLOCATIONS - 1))
+    }
+
+    /// Returns false if there is no free slot for the address
+    fn insert(&self, address: usize, tag: usize) -> bool {
+        for slot in Self::slots(address) {
+            let claimed = [EMPTY_SLOT, REMOVED_SLOT].into_iter().any(|free| {
+                self.addresses[slot]
+                    .compare_exchange(free, address, Ordering::AcqRel, Ordering::Relaxed)
+                    .is_ok()
+            });
+            if claimed {
+                self.tags[slot].store(tag as u8, Ordering::Release);
+                self.live.fetch_add(1, Ordering::Relaxed);
+                return true;
+            }
+        }
+        false
+    }
+
+    /// Removes the address from the set and returns its tag
+    fn remove(&self, address: usize) -> Option<usize> {
+        if self.live.load(Ordering::Relaxed) == 0 {
+            return None;
+        }
+
+        for slot in Self::slots(address) {
+            let current = self.addresses[slot].load(Ordering::Acquire);
+            if current == EMPTY_SLOT {
+                return None;
+            }
+            if current == address {
+                let tag = self.tags[slot].load(Ordering::Acquire) as usize;
+                self.addresses[slot].store(REMOVED_SLOT, Ordering::Release);
+                self.live.fetch_sub(1, Ordering::Relaxed);
+                return Some(tag);
+            }
+        }
+        None
+    }
+}
+
+static TAGGED_ALLOCATIONS: TaggedAllocations = TaggedAllocations::new();
+
+/// Attributes all allocations made on this CPU to the given tag while the guard is alive. Tags
+/// are meant for short call sites that do not block, since the thread could move to another CPU.
+/// Frees are charged to the tag of the allocation, wherever they happen.
+pub struct AllocationTag {
+    previous: usize,
+}
+
+impl AllocationTag {
+    #[must_use]
+    pub fn enter(name: &'static str) -> Self {
+        let mut names = TAG_NAMES.lock();
+        let index = match names.iter().position(|tag| *tag == name) {
+            Some(index) => Some(index),
+            None => names.push(name).ok().map(|_| names.len() - 1),
+        };
+
+        // If there are no free tags left the allocations are not tagged
+        let tag = index.map(|index| index + 1).unwrap_or(0);
+        let previous = CURRENT_TAG.get().swap(tag, Ordering::Relaxed);
+        Self { previous }
+    }
+}
+
+impl Drop for AllocationTag {
+    fn drop(&mut self) {
+        CURRENT_TAG.get().store(self.previous, Ordering::Relaxed);
+    }
+}
+
+fn record_tagged_alloc(ptr: *mut u8, size: usize) {
+    let tag = CURRENT_TAG.get().load(Ordering::Relaxed);
+    if tag == 0 {
+        return;
+    }
+
+    let counters = &TAG_COUNTERS[tag - 1];
+    counters.allocations.fetch_add(1, Ordering::Relaxed);
+    if TAGGED_ALLOCATIONS.insert(ptr as usize, tag - 1) {
+        counters.live_bytes.fetch_add(size, Ordering::Relaxed);
+    } else {
+        counters
+            .untracked_allocations
+            .fetch_add(1, Ordering::Relaxed);
+    }
+}
+
+fn record_tagged_dealloc(ptr: *mut u8, size: usize) {
+    if let Some(tag) = TAGGED_ALLOCATIONS.remove(ptr as usize) {
+        TAG_COUNTERS[tag]
+            .live_bytes
+            .fetch_sub(size, Ordering::Relaxed);
+    }
+}
+
+/// Small allocations are served from per-CPU slab caches, so they do not contend with other CPUs
+/// or with large allocations, which fall back to the first-fit heap.
+struct LockedHeapAllocator {
+    heap: SpinLock<HeapAllocator>,
+    slabs: PerCpu<SpinLock<SlabCache>>,
+    slab_table: SlabTable,
+    counters: Counters,
+}
+
+impl LockedHeapAllocator {
+    const fn new() -> Self {
+        #[allow(clippy::declare_interior_mutable_const)]
+        const EMPTY_CACHE: SpinLock<SlabCache> = SpinLock::new(SlabCache::new());
+        Self {
+            heap: SpinLock::new(HeapAllocator::new()),
+            slabs: PerCpu::new([EMPTY_CACHE; smp::MAX_CPUS]),
+            slab_table: SlabTable::new(),
+            counters: Counters::new(),
+        }
+    }
+
+    fn statistics(&self) -> Statistics {
+        let (free_list_length, heap_free_bytes, largest_free_block) =
+            self.heap.lock().free_list_info();
+        let slab_free_bytes: usize = self
+            .slabs
+            .iter()
+            .map(|cache| cache.lock().free_bytes())
+            .sum();
+
+        let counters = &self.counters;
+        let mut allocations = [0; NUM_BUCKETS];
+        for (count, counter) in allocations.iter_mut().zip(counters.allocations.iter()) {
+            *count = counter.load(Ordering::Relaxed) as u64;
+        }
+
+        Statistics {
+            live_bytes: counters.live_bytes.load(Ordering::Relaxed) as u64,
+            peak_bytes: counters.peak_bytes.load(Ordering::Relaxed) as u64,
+            failed_allocations: counters.failed_allocations.load(Ordering::Relaxed) as u64,
+            allocations,
+            free_list_length: free_list_length as u64,
+            heap_free_bytes: heap_free_bytes as u64,
+            largest_free_block: largest_free_block as u64,
+            slab_free_bytes: slab_free_bytes as u64,
+        }
     }
 }
 
 unsafe impl GlobalAlloc for LockedHeapAllocator {
     unsafe fn alloc(&self, layout: Layout) -> *mut u8 {
-        self.lock().alloc(layout)
+        let (ptr, bucket, size) = match SlabCache::size_class(layout) {
+            Some(class) => {
+                let cpu = smp::cpu_id();
+                let ptr = self.slabs.get_for(cpu).lock().alloc(
+                    class,
+                    &self.slab_table,
+                    cpu,
+                    |slab_layout| self.heap.lock().alloc(slab_layout),
+                );
+                (ptr, class, SlabCache::block_size(class))
+            }
+            None => {
+                let ptr = self.heap.lock().alloc(layout);
+                let size = HeapAllocator::adapt_layout(layout).size();
+                (ptr, LARGE_BUCKET, size)
+            }
+        };
+
+        if ptr.is_null() {
+            self.counters
+                .failed_allocations
+                .fetch_add(1, Ordering::Relaxed);
+        } else {
+            self.counters.record_alloc(bucket, size);
+            record_tagged_alloc(ptr, size);
+        }
+        trace::record(trace::Event::Alloc, layout.size() as u64, ptr as u64);
+        ptr
     }
 
-    /// We just don't free any memory! Leaking is safe after all, isn't it? =D
     unsafe fn dealloc(&self, ptr: *mut u8, layout: Layout) {
-        self.lock().dealloc(ptr, layout)
+        trace::record(trace::Event::Free, layout.size() as u64, ptr as u64);
+
+        let size = match SlabCache::size_class(layout) {
+            Some(class) => {
+                // Blocks go back to the cache owning their slab, which is not necessarily the
+                // cache of this CPU
+                let owner = self.slab_table.info(ptr).owner.load(Ordering::Relaxed) as usize;
+                self.slabs.get_for(owner).lock().dealloc(
+                    ptr,
+                    class,
+                    &self.slab_table,
+                    |slab, slab_layout| self.heap.lock().dealloc(slab, slab_layout),
+                );
+                SlabCache::block_size(class)
+            }
+            None => {
+                self.heap.lock().dealloc(ptr, layout);
+                HeapAllocator::adapt_layout(layout).size()
+            }
+        };
+        self.counters.record_dealloc(size);
+        record_tagged_dealloc(ptr, size);
+    }
+}
+
+pub fn statistics() -> Statistics {
+    ALLOCATOR.statistics()
+}
+
+/// Returns the statistics of all allocation tags in use
+pub fn tag_statistics() -> heapless::Vec<TagStatistics, MAX_TAGS> {
+    let names = TAG_NAMES.lock().clone();
+    names
+        .iter()
+        .zip(TAG_COUNTERS.iter())
+        .map(|(&name, counters)| TagStatistics {
+            name,
+            allocations: counters.allocations.load(Ordering::Relaxed),
+            live_bytes: counters.live_bytes.load(Ordering::Relaxed),
+            untracked_allocations: counters.untracked_allocations.load(Ordering::Relaxed),
+        })
+        .collect()
+}
+
+pub fn print_statistics() {
+    let stats = statistics();
+
+    log_info!("Heap statistics:");
+    log_info!(
+        "\tLive bytes: {}, peak bytes: {}, failed allocations: {}",
+        stats.live_bytes,
+        stats.peak_bytes,
+        stats.failed_allocations
+    );
+    for (class, count) in stats.allocations[..NUM_SIZE_CLASSES].iter().enumerate() {
+        log_info!(
+            "\tAllocations of {} bytes: {}",
+            SlabCache::block_size(class),
+            count
+        );
+    }
+    log_info!(
+        "\tAllocations of more than {} bytes: {}",
+        MAX_BLOCK_SIZE,
+        stats.allocations[LARGE_BUCKET]
+    );
+
+    // Fragmentation is the share of free heap memory that cannot be used by a single allocation
+    let fragmentation = if stats.heap_free_bytes == 0 {
+        0
+    } else {
+        100 - (stats.largest_free_block * 100 / stats.heap_free_bytes)
+    };
+    log_info!(
+        "\tFree list: {} entries, {} free bytes, largest block {} bytes, fragmentation {}%",
+        stats.free_list_length,
+        stats.heap_free_bytes,
+        stats.largest_free_block,
+        fragmentation
+    );
+    log_info!("\tBytes cached in slabs: {}", stats.slab_free_bytes);
+
+    for tag in tag_statistics().iter() {
+        log_info!(
+            "\tTag {}: {} allocations, {} live bytes, {} untracked allocations",
+            tag.name,
+            tag.allocations,
+            tag.live_bytes,
+            tag.untracked_allocations
+        );
     }
 }
 
@@ -270,6 +879,10 @@ unsafe impl GlobalAlloc for LockedHeapAllocator {
 /// shared data with other instances is used.
 unsafe impl Send for HeapAllocator {}
 
+/// Safety:
+/// Same as for the HeapAllocator, the blocks in the free lists are owned by the cache.
+unsafe impl Send for SlabCache {}
+
 #[cfg(test)]
 mod test {
     use super::*;
@@ -504,4 +1117,156 @@ mod test {
 
         test.validate_free_list(&[ListEntryDesc::new(0, test.size())]);
     }
+
+    #[test]
+    fn heap_free_list_info() {
+        let mut test = HeapTest::new();
+        let size = test.size();
+        assert_eq!(test.allocator.free_list_info(), (1, size, size));
+
+        let first_layout = Layout::new::<u32>();
+        let first_ptr = unsafe { test.allocator.alloc(first_layout) };
+        let _second_ptr = unsafe { test.allocator.alloc(Layout::new::<u32>()) };
+        unsafe { test.allocator.dealloc(first_ptr, first_layout) };
+
+        assert_eq!(test.allocator.free_list_info(), (2, size - 16, size - 32));
+    }
+
+    #[test]
+    fn slab_size_classes() {
+        assert_eq!(SlabCache::size_class(Layout::new::<u8>()), Some(0));
+        assert_eq!(SlabCache::size_class(Layout::new::<u128>()), Some(0));
+        assert_eq!(SlabCache::size_class(Layout::new::<[u8; 17]>()), Some(1));
+        assert_eq!(
+            SlabCache::size_class(Layout::from_size_align(8, 64).unwrap()),
+            Some(2)
+        );
+        assert_eq!(SlabCache::size_class(Layout::new::<[u8; 2048]>()), Some(7));
+        assert_eq!(SlabCache::size_class(Layout::new::<[u8; 2049]>()), None);
+    }
+
+    struct SlabTest {
+        _arena: Vec<u32>,
+        heap: HeapAllocator,
+        table: SlabTable,
+        slabs: SlabCache,
+        allocated_slabs: usize,
+        freed_slabs: usize,
+    }
+
+    impl SlabTest {
+        fn new() -> Self {
+            let mut arena = vec![0u32; 4 * SLAB_SIZE];
+            let size = arena.len() * std::mem::size_of::<u32>();
+            let table = SlabTable::new();
+            let mut heap = HeapAllocator::new();
+            unsafe {
+                let heap_size = table.init(arena.as_mut_ptr() as *mut _, size);
+                heap.init(arena.as_mut_ptr() as *mut _, heap_size);
+            }
+
+            Self {
+                _arena: arena,
+                heap,
+                table,
+                slabs: SlabCache::new(),
+                allocated_slabs: 0,
+                freed_slabs: 0,
+            }
+        }
+
+        fn alloc(&mut self, class: usize) -> *mut u8 {
+            let Self {
+                heap,
+                table,
+                slabs,
+                allocated_slabs,
+                ..
+            } = self;
+            unsafe {
+                slabs.alloc(class, table, 0, |layout| {
+                    *allocated_slabs += 1;
+                    heap.alloc(layout)
+                })
+            }
+        }
+
+        fn dealloc(&mut self, ptr: *mut u8, class: usize) {
+            let Self {
+                heap,
+                table,
+                slabs,
+                freed_slabs,
+                ..
+            } = self;
+            unsafe {
+                slabs.dealloc(ptr, class, table, |slab, layout| {
+                    *freed_slabs += 1;
+                    heap.dealloc(slab, layout)
+                })
+            }
+        }
+    }
+
+    #[test]
+    fn slab_alloc_and_free() {
+        let mut test = SlabTest::new();
+
+        let first = test.alloc(1);
+        let second = test.alloc(1);
+        assert!(!first.is_null());
+        assert_eq!(first.align_offset(32), 0);
+        assert_eq!(second as usize, first as usize + 32);
+
+        // Freed blocks are reused right away
+        test.dealloc(first, 1);
+        assert_eq!(test.alloc(1), first);
+
+        // A slab is only requested when the class runs out of blocks
+        for _ in 2..(SLAB_SIZE / 32) {
+            test.alloc(1);
+        }
+        assert_eq!(test.allocated_slabs, 1);
+        assert_eq!(test.slabs.free_bytes(), 0);
+    }
+
+    #[test]
+    fn empty_slabs_are_returned_to_the_heap() {
+        let mut test = SlabTest::new();
+        let (_, heap_free_bytes, _) = test.heap.free_list_info();
+
+        // Two blocks of 2 KiB fill a slab
+        let blocks: Vec<_> = (0..6).map(|_| test.alloc(7)).collect();
+        assert!(blocks.iter().all(|block| !block.is_null()));
+        assert_eq!(test.allocated_slabs, 3);
+
+        for &block in blocks.iter() {
+            test.dealloc(block, 7);
+        }
+
+        // One slab worth of free blocks is retained, the other slabs are back in the heap
+        assert_eq!(test.freed_slabs, 2);
+        assert_eq!(test.slabs.free_bytes(), SLAB_SIZE);
+        let (_, free_bytes, _) = test.heap.free_list_info();
+        assert_eq!(free_bytes, heap_free_bytes - SLAB_SIZE);
+
+        // The retained slab still serves allocations
+        assert!(!test.alloc(7).is_null());
+        assert!(!test.alloc(7).is_null());
+        assert_eq!(test.allocated_slabs, 3);
+    }
+
+    #[test]
+    fn tagged_allocations_are_found_by_address() {
+        let tagged = TaggedAllocations::new();
+        assert_eq!(tagged.remove(0x1000), None);
+
+        assert!(tagged.insert(0x1000, 3));
+        assert!(tagged.insert(0x2000, 5));
+        assert_eq!(tagged.remove(0x3000), None);
+        assert_eq!(tagged.remove(0x2000), Some(5));
+        assert_eq!(tagged.remove(0x2000), None);
+        assert_eq!(tagged.remove(0x1000), Some(3));
+        assert_eq!(tagged.live.load(Ordering::Relaxed), 0);
+    }
 }
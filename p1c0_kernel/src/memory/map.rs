@@ -12,15 +12,17 @@ pub const KERNEL_LOGICAL_SIZE: usize = 128 * 1024 * 1024 * 1024 * 1024; // 128 T
 pub const ADT_VIRTUAL_BASE: VirtualAddress =
     unsafe { VirtualAddress::new_unchecked(0xFFFF000000000000 as *const u8) };
 
+/// All of DRAM is mapped linearly at this base, so that any physical page can be accessed without
+/// modifying the page tables. A physical address `pa` is mapped at `DIRECT_MAP_BASE + pa`.
+pub const DIRECT_MAP_BASE: VirtualAddress =
+    unsafe { VirtualAddress::new_unchecked(0xFFFFC00000000000 as *const u8) };
+pub const DIRECT_MAP_SIZE: usize = 32 * 1024 * 1024 * 1024 * 1024; // 32 TB
+
 /// Last 4GB are reserved for MMIO
 pub const MMIO_BASE: VirtualAddress =
     unsafe { VirtualAddress::new_unchecked(0xFFFFFFFF00000000 as *const u8) };
 pub const MMIO_SIZE: usize = 4 * 1024 * 1024 * 1024 - PAGE_SIZE;
 
-/// Last page is used for fast mapping into the kernel address space.
-pub const FASTMAP_PAGE: VirtualAddress =
-    unsafe { VirtualAddress::new_unchecked(0xFFFFFFFFFFFFC000 as *const u8) };
-
 extern "C" {
     static _text_start: u8;
     static _text_end: u8;
@@ -0,0 +1,78 @@
+//! Physical pages holding read-only file data that stays resident for the lifetime of the kernel,
+//! like the files of the initfs. Address spaces that map the same file data share the same page
+//! instead of allocating and copying their own.
+
+use super::{
+    address::{Address, PhysicalAddress},
+    address_space,
+    physical_page_allocator::PhysicalMemoryRegion,
+    AllocPolicy, Error, MemoryManager,
+};
+use crate::{prelude::*, sync::spinlock::SpinLock};
+
+/// Pages are identified by the address of the data they hold and its length. The data is static,
+/// so the same key always refers to the same contents.
+type Key = (usize, usize);
+
+struct CachedPage {
+    pmr: PhysicalMemoryRegion,
+    mappings: usize,
+}
+
+static PAGE_CACHE: SpinLock<FlatMap<Key, CachedPage>> = SpinLock::new(FlatMap::new_no_capacity());
+
+#[derive(Debug, Clone, Copy, Default)]
+pub struct Statistics {
+    /// Number of physical pages in the cache
+    pub cached_pages: usize,
+    /// Number of mappings of cached pages across all address spaces
+    pub mappings: usize,
+}
+
+/// Returns a page holding the `len` bytes at `data` followed by zeroes, populating it if this is
+/// the first mapping of the data. Each call must be balanced with a call to `release`.
+///
+/// # Safety
+///   `data` must be valid for reads of `len` bytes for the lifetime of the kernel and `len` cannot
+///   exceed the page size.
+pub(super) unsafe fn acquire(data: *const u8, len: usize) -> Result<PhysicalAddress, Error> {
+    let key = (data as usize, len);
+    let mut cache = PAGE_CACHE.lock();
+
+    if let Some(page) = cache.lookup_mut(&key) {
+        page.mappings += 1;
+        return Ok(page.pmr.base_address());
+    }
+
+    let pmr = MemoryManager::instance().request_any_pages(1, AllocPolicy::None)?;
+    address_space::fill_page(pmr.base_address().direct_mapped().as_mut_ptr(), data, len);
+
+    let pa = pmr.base_address();
+    cache.insert(key, CachedPage { pmr, mappings: 1 });
+    Ok(pa)
+}
+
+/// Drops a mapping obtained with `acquire`. The page is freed once it is no longer mapped.
+pub(super) fn release(data: *const u8, len: usize) {
+    let key = (data as usize, len);
+    let mut cache = PAGE_CACHE.lock();
+
+    let page = cache
+        .lookup_mut(&key)
+        .expect("Released a page that is not in the cache");
+    page.mappings -= 1;
+    if page.mappings == 0 {
+        let page = cache.remove(&key).unwrap();
+        MemoryManager::instance()
+            .release_pages(page.pmr)
+            .expect("Cannot release cached page");
+    }
+}
+
+pub fn statistics() -> Statistics {
+    let cache = PAGE_CACHE.lock();
+    Statistics {
+        cached_pages: cache.len(),
+        mappings: cache.iter().map(|(_key, page)| page.mappings).sum(),
+    }
+}
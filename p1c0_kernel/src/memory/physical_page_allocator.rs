@@ -1,10 +1,19 @@
+//! Allocator of physical pages based on a binary buddy system.
+//!
+//! Free memory is kept as naturally aligned blocks of 2^order pages, with one free list per order.
+//! Allocations split the smallest block that fits and releases merge a block with its buddy for as
+//! long as the buddy is free, so both take a number of steps bounded by `MAX_ORDER` regardless of
+//! how fragmented memory is.
+//!
+//! The free lists are intrusive: the links of a free block are stored in its first page, which is
+//! reached through the direct map. Each zone of memory added to the allocator also keeps one
+//! bitmap per order in its first usable pages, with a bit per block that is set while the block is
+//! free, so that checking whether a buddy is free does not need to trust the contents of a page
+//! that might be allocated. As a result the allocator never allocates memory itself.
+
 use super::address::{Address, PhysicalAddress};
 use crate::{
-    arch::mmu::PAGE_BITS,
-    collections::{
-        intrusive_list::{IntrusiveItem, IntrusiveList},
-        OwnedMutPtr,
-    },
+    arch::mmu::{PAGE_BITS, PAGE_SIZE},
     prelude::*,
 };
 
@@ -14,16 +23,15 @@ pub enum Error {
     /// Contains the overlap region
     RegionOverlapsWith(PhysicalAddress, usize),
     NoMemoryAvailable,
-    WouldAllocateMemory,
+    TooManyZones,
 }
 
-#[derive(Debug, Clone, PartialEq)]
-pub enum Options {
-    // Can allocate memory if needed
-    Default,
-    // Never allocates memory
-    NeverAllocate,
-}
+/// Blocks of the largest order span 2^MAX_ORDER pages, which is 32 MiB with 16 KiB pages.
+pub const MAX_ORDER: usize = 11;
+const NUM_ORDERS: usize = MAX_ORDER + 1;
+
+/// Maximum number of discontiguous regions of memory that can be added to the allocator
+const MAX_ZONES: usize = 4;
 
 fn pfn_from_pa(pa: PhysicalAddress) -> usize {
     assert!(pa.is_page_aligned());
@@ -31,6 +39,29 @@ fn pfn_from_pa(pa: PhysicalAddress) -> usize {
     pa.as_usize() >> PAGE_BITS
 }
 
+fn pa_from_pfn(pfn: usize) -> PhysicalAddress {
+    PhysicalAddress::try_from_ptr((pfn << PAGE_BITS) as *const _).unwrap()
+}
+
+/// Returns the order of the smallest block that can hold `num_pages`
+fn order_for_pages(num_pages: usize) -> usize {
+    num_pages.max(1).next_power_of_two().trailing_zeros() as usize
+}
+
+/// Splits the pages in `[pfn, pfn + num_pages)` into the largest naturally aligned blocks and calls
+/// `f` with the pfn and order of each of them, in ascending address order.
+fn for_each_block(mut pfn: usize, num_pages: usize, mut f: impl FnMut(usize, usize)) {
+    let end = pfn + num_pages;
+    while pfn < end {
+        let mut order = core::cmp::min(pfn.trailing_zeros() as usize, MAX_ORDER);
+        while pfn + (1 << order) > end {
+            order -= 1;
+        }
+        f(pfn, order);
+        pfn += 1 << order;
+    }
+}
+
 #[derive(Debug, Clone, PartialEq)]
 pub struct PhysicalMemoryRegion {
     pa: PhysicalAddress,
@@ -42,74 +73,318 @@ impl PhysicalMemoryRegion {
         Self { pa, num_pages }
     }
 
-    fn overlaps(&self, pa: PhysicalAddress, num_pages: usize) -> bool {
-        let self_pfn_start = pfn_from_pa(self.pa);
-        let self_pfn_end = self_pfn_start + self.num_pages;
-        let other_pfn_start = pfn_from_pa(pa);
-        let other_pfn_end = other_pfn_start + num_pages;
+    pub fn base_address(&self) -> PhysicalAddress {
+        self.pa
+    }
 
-        self_pfn_start < other_pfn_end && self_pfn_end > other_pfn_start
+    pub fn num_pages(&self) -> usize {
+        self.num_pages
     }
 
-    fn can_be_consolidated_with(&self, pa: PhysicalAddress, num_pages: usize) -> bool {
-        let self_pfn_start = pfn_from_pa(self.pa);
-        let self_pfn_end = self_pfn_start + self.num_pages;
-        let other_pfn_start = pfn_from_pa(pa);
-        let other_pfn_end = other_pfn_start + num_pages;
+    fn pfn_range(&self) -> (usize, usize) {
+        let pfn = pfn_from_pa(self.pa);
+        (pfn, pfn + self.num_pages)
+    }
+}
+
+/// Maximum number of zero-filled pages kept aside for `AllocPolicy::ZeroFill` requests
+pub const CLEAN_POOL_CAPACITY: usize = 64;
+
+/// Marks the end of a free list
+const NO_BLOCK: usize = usize::MAX;
 
-        self_pfn_start == other_pfn_end || self_pfn_end == other_pfn_start
+/// Links of a free block, stored at the start of its first page
+struct FreeBlock {
+    next: usize,
+    prev: usize,
+}
+
+fn free_block_links(pfn: usize) -> *mut FreeBlock {
+    pa_from_pfn(pfn).direct_mapped().as_mut_ptr() as *mut FreeBlock
+}
+
+const BITS_PER_WORD: usize = u64::BITS as usize;
+
+/// Contiguous range of memory added to the allocator, together with its free block bitmaps
+struct Zone {
+    start: usize,
+    end: usize,
+    /// Bitmap of the free blocks of each order. Bit `i` of the bitmap of order `n` stands for the
+    /// block at pfn `((start >> n) + i) << n`.
+    bitmaps: [*mut u64; NUM_ORDERS],
+}
+
+impl Zone {
+    fn num_words(start: usize, end: usize, order: usize) -> usize {
+        let num_bits = ((end - 1) >> order) - (start >> order) + 1;
+        (num_bits + BITS_PER_WORD - 1) / BITS_PER_WORD
     }
 
-    fn contains(&self, pa: PhysicalAddress, num_pages: usize) -> bool {
-        let self_pfn_start = pfn_from_pa(self.pa);
-        let self_pfn_end = self_pfn_start + self.num_pages;
-        let other_pfn_start = pfn_from_pa(pa);
-        let other_pfn_end = other_pfn_start + num_pages;
+    /// Number of pages taken by the bitmaps of a zone spanning `[start, end)`
+    fn bitmap_pages(start: usize, end: usize) -> usize {
+        let num_words: usize = (0..NUM_ORDERS)
+            .map(|order| Self::num_words(start, end, order))
+            .sum();
+        (num_words * core::mem::size_of::<u64>() + PAGE_SIZE - 1) / PAGE_SIZE
+    }
 
-        other_pfn_start >= self_pfn_start && other_pfn_end <= self_pfn_end
+    /// Creates a zone without free blocks, placing the bitmaps at `bitmap_pfn`.
+    ///
+    /// # Safety
+    ///   The bitmap pages must be owned by the allocator and reachable through the direct map.
+    unsafe fn new(start: usize, end: usize, bitmap_pfn: usize) -> Self {
+        let mut word = pa_from_pfn(bitmap_pfn).direct_mapped().as_mut_ptr() as *mut u64;
+        let mut bitmaps = [core::ptr::null_mut(); NUM_ORDERS];
+        for (order, bitmap) in bitmaps.iter_mut().enumerate() {
+            let num_words = Self::num_words(start, end, order);
+            word.write_bytes(0, num_words);
+            *bitmap = word;
+            word = word.add(num_words);
+        }
+        Self {
+            start,
+            end,
+            bitmaps,
+        }
     }
 
-    fn matches_start(&self, pa: PhysicalAddress) -> bool {
-        let self_pfn_start = pfn_from_pa(self.pa);
-        let other_pfn_start = pfn_from_pa(pa);
+    fn contains(&self, pfn: usize, order: usize) -> bool {
+        pfn >= self.start && pfn + (1 << order) <= self.end
+    }
 
-        self_pfn_start == other_pfn_start
+    fn bit(&self, pfn: usize, order: usize) -> (*mut u64, u64) {
+        let index = (pfn >> order) - (self.start >> order);
+        let word = unsafe { self.bitmaps[order].add(index / BITS_PER_WORD) };
+        (word, 1 << (index % BITS_PER_WORD))
     }
 
-    fn matches_end(&self, pa: PhysicalAddress, num_pages: usize) -> bool {
-        let self_pfn_start = pfn_from_pa(self.pa);
-        let self_pfn_end = self_pfn_start + self.num_pages;
-        let other_pfn_start = pfn_from_pa(pa);
-        let other_pfn_end = other_pfn_start + num_pages;
+    fn is_free(&self, pfn: usize, order: usize) -> bool {
+        let (word, mask) = self.bit(pfn, order);
+        unsafe { *word & mask != 0 }
+    }
 
-        self_pfn_end == other_pfn_end
+    fn set_free(&self, pfn: usize, order: usize, free: bool) {
+        let (word, mask) = self.bit(pfn, order);
+        unsafe {
+            if free {
+                *word |= mask;
+            } else {
+                *word &= !mask;
+            }
+        }
     }
 
-    pub fn base_address(&self) -> PhysicalAddress {
-        self.pa
+    /// Returns the first free block of the given order that starts at or after `pfn`
+    fn next_free_block(&self, pfn: usize, order: usize) -> Option<usize> {
+        let first_block = self.start >> order;
+        let mut index = ((pfn.max(self.start) + (1 << order) - 1) >> order) - first_block;
+        let num_words = Self::num_words(self.start, self.end, order);
+
+        let mut word_index = index / BITS_PER_WORD;
+        if word_index >= num_words {
+            return None;
+        }
+        let mut word =
+            unsafe { *self.bitmaps[order].add(word_index) } & (!0 << (index % BITS_PER_WORD));
+        loop {
+            if word != 0 {
+                index = word_index * BITS_PER_WORD + word.trailing_zeros() as usize;
+                return Some((first_block + index) << order);
+            }
+            word_index += 1;
+            if word_index >= num_words {
+                return None;
+            }
+            word = unsafe { *self.bitmaps[order].add(word_index) };
+        }
     }
 
-    pub fn num_pages(&self) -> usize {
-        self.num_pages
+    /// Calls `f` with the pfn and order of every free block of the zone, in ascending address
+    /// order
+    fn for_each_free_block(&self, mut f: impl FnMut(usize, usize)) {
+        // Merges the blocks of all orders, keeping the next free block of each of them
+        let mut next: [Option<usize>; NUM_ORDERS] = [None; NUM_ORDERS];
+        for (order, block) in next.iter_mut().enumerate() {
+            *block = self.next_free_block(self.start, order);
+        }
+
+        while let Some((order, pfn)) = next
+            .iter()
+            .enumerate()
+            .filter_map(|(order, block)| block.map(|pfn| (order, pfn)))
+            .min_by_key(|(_, pfn)| *pfn)
+        {
+            f(pfn, order);
+            next[order] = self.next_free_block(pfn + (1 << order), order);
+        }
     }
 }
 
 pub struct PhysicalPageAllocator {
-    regions: IntrusiveList<PhysicalMemoryRegion>,
+    zones: heapless::Vec<Zone, MAX_ZONES>,
+    /// Free pages with unknown contents, as one doubly linked list of blocks per order. The pfn of
+    /// a block of order `n` is a multiple of 2^n.
+    free_lists: [usize; NUM_ORDERS],
+    free_blocks: [usize; NUM_ORDERS],
+    /// Free pages that are known to be zero-filled. They are not part of the free lists.
+    clean_pages: heapless::Vec<PhysicalAddress, CLEAN_POOL_CAPACITY>,
+    clean_page_hits: u64,
+    clean_page_misses: u64,
+}
+
+/// Snapshot of the free physical memory. The layout matches `libcxx::syscalls::PageStatistics`.
+#[repr(C)]
+#[derive(Debug, Clone, Copy, Default)]
+pub struct Statistics {
+    /// Includes the clean pages
+    pub free_pages: u64,
+    /// Number of contiguous ranges of free pages, regardless of how they are split in blocks
+    pub num_regions: u64,
+    pub largest_region_pages: u64,
+    pub clean_pages: u64,
+    /// Zero-filled requests served from the clean pages
+    pub clean_page_hits: u64,
+    /// Zero-filled requests that had to be zeroed synchronously
+    pub clean_page_misses: u64,
 }
 
 impl PhysicalPageAllocator {
     pub const fn new() -> Self {
         Self {
-            regions: IntrusiveList::new(),
+            zones: heapless::Vec::new(),
+            free_lists: [NO_BLOCK; NUM_ORDERS],
+            free_blocks: [0; NUM_ORDERS],
+            clean_pages: heapless::Vec::new(),
+            clean_page_hits: 0,
+            clean_page_misses: 0,
         }
     }
 
+    fn zone(&self, pfn: usize) -> Option<&Zone> {
+        self.zones
+            .iter()
+            .find(|zone| pfn >= zone.start && pfn < zone.end)
+    }
+
+    fn is_free_block(&self, pfn: usize, order: usize) -> bool {
+        self.zone(pfn).map_or(false, |zone| {
+            zone.contains(pfn, order) && zone.is_free(pfn, order)
+        })
+    }
+
+    fn insert_block(&mut self, pfn: usize, order: usize) {
+        if self.is_free_block(pfn, order) {
+            panic!("Block {:#x} of order {} is already free", pfn, order);
+        }
+        self.zone(pfn).unwrap().set_free(pfn, order, true);
+
+        let head = self.free_lists[order];
+        unsafe {
+            free_block_links(pfn).write(FreeBlock {
+                next: head,
+                prev: NO_BLOCK,
+            });
+            if head != NO_BLOCK {
+                (*free_block_links(head)).prev = pfn;
+            }
+        }
+        self.free_lists[order] = pfn;
+        self.free_blocks[order] += 1;
+    }
+
+    fn remove_block(&mut self, pfn: usize, order: usize) -> bool {
+        if !self.is_free_block(pfn, order) {
+            return false;
+        }
+        self.zone(pfn).unwrap().set_free(pfn, order, false);
+
+        unsafe {
+            let FreeBlock { next, prev } = free_block_links(pfn).read();
+            if prev == NO_BLOCK {
+                self.free_lists[order] = next;
+            } else {
+                (*free_block_links(prev)).next = next;
+            }
+            if next != NO_BLOCK {
+                (*free_block_links(next)).prev = prev;
+            }
+        }
+        self.free_blocks[order] -= 1;
+        true
+    }
+
+    /// Frees a block, merging it with its buddy for as long as the buddy is also free. Blocks are
+    /// never merged across zones, since the bitmaps only cover the blocks inside of a zone.
+    fn free_block(&mut self, mut pfn: usize, mut order: usize) {
+        while order < MAX_ORDER {
+            let buddy = pfn ^ (1 << order);
+            let same_zone = self
+                .zone(pfn)
+                .map_or(false, |zone| zone.contains(buddy, order));
+            if !same_zone || !self.remove_block(buddy, order) {
+                break;
+            }
+            pfn = core::cmp::min(pfn, buddy);
+            order += 1;
+        }
+        self.insert_block(pfn, order);
+    }
+
+    /// Frees a range of pages that is known not to overlap free memory
+    fn free_range(&mut self, pfn: usize, num_pages: usize) {
+        for_each_block(pfn, num_pages, |pfn, order| self.free_block(pfn, order));
+    }
+
+    /// Returns the free block that contains the given page
+    fn find_free_block(&self, pfn: usize) -> Option<(usize, usize)> {
+        (0..NUM_ORDERS).find_map(|order| {
+            let block = pfn & !((1 << order) - 1);
+            self.is_free_block(block, order).then(|| (block, order))
+        })
+    }
+
+    /// Returns a free block that overlaps the given range of pages
+    fn find_overlapping_block(&self, pfn: usize, num_pages: usize) -> Option<(usize, usize)> {
+        let end = pfn + num_pages;
+        self.zones
+            .iter()
+            .filter(|zone| zone.start < end && pfn < zone.end)
+            .find_map(|zone| {
+                (0..NUM_ORDERS).find_map(|order| {
+                    zone.next_free_block(pfn & !((1 << order) - 1), order)
+                        .filter(|block| *block < end)
+                        .map(|block| (block, order))
+                })
+            })
+    }
+
+    /// Calls `f` with the free memory as maximal contiguous ranges of pages, sorted by address
+    fn for_each_region(&self, mut f: impl FnMut(usize, usize)) {
+        let mut region: Option<(usize, usize)> = None;
+        for zone in self.zones.iter() {
+            zone.for_each_free_block(|pfn, order| match &mut region {
+                Some((start, num_pages)) if *start + *num_pages == pfn => {
+                    *num_pages += 1 << order;
+                }
+                _ => {
+                    if let Some((start, num_pages)) = region.replace((pfn, 1 << order)) {
+                        f(start, num_pages);
+                    }
+                }
+            });
+        }
+        if let Some((start, num_pages)) = region {
+            f(start, num_pages);
+        }
+    }
+
+    /// Adds a zone of memory to the allocator. The pages in `reserved` are already in use and are
+    /// not freed, nor used for the bitmaps of the zone.
     pub(super) fn add_region(
         &mut self,
         pa: PhysicalAddress,
         num_pages: usize,
-        options: Options,
+        reserved: &[PhysicalMemoryRegion],
     ) -> Result<(), Error> {
         log_info!(
             "PhysicalPageAllocator - Adding region with base address {}, num_pages {}",
@@ -117,65 +392,64 @@ impl PhysicalPageAllocator {
             num_pages
         );
 
-        if let Some(region) = self
-            .regions
+        let start = pfn_from_pa(pa);
+        let end = start + num_pages;
+        if let Some(zone) = self
+            .zones
             .iter()
-            .find(|region| region.overlaps(pa, num_pages))
+            .find(|zone| zone.start < end && start < zone.end)
         {
-            return Err(Error::RegionOverlapsWith(region.pa, region.num_pages));
-        }
-
-        // No overlap, we can add the region.
-
-        // We pull the regions that could be consolidated with this one
-        let mut ranges_to_join = self
-            .regions
-            .drain_filter(|region| region.can_be_consolidated_with(pa, num_pages));
-
-        if !ranges_to_join.is_empty() {
-            // Not only we can consolidate entries, but we also do this without carrying out any
-            // allocations, which is truly nice.
-
-            // We can unwrap now because we know the list is not empty
-            let min_pa = core::cmp::min(
-                pa.as_usize(),
-                ranges_to_join
-                    .iter()
-                    .map(|range| range.pa.as_usize())
-                    .reduce(core::cmp::min)
-                    .unwrap(),
-            );
-
-            let total_num_pages = num_pages
-                + ranges_to_join
-                    .iter()
-                    .map(|range| range.num_pages)
-                    .reduce(|num_pages1, num_pages2| num_pages1 + num_pages2)
-                    .unwrap();
-
-            // Take one of the ranges and reuse it's object for the new range. This saves
-            // allocating another object
-            let mut range = ranges_to_join.pop().unwrap();
+            return Err(Error::RegionOverlapsWith(
+                pa_from_pfn(zone.start),
+                zone.end - zone.start,
+            ));
+        }
+        if self.zones.is_full() {
+            return Err(Error::TooManyZones);
+        }
 
-            // This has to be aligned, and we know it is because we never insert ranges that aren't
-            range.pa = PhysicalAddress::try_from_ptr(min_pa as *const _).unwrap();
-            range.num_pages = total_num_pages;
+        // The bitmaps go in the first pages that are not reserved
+        let bitmap_pages = Zone::bitmap_pages(start, end);
+        let mut bitmap_pfn = start;
+        while let Some(region) = reserved.iter().find(|region| {
+            let (reserved_start, reserved_end) = region.pfn_range();
+            reserved_start < bitmap_pfn + bitmap_pages && bitmap_pfn < reserved_end
+        }) {
+            bitmap_pfn = region.pfn_range().1;
+        }
+        if bitmap_pfn + bitmap_pages > end {
+            return Err(Error::NoMemoryAvailable);
+        }
 
-            // Re-insert the range into the list of available regions
-            self.regions.push(range);
+        let zone = unsafe { Zone::new(start, end, bitmap_pfn) };
+        self.zones.push(zone).map_err(|_| Error::TooManyZones)?;
+        self.zones.sort_unstable_by_key(|zone| zone.start);
 
-            ranges_to_join.release(|region| {
-                // # Safety: We currently allocate with regular box.
-                let boxed = unsafe { region.into_box() };
-                drop(boxed);
-            });
-        } else {
-            if options == Options::NeverAllocate {
-                return Err(Error::WouldAllocateMemory);
+        // Free everything in between the reserved ranges (including the bitmaps)
+        let bitmaps = (bitmap_pfn, bitmap_pfn + bitmap_pages);
+        let holes = || {
+            reserved
+                .iter()
+                .map(|region| region.pfn_range())
+                .chain(core::iter::once(bitmaps))
+        };
+        let mut pfn = start;
+        while pfn < end {
+            match holes()
+                .filter(|(_, hole_end)| *hole_end > pfn)
+                .min_by_key(|(hole_start, _)| *hole_start)
+            {
+                Some((hole_start, hole_end)) => {
+                    if hole_start > pfn {
+                        self.free_range(pfn, hole_start.min(end) - pfn);
+                    }
+                    pfn = hole_end;
+                }
+                None => {
+                    self.free_range(pfn, end - pfn);
+                    pfn = end;
+                }
             }
-
-            let region = Box::new(IntrusiveItem::new(PhysicalMemoryRegion::new(pa, num_pages)));
-            self.regions.push(OwnedMutPtr::new_from_box(region));
         }
 
         Ok(())
@@ -187,7 +461,6 @@ impl PhysicalPageAllocator {
         &mut self,
         pa: PhysicalAddress,
         num_pages: usize,
-        options: Options,
     ) -> Result<(), Error> {
         log_info!(
             "PhysicalPageAllocator - Stealing region with base address {}, num_pages {}",
@@ -195,61 +468,35 @@ impl PhysicalPageAllocator {
             num_pages
         );
 
-        let mut contained_ranges = self
-            .regions
-            .drain_filter(|region| region.contains(pa, num_pages));
+        let start = pfn_from_pa(pa);
+        let end = start + num_pages;
 
-        if contained_ranges.is_empty() {
-            return Err(Error::RegionNotAvailable);
+        // Make sure the whole range is free before modifying anything
+        let mut pfn = start;
+        while pfn < end {
+            let (block, order) = self.find_free_block(pfn).ok_or(Error::RegionNotAvailable)?;
+            pfn = block + (1 << order);
         }
 
-        // A region cannot be contained in more than one range. If this happens, there is a bug
-        // in our program
-        if contained_ranges.iter().count() != 1 {
-            panic!("More than one physical region contains a given range, this is a bug!");
-        }
-
-        let mut region = contained_ranges.pop().unwrap();
-
-        let matches_start = region.matches_start(pa);
-        let matches_end = region.matches_end(pa, num_pages);
-
-        if matches_start && matches_end {
-            // Region is completely removed, nothing to do
-            let region = unsafe { region.into_box() };
-            drop(region);
-        } else if matches_start {
-            region.pa = unsafe { pa.offset(num_pages << PAGE_BITS) };
-            region.num_pages -= num_pages;
-            self.regions.push(region);
-        } else if matches_end {
-            region.num_pages -= num_pages;
-            self.regions.push(region);
-        } else {
-            // We need to split the region unfortunately, which means allocating another region
-            // object
-
-            if options == Options::NeverAllocate {
-                return Err(Error::WouldAllocateMemory);
+        // Only the first and last blocks can extend past the range, and the parts that do are
+        // freed again
+        let mut pfn = start;
+        while pfn < end {
+            let (block, order) = self.find_free_block(pfn).unwrap();
+            self.remove_block(block, order);
+
+            let block_end = block + (1 << order);
+            if block < start {
+                for_each_block(block, start - block, |pfn, order| {
+                    self.insert_block(pfn, order)
+                });
             }
-
-            let first_pa = region.pa;
-            let first_num_pages = pa.offset_from(first_pa) as usize >> PAGE_BITS;
-
-            let second_pa = unsafe { pa.offset(num_pages << PAGE_BITS) };
-            let second_num_pages =
-                region.num_pages - (second_pa.offset_from(first_pa) as usize >> PAGE_BITS);
-
-            // We reuse the region object for the first element
-            region.pa = first_pa;
-            region.num_pages = first_num_pages;
-            self.regions.push(region);
-
-            let new_region = Box::new(IntrusiveItem::new(PhysicalMemoryRegion::new(
-                second_pa,
-                second_num_pages,
-            )));
-            self.regions.push(OwnedMutPtr::new_from_box(new_region));
+            if block_end > end {
+                for_each_block(end, block_end - end, |pfn, order| {
+                    self.insert_block(pfn, order)
+                });
+            }
+            pfn = block_end;
         }
 
         Ok(())
@@ -257,181 +504,394 @@ impl PhysicalPageAllocator {
 
     pub fn print_regions(&self) {
         log_info!("Available physical memory regions:");
-        for region in self.regions.iter() {
-            let start_addr = region.pa;
-            let end_addr = unsafe { region.pa.offset(region.num_pages << PAGE_BITS) };
+        self.for_each_region(|pfn, num_pages| {
+            let start_addr = pa_from_pfn(pfn);
+            let end_addr = pa_from_pfn(pfn + num_pages);
             log_info!("\t{} -> {}", start_addr, end_addr);
+        });
+
+        for (order, num_blocks) in self.free_blocks.iter().enumerate() {
+            if *num_blocks != 0 {
+                log_info!("\t{} free blocks of order {}", num_blocks, order);
+            }
         }
     }
 
+    pub fn statistics(&self) -> Statistics {
+        let mut stats = Statistics::default();
+        self.for_each_region(|_, num_pages| {
+            stats.free_pages += num_pages as u64;
+            stats.num_regions += 1;
+            stats.largest_region_pages = stats.largest_region_pages.max(num_pages as u64);
+        });
+        stats.clean_pages = self.clean_pages.len() as u64;
+        stats.free_pages += stats.clean_pages;
+        stats.clean_page_hits = self.clean_page_hits;
+        stats.clean_page_misses = self.clean_page_misses;
+        stats
+    }
+
     pub fn request_pages(
         &mut self,
         pa: PhysicalAddress,
         num_pages: usize,
-        options: Options,
     ) -> Result<PhysicalMemoryRegion, Error> {
-        self.steal_region(pa, num_pages, options)?;
+        self.steal_region(pa, num_pages)?;
         Ok(PhysicalMemoryRegion::new(pa, num_pages))
     }
 
-    pub fn request_any_pages(
-        &mut self,
-        num_pages: usize,
-        options: Options,
-    ) -> Result<PhysicalMemoryRegion, Error> {
-        let mut pa = None;
-        for region in self.regions.iter() {
-            if region.num_pages >= num_pages {
-                pa = Some(region.pa);
-                break;
-            }
+    /// Returns `num_pages` contiguous pages. The region is aligned to the smallest power of two
+    /// number of pages that holds it, up to the size of a block of `MAX_ORDER`.
+    pub fn request_any_pages(&mut self, num_pages: usize) -> Result<PhysicalMemoryRegion, Error> {
+        let order = order_for_pages(num_pages);
+        if order > MAX_ORDER {
+            // Too large for a single block, look for a long enough run of contiguous blocks
+            let mut region = None;
+            self.for_each_region(|pfn, region_pages| {
+                if region.is_none() && region_pages >= num_pages {
+                    region = Some(pfn);
+                }
+            });
+            let pfn = region.ok_or(Error::NoMemoryAvailable)?;
+            return self.request_pages(pa_from_pfn(pfn), num_pages);
         }
 
-        if let Some(pa) = pa {
-            self.request_pages(pa, num_pages, options)
-        } else {
-            Err(Error::NoMemoryAvailable)
+        let block_order = (order..NUM_ORDERS)
+            .find(|order| self.free_lists[*order] != NO_BLOCK)
+            .ok_or(Error::NoMemoryAvailable)?;
+
+        let pfn = self.free_lists[block_order];
+        self.remove_block(pfn, block_order);
+        for split_order in (order..block_order).rev() {
+            self.insert_block(pfn + (1 << split_order), split_order);
         }
+        for_each_block(pfn + num_pages, (1 << order) - num_pages, |pfn, order| {
+            self.free_block(pfn, order)
+        });
+
+        Ok(PhysicalMemoryRegion::new(pa_from_pfn(pfn), num_pages))
     }
 
-    pub fn release_pages(
+    pub fn release_pages(&mut self, region: PhysicalMemoryRegion) -> Result<(), Error> {
+        let pfn = pfn_from_pa(region.pa);
+        if let Some((block, order)) = self.find_overlapping_block(pfn, region.num_pages) {
+            return Err(Error::RegionOverlapsWith(pa_from_pfn(block), 1 << order));
+        }
+
+        self.free_range(pfn, region.num_pages);
+        Ok(())
+    }
+
+    /// Returns zero-filled pages from the clean pool if possible. Only single pages are pooled, so
+    /// larger requests always miss.
+    pub fn request_clean_pages(&mut self, num_pages: usize) -> Option<PhysicalMemoryRegion> {
+        if num_pages == 1 {
+            if let Some(pa) = self.clean_pages.pop() {
+                self.clean_page_hits += 1;
+                return Some(PhysicalMemoryRegion::new(pa, 1));
+            }
+        }
+
+        self.clean_page_misses += 1;
+        None
+    }
+
+    /// Adds a zero-filled page to the clean pool. The page is handed back if the pool is full.
+    pub fn release_clean_page(
         &mut self,
         region: PhysicalMemoryRegion,
-        options: Options,
-    ) -> Result<(), Error> {
-        self.add_region(region.pa, region.num_pages, options)?;
-        Ok(())
+    ) -> Result<(), PhysicalMemoryRegion> {
+        assert_eq!(region.num_pages, 1);
+        self.clean_pages.push(region.pa).map_err(|_| region)
+    }
+
+    /// Takes a page from the clean pool without accounting it as a zero-filled request. Clean
+    /// pages are just free pages that happen to be zeroed already, so they can satisfy any request
+    /// once the regions run out.
+    pub fn reclaim_clean_page(&mut self) -> Option<PhysicalMemoryRegion> {
+        self.clean_pages
+            .pop()
+            .map(|pa| PhysicalMemoryRegion::new(pa, 1))
+    }
+
+    pub fn num_clean_pages(&self) -> usize {
+        self.clean_pages.len()
     }
 }
 
+/// Safety:
+/// The bitmaps and free lists are only reached through the pages owned by the allocator, so it can
+/// be moved to another thread.
+unsafe impl Send for PhysicalPageAllocator {}
+
 #[cfg(test)]
 mod test {
     use super::*;
 
+    /// Host memory standing in for DRAM, since the allocator keeps its bitmaps and free lists in
+    /// the pages it manages
+    struct Dram {
+        base: *mut u8,
+        layout: std::alloc::Layout,
+    }
+
+    impl Dram {
+        fn new(num_pages: usize) -> Self {
+            let layout =
+                std::alloc::Layout::from_size_align(num_pages * PAGE_SIZE, PAGE_SIZE << MAX_ORDER)
+                    .unwrap();
+            let base = unsafe { std::alloc::alloc(layout) };
+            assert!(!base.is_null());
+            Self { base, layout }
+        }
+
+        fn pa(&self, page: usize) -> PhysicalAddress {
+            PhysicalAddress::try_from_ptr(unsafe { self.base.add(page * PAGE_SIZE) }).unwrap()
+        }
+
+        fn pfn(&self, page: usize) -> usize {
+            pfn_from_pa(self.pa(page))
+        }
+
+        fn region(&self, page: usize, num_pages: usize) -> PhysicalMemoryRegion {
+            PhysicalMemoryRegion::new(self.pa(page), num_pages)
+        }
+    }
+
+    impl Drop for Dram {
+        fn drop(&mut self) {
+            unsafe { std::alloc::dealloc(self.base, self.layout) };
+        }
+    }
+
+    fn regions(allocator: &PhysicalPageAllocator) -> Vec<PhysicalMemoryRegion> {
+        let mut regions = vec![];
+        allocator.for_each_region(|pfn, num_pages| {
+            regions.push(PhysicalMemoryRegion::new(pa_from_pfn(pfn), num_pages))
+        });
+        regions
+    }
+
+    /// Returns the sorted pfns of the free blocks of the given order
+    fn free_list(allocator: &PhysicalPageAllocator, order: usize) -> Vec<usize> {
+        let mut blocks = vec![];
+        let mut pfn = allocator.free_lists[order];
+        while pfn != NO_BLOCK {
+            blocks.push(pfn);
+            pfn = unsafe { (*free_block_links(pfn)).next };
+        }
+        assert_eq!(blocks.len(), allocator.free_blocks[order]);
+        blocks.sort_unstable();
+        blocks
+    }
+
+    const NUM_PAGES: usize = 4 << MAX_ORDER;
+
     #[test]
     fn add_region() {
+        let dram = Dram::new(NUM_PAGES);
         let mut allocator = PhysicalPageAllocator::new();
-        let dram_base = PhysicalAddress::try_from_ptr(0x10000000000 as *const _).unwrap();
-        let num_pages = (32 * 1024 * 1024 * 1024) >> PAGE_BITS;
+        allocator.add_region(dram.pa(0), NUM_PAGES, &[]).unwrap();
 
+        // The first page holds the bitmaps
+        assert_eq!(Zone::bitmap_pages(dram.pfn(0), dram.pfn(NUM_PAGES)), 1);
+        assert_eq!(regions(&allocator), vec![dram.region(1, NUM_PAGES - 1)]);
+        assert_eq!(free_list(&allocator, MAX_ORDER).len(), 3);
+    }
+
+    #[test]
+    fn add_region_skips_reserved_pages() {
+        let dram = Dram::new(NUM_PAGES);
+        let mut allocator = PhysicalPageAllocator::new();
         allocator
-            .add_region(dram_base, num_pages, Options::Default)
+            .add_region(
+                dram.pa(0),
+                NUM_PAGES,
+                &[dram.region(0, 2), dram.region(5, 1)],
+            )
             .unwrap();
 
+        // The bitmaps go in the first unreserved page
         assert_eq!(
-            allocator
-                .regions
-                .iter()
-                .map(|region| (**region).clone())
-                .collect::<Vec<_>>(),
-            vec![PhysicalMemoryRegion::new(dram_base, num_pages)]
+            regions(&allocator),
+            vec![dram.region(3, 2), dram.region(6, NUM_PAGES - 6)]
         );
+        assert!(matches!(
+            allocator.steal_region(dram.pa(0), 1),
+            Err(Error::RegionNotAvailable)
+        ));
     }
 
     #[test]
     fn steal_regions() {
+        let dram = Dram::new(NUM_PAGES);
         let mut allocator = PhysicalPageAllocator::new();
-        let dram_base = PhysicalAddress::try_from_ptr(0x10000000000 as *const _).unwrap();
-        let num_pages = (32 * 1024 * 1024 * 1024) >> PAGE_BITS;
-
-        allocator
-            .add_region(dram_base, num_pages, Options::Default)
-            .unwrap();
+        allocator.add_region(dram.pa(0), NUM_PAGES, &[]).unwrap();
 
+        allocator.steal_region(dram.pa(29), 7).unwrap();
         assert_eq!(
-            allocator
-                .regions
-                .iter()
-                .map(|region| (**region).clone())
-                .collect::<Vec<_>>(),
-            vec![PhysicalMemoryRegion::new(dram_base, num_pages)]
+            regions(&allocator),
+            vec![dram.region(1, 28), dram.region(36, NUM_PAGES - 36)]
         );
 
-        let region_base = PhysicalAddress::try_from_ptr(0x10000074000 as *const _).unwrap();
-        let num_pages = 7;
+        allocator.steal_region(dram.pa(36), 9).unwrap();
+        allocator.steal_region(dram.pa(45), 46).unwrap();
         allocator
-            .steal_region(region_base, num_pages, Options::Default)
+            .steal_region(dram.pa(100), 2 << MAX_ORDER)
             .unwrap();
 
-        let second_base = unsafe { PhysicalAddress::new_unchecked(0x10000090000 as *const _) };
+        let end = 100 + (2 << MAX_ORDER);
         assert_eq!(
-            allocator
-                .regions
-                .iter()
-                .map(|region| (**region).clone())
-                .collect::<Vec<_>>(),
+            regions(&allocator),
             vec![
-                PhysicalMemoryRegion::new(dram_base, 29),
-                PhysicalMemoryRegion::new(second_base, 2097116),
+                dram.region(1, 28),
+                dram.region(91, 9),
+                dram.region(end, NUM_PAGES - end)
             ]
         );
+        assert_eq!(
+            allocator.statistics().free_pages as usize,
+            28 + 9 + NUM_PAGES - end
+        );
 
-        let region_base = PhysicalAddress::try_from_ptr(0x10000090000 as *const _).unwrap();
-        let num_pages = 9;
-        allocator
-            .steal_region(region_base, num_pages, Options::Default)
-            .unwrap();
+        assert!(matches!(
+            allocator.steal_region(dram.pa(90), 2),
+            Err(Error::RegionNotAvailable)
+        ));
+    }
 
-        let region_base = PhysicalAddress::try_from_ptr(0x100000b4000 as *const _).unwrap();
-        let num_pages = 46;
-        allocator
-            .steal_region(region_base, num_pages, Options::Default)
-            .unwrap();
+    #[test]
+    fn add_discontiguous_regions() {
+        // Tracking the free blocks never allocates, so any number of zones up to `MAX_ZONES` can be
+        // added, contiguous or not
+        let dram = Dram::new(32);
+        let mut allocator = PhysicalPageAllocator::new();
+        allocator.add_region(dram.pa(0), 16, &[]).unwrap();
+        allocator.add_region(dram.pa(16), 16, &[]).unwrap();
+
+        let others: Vec<_> = (0..3).map(|_| Dram::new(16)).collect();
+        allocator.add_region(others[0].pa(0), 16, &[]).unwrap();
+        allocator.add_region(others[1].pa(0), 16, &[]).unwrap();
+        assert!(matches!(
+            allocator.add_region(others[2].pa(0), 16, &[]),
+            Err(Error::TooManyZones)
+        ));
+
+        // Blocks of adjacent zones are not merged
+        assert!(regions(&allocator).contains(&dram.region(1, 15)));
+        assert!(regions(&allocator).contains(&dram.region(17, 15)));
+        assert_eq!(free_list(&allocator, 4), vec![]);
+        assert_eq!(allocator.statistics().free_pages, 4 * 15);
+
+        let pages: Vec<_> = (0..60)
+            .map(|_| allocator.request_any_pages(1).unwrap())
+            .collect();
+        assert!(matches!(
+            allocator.request_any_pages(1),
+            Err(Error::NoMemoryAvailable)
+        ));
+        for page in pages {
+            allocator.release_pages(page).unwrap();
+        }
+        assert_eq!(allocator.statistics().free_pages, 4 * 15);
+    }
 
-        let region_base = PhysicalAddress::try_from_ptr(0x1000016c000 as *const _).unwrap();
-        let num_pages = 262144;
-        allocator
-            .steal_region(region_base, num_pages, Options::Default)
-            .unwrap();
+    #[test]
+    fn add_overlapping_region() {
+        let dram = Dram::new(16);
+        let mut allocator = PhysicalPageAllocator::new();
+        allocator.add_region(dram.pa(0), 16, &[]).unwrap();
+
+        let err = allocator.add_region(dram.pa(14), 4, &[]).unwrap_err();
+        assert!(matches!(err, Error::RegionOverlapsWith(pa, 16) if pa == dram.pa(0)));
+    }
 
-        let third_base = unsafe { PhysicalAddress::new_unchecked(0x1010016c000 as *const _) };
+    #[test]
+    fn buddies_are_split_and_merged() {
+        let dram = Dram::new(32);
+        let mut allocator = PhysicalPageAllocator::new();
+        allocator.add_region(dram.pa(0), 32, &[]).unwrap();
+        let pfn = |page| dram.pfn(page);
+        assert_eq!(free_list(&allocator, 0), vec![pfn(1)]);
+        assert_eq!(free_list(&allocator, 1), vec![pfn(2)]);
+        assert_eq!(free_list(&allocator, 2), vec![pfn(4)]);
+        assert_eq!(free_list(&allocator, 3), vec![pfn(8)]);
+        assert_eq!(free_list(&allocator, 4), vec![pfn(16)]);
+
+        let page = allocator.request_any_pages(1).unwrap();
+        assert_eq!(page, dram.region(1, 1));
+        assert!(free_list(&allocator, 0).is_empty());
+
+        // Allocations are aligned to their size rounded up to a power of two, and the pages past
+        // the requested ones are freed
+        let region = allocator.request_any_pages(3).unwrap();
+        assert_eq!(region, dram.region(4, 3));
+        assert_eq!(free_list(&allocator, 0), vec![pfn(7)]);
+        assert!(free_list(&allocator, 2).is_empty());
+        assert_eq!(allocator.statistics().free_pages, 27);
+
+        // Larger blocks are split when the smaller orders run out
+        let split = allocator.request_any_pages(4).unwrap();
+        assert_eq!(split, dram.region(8, 4));
+        assert_eq!(free_list(&allocator, 2), vec![pfn(12)]);
+        assert!(free_list(&allocator, 3).is_empty());
+
+        allocator.release_pages(page).unwrap();
+        allocator.release_pages(region).unwrap();
+        allocator.release_pages(split).unwrap();
+        assert_eq!(free_list(&allocator, 0), vec![pfn(1)]);
+        assert_eq!(free_list(&allocator, 1), vec![pfn(2)]);
+        assert_eq!(free_list(&allocator, 2), vec![pfn(4)]);
+        assert_eq!(free_list(&allocator, 3), vec![pfn(8)]);
+        assert_eq!(free_list(&allocator, 4), vec![pfn(16)]);
+
+        let err = allocator.release_pages(dram.region(1, 1)).unwrap_err();
+        assert!(matches!(err, Error::RegionOverlapsWith(..)));
+    }
+
+    #[test]
+    fn request_larger_than_max_order() {
+        let dram = Dram::new(NUM_PAGES);
+        let mut allocator = PhysicalPageAllocator::new();
+        allocator.add_region(dram.pa(0), NUM_PAGES, &[]).unwrap();
+
+        let region = allocator.request_any_pages((2 << MAX_ORDER) + 1).unwrap();
+        assert_eq!(region.base_address(), dram.pa(1));
         assert_eq!(
-            allocator
-                .regions
-                .iter()
-                .map(|region| (**region).clone())
-                .collect::<Vec<_>>(),
-            vec![
-                PhysicalMemoryRegion::new(dram_base, 29),
-                PhysicalMemoryRegion::new(third_base, 1834917)
-            ]
+            allocator.statistics().free_pages as usize,
+            NUM_PAGES - 1 - region.num_pages()
         );
+
+        assert!(matches!(
+            allocator.request_any_pages(2 << MAX_ORDER),
+            Err(Error::NoMemoryAvailable)
+        ));
+
+        allocator.release_pages(region).unwrap();
+        assert_eq!(free_list(&allocator, MAX_ORDER).len(), 3);
     }
 
     #[test]
-    fn add_region_would_allocate() {
+    fn clean_page_pool() {
+        let dram = Dram::new(16);
         let mut allocator = PhysicalPageAllocator::new();
-        let dram_base = PhysicalAddress::try_from_ptr(0x10000000000 as *const _).unwrap();
-        let num_pages = (32 * 1024 * 1024 * 1024) >> PAGE_BITS;
+        allocator.add_region(dram.pa(0), 16, &[]).unwrap();
 
-        allocator
-            .add_region(dram_base, num_pages, Options::Default)
-            .unwrap();
+        assert!(allocator.request_clean_pages(1).is_none());
 
-        let another_contiguous_dram_region =
-            PhysicalAddress::try_from_ptr(0x108_0000_0000 as *const _).unwrap();
-        allocator
-            .add_region(
-                another_contiguous_dram_region,
-                num_pages,
-                Options::NeverAllocate,
-            )
-            .unwrap();
+        let page = allocator.request_any_pages(1).unwrap();
+        allocator.release_clean_page(page.clone()).unwrap();
+        assert_eq!(allocator.statistics().free_pages, 15);
+        assert_eq!(allocator.statistics().clean_pages, 1);
 
-        assert_eq!(
-            allocator
-                .regions
-                .iter()
-                .map(|region| (**region).clone())
-                .collect::<Vec<_>>(),
-            vec![PhysicalMemoryRegion::new(dram_base, num_pages * 2)]
-        );
+        // Only single page requests are served from the pool
+        assert!(allocator.request_clean_pages(2).is_none());
+        assert_eq!(allocator.request_clean_pages(1), Some(page));
+        assert!(allocator.request_clean_pages(1).is_none());
 
-        let a_non_contiguous_region =
-            PhysicalAddress::try_from_ptr(0x200_0000_0000 as *const _).unwrap();
-        let err = allocator
-            .add_region(a_non_contiguous_region, num_pages, Options::NeverAllocate)
-            .unwrap_err();
-        assert!(matches!(err, Error::WouldAllocateMemory));
+        let stats = allocator.statistics();
+        assert_eq!(stats.clean_pages, 0);
+        assert_eq!(stats.clean_page_hits, 1);
+        assert_eq!(stats.clean_page_misses, 3);
     }
 }
@@ -0,0 +1,43 @@
+//! Anonymous memory that several address spaces can map at the same time, so that processes can
+//! exchange data without the kernel copying it.
+
+use super::{
+    num_pages_from_bytes, physical_page_allocator::PhysicalMemoryRegion, request_zeroed_pages,
+    Error, MemoryManager,
+};
+use crate::arch::mmu::PAGE_SIZE;
+
+/// Physically contiguous, zero-filled pages. Address spaces that map them keep a reference, so
+/// the pages are freed once the last mapping and handle are gone.
+pub struct SharedMemory {
+    pmr: PhysicalMemoryRegion,
+}
+
+impl SharedMemory {
+    pub fn new(size_bytes: usize) -> Result<Self, Error> {
+        let num_pages = num_pages_from_bytes(size_bytes).max(1);
+        let pmr = request_zeroed_pages(num_pages)?;
+        Ok(Self { pmr })
+    }
+
+    pub fn size_bytes(&self) -> usize {
+        self.pmr.num_pages() * PAGE_SIZE
+    }
+
+    /// Address of the memory in the linear map of DRAM, through which the kernel can access it
+    pub fn as_mut_ptr(&self) -> *mut u8 {
+        self.pmr.base_address().direct_mapped().as_mut_ptr()
+    }
+
+    pub(super) fn pmr(&self) -> &PhysicalMemoryRegion {
+        &self.pmr
+    }
+}
+
+impl Drop for SharedMemory {
+    fn drop(&mut self) {
+        MemoryManager::instance()
+            .release_pages(self.pmr.clone())
+            .expect("Cannot release shared memory");
+    }
+}
@@ -2,7 +2,8 @@ use crate::{
     collections::ring_buffer::{self, RingBuffer},
     drivers::{Dev, DeviceRef},
     init::is_kernel_relocated,
-    sync::spinlock::SpinLock,
+    process::ProcessHandle,
+    sync::{spinlock::SpinLock, wait_queue::WaitQueue},
     syscall::Syscall,
 };
 
@@ -47,10 +48,154 @@ const BUFFER_SIZE: usize = 1024 * 256;
 static BUFFER: RingBuffer<BUFFER_SIZE> = RingBuffer::new();
 static LOG_WRITER: SpinLock<Option<LogWriter>> = SpinLock::new(None);
 
+/// Notified whenever new data is pushed to any of the print buffers
+static DATA_AVAILABLE: WaitQueue = WaitQueue::new();
+
 struct LogWriter<'a> {
     writer: ring_buffer::Writer<'a, BUFFER_SIZE>,
 }
 
+const STDOUT_BUFFER_SIZE: usize = 1024 * 64;
+static STDOUT_BUFFER: RingBuffer<STDOUT_BUFFER_SIZE> = RingBuffer::new();
+static STDOUT_WRITER: SpinLock<Option<ring_buffer::Writer<'static, STDOUT_BUFFER_SIZE>>> =
+    SpinLock::new(None);
+
+/// Pid reported for stdout records that do not originate from a process
+const KERNEL_PID: u64 = u64::MAX;
+
+/// Metadata stored once at the start of every record in the stdout ring, followed by `length`
+/// bytes of raw output.
+struct StdoutRecordHeader {
+    pid: u64,
+    length: u32,
+}
+
+impl StdoutRecordHeader {
+    const SIZE: usize = 12;
+
+    fn to_bytes(&self) -> [u8; Self::SIZE] {
+        let mut bytes = [0; Self::SIZE];
+        bytes[..8].copy_from_slice(&self.pid.to_le_bytes());
+        bytes[8..].copy_from_slice(&self.length.to_le_bytes());
+        bytes
+    }
+
+    fn from_bytes(bytes: &[u8; Self::SIZE]) -> Self {
+        Self {
+            pid: u64::from_le_bytes(bytes[..8].try_into().unwrap()),
+            length: u32::from_le_bytes(bytes[8..].try_into().unwrap()),
+        }
+    }
+}
+
+/// Appends a single record made of all the given segments to the stdout ring. The data is copied
+/// as-is, it is not validated nor formatted. The whole record is dropped if it does not fit.
+pub fn write_stdout(pid: Option<&ProcessHandle>, segments: &[&[u8]]) -> Result<(), Error> {
+    let length: usize = segments.iter().map(|segment| segment.len()).sum();
+    let header = StdoutRecordHeader {
+        pid: pid.map(|pid| pid.get_raw()).unwrap_or(KERNEL_PID),
+        length: length.try_into().map_err(|_| Error::BufferFull)?,
+    };
+
+    let mut writer = STDOUT_WRITER.lock();
+    let writer = writer.get_or_insert_with(|| {
+        STDOUT_BUFFER
+            .split_writer()
+            .expect("The stdout buffer should not be split")
+    });
+
+    if writer.free_space() < (StdoutRecordHeader::SIZE + length) {
+        return Err(Error::BufferFull);
+    }
+
+    writer
+        .push_slice(&header.to_bytes())
+        .map_err(|_| Error::BufferFull)?;
+    for segment in segments {
+        writer.push_slice(segment).map_err(|_| Error::BufferFull)?;
+    }
+
+    DATA_AVAILABLE.notify_all();
+    Ok(())
+}
+
+/// Maximum number of bytes handed to the logger while holding the print locks. Interrupts are
+/// masked while the locks are held, so this keeps the latency bounded on slow loggers.
+const MAX_BURST_SIZE: usize = 32;
+
+fn write_to_logger(data: &[u8]) {
+    for burst in data.chunks(MAX_BURST_SIZE) {
+        let mut lock = PRINT.lock();
+        if let Some(lock) = lock.as_mut() {
+            let mut lock = lock.lock_write();
+            match &mut *lock {
+                Dev::Logger(logger) => {
+                    logger.write_bytes(burst).unwrap();
+                }
+                _ => {
+                    panic!("Printer must be a Dev::Logger instance");
+                }
+            };
+        }
+    }
+}
+
+/// Writes data straight to the logger, ahead of anything still in the print buffers.
+pub(crate) fn write_raw(data: &[u8]) {
+    write_to_logger(data);
+}
+
+/// Forwards all data currently in the reader to the logger. Returns the number of bytes written.
+fn drain_reader<const SIZE: usize>(
+    reader: &mut ring_buffer::Reader<'_, SIZE>,
+    max_len: usize,
+) -> usize {
+    let (first, second) = reader.readable_slices();
+    let first = &first[..first.len().min(max_len)];
+    let second = &second[..second.len().min(max_len - first.len())];
+
+    write_to_logger(first);
+    write_to_logger(second);
+
+    let len = first.len() + second.len();
+    reader.consume(len).unwrap();
+    len
+}
+
+/// Pops a whole record from the stdout ring and forwards it to the logger, prefixed with its pid.
+/// Returns false if there were no records available.
+fn drain_stdout_record(reader: &mut ring_buffer::Reader<'_, STDOUT_BUFFER_SIZE>) -> bool {
+    if reader.fill_level() < StdoutRecordHeader::SIZE {
+        return false;
+    }
+
+    let mut header = [0; StdoutRecordHeader::SIZE];
+    for byte in header.iter_mut() {
+        *byte = reader.pop().unwrap();
+    }
+    let header = StdoutRecordHeader::from_bytes(&header);
+
+    let mut tag: heapless::String<32> = heapless::String::new();
+    if header.pid == KERNEL_PID {
+        write!(tag, "[kernel] ").unwrap();
+    } else {
+        write!(tag, "[pid {}] ", header.pid).unwrap();
+    }
+    write_to_logger(tag.as_bytes());
+
+    let mut remaining = header.length as usize;
+    while remaining > 0 {
+        let written = drain_reader(reader, remaining);
+        if written == 0 {
+            // The writer publishes the header before the payload, so the rest of the record
+            // is guaranteed to arrive shortly
+            Syscall::yield_exec();
+        }
+        remaining -= written;
+    }
+    true
+}
+
 impl<'a> Write for LogWriter<'a> {
     fn write_str(&mut self, s: &str) -> core::fmt::Result {
         for c in s.bytes() {
@@ -74,11 +219,11 @@ pub fn _print(args: core::fmt::Arguments) -> Result<(), Error> {
             });
         }
 
-        writer
-            .as_mut()
-            .unwrap()
-            .write_fmt(args)
-            .map_err(|_| Error::BufferFull)?;
+        let result = writer.as_mut().unwrap().write_fmt(args);
+
+        // Whatever made it into the buffer needs to be printed, even if the record got truncated
+        DATA_AVAILABLE.notify_all();
+        result.map_err(|_| Error::BufferFull)?;
     } else {
         // We check if there is an EarlyPrint implementation and use that.
 
@@ -105,6 +250,9 @@ pub unsafe fn register_early_printer<T: EarlyPrint>(printer: &'static mut T) {
 #[inline]
 pub fn register_printer(printer: DeviceRef) {
     let mut reader = BUFFER.split_reader().expect("The buffer is already split!");
+    let mut stdout_reader = STDOUT_BUFFER
+        .split_reader()
+        .expect("The stdout buffer is already split!");
 
     match &*printer.lock_read() {
         Dev::Logger(_) => {}
@@ -118,32 +266,19 @@ pub fn register_printer(printer: DeviceRef) {
         .spawn(move || {
             PRINT.lock().replace(printer);
             loop {
-                match reader.pop() {
-                    Ok(val) => {
-                        let mut lock = PRINT.lock();
-                        if let Some(lock) = lock.as_mut() {
-                            let mut lock = lock.lock_write();
-                            match &mut *lock {
-                                Dev::Logger(logger) => {
-                                    logger.write_u8(val).unwrap();
-                                }
-                                _ => {
-                                    panic!("Printer must be a Dev::Logger instance");
-                                }
-                            };
-                        }
-                    }
-                    Err(ring_buffer::Error::WouldBlock) => {
-                        // TODO(javier-varez): Sleep here waiting for condition to happen instead of looping
-                        // At the time of this writing there is no mechanism to do this.
-                        // We can at least yield to the scheduler again
-                        Syscall::yield_exec();
-                        continue;
-                    }
-                    Err(e) => {
-                        panic!("Error reading from the print buffer, {:?}", e);
-                    }
+                // The token must be taken before checking the buffers, otherwise data pushed in
+                // between would not wake us up
+                let token = DATA_AVAILABLE.token();
+
+                if drain_reader(&mut reader, BUFFER_SIZE) != 0 {
+                    continue;
                 }
+
+                if drain_stdout_record(&mut stdout_reader) {
+                    continue;
+                }
+
+                DATA_AVAILABLE.wait(token);
             }
         });
 }
@@ -163,9 +298,11 @@ pub unsafe fn force_flush() {
                         panic!("Printer must be a Dev::Logger instance");
                     }
                 };
-                while let Ok(val) = reader.pop() {
-                    logger.write_u8(val).unwrap();
-                }
+                let (first, second) = reader.readable_slices();
+                logger.write_bytes(first).unwrap();
+                logger.write_bytes(second).unwrap();
+                let len = first.len() + second.len();
+                reader.consume(len).unwrap();
             });
     });
 }
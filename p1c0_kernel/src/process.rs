@@ -1,12 +1,17 @@
+pub mod image;
+mod system_page;
+
 use crate::{
     arch::{exceptions::ExceptionContext, mmu::PAGE_SIZE},
-    elf::{self, ElfParser},
+    elf,
+    filesystem::{self, FileDescription, OpenMode, VirtualFileSystem},
+    ipc,
     memory::{
         self,
         address::{Address, VirtualAddress},
-        address_space::{self, ProcessAddressSpace},
-        num_pages_from_bytes,
+        address_space::{self, FaultKind, ProcessAddressSpace},
         physical_page_allocator::PhysicalMemoryRegion,
+        shared_memory::SharedMemory,
         GlobalPermissions, MemoryManager, Permissions,
     },
     prelude::*,
@@ -14,7 +19,9 @@ use crate::{
     thread::{self, ThreadHandle},
 };
 
+use alloc::borrow::Cow;
 use core::sync::atomic::{AtomicU64, Ordering};
+use image::ExecutableImage;
 
 #[derive(Debug)]
 pub enum Error {
@@ -24,9 +31,14 @@ pub enum Error {
     NoCurrentProcess,
     InvalidBase,
     ElfError(elf::Error),
+    FilesystemError(filesystem::Error),
     UnsupportedExecutable,
     UnalignedLoadableSegment,
     NoEntryPoint,
+    InvalidFileDescriptor,
+    EmptyFile,
+    ArgumentsTooLong,
+    InvalidSize,
 }
 
 impl From<address_space::Error> for Error {
@@ -41,6 +53,12 @@ impl From<memory::Error> for Error {
     }
 }
 
+impl From<filesystem::Error> for Error {
+    fn from(e: filesystem::Error) -> Self {
+        Error::FilesystemError(e)
+    }
+}
+
 impl From<thread::Error> for Error {
     fn from(e: thread::Error) -> Self {
         Error::ThreadError(e)
@@ -71,7 +89,7 @@ pub struct Builder {
     environment: FlatMap<String, String>,
     entrypoint: Option<VirtualAddress>,
     aslr_base: Option<VirtualAddress>,
-    elf_data: Vec<u8>,
+    image: Option<Arc<ExecutableImage>>,
 }
 
 impl Default for Builder {
@@ -82,7 +100,7 @@ impl Default for Builder {
             environment: FlatMap::new(),
             entrypoint: None,
             aslr_base: None,
-            elf_data: vec![],
+            image: None,
         }
     }
 }
@@ -98,46 +116,13 @@ impl Builder {
         self.entrypoint = Some(entrypoint);
     }
 
-    pub fn set_elf_data(&mut self, elf_data: Vec<u8>) {
-        self.elf_data = elf_data;
-    }
-
     pub fn set_aslr_base(&mut self, aslr_base: VirtualAddress) {
         self.aslr_base = Some(aslr_base);
     }
 
-    fn copy_section(&mut self, pmr: &PhysicalMemoryRegion, data: &[u8]) {
-        // Initialize the physical page
-        let mut remaining_bytes = data.len();
-        let mut current_offset = 0;
-
-        for i in 0..pmr.num_pages() {
-            let pa = unsafe { pmr.base_address().offset(i * PAGE_SIZE) };
-            let chunk_size = if remaining_bytes >= PAGE_SIZE {
-                PAGE_SIZE
-            } else {
-                remaining_bytes
-            };
-
-            let page_data = &data[current_offset..];
-
-            // Try to perform a fast mapping of the page to load the contents
-            MemoryManager::instance().do_with_fast_map(
-                pa,
-                GlobalPermissions::new_only_privileged(Permissions::RW),
-                |va| unsafe {
-                    core::ptr::copy_nonoverlapping(page_data.as_ptr(), va.as_mut_ptr(), chunk_size);
-                },
-            );
-
-            remaining_bytes -= chunk_size;
-            current_offset += chunk_size;
-        }
-
-        assert_eq!(remaining_bytes, 0);
-        assert_eq!(current_offset, data.len());
-    }
-
+    /// Maps a section whose pages are populated from `data` when the process first touches them.
+    /// `data` has to outlive the process, which is the case for data borrowed from the executable
+    /// image of the builder, since the process keeps a reference to it.
     pub fn map_section(
         &mut self,
         name: &str,
@@ -146,22 +131,53 @@ impl Builder {
         data: &[u8],
         permissions: Permissions,
     ) -> Result<(), Error> {
-        log_debug!("Mapping section `{}` for new process", name);
-
-        // TODO(javier-varez): In reality this should be done lazily in most cases
-        assert!(size_bytes >= data.len());
+        let backing = if data.is_empty() {
+            address_space::Backing::Zero
+        } else {
+            address_space::Backing::File {
+                data: data.as_ptr(),
+                len: data.len(),
+            }
+        };
+        self.map_lazy_section(name, va, size_bytes, backing, permissions)
+    }
 
-        let num_pages = num_pages_from_bytes(size_bytes);
-        let pmr = MemoryManager::instance()
-            .request_any_pages(num_pages, memory::AllocPolicy::ZeroFill)?;
+    /// Like `map_section`, but pages are shared with any other process mapping the same static
+    /// data until they are written.
+    fn map_shared_section(
+        &mut self,
+        name: &str,
+        va: VirtualAddress,
+        size_bytes: usize,
+        data: &'static [u8],
+        permissions: Permissions,
+    ) -> Result<(), Error> {
+        let backing = if data.is_empty() {
+            address_space::Backing::Zero
+        } else {
+            address_space::Backing::SharedFile {
+                data: data.as_ptr(),
+                len: data.len(),
+            }
+        };
+        self.map_lazy_section(name, va, size_bytes, backing, permissions)
+    }
 
-        self.copy_section(&pmr, data);
+    fn map_lazy_section(
+        &mut self,
+        name: &str,
+        va: VirtualAddress,
+        size_bytes: usize,
+        backing: address_space::Backing,
+        permissions: Permissions,
+    ) -> Result<(), Error> {
+        log_debug!("Mapping section `{}` for new process", name);
 
-        self.address_space.map_section(
+        self.address_space.map_lazy_section(
             name,
             va,
-            pmr,
             size_bytes,
+            backing,
             GlobalPermissions::new_for_process(permissions),
         )?;
 
@@ -177,117 +193,148 @@ impl Builder {
     }
 
     fn map_stack(&mut self, aslr_base: VirtualAddress) -> Result<VirtualAddress, Error> {
-        let num_pages = num_pages_from_bytes(Self::STACK_SIZE);
-        let pmr = MemoryManager::instance()
-            .request_any_pages(num_pages, memory::AllocPolicy::ZeroFill)?;
-
         let stack_va =
             VirtualAddress::try_from_ptr((0xF00000000000 + aslr_base.as_u64()) as *const _)
                 .map_err(|_e| Error::InvalidBase)?;
-        self.address_space.map_section(
+        self.address_space.map_lazy_section(
             ".stack",
             stack_va,
-            pmr,
             Self::STACK_SIZE,
+            address_space::Backing::Zero,
             GlobalPermissions::new_for_process(Permissions::RW),
         )?;
         Ok(stack_va)
     }
 
+    fn map_system_page(&mut self) -> Result<VirtualAddress, Error> {
+        let page = system_page::get()?;
+        let va = self
+            .address_space
+            .reserve_runtime_range(page.size_bytes())?;
+        self.address_space.map_shared_memory(
+            ".system",
+            va,
+            page,
+            GlobalPermissions::new_for_process(Permissions::RO),
+        )?;
+        Ok(va)
+    }
+
+    /// Returns an upper bound of the bytes needed to map the arguments and the environment
+    fn arguments_size(&self) -> usize {
+        let pointer_size = core::mem::size_of::<*const u8>();
+        let arguments: usize = self.arguments.iter().map(|arg| arg.len() + 1).sum();
+        let environment: usize = self
+            .environment
+            .iter()
+            .map(|(key, value)| key.len() + value.len() + 2)
+            .sum();
+
+        // Both pointer arrays are null terminated, aligned to the pointer size and followed by a
+        // zero byte
+        let arrays =
+            (self.arguments.len() + self.environment.len() + 2) * pointer_size + 2 * pointer_size;
+        arguments + environment + arrays
+    }
+
     fn map_arguments(
         &mut self,
         aslr_base: VirtualAddress,
     ) -> Result<(usize, VirtualAddress, VirtualAddress), Error> {
+        if self.arguments_size() > PAGE_SIZE {
+            return Err(Error::ArgumentsTooLong);
+        }
+
         let mut mapped_arg_addresses: Vec<*const u8> = vec![];
         let mut mapped_env_addresses: Vec<*const u8> = vec![];
 
         let args_va_start = unsafe {
             VirtualAddress::new_unchecked(0xF80000000000 as *const _).offset(aslr_base.as_usize())
         };
-        // We are going to assume that args + environment fit in the PAGE_SIZE, which should REALLY be the case
-        let pmr = MemoryManager::instance().request_any_pages(1, memory::AllocPolicy::ZeroFill)?;
+        // The arguments and the environment were checked to fit in a single page
+        let pmr = memory::request_zeroed_pages(1)?;
         let pmr_base_address = pmr.base_address();
 
-        self.address_space.map_section(
+        if let Err(e) = self.address_space.map_section(
             ".args",
             args_va_start,
-            pmr,
+            pmr.clone(),
             PAGE_SIZE,
             GlobalPermissions::new_for_process(Permissions::RO),
-        )?;
+        ) {
+            MemoryManager::instance().release_pages(pmr)?;
+            return Err(e.into());
+        }
 
-        Ok(MemoryManager::instance().do_with_fast_map(
-            pmr_base_address,
-            GlobalPermissions::new_only_privileged(Permissions::RW),
-            |tmp_va| {
-                let mut offset = 0;
-
-                let mut copy_string = |str: &str| {
-                    let len = str.len();
-                    let va = unsafe { args_va_start.offset(offset) };
-
-                    assert!((offset + len + 1) <= PAGE_SIZE);
-                    unsafe {
-                        core::ptr::copy_nonoverlapping(
-                            str.as_ptr(),
-                            tmp_va.offset(offset).as_mut_ptr(),
-                            len,
-                        );
-                        offset += len;
-                        core::ptr::write(tmp_va.offset(offset).as_mut_ptr(), 0);
-                        offset += 1;
-                    }
-                    va
-                };
-                for arg in &self.arguments {
-                    let va = copy_string(arg);
-                    mapped_arg_addresses.push(va.as_ptr());
-                }
+        // The page is not mapped in the current address space yet, so fill it through the linear
+        // map of DRAM
+        let tmp_va = pmr_base_address.direct_mapped();
+        let mut offset = 0;
+
+        let mut copy_string = |str: &str| {
+            let len = str.len();
+            let va = unsafe { args_va_start.offset(offset) };
+
+            assert!((offset + len + 1) <= PAGE_SIZE);
+            unsafe {
+                core::ptr::copy_nonoverlapping(
+                    str.as_ptr(),
+                    tmp_va.offset(offset).as_mut_ptr(),
+                    len,
+                );
+                offset += len;
+                core::ptr::write(tmp_va.offset(offset).as_mut_ptr(), 0);
+                offset += 1;
+            }
+            va
+        };
+        for arg in &self.arguments {
+            let va = copy_string(arg);
+            mapped_arg_addresses.push(va.as_ptr());
+        }
 
-                for (key, value) in self.environment.iter() {
-                    let mut envvar = key.clone();
-                    envvar.push('=');
-                    envvar.push_str(value);
+        for (key, value) in self.environment.iter() {
+            let mut envvar = key.clone();
+            envvar.push('=');
+            envvar.push_str(value);
 
-                    let va = copy_string(&envvar);
-                    mapped_env_addresses.push(va.as_ptr());
-                }
+            let va = copy_string(&envvar);
+            mapped_env_addresses.push(va.as_ptr());
+        }
+
+        // Now that the data is there, we need to push the arrays
+        let argc = mapped_arg_addresses.len();
+
+        mapped_arg_addresses.push(core::ptr::null());
+        mapped_env_addresses.push(core::ptr::null());
 
-                // Now that the data is there, we need to push the arrays
-                let argc = mapped_arg_addresses.len();
-
-                mapped_arg_addresses.push(core::ptr::null());
-                mapped_env_addresses.push(core::ptr::null());
-
-                let mut copy_slice = |slice: &[*const u8]| {
-                    let size_bytes = slice.len() * core::mem::size_of::<*const u8>();
-
-                    // Align offset to pointer size
-                    let alignment = offset % core::mem::size_of::<*const u8>();
-                    if alignment != 0 {
-                        offset += core::mem::size_of::<*const u8>() - alignment;
-                    }
-
-                    let va = unsafe { args_va_start.offset(offset) };
-
-                    assert!((offset + size_bytes) <= PAGE_SIZE);
-                    unsafe {
-                        core::ptr::copy_nonoverlapping(
-                            slice.as_ptr(),
-                            tmp_va.offset(offset).as_mut_ptr() as *mut *const u8,
-                            slice.len(),
-                        );
-                        offset += size_bytes;
-                        core::ptr::write(tmp_va.offset(offset).as_mut_ptr(), 0);
-                        offset += 1;
-                    }
-                    va
-                };
-                let argv = copy_slice(&mapped_arg_addresses);
-                let envp = copy_slice(&mapped_env_addresses);
-                (argc, argv, envp)
-            },
-        ))
+        let mut copy_slice = |slice: &[*const u8]| {
+            let size_bytes = slice.len() * core::mem::size_of::<*const u8>();
+
+            // Align offset to pointer size
+            let alignment = offset % core::mem::size_of::<*const u8>();
+            if alignment != 0 {
+                offset += core::mem::size_of::<*const u8>() - alignment;
+            }
+
+            let va = unsafe { args_va_start.offset(offset) };
+
+            assert!((offset + size_bytes) <= PAGE_SIZE);
+            unsafe {
+                core::ptr::copy_nonoverlapping(
+                    slice.as_ptr(),
+                    tmp_va.offset(offset).as_mut_ptr() as *mut *const u8,
+                    slice.len(),
+                );
+                offset += size_bytes;
+                core::ptr::write(tmp_va.offset(offset).as_mut_ptr(), 0);
+                offset += 1;
+            }
+            va
+        };
+        let argv = copy_slice(&mapped_arg_addresses);
+        let envp = copy_slice(&mapped_env_addresses);
+        Ok((argc, argv, envp))
     }
 
     pub fn start(mut self) -> Result<ProcessHandle, Error> {
@@ -297,6 +344,7 @@ impl Builder {
             .unwrap_or_else(|| VirtualAddress::new_unaligned(core::ptr::null()));
         let stack_va = self.map_stack(aslr_base)?;
         let args = self.map_arguments(aslr_base)?;
+        let system_page_va = self.map_system_page()?;
 
         // Reserve PID
         let pid = NUM_PROCESSES.fetch_add(1, Ordering::Relaxed);
@@ -307,7 +355,9 @@ impl Builder {
             state: State::Running,
             pid,
             aslr_base,
-            elf_data: self.elf_data,
+            image: self.image,
+            open_files: vec![],
+            ipc_handles: vec![],
         })));
 
         // Lock before we create threads or we might get preempted before the process is valid, but
@@ -321,6 +371,7 @@ impl Builder {
             entrypoint,
             aslr_base,
             args,
+            system_page_va,
         );
         process.thread_list.push(thread_id);
 
@@ -329,88 +380,76 @@ impl Builder {
     }
 
     pub fn new_from_elf_data(name: &str, elf_data: Vec<u8>, aslr: usize) -> Result<Builder, Error> {
-        let elf = ElfParser::from_slice(&elf_data[..]).map_err(|e| Error::ElfError(e))?;
-        if !matches!(
-            elf.elf_type(),
-            elf::EType::Executable | elf::EType::SharedObject
-        ) {
-            log_warning!("Elf file is not executable, bailing");
-            return Err(Error::UnsupportedExecutable);
-        }
+        let image = ExecutableImage::parse(Cow::Owned(elf_data))?;
+        Self::new_from_image(name, Arc::new(image), aslr)
+    }
 
-        let mut process_builder = Builder::new();
-        for header in elf.program_header_iter() {
-            let header_type = header.ty().map_err(|e| Error::ElfError(e))?;
-            if matches!(header_type, elf::PtType::Load) {
-                log_debug!(
-                    "Virtual addr 0x{:x}, Physical addr 0x{:x}, Size in process {} Size in file {}",
-                    header.vaddr(),
-                    header.paddr(),
-                    header.memsize(),
-                    header.filesize()
-                );
+    /// Creates a process from an ELF image that is resident for the lifetime of the kernel. The
+    /// image is not copied, and its pages are shared by all processes running it until they are
+    /// written.
+    pub fn new_from_static_elf_data(
+        name: &str,
+        elf_data: &'static [u8],
+        aslr: usize,
+    ) -> Result<Builder, Error> {
+        let image = ExecutableImage::parse(Cow::Borrowed(elf_data))?;
+        Self::new_from_image(name, Arc::new(image), aslr)
+    }
 
-                let vaddr = (header.vaddr() as usize + aslr) as *const _;
-                let vaddr = VirtualAddress::try_from_ptr(vaddr)
-                    .map_err(|_| Error::UnalignedLoadableSegment)?;
-
-                let segment_data = elf.get_segment_data(&header);
-
-                let permissions = match header.permissions() {
-                    elf::Permissions {
-                        read: true,
-                        write: true,
-                        exec: false,
-                    } => Permissions::RW,
-                    elf::Permissions {
-                        read: true,
-                        write: false,
-                        exec: false,
-                    } => Permissions::RO,
-                    elf::Permissions {
-                        read: _,
-                        write: false,
-                        exec: true,
-                    } => Permissions::RX,
-                    elf::Permissions {
-                        read: true,
-                        write: true,
-                        exec: true,
-                    } => Permissions::RWX,
-                    elf::Permissions { read, write, exec } => {
-                        let read = if read { "R" } else { "-" };
-                        let write = if write { "W" } else { "-" };
-                        let exec = if exec { "X" } else { "-" };
-                        panic!(
-                            "Unsupported set of permissions found in elf {}{}{}",
-                            read, write, exec
-                        );
-                    }
-                };
+    /// Creates a process from the executable at `path`. The executable is only parsed the first
+    /// time it is loaded, see `image::load`.
+    pub fn new_from_file(path: &str, aslr: usize) -> Result<Builder, Error> {
+        Self::new_from_image(path, image::load(path)?, aslr)
+    }
 
-                process_builder.map_section(
-                    elf.matching_section_name(&header)
-                        .map_err(|e| Error::ElfError(e))?
-                        .unwrap_or(""),
+    fn new_from_image(
+        name: &str,
+        image: Arc<ExecutableImage>,
+        aslr: usize,
+    ) -> Result<Builder, Error> {
+        let mut process_builder = Builder::new();
+        for segment in image.segments() {
+            let vaddr = VirtualAddress::try_from_ptr((segment.vaddr + aslr) as *const _)
+                .map_err(|_| Error::UnalignedLoadableSegment)?;
+            let section_name = image.segment_name(segment);
+
+            if let Some(segment_data) = image.static_segment_data(segment) {
+                // Segments of static images are mapped in place
+                process_builder.map_shared_section(
+                    section_name,
                     vaddr,
-                    header.memsize() as usize,
+                    segment.size_bytes,
                     segment_data,
-                    permissions,
+                    segment.permissions,
                 )?;
             } else {
-                log_warning!("Unhandled ELF program header with type {:?}", header_type);
+                process_builder.map_section(
+                    section_name,
+                    vaddr,
+                    segment.size_bytes,
+                    image.segment_data(segment),
+                    segment.permissions,
+                )?;
             }
         }
 
         process_builder.set_aslr_base(VirtualAddress::new_unaligned(aslr as *const _));
-        let vaddr = (elf.entry_point() as usize + aslr) as *const _;
+        let vaddr = (image.entry_point() + aslr) as *const _;
         process_builder.set_entrypoint(VirtualAddress::new_unaligned(vaddr));
-        process_builder.set_elf_data(elf_data);
+        // The image is kept alive by the process, so the sections can keep pointing to it
+        process_builder.image = Some(image);
         process_builder.push_argument(name);
         Ok(process_builder)
     }
 }
 
+enum FileSlot {
+    Closed,
+    Open(FileDescription),
+    /// The description is in use by a syscall of one of the threads of the process
+    Busy,
+}
+
 pub struct Process {
     address_space: ProcessAddressSpace,
     // List of thread IDs of our threads
@@ -418,7 +457,11 @@ pub struct Process {
     state: State,
     pid: u64,
     aslr_base: VirtualAddress,
-    elf_data: Vec<u8>,
+    image: Option<Arc<ExecutableImage>>,
+    /// Files opened by the process, indexed by file descriptor. Closed descriptors are reused.
+    open_files: Vec<FileSlot>,
+    /// IPC objects held by the process, released when it is killed
+    ipc_handles: Vec<ipc::Handle>,
 }
 
 impl Process {
@@ -427,9 +470,8 @@ impl Process {
     }
 
     pub fn symbolicator(&self) -> ProcessSymbolicator<'_> {
-        let elf_parser = ElfParser::from_slice(&self.elf_data[..]).unwrap();
         ProcessSymbolicator {
-            elf_parser,
+            image: self.image.as_deref(),
             aslr_base: self.aslr_base,
         }
     }
@@ -443,11 +485,37 @@ impl Process {
             State::Running => None,
         }
     }
+
+    fn insert_file(&mut self, file: FileDescription) -> u64 {
+        if let Some(fd) = self
+            .open_files
+            .iter()
+            .position(|slot| matches!(slot, FileSlot::Closed))
+        {
+            self.open_files[fd] = FileSlot::Open(file);
+            return fd as u64;
+        }
+
+        self.open_files.push(FileSlot::Open(file));
+        (self.open_files.len() - 1) as u64
+    }
+
+    /// Takes the description of an open file out of the process, leaving `slot` in its place
+    fn take_file(&mut self, fd: u64, slot: FileSlot) -> Option<FileDescription> {
+        let open_slot = self.open_files.get_mut(fd as usize)?;
+        match core::mem::replace(open_slot, slot) {
+            FileSlot::Open(file) => Some(file),
+            other => {
+                *open_slot = other;
+                None
+            }
+        }
+    }
 }
 
 #[derive(Clone)]
 pub struct ProcessSymbolicator<'a> {
-    elf_parser: ElfParser<'a>,
+    image: Option<&'a ExecutableImage>,
     aslr_base: VirtualAddress,
 }
 
@@ -455,20 +523,9 @@ impl<'a> crate::backtrace::Symbolicator for ProcessSymbolicator<'a> {
     fn symbolicate(&self, addr: VirtualAddress) -> Option<(String, usize)> {
         let addr = addr.remove_base(self.aslr_base).as_usize();
 
-        self.elf_parser
-            .symbol_table_iter()?
-            .filter(|symbol| matches!(symbol.ty(), Ok(elf::SymbolType::Function)))
-            .find_map(|symbol| {
-                let symbol_start = symbol.value() as usize;
-                let symbol_size = symbol.size() as usize;
-                if (addr >= symbol_start) && (addr < (symbol_start + symbol_size)) {
-                    symbol
-                        .name()
-                        .map(|string| (string.to_string(), addr - symbol_start))
-                } else {
-                    None
-                }
-            })
+        self.image?
+            .symbolicate(addr)
+            .map(|(name, offset)| (name.to_string(), offset))
     }
 }
 
@@ -484,6 +541,20 @@ pub(crate) fn do_with_process<T>(
     f(proc)
 }
 
+/// Resolves a fault of the current process at `va` by populating the page or by copying a shared
+/// page on write. Returns an error if the access is not allowed.
+pub(crate) fn handle_page_fault(
+    va: VirtualAddress,
+    kind: FaultKind,
+    is_write: bool,
+) -> Result<(), Error> {
+    let pid = thread::current_pid().ok_or(Error::NoCurrentProcess)?;
+    do_with_process(&pid, |process| {
+        process.address_space.handle_page_fault(va, kind, is_write)
+    })?;
+    Ok(())
+}
+
 pub(crate) fn kill_current_process(
     cx: &mut ExceptionContext,
     error_code: u64,
@@ -505,6 +576,19 @@ pub(crate) fn kill_current_process(
         error_code
     );
 
+    for slot in killed_proc.open_files.drain(..) {
+        if let FileSlot::Open(file) = slot {
+            VirtualFileSystem::close(file);
+        }
+    }
+
+    for handle in killed_proc.ipc_handles.drain(..) {
+        ipc::release_handle(handle);
+    }
+
+    // Zombies only keep their exit code, so their pages can be given back right away
+    killed_proc.address_space.release_ranges();
+
     thread::wake_threads_waiting_on_pid(&pid, error_code);
     thread::exit_matching_threads(&mut killed_proc.thread_list, cx)?;
 
@@ -513,6 +597,376 @@ pub(crate) fn kill_current_process(
     Ok(())
 }
 
+/// Starts the executable at `path`. If `arguments` is empty, the process gets the path as its
+/// only argument. Environment variables are given as `KEY=VALUE` strings.
+pub(crate) fn spawn(
+    path: &str,
+    arguments: &[&str],
+    environment: &[&str],
+) -> Result<ProcessHandle, Error> {
+    let mut builder = Builder::new_from_file(path, 0)?;
+    if !arguments.is_empty() {
+        builder.arguments.clear();
+        for arg in arguments {
+            builder.push_argument(arg);
+        }
+    }
+
+    for variable in environment {
+        let (key, value) = variable.split_once('=').unwrap_or((variable, ""));
+        builder.push_environment_variable(key, value);
+    }
+
+    builder.start()
+}
+
+/// Records that the current process holds `handle`. Returns false if it already did, or if the
+/// caller is a kernel thread.
+pub(crate) fn hold_ipc_handle(handle: ipc::Handle) -> bool {
+    let pid = match thread::current_pid() {
+        Some(pid) => pid,
+        None => return false,
+    };
+    do_with_process(&pid, |process| {
+        if process.ipc_handles.contains(&handle) {
+            return false;
+        }
+        process.ipc_handles.push(handle);
+        true
+    })
+}
+
+/// Forgets that the current process holds `handle`. Returns false if it did not.
+pub(crate) fn drop_ipc_handle(handle: &ipc::Handle) -> bool {
+    let pid = match thread::current_pid() {
+        Some(pid) => pid,
+        None => return false,
+    };
+    do_with_process(&pid, |process| {
+        match process.ipc_handles.iter().position(|held| held == handle) {
+            Some(index) => {
+                process.ipc_handles.swap_remove(index);
+                true
+            }
+            None => false,
+        }
+    })
+}
+
+/// Opens the file at `path` for reading in the current process and returns its descriptor
+pub(crate) fn open_file(path: &str) -> Result<u64, Error> {
+    let pid = thread::current_pid().ok_or(Error::NoCurrentProcess)?;
+    let mut file = Some(VirtualFileSystem::open(path, OpenMode::Read)?);
+    Ok(do_with_process(&pid, |process| {
+        process.insert_file(file.take().unwrap())
+    }))
+}
+
+/// Runs `f` with the file behind descriptor `fd` of the current process.
+///
+/// The description is taken out of the process while `f` runs, since `f` may touch memory of the
+/// process, and resolving a fault on it needs the process lock. Other threads of the process
+/// cannot use the descriptor in the meantime.
+fn with_file<T>(
+    fd: u64,
+    f: impl FnOnce(&mut FileDescription) -> Result<T, Error>,
+) -> Result<T, Error> {
+    let pid = thread::current_pid().ok_or(Error::NoCurrentProcess)?;
+    let mut file = do_with_process(&pid, |process| process.take_file(fd, FileSlot::Busy))
+        .ok_or(Error::InvalidFileDescriptor)?;
+
+    let result = f(&mut file);
+
+    let mut file = Some(file);
+    let file = do_with_process(&pid, |process| {
+        match process.open_files.get_mut(fd as usize) {
+            Some(slot) => {
+                *slot = FileSlot::Open(file.take().unwrap());
+                None
+            }
+            // The process was killed and its files closed
+            None => file.take(),
+        }
+    });
+    if let Some(file) = file {
+        VirtualFileSystem::close(file);
+    }
+    result
+}
+
+/// Reads from the file behind `fd` into `buffer`, which may be memory of the current process.
+/// Returns the number of bytes read, which is 0 at the end of the file.
+pub(crate) fn read_file(fd: u64, buffer: &mut [u8]) -> Result<usize, Error> {
+    with_file(fd, |file| Ok(VirtualFileSystem::read(file, buffer)?))
+}
+
+pub(crate) fn close_file(fd: u64) -> Result<(), Error> {
+    let pid = thread::current_pid().ok_or(Error::NoCurrentProcess)?;
+    let file = do_with_process(&pid, |process| process.take_file(fd, FileSlot::Closed))
+        .ok_or(Error::InvalidFileDescriptor)?;
+    VirtualFileSystem::close(file);
+    Ok(())
+}
+
+/// Maps the whole file behind `fd` read-only into the current process and returns its address.
+/// The mapping outlives the descriptor.
+pub(crate) fn map_file(fd: u64) -> Result<VirtualAddress, Error> {
+    let pid = thread::current_pid().ok_or(Error::NoCurrentProcess)?;
+    let mut mapping = Some(with_file(fd, |file| {
+        if file.size == 0 {
+            return Err(Error::EmptyFile);
+        }
+
+        match VirtualFileSystem::static_data(file) {
+            Some(data) => Ok(FileMapping::Shared(data)),
+            None => Ok(FileMapping::Private(read_file_into_pages(file)?, file.size)),
+        }
+    })?);
+
+    do_with_process(&pid, |process| {
+        mapping.take().unwrap().map_into(&mut process.address_space)
+    })
+}
+
+/// Maps `memory` read-write into the current process and returns its address
+pub(crate) fn map_shared_memory(memory: Arc<SharedMemory>) -> Result<VirtualAddress, Error> {
+    let pid = thread::current_pid().ok_or(Error::NoCurrentProcess)?;
+    let mut memory = Some(memory);
+    do_with_process(&pid, |process| {
+        let memory = memory.take().unwrap();
+        let address_space = &mut process.address_space;
+        let va = address_space.reserve_runtime_range(memory.size_bytes())?;
+        let name = alloc::format!("shm@{:x}", va.as_usize());
+        address_space.map_shared_memory(
+            &name,
+            va,
+            memory,
+            GlobalPermissions::new_for_process(Permissions::RW),
+        )?;
+        Ok(va)
+    })
+}
+
+fn anonymous_mapping_name(va: VirtualAddress) -> String {
+    alloc::format!("anon@{:x}", va.as_usize())
+}
+
+fn thread_stack_name(va: VirtualAddress) -> String {
+    alloc::format!("stack@{:x}", va.as_usize())
+}
+
+/// Maps `size_bytes` of zeroed memory read-write into the current process and returns its
+/// address. The size is rounded up to whole pages.
+pub(crate) fn map_anonymous(size_bytes: usize) -> Result<VirtualAddress, Error> {
+    if size_bytes == 0 {
+        return Err(Error::InvalidSize);
+    }
+
+    let pid = thread::current_pid().ok_or(Error::NoCurrentProcess)?;
+    let num_pages = memory::num_pages_from_bytes(size_bytes);
+    let mut pmr = Some(memory::request_zeroed_pages(num_pages)?);
+
+    do_with_process(&pid, |process| {
+        let pmr = pmr.take().unwrap();
+        let address_space = &mut process.address_space;
+        let va = match address_space.reserve_runtime_range(size_bytes) {
+            Ok(va) => va,
+            Err(e) => {
+                MemoryManager::instance().release_pages(pmr)?;
+                return Err(e.into());
+            }
+        };
+
+        if let Err(e) = address_space.map_section(
+            &anonymous_mapping_name(va),
+            va,
+            pmr.clone(),
+            num_pages * PAGE_SIZE,
+            GlobalPermissions::new_for_process(Permissions::RW),
+        ) {
+            MemoryManager::instance().release_pages(pmr)?;
+            return Err(e.into());
+        }
+        Ok(va)
+    })
+}
+
+/// Unmaps memory mapped with `map_anonymous` from the current process and frees its pages
+pub(crate) fn unmap_anonymous(va: VirtualAddress) -> Result<(), Error> {
+    let pid = thread::current_pid().ok_or(Error::NoCurrentProcess)?;
+    let pmr = do_with_process(&pid, |process| {
+        Ok(process
+            .address_space
+            .unmap_section(&anonymous_mapping_name(va))?)
+    })?;
+    MemoryManager::instance().release_pages(pmr)?;
+    Ok(())
+}
+
+/// Starts a thread of the current process at `entry_point`, which gets `argument` in its first
+/// register. Its stack of `stack_size` bytes, or of the default size if zero, is populated lazily.
+/// Returns the thread ID, which can be joined like any other thread.
+pub(crate) fn create_thread(
+    entry_point: VirtualAddress,
+    argument: u64,
+    stack_size: usize,
+) -> Result<u64, Error> {
+    let pid = thread::current_pid().ok_or(Error::NoCurrentProcess)?;
+    let stack_size = match stack_size {
+        0 => Builder::STACK_SIZE,
+        size => memory::num_pages_from_bytes(size) * PAGE_SIZE,
+    };
+
+    // The process stays locked until the thread is in its thread list, like in `Builder::start`
+    do_with_process(&pid, |process| {
+        let address_space = &mut process.address_space;
+
+        // Runtime ranges are separated by an unmapped page, which catches stack overflows
+        let stack_va = address_space.reserve_runtime_range(stack_size)?;
+        address_space.map_lazy_section(
+            &thread_stack_name(stack_va),
+            stack_va,
+            stack_size,
+            address_space::Backing::Zero,
+            GlobalPermissions::new_for_process(Permissions::RW),
+        )?;
+
+        let handle = thread::new_secondary_for_process(
+            pid.clone(),
+            stack_va,
+            stack_size,
+            entry_point,
+            argument,
+        );
+        let tid = handle.get_raw();
+        process.thread_list.push(handle);
+        Ok(tid)
+    })
+}
+
+/// Exits the calling thread. Threads of a process leave its thread list, and the process exits
+/// with code 0 when its last thread does.
+pub(crate) fn exit_current_thread(cx: &mut ExceptionContext) -> Result<(), Error> {
+    let (pid, handle) = match (thread::current_pid(), thread::current_thread_handle()) {
+        (Some(pid), Some(handle)) => (pid, handle),
+        _ => {
+            thread::exit_current_thread(cx);
+            return Ok(());
+        }
+    };
+
+    let stack = thread::current_process_stack();
+    let is_last_thread = do_with_process(&pid, |process| {
+        if process.thread_list.len() == 1 {
+            return true;
+        }
+        process.thread_list.retain(|thread| *thread != handle);
+
+        // Threads started with `create_thread` own their stack. The exiting thread does not run
+        // at EL0 again, so it can be unmapped while still in its syscall.
+        if let Some(stack) = stack {
+            match process
+                .address_space
+                .unmap_lazy_section(&thread_stack_name(stack))
+            {
+                Ok(()) | Err(address_space::Error::MemoryRangeNotFound(_)) => {}
+                Err(e) => log_error!("Cannot unmap thread stack: {:?}", e),
+            }
+        }
+        false
+    });
+
+    if is_last_thread {
+        // Killing the process also exits the thread
+        kill_current_process(cx, 0)
+    } else {
+        thread::exit_current_thread(cx);
+        Ok(())
+    }
+}
+
+/// Files that stay resident in memory are mapped lazily, sharing their pages with every other
+/// mapping of the same data through the page cache. Other files are read into private pages when
+/// they are mapped.
+enum FileMapping {
+    Shared(&'static [u8]),
+    Private(PhysicalMemoryRegion, usize),
+}
+
+impl FileMapping {
+    fn size(&self) -> usize {
+        match self {
+            FileMapping::Shared(data) => data.len(),
+            FileMapping::Private(_, size) => *size,
+        }
+    }
+
+    fn map_into(self, address_space: &mut ProcessAddressSpace) -> Result<VirtualAddress, Error> {
+        let va = match address_space.reserve_runtime_range(self.size()) {
+            Ok(va) => va,
+            Err(e) => {
+                if let FileMapping::Private(pmr, _) = self {
+                    MemoryManager::instance().release_pages(pmr)?;
+                }
+                return Err(e.into());
+            }
+        };
+
+        let name = alloc::format!("file@{:x}", va.as_usize());
+        let permissions = GlobalPermissions::new_for_process(Permissions::RO);
+        match self {
+            FileMapping::Shared(data) => address_space.map_lazy_section(
+                &name,
+                va,
+                data.len(),
+                address_space::Backing::SharedFile {
+                    data: data.as_ptr(),
+                    len: data.len(),
+                },
+                permissions,
+            )?,
+            FileMapping::Private(pmr, size) => {
+                if let Err(e) = address_space.map_section(
+                    &name,
+                    va,
+                    pmr.clone(),
+                    memory::num_pages_from_bytes(size) * PAGE_SIZE,
+                    permissions,
+                ) {
+                    MemoryManager::instance().release_pages(pmr)?;
+                    return Err(e.into());
+                }
+            }
+        }
+        Ok(va)
+    }
+}
+
+/// Reads the whole file into newly allocated pages. The tail of the last page is zeroed.
+fn read_file_into_pages(file: &mut FileDescription) -> Result<PhysicalMemoryRegion, Error> {
+    let num_pages = memory::num_pages_from_bytes(file.size);
+    let pmr = MemoryManager::instance().request_any_pages(num_pages, memory::AllocPolicy::None)?;
+
+    // The pages are not mapped anywhere yet, so fill them through the linear map of DRAM
+    let buffer = unsafe {
+        core::slice::from_raw_parts_mut(
+            pmr.base_address().direct_mapped().as_mut_ptr(),
+            num_pages * PAGE_SIZE,
+        )
+    };
+
+    match VirtualFileSystem::read_at(file, 0, &mut buffer[..file.size]) {
+        Ok(bytes) => {
+            buffer[bytes..].fill(0);
+            Ok(pmr)
+        }
+        Err(e) => {
+            MemoryManager::instance().release_pages(pmr)?;
+            Err(e.into())
+        }
+    }
+}
+
 pub(crate) fn validate_pid(pid: u64) -> Option<ProcessHandle> {
     PROCESSES
         .lock()
@@ -0,0 +1,282 @@
+//! Executables parsed into the plan needed to load them.
+//!
+//! Parsing an ELF file walks its program headers, section headers and symbol table. The result
+//! only depends on the contents of the file, so images loaded by path are kept in a cache and every
+//! process started from the same path reuses them. Files never change once the rootfs is mounted,
+//! so cached images are never invalidated.
+
+use super::Error;
+use crate::{
+    elf::{self, ElfParser},
+    filesystem::{OpenMode, VirtualFileSystem},
+    memory::Permissions,
+    prelude::*,
+    sync::spinlock::SpinLock,
+};
+
+use alloc::borrow::Cow;
+use core::ops::Range;
+
+static IMAGE_CACHE: SpinLock<FlatMap<String, Arc<ExecutableImage>>> =
+    SpinLock::new(FlatMap::new_no_capacity());
+
+/// A loadable segment. Addresses are relative to the load base of the image.
+pub struct Segment {
+    pub vaddr: usize,
+    pub size_bytes: usize,
+    pub permissions: Permissions,
+    /// Location of the initialized data and of the section name within the image
+    data: Range<usize>,
+    name: Range<usize>,
+}
+
+/// A function symbol. The name is located within the image.
+struct Symbol {
+    start: usize,
+    size: usize,
+    name: Range<usize>,
+}
+
+pub struct ExecutableImage {
+    data: Cow<'static, [u8]>,
+    segments: Vec<Segment>,
+    entry_point: usize,
+    /// Function symbols sorted by address
+    symbols: Vec<Symbol>,
+}
+
+/// Returns the location of `string` within `data`
+fn range_in(data: &[u8], string: &str) -> Range<usize> {
+    let start = string.as_ptr() as usize - data.as_ptr() as usize;
+    start..start + string.len()
+}
+
+fn segment_permissions(permissions: elf::Permissions) -> Result<Permissions, Error> {
+    match permissions {
+        elf::Permissions {
+            read: true,
+            write: true,
+            exec: false,
+        } => Ok(Permissions::RW),
+        elf::Permissions {
+            read: true,
+            write: false,
+            exec: false,
+        } => Ok(Permissions::RO),
+        elf::Permissions {
+            read: _,
+            write: false,
+            exec: true,
+        } => Ok(Permissions::RX),
+        elf::Permissions {
+            read: true,
+            write: true,
+            exec: true,
+        } => Ok(Permissions::RWX),
+        elf::Permissions { read, write, exec } => {
+            let read = if read { "R" } else { "-" };
+            let write = if write { "W" } else { "-" };
+            let exec = if exec { "X" } else { "-" };
+            log_warning!(
+                "Unsupported set of permissions found in elf {}{}{}",
+                read,
+                write,
+                exec
+            );
+            Err(Error::UnsupportedExecutable)
+        }
+    }
+}
+
+impl ExecutableImage {
+    /// Validates the ELF file in `data` and builds its load plan and symbol index
+    pub fn parse(data: Cow<'static, [u8]>) -> Result<Self, Error> {
+        let elf = ElfParser::from_slice(&data[..]).map_err(Error::ElfError)?;
+        if !matches!(
+            elf.elf_type(),
+            elf::EType::Executable | elf::EType::SharedObject
+        ) {
+            log_warning!("Elf file is not executable, bailing");
+            return Err(Error::UnsupportedExecutable);
+        }
+
+        let mut segments = vec![];
+        for header in elf.program_header_iter() {
+            let header_type = header.ty().map_err(Error::ElfError)?;
+            if !matches!(header_type, elf::PtType::Load) {
+                log_warning!("Unhandled ELF program header with type {:?}", header_type);
+                continue;
+            }
+
+            log_debug!(
+                "Virtual addr 0x{:x}, Physical addr 0x{:x}, Size in process {} Size in file {}",
+                header.vaddr(),
+                header.paddr(),
+                header.memsize(),
+                header.filesize()
+            );
+
+            let vaddr = header.vaddr() as usize;
+            if vaddr % crate::arch::mmu::PAGE_SIZE != 0 {
+                return Err(Error::UnalignedLoadableSegment);
+            }
+
+            let size_bytes = header.memsize() as usize;
+            let file_offset = header.file_offset() as usize;
+            let file_size = header.filesize() as usize;
+            if file_size > size_bytes
+                || file_offset
+                    .checked_add(file_size)
+                    .map_or(true, |end| end > data.len())
+            {
+                return Err(Error::UnsupportedExecutable);
+            }
+
+            let name = elf
+                .matching_section_name(&header)
+                .map_err(Error::ElfError)?
+                .map_or(0..0, |name| range_in(&data, name));
+
+            segments.push(Segment {
+                vaddr,
+                size_bytes,
+                permissions: segment_permissions(header.permissions())?,
+                data: file_offset..file_offset + file_size,
+                name,
+            });
+        }
+
+        let mut symbols: Vec<Symbol> = elf
+            .symbol_table_iter()
+            .into_iter()
+            .flatten()
+            .filter(|symbol| matches!(symbol.ty(), Ok(elf::SymbolType::Function)))
+            .filter(|symbol| symbol.size() != 0)
+            .filter_map(|symbol| {
+                let name = range_in(&data, symbol.name()?);
+                Some(Symbol {
+                    start: symbol.value() as usize,
+                    size: symbol.size() as usize,
+                    name,
+                })
+            })
+            .collect();
+        symbols.sort_unstable_by_key(|symbol| symbol.start);
+
+        let entry_point = elf.entry_point() as usize;
+        Ok(Self {
+            data,
+            segments,
+            entry_point,
+            symbols,
+        })
+    }
+
+    pub fn segments(&self) -> &[Segment] {
+        &self.segments
+    }
+
+    pub fn entry_point(&self) -> usize {
+        self.entry_point
+    }
+
+    /// Returns the name of the section that matches the segment, or an empty string
+    pub fn segment_name(&self, segment: &Segment) -> &str {
+        core::str::from_utf8(&self.data[segment.name.clone()]).unwrap_or("")
+    }
+
+    /// Returns the initialized data of the segment
+    pub fn segment_data(&self, segment: &Segment) -> &[u8] {
+        &self.data[segment.data.clone()]
+    }
+
+    /// Like `segment_data`, but only for images that stay resident for the lifetime of the kernel
+    pub fn static_segment_data(&self, segment: &Segment) -> Option<&'static [u8]> {
+        match self.data {
+            Cow::Borrowed(data) => Some(&data[segment.data.clone()]),
+            Cow::Owned(_) => None,
+        }
+    }
+
+    /// Returns the function containing `addr` and the offset of `addr` within it. Addresses are
+    /// relative to the load base of the image.
+    pub fn symbolicate(&self, addr: usize) -> Option<(&str, usize)> {
+        let index = self
+            .symbols
+            .partition_point(|symbol| symbol.start <= addr)
+            .checked_sub(1)?;
+        let symbol = &self.symbols[index];
+        if addr >= symbol.start + symbol.size {
+            return None;
+        }
+
+        let name = core::str::from_utf8(&self.data[symbol.name.clone()]).ok()?;
+        Some((name, addr - symbol.start))
+    }
+}
+
+/// Returns the parsed executable at `path`, parsing it the first time it is requested. Files that
+/// are resident in memory, like the ones in the initfs, are used in place.
+pub fn load(path: &str) -> Result<Arc<ExecutableImage>, Error> {
+    if let Some(image) = IMAGE_CACHE.lock().lookup(path) {
+        return Ok(image.clone());
+    }
+
+    // The file is read and parsed without holding the lock. If another thread loads the same path
+    // in the meantime, the image it cached is kept.
+    let mut file = VirtualFileSystem::open(path, OpenMode::Read)?;
+    let data = match VirtualFileSystem::static_data(&file) {
+        Some(data) => Ok(Cow::Borrowed(data)),
+        None => {
+            let mut data = vec![0; file.size];
+            VirtualFileSystem::read_at(&mut file, 0, &mut data[..]).map(|_| Cow::Owned(data))
+        }
+    };
+    VirtualFileSystem::close(file);
+    insert(path, data?)
+}
+
+fn insert(path: &str, data: Cow<'static, [u8]>) -> Result<Arc<ExecutableImage>, Error> {
+    let image = Arc::new(ExecutableImage::parse(data)?);
+
+    let mut cache = IMAGE_CACHE.lock();
+    if let Some(image) = cache.lookup(path) {
+        return Ok(image.clone());
+    }
+    cache.insert(path.to_string(), image.clone());
+    Ok(image)
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    #[test]
+    fn symbolicate_finds_containing_function() {
+        let image = ExecutableImage {
+            data: Cow::Borrowed(b"mainhelper"),
+            segments: vec![],
+            entry_point: 0x1000,
+            symbols: vec![
+                Symbol {
+                    start: 0x1000,
+                    size: 0x40,
+                    name: 0..4,
+                },
+                Symbol {
+                    start: 0x1080,
+                    size: 0x10,
+                    name: 4..10,
+                },
+            ],
+        };
+
+        assert_eq!(image.symbolicate(0xFFF), None);
+        assert_eq!(image.symbolicate(0x1000), Some(("main", 0)));
+        assert_eq!(image.symbolicate(0x103F), Some(("main", 0x3F)));
+        // Addresses between functions do not belong to any of them
+        assert_eq!(image.symbolicate(0x1040), None);
+        assert_eq!(image.symbolicate(0x1088), Some(("helper", 8)));
+        assert_eq!(image.symbolicate(0x1090), None);
+    }
+}
@@ -0,0 +1,110 @@
+//! A read-only page mapped into every process, through which the kernel publishes data that
+//! userspace reads without a syscall, like the parameters needed to turn `CNTVCT_EL0` into time.
+//!
+//! The page is created on first use and never changes size. Its layout is versioned and matches
+//! `libcxx::time::SystemPage`. Fields that change after boot are updated under `sequence`, so
+//! readers can retry reads that raced with an update.
+
+use super::Error;
+use crate::{
+    arch::mmu::PAGE_SIZE,
+    drivers::{generic_timer::get_timer, interfaces::timer::Timer},
+    memory::shared_memory::SharedMemory,
+    prelude::*,
+    sync::spinlock::SpinLock,
+};
+
+use core::sync::atomic::{AtomicU32, AtomicU64, Ordering};
+
+/// Incremented whenever fields are added. New fields are only ever appended.
+const VERSION: u32 = 1;
+
+/// Fixed point shift of `ns_mult`
+const NS_SHIFT: u32 = 32;
+
+#[repr(C)]
+struct SystemPageData {
+    /// Odd while the kernel updates the page
+    sequence: AtomicU32,
+    version: AtomicU32,
+    /// Frequency of the counter in `CNTVCT_EL0`, in Hz
+    counter_frequency: AtomicU64,
+    /// Value of `CNTVCT_EL0` when the timer was initialized during boot
+    boot_counter: AtomicU64,
+    /// Nanoseconds are `((counter - boot_counter) * ns_mult) >> ns_shift`, computed with a 128-bit
+    /// product. This avoids a division on every read.
+    ns_mult: AtomicU64,
+    ns_shift: AtomicU32,
+}
+
+static SYSTEM_PAGE: SpinLock<Option<Arc<SharedMemory>>> = SpinLock::new(None);
+
+/// Multiplier that turns counter ticks at `frequency` Hz into nanoseconds, see `NS_SHIFT`
+fn ns_mult(frequency: u64) -> u64 {
+    ((1_000_000_000u128 << NS_SHIFT) / frequency as u128) as u64
+}
+
+fn publish(data: &SystemPageData) {
+    let timer = get_timer();
+    let frequency = timer.resolution().into_hz();
+
+    data.sequence.fetch_add(1, Ordering::Relaxed);
+    core::sync::atomic::fence(Ordering::Release);
+
+    data.version.store(VERSION, Ordering::Relaxed);
+    data.counter_frequency.store(frequency, Ordering::Relaxed);
+    data.boot_counter
+        .store(timer.boot_counter(), Ordering::Relaxed);
+    data.ns_mult.store(ns_mult(frequency), Ordering::Relaxed);
+    data.ns_shift.store(NS_SHIFT, Ordering::Relaxed);
+
+    data.sequence.fetch_add(1, Ordering::Release);
+}
+
+/// Returns the system page, creating and filling it the first time
+pub(super) fn get() -> Result<Arc<SharedMemory>, Error> {
+    let mut system_page = SYSTEM_PAGE.lock();
+    if let Some(page) = system_page.as_ref() {
+        return Ok(page.clone());
+    }
+
+    let page = Arc::new(SharedMemory::new(PAGE_SIZE)?);
+
+    // # Safety
+    //   The memory is zero-filled and at least a page long, which holds the data. The kernel is
+    //   the only writer, processes map it read-only.
+    publish(unsafe { &*(page.as_mut_ptr() as *const SystemPageData) });
+
+    system_page.replace(page.clone());
+    Ok(page)
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    fn ticks_to_ns(ticks: u64, frequency: u64) -> u64 {
+        ((ticks as u128 * ns_mult(frequency) as u128) >> NS_SHIFT) as u64
+    }
+
+    #[test]
+    fn converts_counter_ticks_to_nanoseconds() {
+        // The 24 MHz counter of Apple SoCs
+        const FREQUENCY: u64 = 24_000_000;
+        assert_eq!(ticks_to_ns(0, FREQUENCY), 0);
+        assert_eq!(ticks_to_ns(24, FREQUENCY), 999);
+        assert_eq!(ticks_to_ns(FREQUENCY, FREQUENCY), 999_999_999);
+
+        // A day of ticks is off by less than a microsecond
+        let day_ns = 24 * 3600 * 1_000_000_000u64;
+        let error = day_ns - ticks_to_ns(24 * 3600 * FREQUENCY, FREQUENCY);
+        assert!(error < 1_000);
+    }
+
+    #[test]
+    fn layout_matches_userspace() {
+        // libcxx::time::SystemPage
+        assert_eq!(core::mem::size_of::<SystemPageData>(), 40);
+        assert_eq!(core::mem::align_of::<SystemPageData>(), 8);
+    }
+}
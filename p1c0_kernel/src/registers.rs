@@ -223,3 +223,22 @@ mod cpacr {
 }
 
 pub use cpacr::CPACR;
+
+mod cntkctl_el1 {
+    tock_registers::register_bitfields! { u64,
+        pub CNTKCTL_EL1 [
+            EL0PCTEN OFFSET(0) NUMBITS(1) [],
+            EL0VCTEN OFFSET(1) NUMBITS(1) [],
+        ]
+    }
+
+    crate::define_register!(CNTKCTL_EL1, CNTKCTL_EL1::Register, 3, 0, 14, 1, 0);
+}
+
+pub use cntkctl_el1::CNTKCTL_EL1;
+
+mod tpidr_el1 {
+    crate::define_register!(TPIDR_EL1, (), 3, 0, 13, 0, 4);
+}
+
+pub use tpidr_el1::TPIDR_EL1;
@@ -0,0 +1,53 @@
+//! Per-CPU state.
+//!
+//! Every CPU keeps its logical index in TPIDR_EL1, which the kernel uses for nothing else. The boot
+//! CPU is always CPU 0.
+//!
+//! Only the boot CPU runs the kernel. Bringing up the secondary cores needs an entry point that
+//! gives each of them a stack and enables the MMU with the kernel tables, programming their RVBAR
+//! and kicking them through the PMGR `cpu-start` registers, and per-CPU timer setup. None of that
+//! exists yet, so per-CPU data only has room for the boot CPU and the scheduler keeps a single run
+//! queue.
+
+use crate::registers::TPIDR_EL1;
+
+use tock_registers::interfaces::{Readable, Writeable};
+
+/// Number of CPUs running the kernel. Raise it once the secondary cores are brought up.
+pub const MAX_CPUS: usize = 1;
+pub const BOOT_CPU: usize = 0;
+
+/// Container with one instance of `T` per CPU.
+pub struct PerCpu<T> {
+    values: [T; MAX_CPUS],
+}
+
+impl<T> PerCpu<T> {
+    pub const fn new(values: [T; MAX_CPUS]) -> Self {
+        Self { values }
+    }
+
+    /// Returns the instance of the calling CPU. Threads can migrate to other CPUs when preempted,
+    /// so this is only meaningful in exception context or while exceptions are masked.
+    pub fn get(&self) -> &T {
+        &self.values[cpu_id()]
+    }
+
+    pub fn get_for(&self, cpu: usize) -> &T {
+        &self.values[cpu]
+    }
+
+    pub fn iter(&self) -> impl Iterator<Item = &T> {
+        self.values.iter()
+    }
+}
+
+#[inline]
+pub fn cpu_id() -> usize {
+    TPIDR_EL1.get() as usize
+}
+
+/// Must be called on the boot CPU before anything else, since spinlocks use the CPU index.
+pub fn init_boot_cpu() {
+    TPIDR_EL1.set(BOOT_CPU as u64);
+}
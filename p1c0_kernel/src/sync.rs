@@ -1 +1,3 @@
+pub mod futex;
 pub mod spinlock;
+pub mod wait_queue;
@@ -0,0 +1,65 @@
+//! Futexes let threads of a process block on a 32-bit word of their own memory, so that userspace
+//! locks only enter the kernel when they are contended.
+//!
+//! A futex is identified by the process and the address of its word. Waiters only block while the
+//! word holds the value they expect, and the check and the block happen with the futex lock held,
+//! so a wakeup issued after the word changes cannot be missed.
+
+use crate::{
+    arch::exceptions::ExceptionContext, process::ProcessHandle, sync::spinlock::SpinLock, thread,
+};
+
+use core::sync::atomic::{AtomicU32, Ordering};
+
+#[derive(Debug)]
+pub enum Error {
+    NoCurrentProcess,
+    InvalidAddress,
+}
+
+/// Serializes checking futex words with waking up their waiters
+static FUTEX_LOCK: SpinLock<()> = SpinLock::new(());
+
+fn validate(word: *const u32) -> Result<(ProcessHandle, &'static AtomicU32), Error> {
+    let pid = thread::current_pid().ok_or(Error::NoCurrentProcess)?;
+    if word.is_null() || (word as usize % core::mem::align_of::<AtomicU32>()) != 0 {
+        return Err(Error::InvalidAddress);
+    }
+
+    // We have to trust the user process... If a fault happens, it will be delivered to it anyway
+    Ok((pid, unsafe { &*(word as *const AtomicU32) }))
+}
+
+/// Blocks the current thread until the futex at `word` is woken up, unless `word` no longer holds
+/// `expected`. If the thread blocks, `cx` holds the context of the next thread on return.
+pub(crate) fn wait(
+    cx: &mut ExceptionContext,
+    word: *const u32,
+    expected: u32,
+) -> Result<(), Error> {
+    let (pid, value) = validate(word)?;
+
+    // Populate the page first. Resolving a fault needs the process lock, which must not be taken
+    // with the futex lock held.
+    value.load(Ordering::Relaxed);
+
+    let _lock = FUTEX_LOCK.lock();
+    if value.load(Ordering::Acquire) != expected {
+        return Ok(());
+    }
+
+    thread::wait_on_futex_in_current_thread(cx, pid, word as usize);
+    Ok(())
+}
+
+/// Wakes up to `count` threads waiting on the futex at `word` and returns how many were woken up
+pub(crate) fn wake(word: *const u32, count: usize) -> Result<usize, Error> {
+    let (pid, _) = validate(word)?;
+
+    let _lock = FUTEX_LOCK.lock();
+    Ok(thread::wake_threads_waiting_on_futex(
+        &pid,
+        word as usize,
+        count,
+    ))
+}
@@ -1,10 +1,15 @@
+use crate::smp::{cpu_id, MAX_CPUS};
+
 use core::{cell::UnsafeCell, sync::atomic};
 
 use cortex_a::{asm::barrier, registers::DAIF};
 use tock_registers::interfaces::{Readable, Writeable};
 
-static CRITICAL_NESTING: atomic::AtomicU32 = atomic::AtomicU32::new(0);
-static mut SAVED_DAIF: u64 = 0;
+// Exceptions are masked per CPU, so each CPU tracks its own nesting level
+#[allow(clippy::declare_interior_mutable_const)]
+const NO_NESTING: atomic::AtomicU32 = atomic::AtomicU32::new(0);
+static CRITICAL_NESTING: [atomic::AtomicU32; MAX_CPUS] = [NO_NESTING; MAX_CPUS];
+static mut SAVED_DAIF: [u64; MAX_CPUS] = [0; MAX_CPUS];
 
 #[derive(Debug)]
 pub enum Error {
@@ -37,23 +42,25 @@ fn increment_critical_nesting(saved_daif: u64) {
     assert_eq!(DAIF.read(DAIF::I), 1);
     assert_eq!(DAIF.read(DAIF::F), 1);
 
-    let prev_nesting = CRITICAL_NESTING.fetch_add(1, atomic::Ordering::Acquire);
+    let cpu = cpu_id();
+    let prev_nesting = CRITICAL_NESTING[cpu].fetch_add(1, atomic::Ordering::Acquire);
     if prev_nesting == u32::MAX {
         panic!("We have reached the maximum value for CRITICAL_NESTING. This is MOST LIKELY a bug in user code");
     } else if prev_nesting == 0 {
         // Save the daif value for later when it is unlocked
-        unsafe { SAVED_DAIF = saved_daif };
+        unsafe { SAVED_DAIF[cpu] = saved_daif };
     }
 }
 
 fn decrement_critical_nesting() {
-    let prev_nesting = CRITICAL_NESTING.fetch_sub(1, atomic::Ordering::Release);
+    let cpu = cpu_id();
+    let prev_nesting = CRITICAL_NESTING[cpu].fetch_sub(1, atomic::Ordering::Release);
     if prev_nesting == 1 {
         // Add a barrier here to ensure that memory accesses finish before enabling exceptions
         unsafe { barrier::dsb(barrier::ISHST) };
 
         // Restore daif settings
-        unsafe { DAIF.set(SAVED_DAIF) };
+        unsafe { DAIF.set(SAVED_DAIF[cpu]) };
     }
 }
 
@@ -0,0 +1,104 @@
+//! Condition-variable like primitive that lets kernel threads block until an event happens.
+//!
+//! Waiters take a token before checking their condition and pass it to `wait`. If the queue was
+//! notified in between, `wait` returns immediately, so no wakeups are lost.
+
+use crate::{arch::exceptions::ExceptionContext, syscall::Syscall, thread};
+
+use core::sync::atomic::{AtomicBool, AtomicU64, Ordering};
+
+/// Set when a notification could not wake its waiters right away because the thread lists were
+/// locked. The scheduler then wakes all waiters on its next run.
+static PENDING_WAKEUPS: AtomicBool = AtomicBool::new(false);
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct WaitToken(u64);
+
+/// A queue of threads waiting for an event. The queue is identified by its address, which cannot
+/// change while a thread waits on it because `wait` borrows it.
+pub struct WaitQueue {
+    sequence: AtomicU64,
+}
+
+impl Default for WaitQueue {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl WaitQueue {
+    pub const fn new() -> Self {
+        Self {
+            sequence: AtomicU64::new(0),
+        }
+    }
+
+    fn id(&self) -> usize {
+        self as *const _ as usize
+    }
+
+    /// Returns a token that must be obtained before checking the condition the caller waits for.
+    pub fn token(&self) -> WaitToken {
+        WaitToken(self.sequence.load(Ordering::Acquire))
+    }
+
+    /// Blocks the current thread until the queue is notified. Returns immediately if it was
+    /// notified after the token was taken. Can only be called from kernel threads.
+    pub fn wait(&self, token: WaitToken) {
+        Syscall::wait_queue_wait(self as *const _, token.0);
+    }
+
+    /// Blocks the current thread until `condition` returns true
+    pub fn wait_until(&self, mut condition: impl FnMut() -> bool) {
+        loop {
+            let token = self.token();
+            if condition() {
+                return;
+            }
+            self.wait(token);
+        }
+    }
+
+    /// Blocks the thread that issued the syscall being handled until the queue is notified. Returns
+    /// immediately if it was notified after the token was taken. Unlike `wait`, this can block
+    /// processes. If the thread blocks, `cx` holds the context of the next thread on return.
+    pub(crate) fn block_in_syscall(&self, cx: &mut ExceptionContext, token: WaitToken) {
+        // Exceptions are masked while handling the syscall, so the queue cannot be notified
+        // before the thread is blocked
+        if self.token() != token {
+            return;
+        }
+
+        thread::wait_on_queue_in_current_thread(cx, self.id());
+    }
+
+    /// Wakes up all threads waiting on this queue. Can be called from any context, including
+    /// interrupt handlers.
+    pub fn notify_all(&self) {
+        self.sequence.fetch_add(1, Ordering::Release);
+
+        if thread::wake_threads_waiting_on_queue(self.id()).is_err() {
+            PENDING_WAKEUPS.store(true, Ordering::Release);
+        }
+    }
+}
+
+/// Wakes all threads waiting on any queue if a notification had to be deferred. Waiters re-check
+/// their condition, so the spurious wakeups are harmless.
+pub(crate) fn process_pending_wakeups() {
+    if PENDING_WAKEUPS.swap(false, Ordering::Acquire) {
+        thread::wake_all_threads_waiting_on_queues();
+    }
+}
+
+pub(crate) fn handle_wait(cx: &mut ExceptionContext, queue: *const WaitQueue, token: u64) {
+    if thread::current_pid().is_some() || queue.is_null() {
+        // Processes cannot use kernel wait queues
+        return;
+    }
+
+    // # Safety
+    //   The queue is borrowed by the kernel thread that called `wait`, which is the current thread.
+    let queue = unsafe { &*queue };
+    queue.block_in_syscall(cx, WaitToken(token));
+}
@@ -1,5 +1,14 @@
 use crate::{
-    arch::exceptions::ExceptionContext, prelude::*, process, sync::spinlock::SpinLock, thread,
+    arch::{exceptions::ExceptionContext, mmu::PAGE_SIZE},
+    ipc,
+    memory::{
+        self,
+        address::{Address, VirtualAddress},
+    },
+    prelude::*,
+    process,
+    sync::{futex, spinlock::SpinLock, wait_queue, wait_queue::WaitQueue},
+    thread, trace,
 };
 
 macro_rules! gen_syscall_caller {
@@ -331,6 +340,10 @@ macro_rules! define_syscalls {
         }
 
         pub(crate) fn syscall_handler(imm: u32, cx: &mut ExceptionContext) {
+            // The handler can switch to another thread, so the caller is taken before it runs
+            let caller = thread::current_tid();
+            trace::record(trace::Event::SyscallEnter, imm as u64, cx.gpr[0]);
+
             match imm.try_into() {
                 $(
                     Ok(Syscall::$syscall_name) => {
@@ -342,6 +355,8 @@ macro_rules! define_syscalls {
                     panic!("BUG: Received unknown syscall from user process: {}", id);
                 }
             };
+
+            trace::record(trace::Event::SyscallExit, imm as u64, caller);
         }
 
     };
@@ -357,6 +372,28 @@ define_syscalls!(
     [6, PutString, puts, handle_puts, (*const u8, usize)],
     [7, WaitPid, wait_pid, handle_wait_pid, (u64) -> u64],
     [8, Exit, exit, handle_exit, (u64)],
+    [9, WriteV, writev, handle_writev, (*const IoVec, usize)],
+    [10, WaitQueueWait, wait_queue_wait, handle_wait_queue_wait, (*const WaitQueue, u64)],
+    [11, SetPriority, set_priority, handle_set_priority, (u64) -> u64],
+    [12, MemoryStatistics, memory_statistics, handle_memory_statistics, (*mut memory::Statistics)],
+    [13, Open, open, handle_open, (*const u8, usize) -> u64],
+    [14, Read, read, handle_read, (u64, *mut u8, usize) -> u64],
+    [15, Close, close, handle_close, (u64) -> u64],
+    [16, MapFile, map_file, handle_map_file, (u64) -> u64],
+    [17, Spawn, spawn, handle_spawn, (*const u8, usize, *const *const u8, *const *const u8) -> u64],
+    [18, SharedMemoryCreate, shared_memory_create, handle_shared_memory_create, (usize) -> u64],
+    [19, SharedMemoryMap, shared_memory_map, handle_shared_memory_map, (u64) -> u64],
+    [20, SharedMemoryRelease, shared_memory_release, handle_shared_memory_release, (u64) -> u64],
+    [21, PipeCreate, pipe_create, handle_pipe_create, () -> u64],
+    [22, PipeRead, pipe_read, handle_pipe_read, (u64, *mut u8, usize) -> u64],
+    [23, PipeWrite, pipe_write, handle_pipe_write, (u64, *const u8, usize) -> u64],
+    [24, PipeClose, pipe_close, handle_pipe_close, (u64, u64) -> u64],
+    [25, MapAnonymous, map_anonymous, handle_map_anonymous, (usize) -> u64],
+    [26, Unmap, unmap, handle_unmap, (u64) -> u64],
+    [27, ThreadCreate, thread_create, handle_thread_create, (u64, u64, usize) -> u64],
+    [28, FutexWait, futex_wait, handle_futex_wait, (*const u32, u32) -> u64],
+    [29, FutexWake, futex_wake, handle_futex_wake, (*const u32, usize) -> u64],
+    [30, PrintMemoryStatistics, print_memory_statistics, handle_print_memory_statistics, ()],
     [0x8000, Multiply, multiply, handle_multiply, (u32, u32) -> u32],
 );
 
@@ -364,10 +401,37 @@ pub enum Error {
     UnknownSyscall(u32),
 }
 
-fn handle_noop(_cx: &mut ExceptionContext) {
-    log_info!("Syscall Noop");
+/// A single segment of a vectored write. The layout matches `libcxx::syscalls::IoVec`.
+#[repr(C)]
+#[derive(Clone, Copy)]
+pub struct IoVec {
+    pub base: *const u8,
+    pub len: usize,
 }
 
+impl IoVec {
+    pub fn new(data: &[u8]) -> Self {
+        Self {
+            base: data.as_ptr(),
+            len: data.len(),
+        }
+    }
+}
+
+/// Number of `WriteV` segments gathered into a single stdout record
+const MAX_IOVECS: usize = 16;
+
+/// Returned by the file and process syscalls on failure. Unlike 0xFFFF it can be told apart from
+/// any byte count, address or PID.
+const SYSCALL_ERROR: u64 = u64::MAX;
+
+/// Upper bound on the number of arguments and on the number of environment variables accepted by
+/// `Spawn`
+const MAX_SPAWN_STRINGS: usize = 64;
+
+// Does nothing at all, so that it measures the cost of a syscall round trip
+fn handle_noop(_cx: &mut ExceptionContext) {}
+
 fn handle_reboot(_cx: &mut ExceptionContext) {
     log_warning!("Syscall Reboot - Rebooting computer");
     unsafe {
@@ -394,7 +458,8 @@ fn handle_yield_exec(cx: &mut ExceptionContext) {
 }
 
 fn handle_thread_exit(cx: &mut ExceptionContext) {
-    thread::exit_current_thread(cx);
+    // The thread list of the process is kept in sync, so exiting its threads cannot fail
+    process::exit_current_thread(cx).unwrap();
 }
 
 fn handle_thread_join(cx: &mut ExceptionContext, tid: u64) {
@@ -408,14 +473,333 @@ fn handle_puts(_cx: &mut ExceptionContext, str_ptr: *const u8, length: usize) {
 
     // We have to trust the user process... If a fault happens, it will be delivered to it anyway
     let slice = unsafe { core::slice::from_raw_parts(str_ptr, length) };
-    if let Ok(string) = core::str::from_utf8(slice) {
-        // TODO(javier-varez): Of course this needs to be redirected to stdout instead of using the klog system...
-
-        log_info!(
-            "Message from userspace pid {:?}: {}",
-            thread::current_pid(),
-            string
-        );
+    if print::write_stdout(thread::current_pid().as_ref(), &[slice]).is_err() {
+        log_warning!("Dropping stdout record, the buffer is full");
+    }
+}
+
+fn handle_writev(_cx: &mut ExceptionContext, iov_ptr: *const IoVec, count: usize) {
+    if iov_ptr.is_null() || count == 0 {
+        return;
+    }
+
+    let iovecs = unsafe { core::slice::from_raw_parts(iov_ptr, count) };
+
+    // Segments are gathered in chunks of MAX_IOVECS, each of them is appended as its own record
+    let pid = thread::current_pid();
+    for chunk in iovecs.chunks(MAX_IOVECS) {
+        let mut segments: heapless::Vec<&[u8], MAX_IOVECS> = heapless::Vec::new();
+        for iovec in chunk.iter().filter(|iovec| !iovec.base.is_null()) {
+            // We have to trust the user process... If a fault happens, it will be delivered to it
+            // anyway
+            let slice = unsafe { core::slice::from_raw_parts(iovec.base, iovec.len) };
+            segments.push(slice).unwrap();
+        }
+
+        if print::write_stdout(pid.as_ref(), &segments).is_err() {
+            log_warning!("Dropping stdout record, the buffer is full");
+        }
+    }
+}
+
+fn handle_wait_queue_wait(cx: &mut ExceptionContext, queue: *const WaitQueue, token: u64) {
+    wait_queue::handle_wait(cx, queue, token);
+}
+
+fn handle_set_priority(cx: &mut ExceptionContext, level: u64) -> u64 {
+    let priority = match level.try_into().map(thread::Priority::new) {
+        Ok(Ok(priority)) => priority,
+        _ => {
+            return SYSCALL_ERROR;
+        }
+    };
+
+    // Unprivileged code may only lower its priority. Otherwise any process could starve the rest
+    // of the system by moving itself above the default level.
+    if thread::current_pid().is_some() && priority > thread::Priority::DEFAULT {
+        return SYSCALL_ERROR;
+    }
+
+    // The scheduler may switch to another thread, so the return value has to be stored in the
+    // context of the calling thread before that happens
+    cx.gpr[0] = 0;
+    thread::set_current_thread_priority(cx, priority);
+    cx.gpr[0]
+}
+
+fn handle_memory_statistics(_cx: &mut ExceptionContext, stats: *mut memory::Statistics) {
+    if stats.is_null() {
+        return;
+    }
+
+    // We have to trust the user process... If a fault happens, it will be delivered to it anyway
+    unsafe { stats.write(memory::statistics()) };
+}
+
+fn handle_print_memory_statistics(_cx: &mut ExceptionContext) {
+    memory::print_statistics();
+}
+
+fn handle_open(_cx: &mut ExceptionContext, path_ptr: *const u8, length: usize) -> u64 {
+    if path_ptr.is_null() {
+        return SYSCALL_ERROR;
+    }
+
+    // We have to trust the user process... If a fault happens, it will be delivered to it anyway
+    let path = unsafe { core::slice::from_raw_parts(path_ptr, length) };
+    let path = match core::str::from_utf8(path) {
+        Ok(path) => path,
+        Err(_) => return SYSCALL_ERROR,
+    };
+
+    process::open_file(path).unwrap_or(SYSCALL_ERROR)
+}
+
+fn handle_read(_cx: &mut ExceptionContext, fd: u64, buffer: *mut u8, length: usize) -> u64 {
+    if buffer.is_null() {
+        return SYSCALL_ERROR;
+    }
+
+    // We have to trust the user process... If a fault happens, it will be delivered to it anyway
+    let buffer = unsafe { core::slice::from_raw_parts_mut(buffer, length) };
+    match process::read_file(fd, buffer) {
+        Ok(bytes) => bytes as u64,
+        Err(_) => SYSCALL_ERROR,
+    }
+}
+
+fn handle_close(_cx: &mut ExceptionContext, fd: u64) -> u64 {
+    match process::close_file(fd) {
+        Ok(()) => 0,
+        Err(_) => SYSCALL_ERROR,
+    }
+}
+
+fn handle_map_file(_cx: &mut ExceptionContext, fd: u64) -> u64 {
+    match process::map_file(fd) {
+        Ok(va) => va.as_u64(),
+        Err(e) => {
+            log_warning!("Cannot map file descriptor {}: {:?}", fd, e);
+            SYSCALL_ERROR
+        }
+    }
+}
+
+/// Returns the NUL-terminated string at `ptr`, which cannot be longer than a page
+///
+/// # Safety
+///   `ptr` must point to a NUL-terminated string. We have to trust the user process... If a fault
+///   happens, it will be delivered to it anyway
+unsafe fn user_c_str<'a>(ptr: *const u8) -> Option<&'a str> {
+    let mut length = 0;
+    while *ptr.add(length) != 0 {
+        length += 1;
+        if length == PAGE_SIZE {
+            return None;
+        }
+    }
+    core::str::from_utf8(core::slice::from_raw_parts(ptr, length)).ok()
+}
+
+/// Returns the strings of a null-terminated array of NUL-terminated strings. A null array is empty.
+///
+/// # Safety
+///   Same as `user_c_str` for every element of the array
+unsafe fn user_c_str_array<'a>(array: *const *const u8) -> Option<Vec<&'a str>> {
+    let mut strings = vec![];
+    if array.is_null() {
+        return Some(strings);
+    }
+
+    loop {
+        let ptr = *array.add(strings.len());
+        if ptr.is_null() {
+            return Some(strings);
+        }
+        if strings.len() == MAX_SPAWN_STRINGS {
+            return None;
+        }
+        strings.push(user_c_str(ptr)?);
+    }
+}
+
+fn handle_spawn(
+    _cx: &mut ExceptionContext,
+    path_ptr: *const u8,
+    length: usize,
+    argv: *const *const u8,
+    envp: *const *const u8,
+) -> u64 {
+    if path_ptr.is_null() {
+        return SYSCALL_ERROR;
+    }
+
+    // We have to trust the user process... If a fault happens, it will be delivered to it anyway
+    let path = unsafe { core::slice::from_raw_parts(path_ptr, length) };
+    let strings = unsafe { (user_c_str_array(argv), user_c_str_array(envp)) };
+    let (path, arguments, environment) = match (core::str::from_utf8(path), strings) {
+        (Ok(path), (Some(arguments), Some(environment))) => (path, arguments, environment),
+        _ => return SYSCALL_ERROR,
+    };
+
+    match process::spawn(path, &arguments, &environment) {
+        Ok(pid) => pid.get_raw(),
+        Err(e) => {
+            log_warning!("Cannot spawn `{}`: {:?}", path, e);
+            SYSCALL_ERROR
+        }
+    }
+}
+
+/// Makes the thread issue the syscall being handled again once it resumes. Its arguments are
+/// still in its registers.
+fn restart_syscall(cx: &mut ExceptionContext) {
+    // ELR points to the instruction after the SVC
+    cx.elr_el1 -= 4;
+}
+
+fn handle_shared_memory_create(_cx: &mut ExceptionContext, size_bytes: usize) -> u64 {
+    ipc::create_shared_memory(size_bytes).unwrap_or(SYSCALL_ERROR)
+}
+
+fn handle_shared_memory_map(_cx: &mut ExceptionContext, id: u64) -> u64 {
+    match ipc::map_shared_memory(id) {
+        Ok(va) => va.as_u64(),
+        Err(e) => {
+            log_warning!("Cannot map shared memory {}: {:?}", id, e);
+            SYSCALL_ERROR
+        }
+    }
+}
+
+fn handle_shared_memory_release(_cx: &mut ExceptionContext, id: u64) -> u64 {
+    match ipc::release_shared_memory(id) {
+        Ok(()) => 0,
+        Err(_) => SYSCALL_ERROR,
+    }
+}
+
+fn handle_pipe_create(_cx: &mut ExceptionContext) -> u64 {
+    ipc::create_pipe()
+}
+
+fn handle_pipe_read(cx: &mut ExceptionContext, id: u64, buffer: *mut u8, length: usize) -> u64 {
+    let pipe = match ipc::pipe(id, ipc::PipeEnd::Read) {
+        Ok(pipe) if !buffer.is_null() => pipe,
+        _ => return SYSCALL_ERROR,
+    };
+
+    // We have to trust the user process... If a fault happens, it will be delivered to it anyway
+    let buffer = unsafe { core::slice::from_raw_parts_mut(buffer, length) };
+
+    // The token must be taken before reading, otherwise a write in between would not wake us up
+    let token = pipe.readable().token();
+    match pipe.read(buffer) {
+        Ok(bytes) => bytes as u64,
+        Err(ipc::Error::WouldBlock) => {
+            restart_syscall(cx);
+            pipe.readable().block_in_syscall(cx, token);
+            cx.gpr[0]
+        }
+        Err(_) => SYSCALL_ERROR,
+    }
+}
+
+fn handle_pipe_write(cx: &mut ExceptionContext, id: u64, data: *const u8, length: usize) -> u64 {
+    let pipe = match ipc::pipe(id, ipc::PipeEnd::Write) {
+        Ok(pipe) if !data.is_null() => pipe,
+        _ => return SYSCALL_ERROR,
+    };
+
+    // We have to trust the user process... If a fault happens, it will be delivered to it anyway
+    let data = unsafe { core::slice::from_raw_parts(data, length) };
+
+    let token = pipe.writable().token();
+    match pipe.write(data) {
+        Ok(bytes) => bytes as u64,
+        Err(ipc::Error::WouldBlock) => {
+            restart_syscall(cx);
+            pipe.writable().block_in_syscall(cx, token);
+            cx.gpr[0]
+        }
+        Err(_) => SYSCALL_ERROR,
+    }
+}
+
+fn handle_pipe_close(_cx: &mut ExceptionContext, id: u64, end: u64) -> u64 {
+    let end = match end {
+        0 => ipc::PipeEnd::Read,
+        1 => ipc::PipeEnd::Write,
+        _ => return SYSCALL_ERROR,
+    };
+
+    match ipc::close_pipe(id, end) {
+        Ok(()) => 0,
+        Err(_) => SYSCALL_ERROR,
+    }
+}
+
+fn handle_map_anonymous(_cx: &mut ExceptionContext, size_bytes: usize) -> u64 {
+    match process::map_anonymous(size_bytes) {
+        Ok(va) => va.as_u64(),
+        Err(e) => {
+            log_warning!(
+                "Cannot map {} bytes of anonymous memory: {:?}",
+                size_bytes,
+                e
+            );
+            SYSCALL_ERROR
+        }
+    }
+}
+
+fn handle_unmap(_cx: &mut ExceptionContext, va: u64) -> u64 {
+    let va = match VirtualAddress::try_from_ptr(va as *const _) {
+        Ok(va) => va,
+        Err(_) => return SYSCALL_ERROR,
+    };
+
+    match process::unmap_anonymous(va) {
+        Ok(()) => 0,
+        Err(_) => SYSCALL_ERROR,
+    }
+}
+
+fn handle_thread_create(
+    _cx: &mut ExceptionContext,
+    entry_point: u64,
+    argument: u64,
+    stack_size: usize,
+) -> u64 {
+    // Instructions are 4 bytes long and aligned
+    if entry_point == 0 || (entry_point & 0x3) != 0 {
+        return SYSCALL_ERROR;
+    }
+    let entry_point = VirtualAddress::new_unaligned(entry_point as *const _);
+
+    match process::create_thread(entry_point, argument, stack_size) {
+        Ok(tid) => tid,
+        Err(e) => {
+            log_warning!("Cannot create thread: {:?}", e);
+            SYSCALL_ERROR
+        }
+    }
+}
+
+fn handle_futex_wait(cx: &mut ExceptionContext, word: *const u32, expected: u32) -> u64 {
+    // The scheduler may switch to another thread, so the return value has to be stored in the
+    // context of the calling thread before that happens
+    cx.gpr[0] = 0;
+    match futex::wait(cx, word, expected) {
+        Ok(()) => cx.gpr[0],
+        Err(_) => SYSCALL_ERROR,
+    }
+}
+
+fn handle_futex_wake(_cx: &mut ExceptionContext, word: *const u32, count: usize) -> u64 {
+    match futex::wake(word, count) {
+        Ok(woken) => woken as u64,
+        Err(_) => SYSCALL_ERROR,
     }
 }
 
@@ -5,6 +5,7 @@ use crate::{
     arch::exceptions::{return_from_exception, ExceptionContext},
     collections::{
         intrusive_list::{IntrusiveItem, IntrusiveList},
+        min_heap::MinHeap,
         OwnedMutPtr,
     },
     drivers::{
@@ -13,8 +14,10 @@ use crate::{
     },
     memory::address,
     prelude::*,
+    smp::{self, PerCpu},
     sync::spinlock::SpinLock,
     syscall::Syscall,
+    trace,
 };
 
 use core::{
@@ -29,8 +32,43 @@ use tock_registers::interfaces::Readable;
 #[derive(Debug, PartialEq, Clone)]
 pub enum Error {
     ThreadNotFound,
+    WouldBlock,
+    InvalidPriority,
 }
 
+/// Scheduling priority of a thread. Runnable threads with a higher priority always run before
+/// threads with a lower one.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, PartialOrd, Ord)]
+pub struct Priority(u8);
+
+impl Priority {
+    pub const NUM_LEVELS: usize = 8;
+    pub const LOWEST: Priority = Priority(0);
+    pub const DEFAULT: Priority = Priority(3);
+    pub const HIGHEST: Priority = Priority(Self::NUM_LEVELS as u8 - 1);
+
+    pub fn new(level: u8) -> Result<Self, Error> {
+        if level as usize >= Self::NUM_LEVELS {
+            return Err(Error::InvalidPriority);
+        }
+        Ok(Self(level))
+    }
+
+    pub fn level(&self) -> u8 {
+        self.0
+    }
+
+    fn boosted(self, boost: u8) -> Self {
+        Self(self.0.saturating_add(boost).min(Self::HIGHEST.0))
+    }
+}
+
+/// Priority levels added to threads that wake up from waiting on an event, until they use up a
+/// whole time slice.
+const INTERACTIVE_BOOST: u8 = 1;
+
+const DEFAULT_TIME_SLICE: Duration = Duration::from_millis(4);
+
 enum Stack {
     KernelThread(Vec<u64>),
     ProcessThread(VirtualAddress, usize /* num_pages */),
@@ -95,6 +133,9 @@ enum BlockReason {
     Sleep(Ticks),
     Join(ThreadHandle),
     WaitForPid(ProcessHandle),
+    WaitQueue(usize),
+    /// Waiting on the futex word at the given address of the process
+    Futex(ProcessHandle, usize),
 }
 
 pub struct ThreadControlBlock {
@@ -108,6 +149,12 @@ pub struct ThreadControlBlock {
     // Blocking conditions
     block_reason: Option<BlockReason>,
 
+    // Scheduling
+    priority: Priority,
+    boost: u8,
+    time_slice: Duration,
+    slice_deadline: Option<Ticks>,
+
     // Context switch data
     regs: [u64; 31],
     elr: u64,
@@ -123,18 +170,131 @@ impl ThreadControlBlock {
             Some(&self.name)
         }
     }
+
+    fn effective_priority(&self) -> Priority {
+        self.priority.boosted(self.boost)
+    }
 }
 
 type Tcb = OwnedMutPtr<IntrusiveItem<ThreadControlBlock>>;
 
-static ACTIVE_THREADS: SpinLock<IntrusiveList<ThreadControlBlock>> =
-    SpinLock::new(IntrusiveList::new());
+/// Runnable threads, with one FIFO queue per priority level and a bitmap of the non-empty queues so
+/// that finding the next thread to run does not depend on the number of runnable threads.
+struct RunQueue {
+    queues: [IntrusiveList<ThreadControlBlock>; Priority::NUM_LEVELS],
+    bitmap: u32,
+}
+
+impl RunQueue {
+    const fn new() -> Self {
+        #[allow(clippy::declare_interior_mutable_const)]
+        const EMPTY: IntrusiveList<ThreadControlBlock> = IntrusiveList::new();
+        Self {
+            queues: [EMPTY; Priority::NUM_LEVELS],
+            bitmap: 0,
+        }
+    }
+
+    fn push(&mut self, thread: Tcb) {
+        let level = thread.effective_priority().0 as usize;
+        self.queues[level].push(thread);
+        self.bitmap |= 1 << level;
+    }
+
+    fn highest_priority(&self) -> Option<Priority> {
+        if self.bitmap == 0 {
+            None
+        } else {
+            Some(Priority(31 - self.bitmap.leading_zeros() as u8))
+        }
+    }
+
+    fn pop(&mut self) -> Option<Tcb> {
+        let level = self.highest_priority()?.0 as usize;
+        let thread = self.queues[level].pop();
+        if self.queues[level].is_empty() {
+            self.bitmap &= !(1 << level);
+        }
+        thread
+    }
+
+    fn join(&mut self, threads: IntrusiveList<ThreadControlBlock>) {
+        threads.release(|thread| self.push(thread));
+    }
+
+    fn iter(&self) -> impl Iterator<Item = &IntrusiveItem<ThreadControlBlock>> {
+        self.queues.iter().rev().flat_map(|queue| queue.iter())
+    }
+
+    fn drain_filter<F>(&mut self, mut filter: F) -> IntrusiveList<ThreadControlBlock>
+    where
+        F: FnMut(&mut ThreadControlBlock) -> bool,
+    {
+        let mut drained = IntrusiveList::new();
+        for (level, queue) in self.queues.iter_mut().enumerate() {
+            drained.join(queue.drain_filter(&mut filter));
+            if queue.is_empty() {
+                self.bitmap &= !(1 << level);
+            }
+        }
+        drained
+    }
+}
+
+static ACTIVE_THREADS: SpinLock<RunQueue> = SpinLock::new(RunQueue::new());
 
 static BLOCKED_THREADS: SpinLock<IntrusiveList<ThreadControlBlock>> =
     SpinLock::new(IntrusiveList::new());
 
-static CURRENT_THREAD: SpinLock<Option<Tcb>> = SpinLock::new(None);
-static IDLE_THREAD: SpinLock<Option<Tcb>> = SpinLock::new(None);
+/// A thread blocked in `BlockReason::Sleep`, ordered by its wakeup deadline. Threads with the same
+/// deadline are woken up in the order they went to sleep.
+struct SleepingThread {
+    deadline: Ticks,
+    sequence: u64,
+    thread: Tcb,
+}
+
+impl PartialEq for SleepingThread {
+    fn eq(&self, other: &Self) -> bool {
+        (self.deadline, self.sequence) == (other.deadline, other.sequence)
+    }
+}
+
+impl Eq for SleepingThread {}
+
+impl PartialOrd for SleepingThread {
+    fn partial_cmp(&self, other: &Self) -> Option<core::cmp::Ordering> {
+        Some(self.cmp(other))
+    }
+}
+
+impl Ord for SleepingThread {
+    fn cmp(&self, other: &Self) -> core::cmp::Ordering {
+        (self.deadline, self.sequence).cmp(&(other.deadline, other.sequence))
+    }
+}
+
+static SLEEPING_THREADS: SpinLock<MinHeap<SleepingThread>> = SpinLock::new(MinHeap::new());
+static SLEEP_SEQUENCE: AtomicU64 = AtomicU64::new(0);
+
+#[allow(clippy::declare_interior_mutable_const)]
+const NO_THREAD: SpinLock<Option<Tcb>> = SpinLock::new(None);
+
+static CURRENT_THREAD: PerCpu<SpinLock<Option<Tcb>>> = PerCpu::new([NO_THREAD; smp::MAX_CPUS]);
+static IDLE_THREAD: PerCpu<SpinLock<Option<Tcb>>> = PerCpu::new([NO_THREAD; smp::MAX_CPUS]);
+
+#[allow(clippy::declare_interior_mutable_const)]
+const KERNEL_ADDRESS_SPACE: SpinLock<Option<ProcessHandle>> = SpinLock::new(None);
+
+/// Process whose address space is active in the lower half of each CPU, or None for the kernel
+static ACTIVE_PROCESS: PerCpu<SpinLock<Option<ProcessHandle>>> =
+    PerCpu::new([KERNEL_ADDRESS_SPACE; smp::MAX_CPUS]);
+
+#[allow(clippy::declare_interior_mutable_const)]
+const NO_TID: AtomicU64 = AtomicU64::new(0);
+
+/// Tid of the thread each CPU runs, readable without taking the lock of the current thread
+static RUNNING_TID: PerCpu<AtomicU64> = PerCpu::new([NO_TID; smp::MAX_CPUS]);
 
 static NUM_THREADS: AtomicU64 = AtomicU64::new(0);
 
@@ -145,9 +305,14 @@ extern "C" fn thread_start(thread_control_block: &mut ThreadControlBlock) {
     };
 }
 
+#[derive(Debug, PartialEq, Eq)]
 pub struct ThreadHandle(u64);
 
 impl ThreadHandle {
+    pub fn get_raw(&self) -> u64 {
+        self.0
+    }
+
     pub fn join(self) {
         Syscall::thread_join(self.0);
     }
@@ -156,6 +321,8 @@ impl ThreadHandle {
 pub struct Builder {
     name: Option<String<32>>,
     stack_size: Option<usize>,
+    priority: Option<Priority>,
+    time_slice: Option<Duration>,
 }
 
 impl Default for Builder {
@@ -169,6 +336,8 @@ impl Builder {
         Self {
             name: None,
             stack_size: None,
+            priority: None,
+            time_slice: None,
         }
     }
 
@@ -184,6 +353,19 @@ impl Builder {
         self
     }
 
+    #[must_use]
+    pub fn priority(mut self, priority: Priority) -> Self {
+        self.priority = Some(priority);
+        self
+    }
+
+    /// Maximum time the thread runs before being preempted by threads of the same priority
+    #[must_use]
+    pub fn time_slice(mut self, time_slice: Duration) -> Self {
+        self.time_slice = Some(time_slice);
+        self
+    }
+
     fn create<F>(self, thread: F) -> Tcb
     where
         F: FnOnce() + Send + 'static,
@@ -213,6 +395,10 @@ impl Builder {
             stack,
             process: None,
             block_reason: None,
+            priority: self.priority.unwrap_or(Priority::DEFAULT),
+            boost: 0,
+            time_slice: self.time_slice.unwrap_or(DEFAULT_TIME_SLICE),
+            slice_deadline: None,
             regs,
             elr: elr as u64,
             spsr: spsr.get(),
@@ -242,14 +428,12 @@ where
     Builder::new().spawn(thread)
 }
 
-pub(crate) fn new_for_process(
+fn create_process_thread(
     process: ProcessHandle,
     stack_va: VirtualAddress,
     stack_size: usize,
     entry_point: VirtualAddress,
-    base_address: VirtualAddress,
-    (argc, argv, envp): (usize, VirtualAddress, VirtualAddress),
-) -> ThreadHandle {
+) -> Tcb {
     let name = String::new();
     let stack = Stack::ProcessThread(stack_va, stack_size);
     let stack_ptr = stack.top();
@@ -259,42 +443,78 @@ pub(crate) fn new_for_process(
     let regs = [0; 31];
     let tid = NUM_THREADS.fetch_add(1, Ordering::Relaxed);
 
-    let mut tcb = OwnedMutPtr::new_from_box(Box::new(IntrusiveItem::new(ThreadControlBlock {
+    OwnedMutPtr::new_from_box(Box::new(IntrusiveItem::new(ThreadControlBlock {
         tid,
         name,
         entry: None,
         stack,
         process: Some(process),
         block_reason: None,
+        priority: Priority::DEFAULT,
+        boost: 0,
+        time_slice: DEFAULT_TIME_SLICE,
+        slice_deadline: None,
         regs,
         elr: elr as u64,
         spsr: spsr.get(),
         stack_ptr,
         is_idle_thread: false,
-    })));
+    })))
+}
+
+fn start_thread(tcb: Tcb) -> ThreadHandle {
+    let tid = tcb.tid;
+    ACTIVE_THREADS.lock().push(tcb);
+
+    ThreadHandle(tid)
+}
+
+pub(crate) fn new_for_process(
+    process: ProcessHandle,
+    stack_va: VirtualAddress,
+    stack_size: usize,
+    entry_point: VirtualAddress,
+    base_address: VirtualAddress,
+    (argc, argv, envp): (usize, VirtualAddress, VirtualAddress),
+    system_page: VirtualAddress,
+) -> ThreadHandle {
+    let mut tcb = create_process_thread(process, stack_va, stack_size, entry_point);
     tcb.regs[0] = argc as u64;
     tcb.regs[1] = argv.as_u64();
     tcb.regs[2] = envp.as_u64();
     tcb.regs[3] = base_address.as_u64();
+    tcb.regs[4] = system_page.as_u64();
 
-    ACTIVE_THREADS.lock().push(tcb);
+    start_thread(tcb)
+}
 
-    ThreadHandle(tid)
+/// Starts an additional thread of a running process, which gets `argument` in its first register
+pub(crate) fn new_secondary_for_process(
+    process: ProcessHandle,
+    stack_va: VirtualAddress,
+    stack_size: usize,
+    entry_point: VirtualAddress,
+    argument: u64,
+) -> ThreadHandle {
+    let mut tcb = create_process_thread(process, stack_va, stack_size, entry_point);
+    tcb.regs[0] = argument;
+
+    start_thread(tcb)
 }
 
 pub fn initialize() -> ! {
-    let mut current_thread = CURRENT_THREAD.lock();
+    let mut current_thread = CURRENT_THREAD.get().lock();
     assert!(current_thread.is_none());
 
-    // Spawn idle thread
+    // Spawn the idle thread of this CPU
     let mut idle = Builder::new().name("Idle").stack_size(128).create(|| loop {
         wfi();
     });
     idle.is_idle_thread = true;
-    IDLE_THREAD.lock().replace(idle);
+    IDLE_THREAD.get().lock().replace(idle);
 
-    // Let's take the first element in the thread list and run that
-    let thread = ACTIVE_THREADS.lock().pop().expect("No threads found!");
+    // Let's take the first runnable thread and run that
+    let thread = schedule_next_thread();
     current_thread.replace(thread);
 
     let tcb = current_thread.as_ref().unwrap();
@@ -320,26 +540,48 @@ fn restore_thread_context(cx: &mut ExceptionContext, thread: &Tcb) {
     cx.gpr.copy_from_slice(&thread.regs[..]);
     cx.elr_el1 = thread.elr;
 
+    let previous_tid = RUNNING_TID.get().swap(thread.tid, Ordering::Relaxed);
+    if previous_tid != thread.tid {
+        trace::record(trace::Event::ContextSwitch, previous_tid, thread.tid);
+    }
+
+    // Threads of the same process share its address space, so there is nothing to switch
+    let mut active_process = ACTIVE_PROCESS.get().lock();
+    if *active_process == thread.process {
+        return;
+    }
+
     if let Some(handle) = thread.process.as_ref() {
-        do_with_process(handle, |process| {
-            arch::mmu::switch_process_translation_table(process.address_space().address_table());
-        });
+        do_with_process(handle, |process| process.address_space().activate());
     } else {
         // Set the kernel translation table instead
         crate::memory::MemoryManager::instance().map_kernel_low_pages();
     }
+    *active_process = thread.process.clone();
+}
+
+/// Returns the tid of the thread running on this CPU. Only meaningful in exception context or
+/// while exceptions are masked.
+pub(crate) fn current_tid() -> u64 {
+    RUNNING_TID.get().load(Ordering::Relaxed)
 }
 
 fn wake_asleep_threads() {
     let current_ticks = get_timer().ticks();
-    let unblocked_threads = BLOCKED_THREADS.lock().drain_filter(|thread| {
-        if let BlockReason::Sleep(ticks) = thread.block_reason.as_ref().unwrap() {
-            return *ticks <= current_ticks;
+    let mut sleeping_threads = SLEEPING_THREADS.lock();
+
+    // Only the threads that are due are visited
+    let mut active_threads = ACTIVE_THREADS.lock();
+    while let Some(sleeping) = sleeping_threads.peek() {
+        if sleeping.deadline > current_ticks {
+            break;
         }
-        false
-    });
+        let mut thread = sleeping_threads.pop().unwrap().thread;
+        thread.boost = INTERACTIVE_BOOST;
+        active_threads.push(thread);
+    }
 
-    ACTIVE_THREADS.lock().join(unblocked_threads);
+    get_timer().set_oneshot_deadline(sleeping_threads.peek().map(|sleeping| sleeping.deadline));
 }
 
 pub(crate) fn wake_threads_waiting_on_pid(pid: &ProcessHandle, exit_code: u64) {
@@ -358,22 +600,136 @@ pub(crate) fn wake_threads_waiting_on_pid(pid: &ProcessHandle, exit_code: u64) {
     ACTIVE_THREADS.lock().join(unblocked_threads);
 }
 
+/// Moves all threads waiting on the given queue back to the active list. Fails without blocking
+/// if the thread lists are in use, so that it can be called from any context.
+pub(crate) fn wake_threads_waiting_on_queue(queue_id: usize) -> Result<(), Error> {
+    let mut blocked_threads = BLOCKED_THREADS.try_lock().map_err(|_| Error::WouldBlock)?;
+    let mut active_threads = ACTIVE_THREADS.try_lock().map_err(|_| Error::WouldBlock)?;
+
+    let mut unblocked_threads = blocked_threads.drain_filter(|thread| {
+        if let BlockReason::WaitQueue(id) = thread.block_reason.as_ref().unwrap() {
+            return *id == queue_id;
+        }
+        false
+    });
+    unblocked_threads
+        .iter_mut()
+        .for_each(|thread| thread.boost = INTERACTIVE_BOOST);
+    active_threads.join(unblocked_threads);
+    Ok(())
+}
+
+/// Wakes up to `count` threads of process `pid` waiting on the futex word at `address`, in the
+/// order they started waiting. Returns the number of threads woken up.
+pub(crate) fn wake_threads_waiting_on_futex(
+    pid: &ProcessHandle,
+    address: usize,
+    count: usize,
+) -> usize {
+    let mut remaining = count;
+    let mut unblocked_threads = BLOCKED_THREADS.lock().drain_filter(|thread| {
+        if remaining == 0 {
+            return false;
+        }
+        if let BlockReason::Futex(p, a) = thread.block_reason.as_ref().unwrap() {
+            if p == pid && *a == address {
+                remaining -= 1;
+                return true;
+            }
+        }
+        false
+    });
+
+    unblocked_threads
+        .iter_mut()
+        .for_each(|thread| thread.boost = INTERACTIVE_BOOST);
+    ACTIVE_THREADS.lock().join(unblocked_threads);
+    count - remaining
+}
+
+pub(crate) fn wake_all_threads_waiting_on_queues() {
+    let unblocked_threads = BLOCKED_THREADS.lock().drain_filter(|thread| {
+        matches!(
+            thread.block_reason.as_ref().unwrap(),
+            BlockReason::WaitQueue(_)
+        )
+    });
+
+    ACTIVE_THREADS.lock().join(unblocked_threads);
+}
+
 fn schedule_next_thread() -> Tcb {
     wake_asleep_threads();
+    crate::sync::wait_queue::process_pending_wakeups();
 
-    // This is the actual round-robin scheduling algo... For now it works, but it is obviously not
-    // optimal
-    ACTIVE_THREADS
+    let mut thread = ACTIVE_THREADS
         .lock()
         .pop()
-        .unwrap_or_else(|| IDLE_THREAD.lock().take().unwrap())
+        .unwrap_or_else(|| IDLE_THREAD.get().lock().take().unwrap());
+
+    // Start a new time slice
+    let timer = get_timer();
+    let resolution = timer.resolution();
+    let now = resolution.ticks_to_duration(timer.ticks());
+    thread.slice_deadline = Some(resolution.duration_to_ticks(now + thread.time_slice));
+    thread
+}
+
+/// Called on every timer interrupt. Preempts the current thread if its time slice is over or if a
+/// thread with a higher priority became runnable.
+pub fn handle_timer_tick(cx: &mut ExceptionContext) {
+    wake_asleep_threads();
+    crate::sync::wait_queue::process_pending_wakeups();
+
+    let mut current_thread = CURRENT_THREAD.get().lock();
+    let thread = match current_thread.as_mut() {
+        Some(thread) => thread,
+        None => {
+            // Scheduler is not started
+            return;
+        }
+    };
+
+    let highest_runnable = ACTIVE_THREADS.lock().highest_priority();
+    if thread.is_idle_thread {
+        if highest_runnable.is_some() {
+            drop(current_thread);
+            run_scheduler(cx);
+        }
+        return;
+    }
+
+    let highest_runnable = match highest_runnable {
+        Some(priority) => priority,
+        None => {
+            // Nothing else to run, keep going with the current thread
+            return;
+        }
+    };
+
+    let slice_expired = thread
+        .slice_deadline
+        .map(|deadline| get_timer().ticks() >= deadline)
+        .unwrap_or(true);
+    let preempted = highest_runnable > thread.effective_priority();
+    if !slice_expired && !preempted {
+        return;
+    }
+
+    if slice_expired {
+        // Threads that use their whole time slice are not interactive
+        thread.boost = 0;
+    }
+
+    drop(current_thread);
+    run_scheduler(cx);
 }
 
 pub fn run_scheduler(cx: &mut ExceptionContext) {
     // This should run scheduler and perform context switch.
     // At this point the simplest form of round robin scheduling is implemented.
 
-    let mut current_thread = CURRENT_THREAD.lock();
+    let mut current_thread = CURRENT_THREAD.get().lock();
 
     let mut thread = match current_thread.take() {
         Some(thread) => thread,
@@ -386,7 +742,7 @@ pub fn run_scheduler(cx: &mut ExceptionContext) {
     save_thread_context(&mut thread, cx);
 
     if thread.is_idle_thread {
-        IDLE_THREAD.lock().replace(thread);
+        IDLE_THREAD.get().lock().replace(thread);
     } else {
         // Store the thread in the list again
         ACTIVE_THREADS.lock().push(thread);
@@ -398,7 +754,7 @@ pub fn run_scheduler(cx: &mut ExceptionContext) {
 }
 
 pub fn sleep_current_thread(cx: &mut ExceptionContext, duration: Duration) {
-    let mut current_thread = CURRENT_THREAD.lock();
+    let mut current_thread = CURRENT_THREAD.get().lock();
 
     let mut thread = current_thread
         .take()
@@ -417,7 +773,14 @@ pub fn sleep_current_thread(cx: &mut ExceptionContext, duration: Duration) {
     let target_ticks = timer_res.duration_to_ticks(time_since_epoch + duration);
 
     thread.block_reason = Some(BlockReason::Sleep(target_ticks));
-    BLOCKED_THREADS.lock().push(thread);
+    let mut sleeping_threads = SLEEPING_THREADS.lock();
+    sleeping_threads.push(SleepingThread {
+        deadline: target_ticks,
+        sequence: SLEEP_SEQUENCE.fetch_add(1, Ordering::Relaxed),
+        thread,
+    });
+    timer.set_oneshot_deadline(sleeping_threads.peek().map(|sleeping| sleeping.deadline));
+    drop(sleeping_threads);
 
     let thread = schedule_next_thread();
     restore_thread_context(cx, &thread);
@@ -441,7 +804,7 @@ fn exit_thread(thread: Tcb) {
 }
 
 pub fn exit_current_thread(cx: &mut ExceptionContext) {
-    let mut current_thread = CURRENT_THREAD.lock();
+    let mut current_thread = CURRENT_THREAD.get().lock();
 
     let thread = current_thread
         .take()
@@ -471,6 +834,14 @@ fn validate_thread_handle(tid: u64) -> bool {
         return true;
     }
 
+    if SLEEPING_THREADS
+        .lock()
+        .iter()
+        .any(|sleeping| sleeping.thread.tid == tid)
+    {
+        return true;
+    }
+
     false
 }
 
@@ -480,7 +851,7 @@ pub fn join_thread(cx: &mut ExceptionContext, tid: u64) {
         return;
     }
 
-    let mut current_thread = CURRENT_THREAD.lock();
+    let mut current_thread = CURRENT_THREAD.get().lock();
 
     let mut thread = current_thread
         .take()
@@ -498,12 +869,11 @@ pub fn join_thread(cx: &mut ExceptionContext, tid: u64) {
 }
 
 pub fn print_thread_info() {
-    let current_thread = CURRENT_THREAD.lock();
-    let threads = ACTIVE_THREADS.lock();
     let blocked_threads = BLOCKED_THREADS.lock();
+    let sleeping_threads = SLEEPING_THREADS.lock();
 
     log_info!("Thread information:");
-    if let Some(tcb) = &*current_thread {
+    if let Some(tcb) = &*CURRENT_THREAD.get().lock() {
         if let Some(name) = tcb.name() {
             log_info!("\tCurrent thread: {}, tid: {}", name, tcb.tid);
         } else {
@@ -511,7 +881,7 @@ pub fn print_thread_info() {
         }
     }
 
-    for tcb in threads.iter() {
+    for tcb in ACTIVE_THREADS.lock().iter() {
         if let Some(name) = tcb.name() {
             log_info!("\tThread: {}, tid: {}", name, tcb.tid);
         } else {
@@ -526,17 +896,46 @@ pub fn print_thread_info() {
             log_info!("\tAnonymous blocked thread, tid: {}", tcb.tid);
         }
     }
+
+    for tcb in sleeping_threads.iter().map(|sleeping| &sleeping.thread) {
+        if let Some(name) = tcb.name() {
+            log_info!("\tSleeping thread: {}, tid: {}", name, tcb.tid);
+        } else {
+            log_info!("\tAnonymous sleeping thread, tid: {}", tcb.tid);
+        }
+    }
+}
+
+pub fn current_thread_handle() -> Option<ThreadHandle> {
+    CURRENT_THREAD
+        .get()
+        .lock()
+        .as_ref()
+        .map(|thread| ThreadHandle(thread.tid))
+}
+
+/// Returns the base address of the stack of the current thread, if it runs a process
+pub(crate) fn current_process_stack() -> Option<VirtualAddress> {
+    CURRENT_THREAD
+        .get()
+        .lock()
+        .as_ref()
+        .and_then(|thread| match thread.stack {
+            Stack::ProcessThread(va, _) => Some(va),
+            Stack::KernelThread(_) => None,
+        })
 }
 
 pub fn current_pid() -> Option<ProcessHandle> {
     CURRENT_THREAD
+        .get()
         .lock()
         .as_ref()
         .and_then(|thread| thread.process.clone())
 }
 
 fn find_thread(handle: ThreadHandle) -> Option<Tcb> {
-    let mut current_thread = CURRENT_THREAD.lock();
+    let mut current_thread = CURRENT_THREAD.get().lock();
     let matches_current_thread = if let Some(thread) = current_thread.as_ref() {
         thread.tid == handle.0
     } else {
@@ -563,6 +962,13 @@ fn find_thread(handle: ThreadHandle) -> Option<Tcb> {
         return Some(thread);
     }
 
+    if let Some(sleeping) = SLEEPING_THREADS
+        .lock()
+        .remove_first(|sleeping| sleeping.thread.tid == handle.0)
+    {
+        return Some(sleeping.thread);
+    }
+
     None
 }
 
@@ -583,7 +989,7 @@ pub(crate) fn exit_matching_threads(
 
     let thread = schedule_next_thread();
     restore_thread_context(cx, &thread);
-    CURRENT_THREAD.lock().replace(thread);
+    CURRENT_THREAD.get().lock().replace(thread);
 
     Ok(())
 }
@@ -599,6 +1005,7 @@ pub(crate) fn stack_validator(stack_type: arch::StackType) -> Option<StackValida
             })
         }
         arch::StackType::ProcessStack => CURRENT_THREAD
+            .get()
             .lock()
             .as_ref()
             .map(|thread| thread.stack.validator()),
@@ -606,7 +1013,7 @@ pub(crate) fn stack_validator(stack_type: arch::StackType) -> Option<StackValida
 }
 
 pub(crate) fn wait_for_pid_in_current_thread(cx: &mut ExceptionContext, pid: ProcessHandle) {
-    let mut current_thread = CURRENT_THREAD.lock();
+    let mut current_thread = CURRENT_THREAD.get().lock();
 
     let mut thread = current_thread
         .take()
@@ -622,3 +1029,54 @@ pub(crate) fn wait_for_pid_in_current_thread(cx: &mut ExceptionContext, pid: Pro
     restore_thread_context(cx, &thread);
     current_thread.replace(thread);
 }
+
+pub(crate) fn wait_on_queue_in_current_thread(cx: &mut ExceptionContext, queue_id: usize) {
+    let mut current_thread = CURRENT_THREAD.get().lock();
+
+    let mut thread = current_thread
+        .take()
+        .expect("There is no current thread calling wait_on_queue!");
+    assert!(!thread.is_idle_thread);
+
+    save_thread_context(&mut thread, cx);
+
+    thread.block_reason = Some(BlockReason::WaitQueue(queue_id));
+    BLOCKED_THREADS.lock().push(thread);
+
+    let thread = schedule_next_thread();
+    restore_thread_context(cx, &thread);
+    current_thread.replace(thread);
+}
+
+/// Blocks the current thread, which belongs to process `pid`, until the futex word at `address` is
+/// woken up with `wake_threads_waiting_on_futex`
+pub(crate) fn wait_on_futex_in_current_thread(
+    cx: &mut ExceptionContext,
+    pid: ProcessHandle,
+    address: usize,
+) {
+    let mut current_thread = CURRENT_THREAD.get().lock();
+
+    let mut thread = current_thread
+        .take()
+        .expect("There is no current thread calling wait_on_futex!");
+    assert!(!thread.is_idle_thread);
+
+    save_thread_context(&mut thread, cx);
+
+    thread.block_reason = Some(BlockReason::Futex(pid, address));
+    BLOCKED_THREADS.lock().push(thread);
+
+    let thread = schedule_next_thread();
+    restore_thread_context(cx, &thread);
+    current_thread.replace(thread);
+}
+
+pub fn set_current_thread_priority(cx: &mut ExceptionContext, priority: Priority) {
+    if let Some(thread) = CURRENT_THREAD.get().lock().as_mut() {
+        thread.priority = priority;
+    }
+
+    // Some other thread might have a higher priority now
+    run_scheduler(cx);
+}
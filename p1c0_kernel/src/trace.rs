@@ -0,0 +1,416 @@
+//! Binary event tracing.
+//!
+//! Trace points write fixed-size records into a ring per CPU, without taking locks or formatting
+//! anything, so that they can stay in the scheduler, syscall, exception and allocator paths
+//! without changing their timing noticeably. Every category of events is enabled separately at
+//! runtime and all of them start disabled, in which case a trace point is a single load.
+//!
+//! Rings never block writers. When a ring is full the oldest records are overwritten, and the next
+//! drain reports how many were lost.
+//!
+//! The exported trace is a `Header` followed by `Record`s, all of them little endian. Records are
+//! grouped by CPU and ordered by time within each CPU. Records that could not be read are replaced
+//! by a single `Event::RecordsLost` record. `dump_to_logger` writes the trace to the UART as lines
+//! of hex characters between `TRACE BEGIN` and `TRACE END`, which `xxd -r -p` turns back into
+//! binary. Other sinks, like a semihosting file, can be fed with `export`.
+
+use crate::{
+    print,
+    smp::{self, PerCpu},
+    thread,
+};
+
+use core::{
+    cell::UnsafeCell,
+    sync::atomic::{fence, AtomicBool, AtomicU32, AtomicU64, Ordering},
+};
+
+use cortex_a::registers::{CNTFRQ_EL0, CNTVCT_EL0};
+use tock_registers::interfaces::Readable;
+
+#[derive(Debug)]
+pub enum Error {
+    DrainInProgress,
+}
+
+type Result<T> = core::result::Result<T, Error>;
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+#[repr(u32)]
+pub enum Category {
+    Scheduler = 1 << 0,
+    Syscall = 1 << 1,
+    Exception = 1 << 2,
+    Irq = 1 << 3,
+    Alloc = 1 << 4,
+}
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+#[repr(u16)]
+pub enum Event {
+    /// Written by the drain in place of records of the CPU that were lost. arg0: number of records
+    RecordsLost = 0,
+    /// arg0: tid of the previous thread, arg1: tid of the next thread
+    ContextSwitch = 1,
+    /// arg0: syscall number, arg1: x0 of the caller
+    SyscallEnter = 2,
+    /// arg0: syscall number, arg1: tid of the caller. The record is attributed to the thread the
+    /// syscall returns to, which is a different one if the caller blocked.
+    SyscallExit = 3,
+    /// Synchronous exceptions other than syscalls. arg0: ESR_EL1, arg1: FAR_EL1
+    Exception = 4,
+    /// arg0: `IrqSource`, arg1: interrupt number, if the source has them
+    Irq = 5,
+    /// arg0: size, arg1: address
+    Alloc = 6,
+    /// arg0: size, arg1: address
+    Free = 7,
+    /// arg0: number of pages, arg1: physical address
+    PageAlloc = 8,
+    /// arg0: number of pages, arg1: physical address
+    PageFree = 9,
+}
+
+impl Event {
+    #[inline(always)]
+    const fn category(self) -> Option<Category> {
+        match self {
+            Event::RecordsLost => None,
+            Event::ContextSwitch => Some(Category::Scheduler),
+            Event::SyscallEnter | Event::SyscallExit => Some(Category::Syscall),
+            Event::Exception => Some(Category::Exception),
+            Event::Irq => Some(Category::Irq),
+            Event::Alloc | Event::Free | Event::PageAlloc | Event::PageFree => {
+                Some(Category::Alloc)
+            }
+        }
+    }
+}
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+#[repr(u64)]
+pub enum IrqSource {
+    Timer = 0,
+}
+
+#[derive(Debug, Clone, Copy, Default, PartialEq, Eq)]
+#[repr(C)]
+pub struct Record {
+    /// Value of the virtual counter, see `Header::timer_frequency`
+    pub timestamp: u64,
+    /// Lower bits of the tid of the thread running on the CPU
+    pub tid: u32,
+    pub cpu: u16,
+    pub event: u16,
+    pub arg0: u64,
+    pub arg1: u64,
+}
+
+impl Record {
+    pub const SIZE: usize = core::mem::size_of::<Self>();
+
+    pub fn to_bytes(&self) -> [u8; Self::SIZE] {
+        let mut bytes = [0; Self::SIZE];
+        bytes[0..8].copy_from_slice(&self.timestamp.to_le_bytes());
+        bytes[8..12].copy_from_slice(&self.tid.to_le_bytes());
+        bytes[12..14].copy_from_slice(&self.cpu.to_le_bytes());
+        bytes[14..16].copy_from_slice(&self.event.to_le_bytes());
+        bytes[16..24].copy_from_slice(&self.arg0.to_le_bytes());
+        bytes[24..32].copy_from_slice(&self.arg1.to_le_bytes());
+        bytes
+    }
+}
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct Header {
+    pub version: u32,
+    pub record_size: u32,
+    /// Frequency of the counter used for timestamps, in Hz
+    pub timer_frequency: u64,
+}
+
+impl Header {
+    pub const MAGIC: [u8; 8] = *b"P1C0TRC\0";
+    pub const VERSION: u32 = 1;
+    pub const SIZE: usize = 24;
+
+    pub fn to_bytes(&self) -> [u8; Self::SIZE] {
+        let mut bytes = [0; Self::SIZE];
+        bytes[0..8].copy_from_slice(&Self::MAGIC);
+        bytes[8..12].copy_from_slice(&self.version.to_le_bytes());
+        bytes[12..16].copy_from_slice(&self.record_size.to_le_bytes());
+        bytes[16..24].copy_from_slice(&self.timer_frequency.to_le_bytes());
+        bytes
+    }
+}
+
+/// Number of records in the ring of each CPU. Must be a power of two.
+const RING_SIZE: usize = 512;
+
+/// Marks a slot whose record is being written
+const WRITING: u64 = 0;
+
+struct Slot {
+    /// Position of the record in the slot plus one, or `WRITING`
+    seq: AtomicU64,
+    record: UnsafeCell<Record>,
+}
+
+impl Slot {
+    const fn new() -> Self {
+        Self {
+            seq: AtomicU64::new(WRITING),
+            record: UnsafeCell::new(Record {
+                timestamp: 0,
+                tid: 0,
+                cpu: 0,
+                event: 0,
+                arg0: 0,
+                arg1: 0,
+            }),
+        }
+    }
+}
+
+/// Ring of records with any number of writers and a single reader. Writers only contend on
+/// `head`, and each slot works as a sequence lock, so the reader can tell apart records that were
+/// overwritten while it read them.
+struct Ring {
+    /// Position of the next record to write
+    head: AtomicU64,
+    /// Position of the next record to read
+    tail: AtomicU64,
+    slots: [Slot; RING_SIZE],
+}
+
+// Slots are only accessed through the sequence lock protocol
+unsafe impl Sync for Ring {}
+
+impl Ring {
+    const fn new() -> Self {
+        #[allow(clippy::declare_interior_mutable_const)]
+        const EMPTY_SLOT: Slot = Slot::new();
+        Self {
+            head: AtomicU64::new(0),
+            tail: AtomicU64::new(0),
+            slots: [EMPTY_SLOT; RING_SIZE],
+        }
+    }
+
+    fn slot(&self, pos: u64) -> &Slot {
+        &self.slots[pos as usize & (RING_SIZE - 1)]
+    }
+
+    fn push(&self, record: &Record) {
+        let pos = self.head.fetch_add(1, Ordering::Relaxed);
+        let slot = self.slot(pos);
+
+        slot.seq.store(WRITING, Ordering::Relaxed);
+        fence(Ordering::Release);
+        unsafe { slot.record.get().write_volatile(*record) };
+        slot.seq.store(pos + 1, Ordering::Release);
+    }
+
+    /// Returns the record at `pos`, or None if it was overwritten or is still being written
+    fn read(&self, pos: u64) -> Option<Record> {
+        let slot = self.slot(pos);
+        if slot.seq.load(Ordering::Acquire) != pos + 1 {
+            return None;
+        }
+        let record = unsafe { slot.record.get().read_volatile() };
+        fence(Ordering::Acquire);
+        (slot.seq.load(Ordering::Relaxed) == pos + 1).then(|| record)
+    }
+
+    /// Calls `f` with every record written since the last drain, oldest first. Returns the number
+    /// of records that could not be read. Must not run concurrently with itself.
+    fn drain(&self, mut f: impl FnMut(&Record)) -> u64 {
+        let head = self.head.load(Ordering::Acquire);
+        let tail = self.tail.load(Ordering::Relaxed);
+
+        // Everything older than the last RING_SIZE records has been overwritten
+        let first = tail.max(head.saturating_sub(RING_SIZE as u64));
+        let mut lost = first - tail;
+        for pos in first..head {
+            match self.read(pos) {
+                Some(record) => f(&record),
+                None => lost += 1,
+            }
+        }
+
+        self.tail.store(head, Ordering::Relaxed);
+        lost
+    }
+}
+
+static ENABLED: AtomicU32 = AtomicU32::new(0);
+static DRAINING: AtomicBool = AtomicBool::new(false);
+
+#[allow(clippy::declare_interior_mutable_const)]
+const EMPTY_RING: Ring = Ring::new();
+static RINGS: PerCpu<Ring> = PerCpu::new([EMPTY_RING; smp::MAX_CPUS]);
+
+/// Starts recording events of the category. Must not be called before the per-CPU state is set
+/// up, since every record looks up the CPU that writes it.
+pub fn enable(category: Category) {
+    ENABLED.fetch_or(category as u32, Ordering::Relaxed);
+}
+
+pub fn disable(category: Category) {
+    ENABLED.fetch_and(!(category as u32), Ordering::Relaxed);
+}
+
+pub fn is_enabled(category: Category) -> bool {
+    (ENABLED.load(Ordering::Relaxed) & category as u32) != 0
+}
+
+/// Records the event if its category is enabled.
+#[inline(always)]
+pub fn record(event: Event, arg0: u64, arg1: u64) {
+    if let Some(category) = event.category() {
+        if is_enabled(category) {
+            write_record(event, arg0, arg1);
+        }
+    }
+}
+
+#[inline(never)]
+fn write_record(event: Event, arg0: u64, arg1: u64) {
+    let cpu = smp::cpu_id();
+    let record = Record {
+        timestamp: CNTVCT_EL0.get(),
+        tid: thread::current_tid() as u32,
+        cpu: cpu as u16,
+        event: event as u16,
+        arg0,
+        arg1,
+    };
+    RINGS.get_for(cpu).push(&record);
+}
+
+/// Calls `f` with every record written since the last drain, CPU by CPU. Records that were lost
+/// are reported with a `RecordsLost` record after the ones of the same CPU.
+pub fn drain(mut f: impl FnMut(&Record)) -> Result<()> {
+    if DRAINING.swap(true, Ordering::Acquire) {
+        return Err(Error::DrainInProgress);
+    }
+
+    for (cpu, ring) in RINGS.iter().enumerate() {
+        let mut last_timestamp = 0;
+        let lost = ring.drain(|record| {
+            last_timestamp = record.timestamp;
+            f(record)
+        });
+
+        if lost != 0 {
+            f(&Record {
+                timestamp: last_timestamp,
+                tid: 0,
+                cpu: cpu as u16,
+                event: Event::RecordsLost as u16,
+                arg0: lost,
+                arg1: 0,
+            });
+        }
+    }
+
+    DRAINING.store(false, Ordering::Release);
+    Ok(())
+}
+
+/// Drains the trace in its binary format. `sink` is called once with the header and then once
+/// per record.
+pub fn export(mut sink: impl FnMut(&[u8])) -> Result<()> {
+    let header = Header {
+        version: Header::VERSION,
+        record_size: Record::SIZE as u32,
+        timer_frequency: CNTFRQ_EL0.get(),
+    };
+    sink(&header.to_bytes());
+    drain(|record| sink(&record.to_bytes()))
+}
+
+/// Drains the trace to the logger, bypassing the print buffer. Every part of the binary trace is
+/// written as a line of hex characters.
+pub fn dump_to_logger() -> Result<()> {
+    const HEX: &[u8; 16] = b"0123456789abcdef";
+
+    print::write_raw(b"\nTRACE BEGIN\n");
+    let result = export(|bytes| {
+        let mut line = [0u8; Record::SIZE * 2 + 1];
+        for (byte, hex) in bytes.iter().zip(line.chunks_exact_mut(2)) {
+            hex[0] = HEX[(byte >> 4) as usize];
+            hex[1] = HEX[(byte & 0xF) as usize];
+        }
+        line[bytes.len() * 2] = b'\n';
+        print::write_raw(&line[..bytes.len() * 2 + 1]);
+    });
+    print::write_raw(b"TRACE END\n");
+    result
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    fn record(timestamp: u64) -> Record {
+        Record {
+            timestamp,
+            event: Event::Irq as u16,
+            ..Default::default()
+        }
+    }
+
+    fn drain(ring: &Ring) -> (Vec<u64>, u64) {
+        let mut timestamps = vec![];
+        let lost = ring.drain(|record| timestamps.push(record.timestamp));
+        (timestamps, lost)
+    }
+
+    #[test]
+    fn test_records_are_drained_in_order_once() {
+        let ring = Box::new(Ring::new());
+        (0..3).for_each(|i| ring.push(&record(i)));
+        assert_eq!(drain(&ring), (vec![0, 1, 2], 0));
+
+        ring.push(&record(3));
+        assert_eq!(drain(&ring), (vec![3], 0));
+        assert_eq!(drain(&ring), (vec![], 0));
+    }
+
+    #[test]
+    fn test_overwritten_records_are_lost() {
+        let ring = Box::new(Ring::new());
+        let total = RING_SIZE as u64 + 10;
+        (0..total).for_each(|i| ring.push(&record(i)));
+
+        let (timestamps, lost) = drain(&ring);
+        assert_eq!(lost, 10);
+        assert_eq!(timestamps, (10..total).collect::<Vec<_>>());
+    }
+
+    #[test]
+    fn test_records_being_written_are_lost() {
+        let ring = Box::new(Ring::new());
+        ring.push(&record(0));
+        // A writer that reserved the next slot but did not finish writing it
+        ring.head.fetch_add(1, Ordering::Relaxed);
+
+        assert_eq!(drain(&ring), (vec![0], 1));
+    }
+
+    #[test]
+    fn test_record_layout() {
+        let record = Record {
+            timestamp: 0x0807060504030201,
+            tid: 0x0c0b0a09,
+            cpu: 0x0e0d,
+            event: 0x100f,
+            arg0: 0x1817161514131211,
+            arg1: 0x201f1e1d1c1b1a19,
+        };
+        let expected: Vec<u8> = (1..=32).collect();
+        assert_eq!(&record.to_bytes()[..], &expected[..]);
+        assert_eq!(Record::SIZE, 32);
+    }
+}
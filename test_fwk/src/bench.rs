@@ -0,0 +1,189 @@
+//! Microbenchmarks that run on the target.
+//!
+//! A benchmark calls a closure a number of times, split in batches, and times every batch with the
+//! virtual counter (`CNTVCT_EL0`) and, when the CPU has an architectural PMU, with the cycle
+//! counter (`PMCCNTR_EL0`). The statistics of the batches are printed over semihosting as a single
+//! line:
+//!
+//! ```text
+//! BENCH name=<name> iterations=<n> min_ns=<f> median_ns=<f> batch_p99_ns=<f> ops_per_sec=<f> median_cycles=<n>
+//! ```
+//!
+//! All times are per iteration, averaged over a batch. Single operations are not timed because
+//! most of them take less than a tick of the virtual counter, so `batch_p99_ns` is the 99th
+//! percentile of the batch means and not the tail latency of an operation: a slow iteration is
+//! diluted by the rest of its batch. `median_cycles` is omitted without a cycle counter.
+//! `m1_runner` parses these lines to compare them against a baseline.
+
+use arm_semihosting::println;
+
+pub use core::hint::black_box;
+
+/// Maximum number of batches timed for a benchmark. Each batch runs the same number of iterations.
+pub const MAX_SAMPLES: usize = 128;
+
+/// The prefix of the lines with the results of a benchmark
+pub const RESULT_PREFIX: &str = "BENCH";
+
+#[derive(Clone, Copy, Debug)]
+pub struct Stats {
+    pub iterations: usize,
+    pub min_ns: f64,
+    pub median_ns: f64,
+    /// 99th percentile of the batch means
+    pub batch_p99_ns: f64,
+    pub ops_per_sec: f64,
+    pub median_cycles: Option<u64>,
+}
+
+#[cfg(all(target_arch = "aarch64", target_os = "none"))]
+mod counters {
+    /// Returns the virtual counter, after all previous instructions complete.
+    pub fn ticks() -> u64 {
+        let ticks: u64;
+        unsafe { core::arch::asm!("isb", "mrs {}, cntvct_el0", out(reg) ticks) };
+        ticks
+    }
+
+    pub fn frequency() -> u64 {
+        let frequency: u64;
+        unsafe { core::arch::asm!("mrs {}, cntfrq_el0", out(reg) frequency) };
+        frequency
+    }
+
+    /// Enables the cycle counter, if the CPU implements an architectural PMU. Apple cores report
+    /// an IMPLEMENTATION DEFINED one, which does not have it.
+    pub fn enable_cycle_counter() -> bool {
+        const PMUVER_SHIFT: u64 = 8;
+        const PMUVER_MASK: u64 = 0xF;
+        const PMUVER_IMPDEF: u64 = 0xF;
+        // Enable, and count with 64 bits
+        const PMCR_E: u64 = 1 << 0;
+        const PMCR_LC: u64 = 1 << 6;
+        const PMCNTENSET_C: u64 = 1 << 31;
+
+        let dfr0: u64;
+        unsafe { core::arch::asm!("mrs {}, id_aa64dfr0_el1", out(reg) dfr0) };
+        let pmuver = (dfr0 >> PMUVER_SHIFT) & PMUVER_MASK;
+        if pmuver == 0 || pmuver == PMUVER_IMPDEF {
+            return false;
+        }
+
+        unsafe {
+            let mut pmcr: u64;
+            core::arch::asm!("mrs {}, pmcr_el0", out(reg) pmcr);
+            pmcr |= PMCR_E | PMCR_LC;
+            core::arch::asm!(
+                "msr pmcr_el0, {}",
+                "msr pmccfiltr_el0, xzr",
+                "msr pmcntenset_el0, {}",
+                "isb",
+                in(reg) pmcr,
+                in(reg) PMCNTENSET_C,
+            );
+        }
+        true
+    }
+
+    pub fn cycles() -> u64 {
+        let cycles: u64;
+        unsafe { core::arch::asm!("isb", "mrs {}, pmccntr_el0", out(reg) cycles) };
+        cycles
+    }
+}
+
+#[cfg(not(all(target_arch = "aarch64", target_os = "none")))]
+mod counters {
+    pub fn ticks() -> u64 {
+        0
+    }
+
+    pub fn frequency() -> u64 {
+        1
+    }
+
+    pub fn enable_cycle_counter() -> bool {
+        false
+    }
+
+    pub fn cycles() -> u64 {
+        0
+    }
+}
+
+/// Returns the value at the given percentile of sorted samples.
+fn percentile(sorted: &[u64], percent: usize) -> u64 {
+    let rank = (sorted.len() * percent + 99) / 100;
+    sorted[rank.max(1) - 1]
+}
+
+/// Runs `f` `iterations` times and prints its statistics.
+pub fn bench<F: FnMut()>(name: &str, iterations: usize, mut f: F) -> Stats {
+    assert!(iterations > 0);
+    let num_samples = iterations.min(MAX_SAMPLES);
+    let batch = iterations / num_samples;
+    let has_cycles = counters::enable_cycle_counter();
+
+    // Warm up caches and the branch predictor
+    f();
+
+    let mut ticks = [0u64; MAX_SAMPLES];
+    let mut cycles = [0u64; MAX_SAMPLES];
+    for (ticks, cycles) in ticks.iter_mut().zip(cycles.iter_mut()).take(num_samples) {
+        let start_cycles = counters::cycles();
+        let start = counters::ticks();
+        for _ in 0..batch {
+            f();
+        }
+        *ticks = counters::ticks() - start;
+        *cycles = counters::cycles() - start_cycles;
+    }
+
+    let ticks = &mut ticks[..num_samples];
+    let cycles = &mut cycles[..num_samples];
+    ticks.sort_unstable();
+    cycles.sort_unstable();
+
+    let ns_per_tick = 1_000_000_000.0 / counters::frequency() as f64;
+    let per_iteration = |ticks: u64| ticks as f64 * ns_per_tick / batch as f64;
+    let median = percentile(ticks, 50);
+    let stats = Stats {
+        iterations: num_samples * batch,
+        min_ns: per_iteration(ticks[0]),
+        median_ns: per_iteration(median),
+        batch_p99_ns: per_iteration(percentile(ticks, 99)),
+        ops_per_sec: 1_000_000_000.0 / per_iteration(median.max(1)),
+        median_cycles: has_cycles.then(|| percentile(cycles, 50) / batch as u64),
+    };
+
+    report(name, &stats);
+    stats
+}
+
+fn report(name: &str, stats: &Stats) {
+    // The result starts on a line of its own, after the name printed by the test runner
+    println!("");
+    match stats.median_cycles {
+        Some(cycles) => println!(
+            "{} name={} iterations={} min_ns={:.1} median_ns={:.1} batch_p99_ns={:.1} ops_per_sec={:.0} median_cycles={}",
+            RESULT_PREFIX,
+            name,
+            stats.iterations,
+            stats.min_ns,
+            stats.median_ns,
+            stats.batch_p99_ns,
+            stats.ops_per_sec,
+            cycles
+        ),
+        None => println!(
+            "{} name={} iterations={} min_ns={:.1} median_ns={:.1} batch_p99_ns={:.1} ops_per_sec={:.0}",
+            RESULT_PREFIX,
+            name,
+            stats.iterations,
+            stats.min_ns,
+            stats.median_ns,
+            stats.batch_p99_ns,
+            stats.ops_per_sec
+        ),
+    }
+}
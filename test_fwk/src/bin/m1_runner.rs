@@ -1,10 +1,11 @@
 use anyhow::anyhow;
 use anyhow::Context;
 use object::read::elf::ElfFile;
-use std::{error::Error, fs::File, io::Read, path::Path};
+use std::{collections::BTreeMap, error::Error, fs::File, io::Read, path::Path};
 use std::{fs, io::Write};
 use structopt::StructOpt;
-use toml::Value;
+use test_fwk::bench::RESULT_PREFIX;
+use toml::{value::Table, Value};
 use xshell::{cmd, rm_rf};
 
 #[derive(StructOpt)]
@@ -26,6 +27,20 @@ struct Opts {
 
     #[structopt(long, short)]
     profile: bool,
+
+    /// Compares the results of the benchmarks against the baseline in this file
+    #[structopt(long, parse(from_os_str), env = "M1_RUNNER_BENCH_BASELINE")]
+    bench_baseline: Option<std::path::PathBuf>,
+
+    /// Stores the results of the benchmarks as the baseline in this file. Results of benchmarks
+    /// already in the file are replaced, and the rest are kept.
+    #[structopt(long, parse(from_os_str), env = "M1_RUNNER_SAVE_BENCH_BASELINE")]
+    save_bench_baseline: Option<std::path::PathBuf>,
+
+    /// Largest increase of the median time of a benchmark allowed, as a percentage of the
+    /// baseline
+    #[structopt(long, default_value = "10", env = "M1_RUNNER_MAX_BENCH_REGRESSION")]
+    max_bench_regression: f64,
 }
 
 #[derive(Debug, Clone)]
@@ -115,6 +130,132 @@ fn build_macho_executable_with_payload(elf: &Path, macho_exec: &Path) -> anyhow:
     Ok(())
 }
 
+/// Statistics of a benchmark, as printed by `test_fwk::bench`. All times are per iteration.
+#[derive(Debug, Default)]
+struct BenchResult {
+    min_ns: f64,
+    median_ns: f64,
+    batch_p99_ns: f64,
+}
+
+const BENCH_FIELDS: [&str; 3] = ["min_ns", "median_ns", "batch_p99_ns"];
+
+fn parse_bench_results(output: &str) -> anyhow::Result<BTreeMap<String, BenchResult>> {
+    let mut results = BTreeMap::new();
+    for line in output.lines() {
+        let fields = match line.trim().strip_prefix(RESULT_PREFIX) {
+            Some(fields) => fields,
+            None => continue,
+        };
+
+        let mut name = None;
+        let mut result = BenchResult::default();
+        for field in fields.split_whitespace() {
+            let (key, value) = field
+                .split_once('=')
+                .ok_or_else(|| anyhow!("Malformed benchmark field {:?}", field))?;
+            let parse = || {
+                value
+                    .parse::<f64>()
+                    .with_context(|| format!("Invalid value for {}: {:?}", key, value))
+            };
+            match key {
+                "name" => name = Some(value.to_string()),
+                "min_ns" => result.min_ns = parse()?,
+                "median_ns" => result.median_ns = parse()?,
+                "batch_p99_ns" => result.batch_p99_ns = parse()?,
+                _ => {}
+            }
+        }
+
+        let name = name.ok_or_else(|| anyhow!("Benchmark result without a name: {:?}", line))?;
+        results.insert(name, result);
+    }
+    Ok(results)
+}
+
+fn read_baseline(path: &Path) -> anyhow::Result<Table> {
+    let content = fs::read_to_string(path)
+        .with_context(|| format!("Failed to read baseline {}", path.display()))?;
+    match content.parse::<Value>() {
+        Ok(Value::Table(table)) => Ok(table),
+        Ok(_) => Err(anyhow!("Baseline {} is not a table", path.display())),
+        Err(err) => Err(anyhow!(
+            "Failed to parse baseline {}: {}",
+            path.display(),
+            err
+        )),
+    }
+}
+
+fn save_baseline(path: &Path, results: &BTreeMap<String, BenchResult>) -> anyhow::Result<()> {
+    let mut baseline = if path.exists() {
+        read_baseline(path)?
+    } else {
+        Table::new()
+    };
+
+    for (name, result) in results {
+        let values = [result.min_ns, result.median_ns, result.batch_p99_ns];
+        let entry = BENCH_FIELDS
+            .iter()
+            .zip(values)
+            .map(|(key, value)| (key.to_string(), Value::Float(value)))
+            .collect();
+        baseline.insert(name.clone(), Value::Table(entry));
+    }
+
+    fs::write(path, toml::to_string(&Value::Table(baseline))?)
+        .with_context(|| format!("Failed to write baseline {}", path.display()))?;
+    println!(
+        "Saved {} benchmark results to {}",
+        results.len(),
+        path.display()
+    );
+    Ok(())
+}
+
+fn compare_with_baseline(
+    path: &Path,
+    results: &BTreeMap<String, BenchResult>,
+    max_regression: f64,
+) -> anyhow::Result<()> {
+    let baseline = read_baseline(path)?;
+
+    let mut regressions = vec![];
+    for (name, result) in results {
+        let base = baseline
+            .get(name)
+            .and_then(|entry| entry.get("median_ns"))
+            .and_then(Value::as_float);
+        let base = match base {
+            Some(base) if base > 0.0 => base,
+            _ => {
+                println!("{}: {:.1} ns (not in baseline)", name, result.median_ns);
+                continue;
+            }
+        };
+
+        let change = (result.median_ns / base - 1.0) * 100.0;
+        println!(
+            "{}: {:.1} ns -> {:.1} ns ({:+.1}%)",
+            name, base, result.median_ns, change
+        );
+        if change > max_regression {
+            regressions.push(name.as_str());
+        }
+    }
+
+    if !regressions.is_empty() {
+        return Err(anyhow!(
+            "Benchmarks regressed by more than {}%: {}",
+            max_regression,
+            regressions.join(", ")
+        ));
+    }
+    Ok(())
+}
+
 fn main() -> Result<(), Box<dyn Error>> {
     let opts = Opts::from_args();
 
@@ -181,8 +322,28 @@ fn main() -> Result<(), Box<dyn Error>> {
         additional_args.push(semihosting_arg);
     }
 
-    qemu_cmd.args(additional_args.iter()).run()?;
+    let qemu_cmd = qemu_cmd.args(additional_args.iter());
+    if opts.bench_baseline.is_none() && opts.save_bench_baseline.is_none() {
+        qemu_cmd.run()?;
+        rm_rf(temp_file_name)?;
+        return Ok(());
+    }
 
+    // The output is captured to find the results of the benchmarks
+    let output = qemu_cmd.ignore_status().output()?;
+    std::io::stdout().write_all(&output.stdout)?;
+    std::io::stderr().write_all(&output.stderr)?;
     rm_rf(temp_file_name)?;
+    if !output.status.success() {
+        return Err(anyhow!("qemu exited with {}", output.status).into());
+    }
+
+    let results = parse_bench_results(&String::from_utf8_lossy(&output.stdout))?;
+    if let Some(path) = &opts.save_bench_baseline {
+        save_baseline(path, &results)?;
+    }
+    if let Some(path) = &opts.bench_baseline {
+        compare_with_baseline(path, &results, opts.max_bench_regression)?;
+    }
     Ok(())
 }
@@ -1,4 +1,7 @@
 #![no_std]
+#![feature(bench_black_box)]
+
+pub mod bench;
 
 use arm_semihosting::{print, println};
 use core::{
@@ -1,6 +1,9 @@
 #include <libcxx/types.h>
 #include <libcxx/syscalls.h>
 #include <libcxx/fmt.h>
+#include <libcxx/sync.h>
+#include <libcxx/thread.h>
+#include <libcxx/time.h>
 
 using libcxx::u64;
 using libcxx::usize;
@@ -9,16 +12,29 @@ namespace {
     [[gnu::noinline]] void oh_my_bug(u64 i, bool withTrick);
 
     [[gnu::noinline]] void print_message(u64 i, bool withTrick);
+
+    void test_threads();
 }
 
 // base_addr is passed to us via the OS so that we know where the binary was loaded. This can be used for ASLR.
 int main(int argc, char *argv[], char *envp[]) {
   int i = 0;
 
-  libcxx::print("Num arguments is %x", argc);
+  libcxx::println("Num arguments is {}", argc);
   for (usize i = 0; i < argc; i++) {
-    libcxx::print("Argument %x is `%s`", i, argv[i]);
+    libcxx::println("Argument {} is `{}`", i, argv[i]);
+  }
+
+  auto *values = new u64[64];
+  for (usize i = 0; i < 64; i++) {
+    values[i] = i;
   }
+  libcxx::println("Heap allocations work! Last value is {}", values[63]);
+  delete[] values;
+
+  const u64 start = libcxx::time::now();
+  test_threads();
+  libcxx::println("Threads took {} us", (libcxx::time::now() - start) / 1000);
 
   while (i < 5) {
     print_message(i, argc > 1);
@@ -33,20 +49,20 @@ namespace {
     class Guard {
     public:
         Guard() {
-          libcxx::print("C++ global constructors work!");
+          libcxx::println("C++ global constructors work!");
         }
 
         ~Guard() {
-          libcxx::print("C++ global destructors also work!");
+          libcxx::println("C++ global destructors also work!");
         }
     };
 
     __attribute__((constructor)) void constructor() {
-      libcxx::print("C constructor functions work!");
+      libcxx::println("C constructor functions work!");
     }
 
     __attribute__((destructor)) void destructor() {
-      libcxx::print("C destructor functions work!");
+      libcxx::println("C destructor functions work!");
     }
 
     Guard guard;
@@ -59,8 +75,43 @@ namespace {
       }
     }
 
+    struct SharedCounter {
+        constexpr static u64 INCREMENTS = 10'000;
+
+        libcxx::Mutex mutex;
+        libcxx::ConditionVariable done;
+        u64 value{0};
+        usize finished{0};
+    };
+
+    void increment(void *argument) {
+      auto &counter = *static_cast<SharedCounter *>(argument);
+      for (u64 i = 0; i < SharedCounter::INCREMENTS; i++) {
+        libcxx::LockGuard guard{counter.mutex};
+        counter.value++;
+      }
+
+      libcxx::LockGuard guard{counter.mutex};
+      counter.finished++;
+      counter.done.notify_all();
+    }
+
+    void test_threads() {
+      SharedCounter counter;
+      libcxx::Thread first{increment, &counter};
+      libcxx::Thread second{increment, &counter};
+
+      counter.mutex.lock();
+      counter.done.wait(counter.mutex, [&counter] { return counter.finished == 2; });
+      counter.mutex.unlock();
+
+      first.join();
+      second.join();
+      libcxx::println("Threads work! Counter is {}, expected {}", counter.value, 2 * SharedCounter::INCREMENTS);
+    }
+
     [[gnu::noinline]] void print_message(u64 i, bool withTrick) {
-      libcxx::print("Hi there! %x", i);
+      libcxx::println("Hi there! {}", i);
       oh_my_bug(i, withTrick);
     }
 }
\ No newline at end of file
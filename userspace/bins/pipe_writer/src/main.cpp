@@ -0,0 +1,30 @@
+#include <libcxx/syscalls.h>
+#include <libcxx/types.h>
+
+using libcxx::u64;
+using libcxx::usize;
+
+namespace {
+    u64 parse_decimal(const char *str) {
+      u64 value = 0;
+      while ((*str >= '0') && (*str <= '9')) {
+        value = value * 10 + static_cast<u64>(*str++ - '0');
+      }
+      return value;
+    }
+}
+
+// Writes a message into the pipe whose ID is the first argument. The write end is left open on purpose, the kernel
+// closes it when the process exits.
+int main(int argc, char *argv[], char *envp[]) {
+  if (argc < 2) {
+    return 1;
+  }
+
+  constexpr char MESSAGE[] = "Hello from pipe_writer";
+  constexpr usize LENGTH = sizeof(MESSAGE) - 1;
+  if (libcxx::syscalls::pipe_write(parse_decimal(argv[1]), MESSAGE, LENGTH) != LENGTH) {
+    return 2;
+  }
+  return 0;
+}
@@ -0,0 +1,20 @@
+#ifndef CRT_EXIT_H_
+#define CRT_EXIT_H_
+
+namespace crt {
+    using u64 = __UINT64_TYPE__;
+
+    /**
+     * @brief Runs the atexit handlers and global destructors, flushes stdout and exits the process with the given code.
+     */
+    [[noreturn]] void exit(u64 exit_code) noexcept;
+
+    /**
+     * @brief Flushes stdout and terminates the process with a fault, without running atexit handlers or destructors.
+     * Output buffered by a process that is killed by the kernel (for instance after a fault it did not raise through
+     * this function) is lost, since the process gets no chance to flush it.
+     */
+    [[noreturn]] void abort() noexcept;
+}  // namespace crt
+
+#endif  // CRT_EXIT_H_
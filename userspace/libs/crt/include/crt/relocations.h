@@ -10,10 +10,23 @@ namespace crt::relocations {
         u64 addend;
     };
 
+    /**
+     * @brief Entry of a packed relative relocation table (DT_RELR). An even entry is the offset of a word to relocate.
+     * An odd entry is a bitmap of the 63 words that follow the last relocated word or the words covered by the previous
+     * bitmap: bit n + 1 set means word n has to be relocated. The addends are stored in the words themselves.
+     */
+    using RelrEntry = u64;
+
     constexpr static auto R_AARCH64_RELATIVE = 1027;
 
     u64 apply_relocations(u64 base, const RelaEntry *rela_entry, u64 rela_len_bytes);
 
+    /**
+     * @brief Applies the relative relocations packed by the linker (-z pack-relative-relocs), which are not in the
+     * RELA table anymore.
+     */
+    void apply_relr_relocations(u64 base, const RelrEntry *relr_entry, u64 relr_len_bytes);
+
 }  // namespace crt::relocations
 
 #endif  // CRT_RELOCATIONS_H_
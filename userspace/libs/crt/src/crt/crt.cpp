@@ -1,3 +1,5 @@
+#include <crt/exit.h>
+
 
 using FuncPtr = void (*)();
 using FuncWithArgPtr = void (*)(void *);
@@ -9,22 +11,37 @@ extern const FuncPtr __init_array_start;
 extern const FuncPtr __init_array_end;
 extern const FuncPtr __fini_array_start;
 extern const FuncPtr __fini_array_end;
+
+// Overridden by libcxx when its output streams are linked in. Flushes any buffered output.
+__attribute__((weak)) void __libcxx_flush_stdout() {}
 }
 
 namespace {
-    class Spinlock final {
+    /**
+     * @brief Sleeping lock built directly on the futex syscalls, since crt cannot use the libcxx Mutex. Threads that
+     * find it taken block in the kernel instead of spinning through the time slice of the thread holding it.
+     */
+    class FutexLock final {
     public:
         void lock() noexcept {
-          while (__atomic_exchange_n(&mLocked, true, __ATOMIC_ACQUIRE)) {}
+          while (__atomic_exchange_n(&mLocked, 1u, __ATOMIC_ACQUIRE) != 0) {
+            asm volatile(
+            "mov x0, %0\n"
+            "mov x1, #1\n"
+            "svc 28" : : "r" (&mLocked) : "x0", "x1", "memory");
+          }
         }
 
         void unlock() noexcept {
-          mLocked = false;
-          __atomic_store_n(&mLocked, false, __ATOMIC_RELEASE);
+          __atomic_store_n(&mLocked, 0u, __ATOMIC_RELEASE);
+          asm volatile(
+          "mov x0, %0\n"
+          "mov x1, #1\n"
+          "svc 29" : : "r" (&mLocked) : "x0", "x1", "memory");
         }
 
     private:
-        bool mLocked{false};
+        unsigned int mLocked{0};
     };
 
     template <typename T>
@@ -80,11 +97,28 @@ namespace crt {
       while (ptr < &__fini_array_end) {
         (*ptr++)();
       }
+
+      // Destructors and atexit handlers may still print, so this must happen last
+      __libcxx_flush_stdout();
+    }
+
+    void exit(u64 exit_code) noexcept {
+      fini();
+
+      asm volatile(
+      "mov x0, %0\n"
+      "svc 8" : : "r" (exit_code) : "x0");
+      __builtin_unreachable();
+    }
+
+    void abort() noexcept {
+      __libcxx_flush_stdout();
+      __builtin_trap();
     }
 
     extern "C" void __cxa_atexit(FuncWithArgPtr fn, void *arg, void *dso_handle) {
-      static Spinlock mutex;
-      UniqueLock<Spinlock> l{mutex};
+      static FutexLock mutex;
+      UniqueLock<FutexLock> l{mutex};
 
       atExitHandlers[numAtExitHandlers++] = AtExitEntry{
           .fn = fn,
@@ -14,4 +14,27 @@ namespace crt::relocations {
       return 0;
     }
 
+    void apply_relr_relocations(u64 base, const RelrEntry *relocations, u64 relr_len_bytes) {
+      constexpr u64 BITS_PER_BITMAP = 63;
+      const u64 num_entries = relr_len_bytes / sizeof(RelrEntry);
+
+      u64 *where = nullptr;
+      for (u64 i = 0; i < num_entries; i++) {
+        const RelrEntry entry = relocations[i];
+        if ((entry & 1) == 0) {
+          where = reinterpret_cast<u64 *>(base + entry);
+          *where++ += base;
+          continue;
+        }
+
+        // Only the set bits are visited, clearing the lowest one on every step
+        u64 bitmap = entry >> 1;
+        while (bitmap != 0) {
+          where[__builtin_ctzll(bitmap)] += base;
+          bitmap &= bitmap - 1;
+        }
+        where += BITS_PER_BITMAP;
+      }
+    }
+
 }  // namespace crt::relocations
\ No newline at end of file
@@ -1,24 +1,21 @@
+#include <crt/exit.h>
 #include <crt/relocations.h>
 
 namespace crt {
     void init() noexcept;
-
-    void fini() noexcept;
-}
-
-namespace {
-    [[noreturn]] void exit(crt::relocations::u64 exit_code) {
-      asm volatile(
-      "mov x0, %0\n"
-      "svc 8" : : "r" (exit_code) : "x0");
-      __builtin_unreachable();
-    }
 }
 
 int main(int argc, char *argv[], char *envp[]);
 
+// Read-only page through which the kernel publishes data that needs no syscall to read, like the clock parameters.
+// Read by libcxx.
+extern "C" {
+const void *__crt_system_page = nullptr;
+}
+
 // base_addr is passed to us via the OS so that we know where the binary was loaded. This can be used for ASLR.
-extern "C" [[noreturn]] void _start(int argc, char *argv[], char *envp[], crt::relocations::u64 base_addr) {
+extern "C" [[noreturn]] void _start(int argc, char *argv[], char *envp[], crt::relocations::u64 base_addr,
+                                    const void *system_page) {
   // After booting we need to apply self-relocations (since this is a pie executable there is no dynamic loader to do
   // any relocations)
   const crt::relocations::RelaEntry *relocations;
@@ -31,13 +28,23 @@ extern "C" [[noreturn]] void _start(int argc, char *argv[], char *envp[], crt::r
 
   crt::relocations::apply_relocations(base_addr, relocations, rela_len_bytes);
 
-  crt::init();
+  // Relative relocations are packed separately when linking with -z pack-relative-relocs
+  const crt::relocations::RelrEntry *packed_relocations;
+  crt::relocations::u64 relr_len_bytes;
 
-  const auto retval = main(argc, argv, envp);
+  asm volatile("adr %0, _relr_start\n"
+               "adr %1, _relr_end\n"
+               "sub %1, %1, %0\n" :
+  "=r" (packed_relocations), "=r" (relr_len_bytes)::);
+
+  crt::relocations::apply_relr_relocations(base_addr, packed_relocations, relr_len_bytes);
 
-  crt::fini();
+  // Globals can only be written once they are relocated
+  __crt_system_page = system_page;
 
-  exit(retval);
+  crt::init();
+
+  const auto retval = main(argc, argv, envp);
 
-  while (true);
+  crt::exit(retval);
 }
\ No newline at end of file
@@ -0,0 +1,74 @@
+#ifndef LIBCXX_ALLOCATOR_H_
+#define LIBCXX_ALLOCATOR_H_
+
+#include <libcxx/types.h>
+
+namespace libcxx {
+    /** @brief Size of the pages mapped by the kernel. Must match the kernel's PAGE_SIZE. */
+    constexpr usize PAGE_SIZE = 16 * 1024;
+
+    /** @brief Alignment of all allocations unless a larger one is requested */
+    constexpr usize DEFAULT_ALIGNMENT = 16;
+
+    /**
+     * @brief Allocates from the process heap. Returns nullptr if the memory cannot be mapped or the alignment is
+     * larger than a page.
+     *
+     * Allocations of up to MAX_POOLED_SIZE bytes come from per-size-class pools, which take memory from the kernel a
+     * few pages at a time. Larger allocations are mapped on their own and unmapped when deallocated.
+     */
+    [[nodiscard]] void *allocate(usize size, usize alignment = DEFAULT_ALIGNMENT) noexcept;
+
+    /** @brief Returns memory obtained with allocate to the heap. Does nothing for nullptr. */
+    void deallocate(void *ptr) noexcept;
+
+    /** @brief Largest allocation served by the size-class pools */
+    constexpr usize MAX_POOLED_SIZE = 2048;
+
+    /**
+     * @brief Bump-pointer allocator for allocations that share a lifetime, like those made while handling a request.
+     *
+     * Allocating is a pointer increment. Nothing is freed individually: reset() drops all allocations at once, and the
+     * memory goes back to the kernel when the arena is destroyed. Memory is mapped in chunks of the given size, or
+     * larger for allocations that do not fit.
+     */
+    class Arena final {
+    public:
+        constexpr static usize DEFAULT_CHUNK_SIZE = 4 * PAGE_SIZE;
+
+        constexpr explicit Arena(usize chunk_size = DEFAULT_CHUNK_SIZE) noexcept: mChunkSize(chunk_size) {}
+
+        ~Arena() noexcept;
+
+        Arena(const Arena &) = delete;
+
+        Arena &operator=(const Arena &) = delete;
+
+        /** @brief Returns nullptr if no more memory can be mapped. */
+        [[nodiscard]] void *allocate(usize size, usize alignment = DEFAULT_ALIGNMENT) noexcept;
+
+        /** @brief Allocates uninitialized storage for count objects of type T. */
+        template<typename T>
+        [[nodiscard]] T *allocate_array(usize count) noexcept {
+          return static_cast<T *>(allocate(sizeof(T) * count, alignof(T)));
+        }
+
+        /** @brief Drops all allocations. The most recent chunk is kept for the next ones, the others are unmapped. */
+        void reset() noexcept;
+
+    private:
+        struct Chunk {
+            Chunk *next;
+            usize size;
+        };
+
+        bool grow(usize size, usize alignment) noexcept;
+
+        usize mChunkSize;
+        Chunk *mChunks{nullptr};
+        u8 *mCursor{nullptr};
+        u8 *mEnd{nullptr};
+    };
+}
+
+#endif  // LIBCXX_ALLOCATOR_H_
@@ -1,6 +1,7 @@
 #ifndef LIBCXX_ARRAY_H_
 #define LIBCXX_ARRAY_H_
 
+#include <libcxx/iterator.h>
 #include <libcxx/types.h>
 
 namespace libcxx {
@@ -1,17 +1,363 @@
 #ifndef LIBCXX_FMT_H_
 #define LIBCXX_FMT_H_
 
-#include <libcxx/string.h>
 #include <libcxx/span.h>
+#include <libcxx/stream.h>
+#include <libcxx/string.h>
+#include <libcxx/string_view.h>
+#include <libcxx/type_traits.h>
+#include <libcxx/types.h>
 
 namespace libcxx {
-    usize sprint(Span<char> buffer, const char *fmt, ...) noexcept __attribute__((format(printf, 2, 3)));
+    /**
+     * @brief Options of a replacement field, parsed from `{:[[fill]align][0][width][type]}`.
+     *
+     * The alignment is `<` or `>`. A leading `0` pads numbers with zeroes after the sign. The type is `d` for decimal,
+     * `x` or `X` for hexadecimal. By default integers are decimal, pointers are hexadecimal, numbers are aligned to the
+     * right and everything else to the left.
+     */
+    struct FormatSpec {
+        enum class Align : u8 {
+            Default,
+            Left,
+            Right,
+        };
+
+        enum class Type : u8 {
+            Default,
+            Decimal,
+            Hex,
+            UpperHex,
+        };
+
+        char fill{' '};
+        Align align{Align::Default};
+        Type type{Type::Default};
+        bool zero_pad{false};
+        usize width{0};
+    };
+
+    namespace detail {
+        enum class ArgumentKind : u8 {
+            None,
+            Bool,
+            Char,
+            Signed,
+            Unsigned,
+            Pointer,
+            String,
+        };
+
+        /**
+         * @brief A type-erased argument. Formatting it is not a template, so every call site shares the same code.
+         */
+        struct Argument {
+            struct StringValue {
+                const char *data;
+                usize length;
+            };
+
+            ArgumentKind kind{ArgumentKind::None};
+            union {
+                u64 unsigned_value{0};
+                i64 signed_value;
+                StringValue string_value;
+            };
+        };
+
+        /** @brief Literal text of a format string followed by the replacement field of the next argument. */
+        struct Piece {
+            const char *literal{nullptr};
+            usize length{0};
+            /** @brief The literal contains escaped braces (`{{` or `}}`) */
+            bool escaped{false};
+            FormatSpec spec{};
+        };
+
+        template<typename T>
+        struct ArgumentTraits {
+            constexpr static ArgumentKind kind = ArgumentKind::None;
+        };
+
+        template<>
+        struct ArgumentTraits<bool> {
+            constexpr static ArgumentKind kind = ArgumentKind::Bool;
+
+            static Argument make(bool value) noexcept {
+              return Argument{.kind = kind, .unsigned_value = value};
+            }
+        };
+
+        template<>
+        struct ArgumentTraits<char> {
+            constexpr static ArgumentKind kind = ArgumentKind::Char;
+
+            static Argument make(char value) noexcept {
+              return Argument{.kind = kind, .unsigned_value = static_cast<u8>(value)};
+            }
+        };
+
+        template<typename T> requires OneOf<T, signed char, short, int, long, long long>
+        struct ArgumentTraits<T> {
+            constexpr static ArgumentKind kind = ArgumentKind::Signed;
+
+            static Argument make(T value) noexcept {
+              Argument argument{.kind = kind};
+              argument.signed_value = value;
+              return argument;
+            }
+        };
+
+        template<typename T> requires OneOf<T, unsigned char, unsigned short, unsigned, unsigned long, unsigned long long>
+        struct ArgumentTraits<T> {
+            constexpr static ArgumentKind kind = ArgumentKind::Unsigned;
+
+            static Argument make(T value) noexcept {
+              return Argument{.kind = kind, .unsigned_value = value};
+            }
+        };
+
+        template<typename T> requires (!SameAs<RemoveConstT<T>, char>)
+        struct ArgumentTraits<T *> {
+            constexpr static ArgumentKind kind = ArgumentKind::Pointer;
+
+            static Argument make(const T *value) noexcept {
+              return Argument{.kind = kind, .unsigned_value = reinterpret_cast<usize>(value)};
+            }
+        };
+
+        inline Argument make_string_argument(const char *data, usize length) noexcept {
+          Argument argument{.kind = ArgumentKind::String};
+          argument.string_value = Argument::StringValue{data, length};
+          return argument;
+        }
+
+        template<typename T> requires OneOf<T, const char *, char *>
+        struct ArgumentTraits<T> {
+            constexpr static ArgumentKind kind = ArgumentKind::String;
+
+            static Argument make(const char *value) noexcept {
+              return make_string_argument(value, strlen(value));
+            }
+        };
+
+        template<usize N>
+        struct ArgumentTraits<char[N]> {
+            constexpr static ArgumentKind kind = ArgumentKind::String;
+
+            static Argument make(const char (&value)[N]) noexcept {
+              return make_string_argument(value, strlen(value));
+            }
+        };
+
+        template<typename T> requires OneOf<T, StringView, Span<const char>, Span<char>>
+        struct ArgumentTraits<T> {
+            constexpr static ArgumentKind kind = ArgumentKind::String;
+
+            static Argument make(const T &value) noexcept {
+              return make_string_argument(value.data(), value.size());
+            }
+        };
+
+        /**
+         * @brief Never defined. Calling it while parsing a format string turns the message into a compile error.
+         */
+        void format_error(const char *message);
+
+        consteval bool is_integer(ArgumentKind kind) {
+          return (kind == ArgumentKind::Char) || (kind == ArgumentKind::Signed) || (kind == ArgumentKind::Unsigned) ||
+                 (kind == ArgumentKind::Pointer);
+        }
+
+        /**
+         * @brief Parses the replacement field that starts after the `{` at `fmt[index]`.
+         * @return The index after the closing `}`.
+         */
+        consteval usize parse_spec(const char *fmt, usize index, FormatSpec &spec, ArgumentKind kind) {
+          if (fmt[index] == '}') {
+            return index + 1;
+          }
+          if (fmt[index] != ':') {
+            format_error("Expected `:` or `}` in replacement field");
+          }
+          index++;
+
+          const auto align_of = [](char c) {
+              if (c == '<') {
+                return FormatSpec::Align::Left;
+              }
+              if (c == '>') {
+                return FormatSpec::Align::Right;
+              }
+              return FormatSpec::Align::Default;
+          };
+
+          const bool has_fill = (fmt[index] != '\0') && (fmt[index] != '{') && (fmt[index] != '}');
+          if (has_fill && (align_of(fmt[index + 1]) != FormatSpec::Align::Default)) {
+            spec.fill = fmt[index];
+            spec.align = align_of(fmt[index + 1]);
+            index += 2;
+          } else if (align_of(fmt[index]) != FormatSpec::Align::Default) {
+            spec.align = align_of(fmt[index]);
+            index++;
+          }
+
+          if (fmt[index] == '0') {
+            spec.zero_pad = true;
+            index++;
+          }
+
+          while ((fmt[index] >= '0') && (fmt[index] <= '9')) {
+            spec.width = spec.width * 10 + (fmt[index] - '0');
+            index++;
+          }
+
+          switch (fmt[index]) {
+            case 'd':
+              spec.type = FormatSpec::Type::Decimal;
+              index++;
+              break;
+            case 'x':
+              spec.type = FormatSpec::Type::Hex;
+              index++;
+              break;
+            case 'X':
+              spec.type = FormatSpec::Type::UpperHex;
+              index++;
+              break;
+            default:
+              break;
+          }
+
+          if (fmt[index] != '}') {
+            format_error("Invalid or unterminated replacement field");
+          }
+          if (((spec.type != FormatSpec::Type::Default) || spec.zero_pad) && !is_integer(kind)) {
+            format_error("Integer presentation used with an argument that is not an integer");
+          }
+          return index + 1;
+        }
+
+        /** @brief Destination of formatted text */
+        class Sink {
+        public:
+            virtual void write(Span<const char> data) noexcept = 0;
+
+        protected:
+            ~Sink() = default;
+        };
+
+        void vformat(Sink &sink, Span<const Piece> pieces, Span<const Argument> arguments) noexcept;
+
+        void vprint(OutputStream &stream, Span<const Piece> pieces, Span<const Argument> arguments,
+                    bool newline) noexcept;
+
+        usize vsprint(Span<char> buffer, Span<const Piece> pieces, Span<const Argument> arguments,
+                      bool newline) noexcept;
+    }
+
+    /**
+     * @brief A format string checked against the types of its arguments and split into pieces at compile time.
+     *
+     * Replacement fields are written as `{}` or `{:spec}` (see FormatSpec), and literal braces as `{{` and `}}`.
+     */
+    template<typename... Args>
+    class BasicFormatString final {
+    public:
+        template<usize N>
+        consteval BasicFormatString(const char (&fmt)[N]) noexcept {
+          constexpr detail::ArgumentKind kinds[] = {detail::ArgumentTraits<Args>::kind..., detail::ArgumentKind::None};
+          for (usize i = 0; i < sizeof...(Args); i++) {
+            if (kinds[i] == detail::ArgumentKind::None) {
+              detail::format_error("Argument type cannot be formatted");
+            }
+          }
+
+          usize start = 0;
+          usize field = 0;
+          bool escaped = false;
+          usize index = 0;
+          while (index < N - 1) {
+            const bool is_escape = (fmt[index] == fmt[index + 1]) && ((fmt[index] == '{') || (fmt[index] == '}'));
+            if (is_escape) {
+              escaped = true;
+              index += 2;
+              continue;
+            }
+
+            if (fmt[index] == '}') {
+              detail::format_error("Unmatched `}` in format string");
+            }
+
+            if (fmt[index] == '{') {
+              if (field == sizeof...(Args)) {
+                detail::format_error("Format string has more replacement fields than arguments");
+              }
+
+              mPieces[field].literal = &fmt[start];
+              mPieces[field].length = index - start;
+              mPieces[field].escaped = escaped;
+              index = detail::parse_spec(fmt, index + 1, mPieces[field].spec, kinds[field]);
+
+              field++;
+              start = index;
+              escaped = false;
+              continue;
+            }
+
+            index++;
+          }
+
+          if (field != sizeof...(Args)) {
+            detail::format_error("Format string has fewer replacement fields than arguments");
+          }
+          mPieces[field].literal = &fmt[start];
+          mPieces[field].length = N - 1 - start;
+          mPieces[field].escaped = escaped;
+        }
+
+        /** @brief One piece per argument, followed by the trailing literal text. */
+        [[nodiscard]] Span<const detail::Piece> pieces() const noexcept {
+          return Span<const detail::Piece>{&mPieces[0], sizeof...(Args) + 1};
+        }
+
+    private:
+        detail::Piece mPieces[sizeof...(Args) + 1]{};
+    };
+
+    template<typename... Args>
+    using FormatString = BasicFormatString<TypeIdentityT<Args>...>;
+
+    /**
+     * @brief Formats into `buffer`, truncating the output if it does not fit.
+     * @return The number of characters written, including the terminating NUL. 0 if `buffer` is empty.
+     */
+    template<typename... Args>
+    usize sprint(Span<char> buffer, const FormatString<Args...> &fmt, const Args &...args) noexcept {
+      const detail::Argument arguments[] = {detail::ArgumentTraits<Args>::make(args)..., detail::Argument{}};
+      return detail::vsprint(buffer, fmt.pieces(), Span<const detail::Argument>{arguments, sizeof...(Args)}, false);
+    }
 
-    usize sprintln(Span<char> buffer, const char *fmt, ...) noexcept __attribute__((format(printf, 2, 3)));
+    /** @brief Like sprint, followed by a newline. */
+    template<typename... Args>
+    usize sprintln(Span<char> buffer, const FormatString<Args...> &fmt, const Args &...args) noexcept {
+      const detail::Argument arguments[] = {detail::ArgumentTraits<Args>::make(args)..., detail::Argument{}};
+      return detail::vsprint(buffer, fmt.pieces(), Span<const detail::Argument>{arguments, sizeof...(Args)}, true);
+    }
 
-    void print(const char *fmt, ...) noexcept __attribute__((format(printf, 1, 2)));
+    /** @brief Formats straight into the stdout stream. */
+    template<typename... Args>
+    void print(const FormatString<Args...> &fmt, const Args &...args) noexcept {
+      const detail::Argument arguments[] = {detail::ArgumentTraits<Args>::make(args)..., detail::Argument{}};
+      detail::vprint(stdout(), fmt.pieces(), Span<const detail::Argument>{arguments, sizeof...(Args)}, false);
+    }
 
-    void println(const char *fmt, ...) noexcept __attribute__((format(printf, 1, 2)));
+    /** @brief Like print, followed by a newline. */
+    template<typename... Args>
+    void println(const FormatString<Args...> &fmt, const Args &...args) noexcept {
+      const detail::Argument arguments[] = {detail::ArgumentTraits<Args>::make(args)..., detail::Argument{}};
+      detail::vprint(stdout(), fmt.pieces(), Span<const detail::Argument>{arguments, sizeof...(Args)}, true);
+    }
 }
 
 #endif  // LIBCXX_FMT_H_
@@ -41,6 +41,10 @@ namespace libcxx {
           return mPtr[index];
         }
 
+        constexpr T *data() const noexcept {
+          return mPtr;
+        }
+
         constexpr usize size() const noexcept {
           return mLength;
         }
@@ -0,0 +1,76 @@
+#ifndef LIBCXX_STREAM_H_
+#define LIBCXX_STREAM_H_
+
+#include <libcxx/array.h>
+#include <libcxx/span.h>
+#include <libcxx/types.h>
+
+namespace libcxx {
+    /**
+     * @brief Controls when an OutputStream hands its buffered data to the kernel
+     */
+    enum class BufferMode {
+        /** @brief Every write goes straight to the kernel */
+        Unbuffered,
+        /** @brief Data is flushed when a newline is written or the buffer is full */
+        LineBuffered,
+        /** @brief Data is only flushed when the buffer is full or on an explicit flush() */
+        FullyBuffered,
+    };
+
+    /**
+     * @brief Buffered output stream backed by the PutString syscall
+     */
+    class OutputStream final {
+    public:
+        constexpr static usize BUFFER_SIZE = 4096;
+
+        constexpr explicit OutputStream(BufferMode mode) noexcept: mMode(mode) {}
+
+        OutputStream(const OutputStream &) = delete;
+
+        OutputStream &operator=(const OutputStream &) = delete;
+
+        /**
+         * @brief Appends the given characters to the stream, flushing as required by the buffer mode
+         */
+        void write(Span<const char> data) noexcept;
+
+        /**
+         * @brief Appends a single character to the stream
+         */
+        void put(char c) noexcept;
+
+        /**
+         * @brief Hands all buffered data to the kernel
+         */
+        void flush() noexcept;
+
+        /**
+         * @brief Changes the buffering mode. Pending data is flushed first.
+         */
+        void set_mode(BufferMode mode) noexcept;
+
+        [[nodiscard]] BufferMode mode() const noexcept {
+          return mMode;
+        }
+
+    private:
+        BufferMode mMode;
+        usize mLength{0};
+        Array<char, BUFFER_SIZE> mBuffer{};
+    };
+
+    /**
+     * @brief Returns the process-wide stdout stream. It is line buffered by default. It is flushed when the process
+     * exits through crt::exit() or crt::abort(), but the pending data is lost if the kernel kills the process.
+     */
+    [[nodiscard]] OutputStream &stdout() noexcept;
+
+    /**
+     * @brief Flushes the process-wide stdout stream
+     */
+    void flush() noexcept;
+}
+
+#endif  // LIBCXX_STREAM_H_
@@ -4,11 +4,20 @@
 #include <libcxx/types.h>
 
 namespace libcxx {
+    namespace detail {
+        /** @brief Out-of-line strlen used at runtime. Scans a word or a vector register at a time. */
+        usize strlen(const char *str) noexcept;
+    }
+
     constexpr usize strlen(const char *str) noexcept {
       if (str == nullptr) {
         return 0;
       }
 
+      if (!__builtin_is_constant_evaluated()) {
+        return detail::strlen(str);
+      }
+
       usize size = 0;
       while (*str != '\0') {
         size++;
@@ -17,6 +26,24 @@ namespace libcxx {
 
       return size;
     }
+
+    /** @brief Copies `size` bytes from `src` to `dst`. The regions must not overlap. */
+    void *memcpy(void *dst, const void *src, usize size) noexcept;
+
+    /** @brief Copies `size` bytes from `src` to `dst`. The regions may overlap. */
+    void *memmove(void *dst, const void *src, usize size) noexcept;
+
+    /** @brief Fills `size` bytes at `dst` with the byte `value`. */
+    void *memset(void *dst, int value, usize size) noexcept;
+
+    /**
+     * @brief Compares `size` bytes of `lhs` and `rhs` as unsigned bytes.
+     * @return 0 if they are equal, or the sign of the difference of the first bytes that differ.
+     */
+    int memcmp(const void *lhs, const void *rhs, usize size) noexcept;
+
+    /** @brief Returns the first occurrence of the byte `value` in the `size` bytes at `src`, or nullptr. */
+    const void *memchr(const void *src, int value, usize size) noexcept;
 }
 
 #endif  // LIBCXX_STRING_H_
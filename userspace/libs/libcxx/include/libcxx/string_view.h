@@ -32,6 +32,10 @@ namespace libcxx {
           return mInner[index];
         }
 
+        constexpr const char *data() const noexcept {
+          return mInner.data();
+        }
+
         constexpr usize size() const noexcept {
           return mInner.size();
         }
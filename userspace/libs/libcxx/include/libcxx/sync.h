@@ -0,0 +1,95 @@
+#ifndef LIBCXX_SYNC_H_
+#define LIBCXX_SYNC_H_
+
+#include <libcxx/types.h>
+
+namespace libcxx {
+    /**
+     * @brief Mutual exclusion lock for the threads of a process.
+     *
+     * Taking a free lock is a single atomic operation. Threads that find it taken block in the kernel instead of
+     * spinning, so the thread holding it gets to run and release it.
+     */
+    class Mutex final {
+    public:
+        constexpr Mutex() noexcept = default;
+
+        Mutex(const Mutex &) = delete;
+
+        Mutex &operator=(const Mutex &) = delete;
+
+        void lock() noexcept;
+
+        /** @brief Takes the lock if it is free. Returns whether it was taken. */
+        [[nodiscard]] bool try_lock() noexcept;
+
+        void unlock() noexcept;
+
+    private:
+        enum State : u32 {
+            Unlocked = 0,
+            Locked = 1,
+            /** @brief Locked, and other threads may be blocked waiting for it */
+            Contended = 2,
+        };
+
+        u32 mState{Unlocked};
+    };
+
+    /** @brief Holds a lock for the lifetime of the guard */
+    template<typename T>
+    class LockGuard final {
+    public:
+        explicit LockGuard(T &lock) noexcept: mLock(lock) {
+          mLock.lock();
+        }
+
+        ~LockGuard() noexcept {
+          mLock.unlock();
+        }
+
+        LockGuard(const LockGuard &) = delete;
+
+        LockGuard &operator=(const LockGuard &) = delete;
+
+    private:
+        T &mLock;
+    };
+
+    /**
+     * @brief Lets threads block until a condition protected by a Mutex becomes true.
+     *
+     * Waiters may wake up without being notified, so the condition has to be checked again after every wait.
+     */
+    class ConditionVariable final {
+    public:
+        constexpr ConditionVariable() noexcept = default;
+
+        ConditionVariable(const ConditionVariable &) = delete;
+
+        ConditionVariable &operator=(const ConditionVariable &) = delete;
+
+        /**
+         * @brief Releases the locked mutex and blocks until notified. The mutex is locked again on return.
+         */
+        void wait(Mutex &mutex) noexcept;
+
+        /** @brief Blocks until predicate returns true. The mutex must be locked. */
+        template<typename Predicate>
+        void wait(Mutex &mutex, Predicate predicate) noexcept {
+          while (!predicate()) {
+            wait(mutex);
+          }
+        }
+
+        void notify_one() noexcept;
+
+        void notify_all() noexcept;
+
+    private:
+        /** @brief Incremented on every notification, so waiters can tell whether they missed one */
+        u32 mSequence{0};
+    };
+}
+
+#endif  // LIBCXX_SYNC_H_
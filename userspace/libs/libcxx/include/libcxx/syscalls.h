@@ -1,18 +1,203 @@
 #ifndef LIBCXX_SYSCALLS_H_
 #define LIBCXX_SYSCALLS_H_
 
+#include <libcxx/span.h>
 #include <libcxx/types.h>
 
 namespace libcxx::syscalls {
+    /**
+     * @brief A single segment of a vectored write. Must match the layout of the kernel's IoVec.
+     */
+    struct IoVec {
+        const char *base;
+        usize length;
+    };
+
+    /**
+     * @brief Kernel heap counters. Must match the layout of the kernel's kalloc::Statistics.
+     */
+    struct HeapStatistics {
+        constexpr static usize NUM_BUCKETS = 9;
+
+        u64 live_bytes;
+        u64 peak_bytes;
+        u64 failed_allocations;
+        /** @brief Allocations per size class from 16 to 2048 bytes. The last bucket counts larger allocations. */
+        u64 allocations[NUM_BUCKETS];
+        u64 free_list_length;
+        u64 heap_free_bytes;
+        u64 largest_free_block;
+        u64 slab_free_bytes;
+    };
+
+    /**
+     * @brief Free physical memory. Must match the layout of the kernel's physical_page_allocator::Statistics.
+     */
+    struct PageStatistics {
+        /** @brief Includes the clean pages */
+        u64 free_pages;
+        u64 num_regions;
+        u64 largest_region_pages;
+        /** @brief Free pages that were zeroed in the background */
+        u64 clean_pages;
+        u64 clean_page_hits;
+        u64 clean_page_misses;
+    };
+
+    /**
+     * @brief Must match the layout of the kernel's memory::Statistics
+     */
+    struct MemoryStatistics {
+        HeapStatistics heap;
+        PageStatistics pages;
+    };
+
+    /**
+     * @brief Returned by the file and process syscalls on failure
+     */
+    constexpr u64 SYSCALL_ERROR = ~0ull;
+
     /**
      * @brief Writes the given string to stdout
      */
     void puts(const char *str);
 
+    /**
+     * @brief Writes length bytes starting at str to stdout
+     */
+    void write(const char *str, usize length);
+
+    /**
+     * @brief Writes all segments to stdout as a single record, without interleaving with other writers
+     */
+    void writev(Span<const IoVec> segments);
+
     /**
      * @brief Sleeps for the given number of nanoseconds
      */
     void sleep(u64 time_us);
+
+    /**
+     * @brief Fills stats with the current memory usage of the kernel
+     */
+    void memory_statistics(MemoryStatistics &stats);
+
+    /**
+     * @brief Makes the kernel log a report of its memory usage: heap size classes and tags, physical pages, the clean
+     * page pool and the page cache
+     */
+    void print_memory_statistics();
+
+    /**
+     * @brief Opens the file at the given absolute path for reading. Returns its descriptor or SYSCALL_ERROR
+     */
+    u64 open(const char *path);
+
+    /**
+     * @brief Reads up to length bytes into buffer. Returns the number of bytes read, 0 at the end of the file, or SYSCALL_ERROR
+     */
+    u64 read(u64 fd, void *buffer, usize length);
+
+    /**
+     * @brief Closes the descriptor. Returns 0 or SYSCALL_ERROR
+     */
+    u64 close(u64 fd);
+
+    /**
+     * @brief Maps the whole file read-only into the process. The mapping stays valid after the descriptor is closed.
+     * Returns nullptr on failure
+     */
+    const u8 *map_file(u64 fd);
+
+    /**
+     * @brief Starts the executable at path. argv and envp are null-terminated arrays and can be nullptr, in which case
+     * the process gets its path as only argument. Returns the PID of the new process or SYSCALL_ERROR
+     */
+    u64 spawn(const char *path, const char *const *argv, const char *const *envp);
+
+    /**
+     * @brief Creates a zero-filled memory region that any process can map. Returns its ID or SYSCALL_ERROR
+     */
+    u64 shared_memory_create(usize size);
+
+    /**
+     * @brief Maps the shared memory region read-write into the process. Returns nullptr on failure
+     */
+    u8 *shared_memory_map(u64 id);
+
+    /**
+     * @brief Releases the ID of the region. Existing mappings stay valid. Returns 0 or SYSCALL_ERROR
+     */
+    u64 shared_memory_release(u64 id);
+
+    /**
+     * @brief Ends of a pipe, as passed to pipe_close
+     */
+    enum class PipeEnd : u64 {
+        Read = 0,
+        Write = 1,
+    };
+
+    /**
+     * @brief Creates a pipe and returns its ID, which is used for both ends
+     */
+    u64 pipe_create();
+
+    /**
+     * @brief Blocks until data is available and reads up to length bytes of it. Returns the number of bytes read, 0
+     * once the write end is closed and the pipe is empty, or SYSCALL_ERROR
+     */
+    u64 pipe_read(u64 id, void *buffer, usize length);
+
+    /**
+     * @brief Blocks until there is space in the pipe and writes up to length bytes. Returns the number of bytes
+     * written or SYSCALL_ERROR if the read end is closed
+     */
+    u64 pipe_write(u64 id, const void *data, usize length);
+
+    /**
+     * @brief Closes one end of the pipe for this process. Returns 0, or SYSCALL_ERROR if the process does not hold that
+     * end. A process holds both ends of the pipes it creates and the ends it reads from or writes to, and the kernel
+     * closes them when it exits. An end is closed once all its holders closed it.
+     */
+    u64 pipe_close(u64 id, PipeEnd end);
+
+    /**
+     * @brief Maps at least size bytes of zero-filled memory read-write into the process. Returns nullptr on failure
+     */
+    u8 *map_anonymous(usize size);
+
+    /**
+     * @brief Unmaps memory returned by map_anonymous and frees it. Returns 0 or SYSCALL_ERROR
+     */
+    u64 unmap(void *address);
+
+    /**
+     * @brief Starts a thread of the process that runs entry(argument) on a new stack of stack_size bytes, or of the
+     * default size if 0. entry must not return, it ends with thread_exit. Returns the thread ID or SYSCALL_ERROR
+     */
+    u64 thread_create(void (*entry)(void *), void *argument, usize stack_size);
+
+    /**
+     * @brief Ends the calling thread. The process exits with code 0 once its last thread does.
+     */
+    [[noreturn]] void thread_exit();
+
+    /**
+     * @brief Blocks until the thread with the given ID has exited. Returns right away if there is no such thread
+     */
+    void thread_join(u64 tid);
+
+    /**
+     * @brief Blocks until the futex at word is woken up, unless word no longer holds expected. Returns 0 or
+     * SYSCALL_ERROR. Spurious wakeups are possible, so callers must check their condition again
+     */
+    u64 futex_wait(const u32 *word, u32 expected);
+
+    /**
+     * @brief Wakes up to count threads waiting on the futex at word. Returns how many were woken up or SYSCALL_ERROR
+     */
+    u64 futex_wake(const u32 *word, usize count);
 }
 
 #endif  // LIBCXX_SYSCALLS_H_
@@ -0,0 +1,49 @@
+#ifndef LIBCXX_THREAD_H_
+#define LIBCXX_THREAD_H_
+
+#include <libcxx/types.h>
+
+namespace libcxx {
+    /**
+     * @brief A thread of the current process.
+     *
+     * The thread shares the address space of the process and runs until its entry function returns. It is joined when
+     * the Thread is destroyed, so the entry function and its argument only have to outlive the Thread object. Its stack
+     * is mapped by the kernel, which unmaps it when the thread exits.
+     */
+    class Thread final {
+    public:
+        using Entry = void (*)(void *argument);
+
+        /** @brief Lets the kernel pick the stack size */
+        constexpr static usize DEFAULT_STACK_SIZE = 0;
+
+        /** @brief Starts running entry(argument). Check joinable() to find out whether the thread was created. */
+        Thread(Entry entry, void *argument, usize stack_size = DEFAULT_STACK_SIZE) noexcept;
+
+        ~Thread() noexcept;
+
+        Thread(const Thread &) = delete;
+
+        Thread &operator=(const Thread &) = delete;
+
+        /** @brief True if the thread was created and it has not been joined yet */
+        [[nodiscard]] bool joinable() const noexcept;
+
+        /** @brief Blocks until the thread has exited */
+        void join() noexcept;
+
+        [[nodiscard]] u64 id() const noexcept {
+          return mTid;
+        }
+
+    private:
+        [[noreturn]] static void start(void *thread) noexcept;
+
+        Entry mEntry;
+        void *mArgument;
+        u64 mTid;
+    };
+}
+
+#endif  // LIBCXX_THREAD_H_
@@ -0,0 +1,46 @@
+#ifndef LIBCXX_TIME_H_
+#define LIBCXX_TIME_H_
+
+#include <libcxx/types.h>
+
+namespace libcxx::time {
+    /**
+     * @brief Data published by the kernel in a read-only page of every process. Must match the layout of the kernel's
+     * process::system_page::SystemPageData. Fields are only ever appended, and version tells which ones are present.
+     */
+    struct SystemPage {
+        /** @brief Odd while the kernel updates the page */
+        u32 sequence;
+        u32 version;
+        /** @brief Frequency of CNTVCT_EL0 in Hz */
+        u64 counter_frequency;
+        /** @brief Value of CNTVCT_EL0 when the kernel booted */
+        u64 boot_counter;
+        /** @brief Nanoseconds are ((counter - boot_counter) * ns_mult) >> ns_shift, with a 128-bit product */
+        u64 ns_mult;
+        u32 ns_shift;
+    };
+
+    /** @brief Returns the system page of the process */
+    [[nodiscard]] const SystemPage &system_page() noexcept;
+
+    /**
+     * @brief Raw value of the virtual counter, read without a syscall. This is the cheapest timestamp, convert it with
+     * ticks_to_nanoseconds when needed.
+     */
+    [[nodiscard]] inline u64 ticks() noexcept {
+      u64 value;
+      // Keeps the read from being reordered with the instructions before it
+      asm volatile("isb\n"
+                   "mrs %0, cntvct_el0" : "=r" (value) : : "memory");
+      return value;
+    }
+
+    /** @brief Converts a difference of counter values into nanoseconds */
+    [[nodiscard]] u64 ticks_to_nanoseconds(u64 ticks) noexcept;
+
+    /** @brief Nanoseconds since boot, read without a syscall */
+    [[nodiscard]] u64 now() noexcept;
+}
+
+#endif  // LIBCXX_TIME_H_
@@ -15,6 +15,17 @@ namespace libcxx {
     template<typename T>
     using RemoveConstT = typename RemoveConst<T>::type;
 
+    /**
+     * @brief Names T in a context where it cannot be deduced
+     */
+    template<typename T>
+    struct TypeIdentity final {
+        using type = T;
+    };
+
+    template<typename T>
+    using TypeIdentityT = typename TypeIdentity<T>::type;
+
     template<typename T, typename U>
     struct IsSame {
         inline constexpr static bool value = false;
@@ -30,6 +41,9 @@ namespace libcxx {
 
     template<typename T, typename U>
     concept SameAs = IsSameV<T, U>;
+
+    template<typename T, typename... Us>
+    concept OneOf = (IsSameV<T, Us> || ...);
 }
 
 #endif  // LIBCXX_TYPE_TRAITS_H_
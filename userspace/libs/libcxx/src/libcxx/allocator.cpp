@@ -0,0 +1,280 @@
+#include <crt/exit.h>
+#include <libcxx/allocator.h>
+#include <libcxx/sync.h>
+#include <libcxx/syscalls.h>
+
+using libcxx::u32;
+using libcxx::u8;
+using libcxx::usize;
+
+namespace {
+    constexpr usize MIN_CLASS_SHIFT = 4;
+    constexpr usize NUM_SIZE_CLASSES = 8;
+    static_assert((1ul << (MIN_CLASS_SHIFT + NUM_SIZE_CLASSES - 1)) == libcxx::MAX_POOLED_SIZE);
+
+    /** @brief Number of pages mapped at once when the pools run out of pages */
+    constexpr usize REFILL_PAGES = 4;
+
+    constexpr u32 PAGE_MAGIC = 0x6865'6170;
+    constexpr u32 LARGE_ALLOCATION = ~0u;
+
+    /**
+     * @brief Placed at the start of every heap page. A pooled page holds blocks of a single size class, and the
+     * header takes the place of its first block, so every block is aligned to its size. A large allocation starts
+     * after the header of its first page.
+     */
+    struct PageHeader {
+        u32 magic;
+        u32 size_class;
+        usize mapping_size;
+    };
+    static_assert(sizeof(PageHeader) <= (1ul << MIN_CLASS_SHIFT));
+
+    struct FreeBlock {
+        FreeBlock *next;
+    };
+
+    usize align_up(const usize value, const usize alignment) {
+      return (value + alignment - 1) & ~(alignment - 1);
+    }
+
+    PageHeader *header_of(void *ptr) {
+      return reinterpret_cast<PageHeader *>(reinterpret_cast<usize>(ptr) & ~(libcxx::PAGE_SIZE - 1));
+    }
+
+    /** @brief Index of the smallest size class that holds size bytes, which must not exceed MAX_POOLED_SIZE */
+    usize size_class_of(const usize size) {
+      if (size <= (1ul << MIN_CLASS_SHIFT)) {
+        return 0;
+      }
+      return (64 - __builtin_clzll(size - 1)) - MIN_CLASS_SHIFT;
+    }
+
+    class Heap final {
+    public:
+        void *allocate(const usize size, const usize alignment) noexcept {
+          // Blocks are aligned to their size, so a large alignment just selects a larger size class
+          const usize block_size = size > alignment ? size : alignment;
+          if (block_size > libcxx::MAX_POOLED_SIZE) {
+            return allocate_large(size, alignment);
+          }
+
+          const usize size_class = size_class_of(block_size);
+          libcxx::LockGuard guard{mLock};
+          if ((mFreeLists[size_class] == nullptr) && !refill(size_class)) {
+            return nullptr;
+          }
+
+          FreeBlock *block = mFreeLists[size_class];
+          mFreeLists[size_class] = block->next;
+          return block;
+        }
+
+        void deallocate(void *ptr) noexcept {
+          PageHeader *header = header_of(ptr);
+          if (header->magic != PAGE_MAGIC) {
+            // Not allocated by this heap, or the heap is corrupted
+            crt::abort();
+          }
+
+          if (header->size_class == LARGE_ALLOCATION) {
+            libcxx::syscalls::unmap(header);
+            return;
+          }
+
+          auto *block = static_cast<FreeBlock *>(ptr);
+          libcxx::LockGuard guard{mLock};
+          block->next = mFreeLists[header->size_class];
+          mFreeLists[header->size_class] = block;
+        }
+
+    private:
+        /** @brief Carves a free page into blocks of the size class. Must be called with the lock held. */
+        bool refill(const usize size_class) noexcept {
+          if (mNumFreePages == 0) {
+            mFreePages = libcxx::syscalls::map_anonymous(REFILL_PAGES * libcxx::PAGE_SIZE);
+            if (mFreePages == nullptr) {
+              return false;
+            }
+            mNumFreePages = REFILL_PAGES;
+          }
+
+          u8 *page = mFreePages;
+          mFreePages += libcxx::PAGE_SIZE;
+          mNumFreePages--;
+
+          auto *header = reinterpret_cast<PageHeader *>(page);
+          header->magic = PAGE_MAGIC;
+          header->size_class = size_class;
+          header->mapping_size = libcxx::PAGE_SIZE;
+
+          // Pushed in reverse, so that blocks are handed out in address order
+          const usize block_size = 1ul << (size_class + MIN_CLASS_SHIFT);
+          for (usize offset = libcxx::PAGE_SIZE - block_size; offset >= block_size; offset -= block_size) {
+            auto *block = reinterpret_cast<FreeBlock *>(page + offset);
+            block->next = mFreeLists[size_class];
+            mFreeLists[size_class] = block;
+          }
+          return true;
+        }
+
+        static void *allocate_large(const usize size, const usize alignment) noexcept {
+          if (alignment >= libcxx::PAGE_SIZE) {
+            return nullptr;
+          }
+
+          const usize offset = align_up(sizeof(PageHeader), alignment);
+          const usize mapping_size = align_up(offset + size, libcxx::PAGE_SIZE);
+          u8 *memory = libcxx::syscalls::map_anonymous(mapping_size);
+          if (memory == nullptr) {
+            return nullptr;
+          }
+
+          auto *header = reinterpret_cast<PageHeader *>(memory);
+          header->magic = PAGE_MAGIC;
+          header->size_class = LARGE_ALLOCATION;
+          header->mapping_size = mapping_size;
+          return memory + offset;
+        }
+
+        libcxx::Mutex mLock;
+        FreeBlock *mFreeLists[NUM_SIZE_CLASSES]{};
+        /** @brief Pages of the last mapping that have not been given to a size class yet */
+        u8 *mFreePages{nullptr};
+        usize mNumFreePages{0};
+    };
+
+    Heap gHeap;
+
+    /** @brief Exceptions are disabled, so running out of memory in operator new is fatal */
+    void *checked(void *ptr) {
+      if (ptr == nullptr) {
+        crt::abort();
+      }
+      return ptr;
+    }
+}
+
+namespace libcxx {
+    void *allocate(const usize size, const usize alignment) noexcept {
+      return gHeap.allocate(size, alignment < DEFAULT_ALIGNMENT ? DEFAULT_ALIGNMENT : alignment);
+    }
+
+    void deallocate(void *const ptr) noexcept {
+      if (ptr != nullptr) {
+        gHeap.deallocate(ptr);
+      }
+    }
+
+    Arena::~Arena() noexcept {
+      while (mChunks != nullptr) {
+        Chunk *next = mChunks->next;
+        syscalls::unmap(mChunks);
+        mChunks = next;
+      }
+    }
+
+    void *Arena::allocate(const usize size, const usize alignment) noexcept {
+      const auto fits = [this](const usize start, const usize size) {
+          return (mCursor != nullptr) && (start <= reinterpret_cast<usize>(mEnd)) &&
+                 (size <= reinterpret_cast<usize>(mEnd) - start);
+      };
+
+      usize start = align_up(reinterpret_cast<usize>(mCursor), alignment);
+      if (!fits(start, size)) {
+        if (!grow(size, alignment)) {
+          return nullptr;
+        }
+        start = align_up(reinterpret_cast<usize>(mCursor), alignment);
+      }
+
+      mCursor = reinterpret_cast<u8 *>(start + size);
+      return reinterpret_cast<void *>(start);
+    }
+
+    bool Arena::grow(const usize size, const usize alignment) noexcept {
+      const usize needed = align_up(sizeof(Chunk), alignment) + size;
+      const usize chunk_size = align_up(needed > mChunkSize ? needed : mChunkSize, PAGE_SIZE);
+      u8 *memory = syscalls::map_anonymous(chunk_size);
+      if (memory == nullptr) {
+        return false;
+      }
+
+      auto *chunk = reinterpret_cast<Chunk *>(memory);
+      chunk->next = mChunks;
+      chunk->size = chunk_size;
+      mChunks = chunk;
+      mCursor = memory + sizeof(Chunk);
+      mEnd = memory + chunk_size;
+      return true;
+    }
+
+    void Arena::reset() noexcept {
+      if (mChunks == nullptr) {
+        return;
+      }
+
+      Chunk *chunk = mChunks->next;
+      while (chunk != nullptr) {
+        Chunk *next = chunk->next;
+        syscalls::unmap(chunk);
+        chunk = next;
+      }
+
+      mChunks->next = nullptr;
+      mCursor = reinterpret_cast<u8 *>(mChunks) + sizeof(Chunk);
+      mEnd = reinterpret_cast<u8 *>(mChunks) + mChunks->size;
+    }
+}
+
+namespace std {
+    enum class align_val_t : decltype(sizeof(0)) {};
+}
+
+void *operator new(const usize size) {
+  return checked(libcxx::allocate(size));
+}
+
+void *operator new[](const usize size) {
+  return checked(libcxx::allocate(size));
+}
+
+void *operator new(const usize size, const std::align_val_t alignment) {
+  return checked(libcxx::allocate(size, static_cast<usize>(alignment)));
+}
+
+void *operator new[](const usize size, const std::align_val_t alignment) {
+  return checked(libcxx::allocate(size, static_cast<usize>(alignment)));
+}
+
+void operator delete(void *ptr) noexcept {
+  libcxx::deallocate(ptr);
+}
+
+void operator delete[](void *ptr) noexcept {
+  libcxx::deallocate(ptr);
+}
+
+void operator delete(void *ptr, usize) noexcept {
+  libcxx::deallocate(ptr);
+}
+
+void operator delete[](void *ptr, usize) noexcept {
+  libcxx::deallocate(ptr);
+}
+
+void operator delete(void *ptr, std::align_val_t) noexcept {
+  libcxx::deallocate(ptr);
+}
+
+void operator delete[](void *ptr, std::align_val_t) noexcept {
+  libcxx::deallocate(ptr);
+}
+
+void operator delete(void *ptr, usize, std::align_val_t) noexcept {
+  libcxx::deallocate(ptr);
+}
+
+void operator delete[](void *ptr, usize, std::align_val_t) noexcept {
+  libcxx::deallocate(ptr);
+}
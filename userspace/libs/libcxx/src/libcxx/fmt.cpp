@@ -1,142 +1,210 @@
-
 #include <libcxx/fmt.h>
-#include <libcxx/syscalls.h>
-#include <libcxx/stdarg.h>
+#include <libcxx/stream.h>
 
-using libcxx::usize;
+using libcxx::FormatSpec;
 using libcxx::Span;
-using libcxx::u32;
+using libcxx::u64;
+using libcxx::usize;
+using libcxx::detail::Argument;
+using libcxx::detail::ArgumentKind;
+using libcxx::detail::Piece;
+using libcxx::detail::Sink;
 
 namespace {
-    template<libcxx::IteratorType Iter>
-    Iter format_hex(u32 number, const Iter begin, const Iter end) {
-      Iter iter = begin;
-      const u32 mask = 0xF000'0000;
-
-      for (u32 i = 0; i < 8; i++) {
-        const auto value = (number & mask) >> 28;
-        if (value != 0) {
-          if (iter == end) {
-            return iter;
+    class StreamSink final : public Sink {
+    public:
+        explicit StreamSink(libcxx::OutputStream &stream) noexcept: mStream(stream) {}
+
+        void write(const Span<const char> data) noexcept override {
+          if (data.size() != 0) {
+            mStream.write(data);
           }
+        }
 
-          if (value >= 10) {
-            *iter++ = 'A' + value - 10;
-          } else {
-            *iter++ = '0' + value;
+    private:
+        libcxx::OutputStream &mStream;
+    };
+
+    /**
+     * @brief Writes into a fixed buffer, always leaving room for the terminating NUL. Output that does not fit is
+     * dropped.
+     */
+    class BufferSink final : public Sink {
+    public:
+        explicit BufferSink(const Span<char> buffer) noexcept: mBuffer(buffer) {}
+
+        void write(const Span<const char> data) noexcept override {
+          // An empty buffer has no room even for the terminating NUL
+          if (mBuffer.size() == 0) {
+            return;
           }
+
+          const usize available = mBuffer.size() - 1 - mLength;
+          const usize length = data.size() < available ? data.size() : available;
+          libcxx::memcpy(&mBuffer[mLength], data.data(), length);
+          mLength += length;
         }
-        number <<= 4;
-      }
 
-      if ((iter == begin) && (iter != end)) {
-        *iter++ = '0';
-      }
+        [[nodiscard]] usize length() const noexcept {
+          return mLength;
+        }
 
-      return iter;
-    }
+    private:
+        Span<char> mBuffer;
+        usize mLength{0};
+    };
 
-    template<libcxx::IteratorType Iter>
-    Iter format_string(Iter iter, Iter end, const char *str) {
-      while ((*str != '\0') && (iter != end)) {
-        *iter++ = *str++;
+    void write_fill(Sink &sink, const char fill, usize count) {
+      libcxx::Array<char, 16> chunk{};
+      libcxx::memset(chunk.data(), fill, chunk.size());
+
+      while (count > 0) {
+        const usize length = count < chunk.size() ? count : chunk.size();
+        sink.write(Span<const char>{chunk.data(), length});
+        count -= length;
       }
-      return iter;
     }
 
-    usize vsprint(Span<char> buffer, const char *fmt, va_list list) noexcept {
-      auto iter = buffer.begin();
-      const auto end = buffer.begin() - 1;
-
-      while (*fmt != '\0') {
-        if (*fmt == '%') {
-          // Skip the %
-          fmt++;
-
-          switch (*fmt) {
-            case 'x': {
-              // Right now only this is supported with no other spec parsers
-              const u32 value = va_arg(list, u32);
-              iter = format_hex(value, iter, end);
-              break;
-            }
-            case 's': {
-              const char *str = va_arg(list, const char*);
-              iter = format_string(iter, end, str);
-              break;
-            }
-            default: {
-              if (iter == end) {
-                // Can't push more characters, just return what we have
-                return iter - buffer.begin();
-              }
-              *iter++ = *fmt;
-              break;
-            }
-          }
-        } else {
-          if (iter == end) {
-              // Can't push more characters, just return what we have
-              return iter - buffer.begin();
-          }
-          *iter++ = *fmt;
-        }
-        fmt++;
+    /**
+     * @brief Writes `prefix` and `body` padded to the width of the spec. Zero padding goes between them.
+     */
+    void write_padded(Sink &sink, const FormatSpec &spec, const Span<const char> prefix, const Span<const char> body,
+                      const FormatSpec::Align default_align) {
+      const usize length = prefix.size() + body.size();
+      const usize padding = spec.width > length ? spec.width - length : 0;
+
+      if (spec.zero_pad) {
+        sink.write(prefix);
+        write_fill(sink, '0', padding);
+        sink.write(body);
+        return;
       }
 
-      return iter - buffer.begin();
+      const auto align = spec.align == FormatSpec::Align::Default ? default_align : spec.align;
+      if (align == FormatSpec::Align::Right) {
+        write_fill(sink, spec.fill, padding);
+      }
+      sink.write(prefix);
+      sink.write(body);
+      if (align == FormatSpec::Align::Left) {
+        write_fill(sink, spec.fill, padding);
+      }
     }
-}
 
-namespace libcxx {
-    usize sprint(Span<char> buffer, const char *fmt, ...) noexcept {
-      va_list args;
-      va_start(args, fmt);
-      usize offset = vsprint(buffer, fmt, args);
-      va_end(args);
-      buffer[offset++] = '\0';
-      return offset;
+    void format_integer(Sink &sink, const FormatSpec &spec, u64 magnitude, const bool negative, const bool is_pointer) {
+      const bool is_default_hex = is_pointer && (spec.type == FormatSpec::Type::Default);
+      const bool is_hex = is_default_hex || (spec.type == FormatSpec::Type::Hex) ||
+                          (spec.type == FormatSpec::Type::UpperHex);
+      const char *digits = spec.type == FormatSpec::Type::UpperHex ? "0123456789ABCDEF" : "0123456789abcdef";
+      const u64 base = is_hex ? 16 : 10;
+
+      // Enough for the 20 decimal digits of the largest u64
+      libcxx::Array<char, 20> buffer{};
+      usize start = buffer.size();
+      do {
+        buffer[--start] = digits[magnitude % base];
+        magnitude /= base;
+      } while (magnitude != 0);
+
+      const char *prefix = negative ? "-" : (is_default_hex ? "0x" : "");
+      write_padded(sink, spec, Span<const char>{prefix, libcxx::strlen(prefix)},
+                   Span<const char>{buffer.data() + start, buffer.size() - start}, FormatSpec::Align::Right);
     }
 
-    usize sprintln(Span<char> buffer, const char *fmt, ...) noexcept {
-      va_list args;
-      va_start(args, fmt);
-      usize offset = vsprint(buffer, fmt, args);
-      va_end(args);
-
-      if (offset < buffer.size() - 1) {
-        buffer[offset++] = '\n';
+    void format_argument(Sink &sink, const FormatSpec &spec, const Argument &argument) {
+      const auto align = FormatSpec::Align::Left;
+      switch (argument.kind) {
+        case ArgumentKind::None:
+          break;
+        case ArgumentKind::Bool: {
+          const char *str = argument.unsigned_value != 0 ? "true" : "false";
+          write_padded(sink, spec, {}, Span<const char>{str, libcxx::strlen(str)}, align);
+          break;
+        }
+        case ArgumentKind::Char: {
+          if (spec.type != FormatSpec::Type::Default) {
+            format_integer(sink, spec, argument.unsigned_value, false, false);
+            break;
+          }
+          const char c = static_cast<char>(argument.unsigned_value);
+          write_padded(sink, spec, {}, Span<const char>{&c, 1}, align);
+          break;
+        }
+        case ArgumentKind::Signed: {
+          const bool negative = argument.signed_value < 0;
+          // Negating in unsigned arithmetic also works for the smallest value
+          const u64 magnitude = negative ? 0 - argument.unsigned_value : argument.unsigned_value;
+          format_integer(sink, spec, magnitude, negative, false);
+          break;
+        }
+        case ArgumentKind::Unsigned:
+          format_integer(sink, spec, argument.unsigned_value, false, false);
+          break;
+        case ArgumentKind::Pointer:
+          format_integer(sink, spec, argument.unsigned_value, false, true);
+          break;
+        case ArgumentKind::String: {
+          const auto &string = argument.string_value;
+          write_padded(sink, spec, {}, Span<const char>{string.data, string.length}, align);
+          break;
+        }
       }
-      buffer[offset++] = '\0';
-      return offset;
     }
 
-    void print(const char *fmt, ...) noexcept {
-      // TODO(javier-varez): Use buffered IO instead of this piece of crap array thing
-      Array<char, 512> string;
+    /** @brief Writes the literal, replacing escaped braces by a single brace. */
+    void write_literal(Sink &sink, const Piece &piece) {
+      if (!piece.escaped) {
+        sink.write(Span<const char>{piece.literal, piece.length});
+        return;
+      }
 
-      va_list args;
-      va_start(args, fmt);
-      usize offset = vsprint(string, fmt, args);
-      va_end(args);
+      usize start = 0;
+      for (usize i = 0; i < piece.length; i++) {
+        const char c = piece.literal[i];
+        if ((c == '{') || (c == '}')) {
+          // Write up to and including the first brace, and skip the second one
+          sink.write(Span<const char>{piece.literal + start, i + 1 - start});
+          i++;
+          start = i + 1;
+        }
+      }
+      sink.write(Span<const char>{piece.literal + start, piece.length - start});
+    }
+}
 
-      string[offset++] = '\0';
-      libcxx::syscalls::puts(&string[0]);
+namespace libcxx::detail {
+    void vformat(Sink &sink, const Span<const Piece> pieces, const Span<const Argument> arguments) noexcept {
+      // Format strings have one more piece than arguments, checked when they are parsed
+      for (usize i = 0; i < arguments.size(); i++) {
+        write_literal(sink, pieces[i]);
+        format_argument(sink, pieces[i].spec, arguments[i]);
+      }
+      write_literal(sink, pieces[arguments.size()]);
     }
 
-    void println(const char *fmt, ...) noexcept {
-      // TODO(javier-varez): Use buffered IO instead of this piece of crap array thing
-      Array<char, 512> string;
+    void vprint(OutputStream &stream, const Span<const Piece> pieces, const Span<const Argument> arguments,
+                const bool newline) noexcept {
+      StreamSink sink{stream};
+      vformat(sink, pieces, arguments);
+      if (newline) {
+        stream.put('\n');
+      }
+    }
 
-      va_list args;
-      va_start(args, fmt);
-      usize offset = vsprint(string, fmt, args);
-      va_end(args);
+    usize vsprint(const Span<char> buffer, const Span<const Piece> pieces, const Span<const Argument> arguments,
+                  const bool newline) noexcept {
+      BufferSink sink{buffer};
+      vformat(sink, pieces, arguments);
+      if (newline) {
+        sink.write(Span<const char>{"\n", 1});
+      }
 
-      if (offset < string.size() - 1) {
-        string[offset++] = '\n';
+      if (buffer.size() == 0) {
+        return 0;
       }
-      string[offset++] = '\0';
-      libcxx::syscalls::puts(&string[0]);
+
+      usize offset = sink.length();
+      buffer[offset++] = '\0';
+      return offset;
     }
-}
\ No newline at end of file
+}
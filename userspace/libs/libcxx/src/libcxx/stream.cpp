@@ -0,0 +1,71 @@
+#include <libcxx/stream.h>
+#include <libcxx/syscalls.h>
+
+namespace {
+    libcxx::OutputStream gStdout{libcxx::BufferMode::LineBuffered};
+}
+
+namespace libcxx {
+    void OutputStream::write(const Span<const char> data) noexcept {
+      if (data.size() == 0) {
+        return;
+      }
+
+      if (mMode == BufferMode::Unbuffered) {
+        syscalls::write(data.data(), data.size());
+        return;
+      }
+
+      if (data.size() > (BUFFER_SIZE - mLength)) {
+        // Hand both the pending data and the new data to the kernel in a single syscall without copying
+        const Array<syscalls::IoVec, 2> segments{
+            syscalls::IoVec{mBuffer.data(), mLength},
+            syscalls::IoVec{data.data(), data.size()},
+        };
+        syscalls::writev(Span<const syscalls::IoVec>{segments.data(), segments.size()});
+        mLength = 0;
+        return;
+      }
+
+      bool has_newline = false;
+      for (const char c: data) {
+        has_newline |= c == '\n';
+        mBuffer[mLength++] = c;
+      }
+
+      if ((mLength == BUFFER_SIZE) || (has_newline && (mMode == BufferMode::LineBuffered))) {
+        flush();
+      }
+    }
+
+    void OutputStream::put(const char c) noexcept {
+      write(Span<const char>{&c, 1});
+    }
+
+    void OutputStream::flush() noexcept {
+      if (mLength == 0) {
+        return;
+      }
+
+      syscalls::write(mBuffer.data(), mLength);
+      mLength = 0;
+    }
+
+    void OutputStream::set_mode(const BufferMode mode) noexcept {
+      flush();
+      mMode = mode;
+    }
+
+    OutputStream &stdout() noexcept {
+      return gStdout;
+    }
+
+    void flush() noexcept {
+      gStdout.flush();
+    }
+}
+
+// Called by crt::fini() before the process exits, so that no buffered output is lost.
+extern "C" void __libcxx_flush_stdout() {
+  gStdout.flush();
+}
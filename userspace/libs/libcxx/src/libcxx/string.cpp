@@ -0,0 +1,284 @@
+#include <libcxx/string.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+using libcxx::u8;
+using libcxx::u64;
+using libcxx::usize;
+
+namespace {
+    // Memory is accessed in words through a type that may alias any object
+    using Word = u64 __attribute__((may_alias));
+
+    constexpr usize WORD_SIZE = sizeof(Word);
+    constexpr u64 ONES = 0x0101'0101'0101'0101ull;
+    constexpr u64 HIGHS = 0x8080'8080'8080'8080ull;
+
+    /**
+     * @brief Sets the high bit of the first zero byte of `word`. Bytes after it may be flagged too, but bytes before it
+     * never are.
+     */
+    constexpr u64 zero_bytes(u64 word) {
+      return (word - ONES) & ~word & HIGHS;
+    }
+
+    /** @brief Index of the first byte flagged by `zero_bytes`. Words are little endian. */
+    constexpr usize first_flagged_byte(u64 flags) {
+      return __builtin_ctzll(flags) / 8;
+    }
+
+    usize misalignment(const void *ptr, usize alignment) {
+      return reinterpret_cast<usize>(ptr) & (alignment - 1);
+    }
+
+    /** @brief True if both pointers can be aligned to a word by advancing them the same number of bytes. */
+    bool are_coaligned(const void *lhs, const void *rhs) {
+      return misalignment(lhs, WORD_SIZE) == misalignment(rhs, WORD_SIZE);
+    }
+
+#if defined(__ARM_NEON)
+    constexpr usize VECTOR_SIZE = 16;
+
+    /** @brief Narrows a comparison result to a mask with 4 bits per byte. */
+    u64 byte_mask(uint8x16_t comparison) {
+      const uint8x8_t narrowed = vshrn_n_u16(vreinterpretq_u16_u8(comparison), 4);
+      return vget_lane_u64(vreinterpret_u64_u8(narrowed), 0);
+    }
+
+    /** @brief Index of the first byte set in a mask returned by `byte_mask`. */
+    usize first_masked_byte(u64 mask) {
+      return __builtin_ctzll(mask) / 4;
+    }
+#endif
+}
+
+usize libcxx::detail::strlen(const char *str) noexcept {
+  // Aligned reads never cross into the next page, so reading past the terminator cannot fault. Bytes before the start
+  // of the string are discarded.
+#if defined(__ARM_NEON)
+  const usize offset = misalignment(str, VECTOR_SIZE);
+  const u8 *block = reinterpret_cast<const u8 *>(str - offset);
+  const uint8x16_t zero = vdupq_n_u8(0);
+
+  u64 mask = byte_mask(vceqq_u8(vld1q_u8(block), zero)) >> (offset * 4);
+  if (mask != 0) {
+    return first_masked_byte(mask);
+  }
+
+  while (true) {
+    block += VECTOR_SIZE;
+    mask = byte_mask(vceqq_u8(vld1q_u8(block), zero));
+    if (mask != 0) {
+      return reinterpret_cast<const char *>(block) + first_masked_byte(mask) - str;
+    }
+  }
+#else
+  const usize offset = misalignment(str, WORD_SIZE);
+  const Word *word = reinterpret_cast<const Word *>(str - offset);
+
+  u64 flags = zero_bytes(*word | ((1ull << (offset * 8)) - 1));
+  while (flags == 0) {
+    flags = zero_bytes(*++word);
+  }
+  return reinterpret_cast<const char *>(word) + first_flagged_byte(flags) - str;
+#endif
+}
+
+void *libcxx::memcpy(void *dst, const void *src, usize size) noexcept {
+  u8 *to = static_cast<u8 *>(dst);
+  const u8 *from = static_cast<const u8 *>(src);
+
+#if defined(__ARM_NEON)
+  // Vector loads and stores of bytes have no alignment requirements
+  for (; size >= 2 * VECTOR_SIZE; size -= 2 * VECTOR_SIZE) {
+    const uint8x16_t first = vld1q_u8(from);
+    const uint8x16_t second = vld1q_u8(from + VECTOR_SIZE);
+    vst1q_u8(to, first);
+    vst1q_u8(to + VECTOR_SIZE, second);
+    to += 2 * VECTOR_SIZE;
+    from += 2 * VECTOR_SIZE;
+  }
+#else
+  if (are_coaligned(to, from)) {
+    for (; (size > 0) && (misalignment(to, WORD_SIZE) != 0); size--) {
+      *to++ = *from++;
+    }
+
+    Word *to_word = reinterpret_cast<Word *>(to);
+    const Word *from_word = reinterpret_cast<const Word *>(from);
+    for (; size >= 4 * WORD_SIZE; size -= 4 * WORD_SIZE) {
+      to_word[0] = from_word[0];
+      to_word[1] = from_word[1];
+      to_word[2] = from_word[2];
+      to_word[3] = from_word[3];
+      to_word += 4;
+      from_word += 4;
+    }
+    for (; size >= WORD_SIZE; size -= WORD_SIZE) {
+      *to_word++ = *from_word++;
+    }
+
+    to = reinterpret_cast<u8 *>(to_word);
+    from = reinterpret_cast<const u8 *>(from_word);
+  }
+#endif
+
+  while (size-- > 0) {
+    *to++ = *from++;
+  }
+  return dst;
+}
+
+void *libcxx::memmove(void *dst, const void *src, usize size) noexcept {
+  u8 *to = static_cast<u8 *>(dst);
+  const u8 *from = static_cast<const u8 *>(src);
+
+  // Copying forwards is only wrong if the destination starts within the source
+  if ((to <= from) || (to >= from + size)) {
+    return memcpy(dst, src, size);
+  }
+
+  while (size-- > 0) {
+    to[size] = from[size];
+  }
+  return dst;
+}
+
+void *libcxx::memset(void *dst, int value, usize size) noexcept {
+  u8 *to = static_cast<u8 *>(dst);
+  const u8 byte = static_cast<u8>(value);
+
+#if defined(__ARM_NEON)
+  const uint8x16_t vector = vdupq_n_u8(byte);
+  for (; size >= VECTOR_SIZE; size -= VECTOR_SIZE) {
+    vst1q_u8(to, vector);
+    to += VECTOR_SIZE;
+  }
+#else
+  for (; (size > 0) && (misalignment(to, WORD_SIZE) != 0); size--) {
+    *to++ = byte;
+  }
+
+  const u64 pattern = ONES * byte;
+  Word *to_word = reinterpret_cast<Word *>(to);
+  for (; size >= WORD_SIZE; size -= WORD_SIZE) {
+    *to_word++ = pattern;
+  }
+  to = reinterpret_cast<u8 *>(to_word);
+#endif
+
+  while (size-- > 0) {
+    *to++ = byte;
+  }
+  return dst;
+}
+
+int libcxx::memcmp(const void *lhs, const void *rhs, usize size) noexcept {
+  const u8 *left = static_cast<const u8 *>(lhs);
+  const u8 *right = static_cast<const u8 *>(rhs);
+
+  // The bulk loops only skip blocks that are equal. The first difference is found by the byte loop.
+#if defined(__ARM_NEON)
+  for (; size >= VECTOR_SIZE; size -= VECTOR_SIZE) {
+    const uint8x16_t equal = vceqq_u8(vld1q_u8(left), vld1q_u8(right));
+    if (vminvq_u8(equal) != 0xFF) {
+      const usize index = first_masked_byte(byte_mask(vmvnq_u8(equal)));
+      return static_cast<int>(left[index]) - static_cast<int>(right[index]);
+    }
+    left += VECTOR_SIZE;
+    right += VECTOR_SIZE;
+  }
+#else
+  if (are_coaligned(left, right)) {
+    for (; (size > 0) && (misalignment(left, WORD_SIZE) != 0); size--) {
+      if (*left != *right) {
+        return static_cast<int>(*left) - static_cast<int>(*right);
+      }
+      left++;
+      right++;
+    }
+
+    const Word *left_word = reinterpret_cast<const Word *>(left);
+    const Word *right_word = reinterpret_cast<const Word *>(right);
+    for (; (size >= WORD_SIZE) && (*left_word == *right_word); size -= WORD_SIZE) {
+      left_word++;
+      right_word++;
+    }
+    left = reinterpret_cast<const u8 *>(left_word);
+    right = reinterpret_cast<const u8 *>(right_word);
+  }
+#endif
+
+  for (; size > 0; size--) {
+    if (*left != *right) {
+      return static_cast<int>(*left) - static_cast<int>(*right);
+    }
+    left++;
+    right++;
+  }
+  return 0;
+}
+
+const void *libcxx::memchr(const void *src, int value, usize size) noexcept {
+  const u8 *from = static_cast<const u8 *>(src);
+  const u8 byte = static_cast<u8>(value);
+
+#if defined(__ARM_NEON)
+  const uint8x16_t vector = vdupq_n_u8(byte);
+  for (; size >= VECTOR_SIZE; size -= VECTOR_SIZE) {
+    const u64 mask = byte_mask(vceqq_u8(vld1q_u8(from), vector));
+    if (mask != 0) {
+      return from + first_masked_byte(mask);
+    }
+    from += VECTOR_SIZE;
+  }
+#else
+  for (; (size > 0) && (misalignment(from, WORD_SIZE) != 0); size--) {
+    if (*from == byte) {
+      return from;
+    }
+    from++;
+  }
+
+  // Bytes equal to the value become zero
+  const u64 pattern = ONES * byte;
+  const Word *word = reinterpret_cast<const Word *>(from);
+  for (; size >= WORD_SIZE; size -= WORD_SIZE) {
+    const u64 flags = zero_bytes(*word ^ pattern);
+    if (flags != 0) {
+      return reinterpret_cast<const u8 *>(word) + first_flagged_byte(flags);
+    }
+    word++;
+  }
+  from = reinterpret_cast<const u8 *>(word);
+#endif
+
+  for (; size > 0; size--) {
+    if (*from == byte) {
+      return from;
+    }
+    from++;
+  }
+  return nullptr;
+}
+
+// The compiler emits calls to these for copies and initialization of large objects, even when freestanding
+extern "C" {
+    void *memcpy(void *dst, const void *src, usize size) {
+      return libcxx::memcpy(dst, src, size);
+    }
+
+    void *memmove(void *dst, const void *src, usize size) {
+      return libcxx::memmove(dst, src, size);
+    }
+
+    void *memset(void *dst, int value, usize size) {
+      return libcxx::memset(dst, value, size);
+    }
+
+    int memcmp(const void *lhs, const void *rhs, usize size) {
+      return libcxx::memcmp(lhs, rhs, size);
+    }
+}
@@ -0,0 +1,50 @@
+#include <libcxx/sync.h>
+#include <libcxx/syscalls.h>
+
+namespace libcxx {
+    void Mutex::lock() noexcept {
+      u32 state = Unlocked;
+      if (__atomic_compare_exchange_n(&mState, &state, Locked, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return;
+      }
+
+      // Once there may be waiters the lock stays contended until it is released, so that whoever releases it wakes
+      // one of them up. The thread that takes it cannot know whether others are still blocked.
+      if (state != Contended) {
+        state = __atomic_exchange_n(&mState, Contended, __ATOMIC_ACQUIRE);
+      }
+      while (state != Unlocked) {
+        syscalls::futex_wait(&mState, Contended);
+        state = __atomic_exchange_n(&mState, Contended, __ATOMIC_ACQUIRE);
+      }
+    }
+
+    bool Mutex::try_lock() noexcept {
+      u32 state = Unlocked;
+      return __atomic_compare_exchange_n(&mState, &state, Locked, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+    }
+
+    void Mutex::unlock() noexcept {
+      if (__atomic_exchange_n(&mState, Unlocked, __ATOMIC_RELEASE) == Contended) {
+        syscalls::futex_wake(&mState, 1);
+      }
+    }
+
+    void ConditionVariable::wait(Mutex &mutex) noexcept {
+      // A notification between unlocking and blocking changes the sequence, so the kernel does not block
+      const u32 sequence = __atomic_load_n(&mSequence, __ATOMIC_RELAXED);
+      mutex.unlock();
+      syscalls::futex_wait(&mSequence, sequence);
+      mutex.lock();
+    }
+
+    void ConditionVariable::notify_one() noexcept {
+      __atomic_fetch_add(&mSequence, 1, __ATOMIC_RELAXED);
+      syscalls::futex_wake(&mSequence, 1);
+    }
+
+    void ConditionVariable::notify_all() noexcept {
+      __atomic_fetch_add(&mSequence, 1, __ATOMIC_RELAXED);
+      syscalls::futex_wake(&mSequence, ~0ul);
+    }
+}
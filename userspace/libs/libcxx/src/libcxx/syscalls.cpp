@@ -5,11 +5,27 @@
 
 namespace libcxx::syscalls {
     void puts(const char *str) {
-      const usize string_length = strlen(str);
+      write(str, strlen(str));
+    }
+
+    void write(const char *str, const usize length) {
       asm volatile(
       "mov x0, %0\n"
       "mov x1, %1\n"
-      "svc 6" : : "r" (str), "r" (string_length) : "x0", "x1" );
+      "svc 6" : : "r" (str), "r" (length) : "x0", "x1", "memory");
+    }
+
+    void writev(const Span<const IoVec> segments) {
+      if (segments.size() == 0) {
+        return;
+      }
+
+      const IoVec *const iov = segments.data();
+      const usize count = segments.size();
+      asm volatile(
+      "mov x0, %0\n"
+      "mov x1, %1\n"
+      "svc 9" : : "r" (iov), "r" (count) : "x0", "x1", "memory");
     }
 
     void sleep(const u64 time_us) {
@@ -17,4 +33,188 @@ namespace libcxx::syscalls {
       "mov x0, %0\n"
       "svc 2" : : "r" (time_us) : "x0");
     }
-}
\ No newline at end of file
+
+    void memory_statistics(MemoryStatistics &stats) {
+      MemoryStatistics *const ptr = &stats;
+      asm volatile(
+      "mov x0, %0\n"
+      "svc 12" : : "r" (ptr) : "x0", "memory");
+    }
+
+    void print_memory_statistics() {
+      asm volatile("svc 30");
+    }
+
+    u64 open(const char *path) {
+      const usize length = strlen(path);
+      register u64 result asm("x0");
+      asm volatile(
+      "mov x0, %1\n"
+      "mov x1, %2\n"
+      "svc 13" : "=&r" (result) : "r" (path), "r" (length) : "x1", "memory");
+      return result;
+    }
+
+    u64 read(const u64 fd, void *const buffer, const usize length) {
+      register u64 result asm("x0");
+      asm volatile(
+      "mov x0, %1\n"
+      "mov x1, %2\n"
+      "mov x2, %3\n"
+      "svc 14" : "=&r" (result) : "r" (fd), "r" (buffer), "r" (length) : "x1", "x2", "memory");
+      return result;
+    }
+
+    u64 close(const u64 fd) {
+      register u64 result asm("x0");
+      asm volatile(
+      "mov x0, %1\n"
+      "svc 15" : "=&r" (result) : "r" (fd));
+      return result;
+    }
+
+    const u8 *map_file(const u64 fd) {
+      register u64 result asm("x0");
+      asm volatile(
+      "mov x0, %1\n"
+      "svc 16" : "=&r" (result) : "r" (fd) : "memory");
+      if (result == SYSCALL_ERROR) {
+        return nullptr;
+      }
+      return reinterpret_cast<const u8 *>(result);
+    }
+
+    u64 spawn(const char *path, const char *const *argv, const char *const *envp) {
+      const usize length = strlen(path);
+      register u64 result asm("x0");
+      asm volatile(
+      "mov x0, %1\n"
+      "mov x1, %2\n"
+      "mov x2, %3\n"
+      "mov x3, %4\n"
+      "svc 17" : "=&r" (result) : "r" (path), "r" (length), "r" (argv), "r" (envp) : "x1", "x2", "x3", "memory");
+      return result;
+    }
+
+    u64 shared_memory_create(const usize size) {
+      register u64 result asm("x0");
+      asm volatile(
+      "mov x0, %1\n"
+      "svc 18" : "=&r" (result) : "r" (size));
+      return result;
+    }
+
+    u8 *shared_memory_map(const u64 id) {
+      register u64 result asm("x0");
+      asm volatile(
+      "mov x0, %1\n"
+      "svc 19" : "=&r" (result) : "r" (id) : "memory");
+      if (result == SYSCALL_ERROR) {
+        return nullptr;
+      }
+      return reinterpret_cast<u8 *>(result);
+    }
+
+    u64 shared_memory_release(const u64 id) {
+      register u64 result asm("x0");
+      asm volatile(
+      "mov x0, %1\n"
+      "svc 20" : "=&r" (result) : "r" (id));
+      return result;
+    }
+
+    u64 pipe_create() {
+      register u64 result asm("x0");
+      asm volatile(
+      "svc 21" : "=r" (result));
+      return result;
+    }
+
+    u64 pipe_read(const u64 id, void *const buffer, const usize length) {
+      register u64 result asm("x0");
+      asm volatile(
+      "mov x0, %1\n"
+      "mov x1, %2\n"
+      "mov x2, %3\n"
+      "svc 22" : "=&r" (result) : "r" (id), "r" (buffer), "r" (length) : "x1", "x2", "memory");
+      return result;
+    }
+
+    u64 pipe_write(const u64 id, const void *const data, const usize length) {
+      register u64 result asm("x0");
+      asm volatile(
+      "mov x0, %1\n"
+      "mov x1, %2\n"
+      "mov x2, %3\n"
+      "svc 23" : "=&r" (result) : "r" (id), "r" (data), "r" (length) : "x1", "x2", "memory");
+      return result;
+    }
+
+    u64 pipe_close(const u64 id, const PipeEnd end) {
+      const u64 end_value = static_cast<u64>(end);
+      register u64 result asm("x0");
+      asm volatile(
+      "mov x0, %1\n"
+      "mov x1, %2\n"
+      "svc 24" : "=&r" (result) : "r" (id), "r" (end_value) : "x1");
+      return result;
+    }
+
+    u8 *map_anonymous(const usize size) {
+      register u64 result asm("x0");
+      asm volatile(
+      "mov x0, %1\n"
+      "svc 25" : "=&r" (result) : "r" (size) : "memory");
+      if (result == SYSCALL_ERROR) {
+        return nullptr;
+      }
+      return reinterpret_cast<u8 *>(result);
+    }
+
+    u64 unmap(void *const address) {
+      register u64 result asm("x0");
+      asm volatile(
+      "mov x0, %1\n"
+      "svc 26" : "=&r" (result) : "r" (address) : "memory");
+      return result;
+    }
+
+    u64 thread_create(void (*const entry)(void *), void *const argument, const usize stack_size) {
+      register u64 result asm("x0");
+      asm volatile(
+      "mov x0, %1\n"
+      "mov x1, %2\n"
+      "mov x2, %3\n"
+      "svc 27" : "=&r" (result) : "r" (entry), "r" (argument), "r" (stack_size) : "x1", "x2", "memory");
+      return result;
+    }
+
+    void thread_exit() {
+      asm volatile("svc 4" : : : "memory");
+      __builtin_unreachable();
+    }
+
+    void thread_join(const u64 tid) {
+      asm volatile(
+      "mov x0, %0\n"
+      "svc 5" : : "r" (tid) : "x0", "memory");
+    }
+
+    u64 futex_wait(const u32 *const word, const u32 expected) {
+      register u64 result asm("x0");
+      asm volatile(
+      "mov x0, %1\n"
+      "mov x1, %2\n"
+      "svc 28" : "=&r" (result) : "r" (word), "r" (static_cast<u64>(expected)) : "x1", "memory");
+      return result;
+    }
+
+    u64 futex_wake(const u32 *const word, const usize count) {
+      register u64 result asm("x0");
+      asm volatile(
+      "mov x0, %1\n"
+      "mov x1, %2\n"
+      "svc 29" : "=&r" (result) : "r" (word), "r" (count) : "x1", "memory");
+      return result;
+    }
+}
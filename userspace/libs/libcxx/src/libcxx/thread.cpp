@@ -0,0 +1,32 @@
+#include <libcxx/syscalls.h>
+#include <libcxx/thread.h>
+
+namespace libcxx {
+    Thread::Thread(const Entry entry, void *const argument, const usize stack_size) noexcept
+        : mEntry(entry), mArgument(argument) {
+      // The thread starts with this object as its argument, which lives until the thread is joined
+      mTid = syscalls::thread_create(&Thread::start, this, stack_size);
+    }
+
+    Thread::~Thread() noexcept {
+      if (joinable()) {
+        join();
+      }
+    }
+
+    bool Thread::joinable() const noexcept {
+      return mTid != syscalls::SYSCALL_ERROR;
+    }
+
+    void Thread::join() noexcept {
+      syscalls::thread_join(mTid);
+      mTid = syscalls::SYSCALL_ERROR;
+    }
+
+    void Thread::start(void *const thread) noexcept {
+      // The kernel starts threads without a return address, so they must exit through the syscall
+      const auto *self = static_cast<const Thread *>(thread);
+      self->mEntry(self->mArgument);
+      syscalls::thread_exit();
+    }
+}
@@ -0,0 +1,52 @@
+#include <libcxx/time.h>
+
+using libcxx::u32;
+using libcxx::u64;
+
+extern "C" const void *__crt_system_page;
+
+namespace {
+    struct Conversion {
+        u64 boot_counter;
+        u64 ns_mult;
+        u32 ns_shift;
+    };
+
+    /** @brief Reads the conversion parameters, retrying if the kernel updated them in the middle of the read */
+    Conversion read_conversion() noexcept {
+      const auto &page = libcxx::time::system_page();
+      while (true) {
+        const u32 sequence = __atomic_load_n(&page.sequence, __ATOMIC_ACQUIRE);
+        const Conversion conversion{
+            .boot_counter = __atomic_load_n(&page.boot_counter, __ATOMIC_RELAXED),
+            .ns_mult = __atomic_load_n(&page.ns_mult, __ATOMIC_RELAXED),
+            .ns_shift = __atomic_load_n(&page.ns_shift, __ATOMIC_RELAXED),
+        };
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (((sequence & 1) == 0) && (__atomic_load_n(&page.sequence, __ATOMIC_RELAXED) == sequence)) {
+          return conversion;
+        }
+      }
+    }
+
+    u64 scale(const u64 ticks, const Conversion &conversion) noexcept {
+      // The 128-bit product is a single umulh, unlike a 128-bit division, which would need libgcc
+      return static_cast<u64>((static_cast<unsigned __int128>(ticks) * conversion.ns_mult) >> conversion.ns_shift);
+    }
+}
+
+namespace libcxx::time {
+    const SystemPage &system_page() noexcept {
+      return *static_cast<const SystemPage *>(__crt_system_page);
+    }
+
+    u64 ticks_to_nanoseconds(const u64 ticks) noexcept {
+      return scale(ticks, read_conversion());
+    }
+
+    u64 now() noexcept {
+      const Conversion conversion = read_conversion();
+      return scale(ticks() - conversion.boot_counter, conversion);
+    }
+}
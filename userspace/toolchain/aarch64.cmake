@@ -15,6 +15,14 @@ set(CMAKE_CXX_COMPILER_TARGET ${triple})
 set(CMAKE_CXX_FLAGS "-fno-omit-frame-pointer")
 set(CMAKE_C_FLAGS "-fno-omit-frame-pointer")
 
+# Flags of each build type. They are added after the flags above, so the optimized profiles keep the frame pointer
+set(CMAKE_CXX_FLAGS_DEBUG_INIT "-O0 -g3")
+set(CMAKE_CXX_FLAGS_RELEASE_INIT "-O2")
+set(CMAKE_CXX_FLAGS_RELWITHDEBINFO_INIT "-O2 -g")
+set(CMAKE_C_FLAGS_DEBUG_INIT "-O0 -g3")
+set(CMAKE_C_FLAGS_RELEASE_INIT "-O2")
+set(CMAKE_C_FLAGS_RELWITHDEBINFO_INIT "-O2 -g")
+
 set(CMAKE_FIND_ROOT_PATH_MODE_PROGRAM NEVER)
 set(CMAKE_FIND_ROOT_PATH_MODE_LIBRARY ONLY)
 set(CMAKE_FIND_ROOT_PATH_MODE_INCLUDE ONLY)
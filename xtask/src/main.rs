@@ -49,10 +49,10 @@ const FW_DIR: &str = "fw";
 const ROOTFS_DIR: &str = "build/rootfs";
 const ROOTFS_FILE: &str = "build/rootfs.cpio";
 
-fn build_rootfs() -> Result<(), anyhow::Error> {
+fn build_rootfs(release: bool) -> Result<(), anyhow::Error> {
     mkdir_p(ROOTFS_DIR)?;
 
-    userspace::build()?;
+    userspace::build(release)?;
     drivers::build()?;
 
     let rootfs_cpio_data = {
@@ -186,7 +186,7 @@ fn get_cargo_args(
 }
 
 fn run_build(release: bool, emulator: bool, binary: bool) -> Result<(), anyhow::Error> {
-    build_rootfs()?;
+    build_rootfs(release)?;
 
     let _dir = pushd(FW_DIR)?;
     let (release, features) = get_cargo_args(release, emulator, binary)?;
@@ -215,7 +215,7 @@ fn check_prerequisites() -> Result<(), anyhow::Error> {
 }
 
 fn run_tests() -> Result<(), anyhow::Error> {
-    build_rootfs()?;
+    build_rootfs(false)?;
 
     // Run host tests
     cmd!("cargo test").run()?;
@@ -227,7 +227,7 @@ fn run_tests() -> Result<(), anyhow::Error> {
 }
 
 fn run_clippy() -> Result<(), anyhow::Error> {
-    build_rootfs()?;
+    build_rootfs(false)?;
     cmd!("cargo clippy").run()?;
     let _dir = pushd(FW_DIR)?;
     cmd!("cargo clippy").run()?;
@@ -235,7 +235,7 @@ fn run_clippy() -> Result<(), anyhow::Error> {
 }
 
 fn run_qemu(release: bool) -> Result<(), anyhow::Error> {
-    build_rootfs()?;
+    build_rootfs(false)?;
 
     let _dir = pushd(FW_DIR)?;
     let (release, features) = get_cargo_args(release, true, false)?;
@@ -297,7 +297,7 @@ fn run_fw_coverage() -> Result<(), anyhow::Error> {
 }
 
 fn run_coverage() -> Result<(), anyhow::Error> {
-    build_rootfs()?;
+    build_rootfs(false)?;
 
     run_fw_coverage()?;
 
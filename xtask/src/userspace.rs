@@ -3,10 +3,12 @@ use xshell::cmd;
 const USERSPACE_DIR: &str = "userspace";
 const BUILD_DIR: &str = "build";
 
-pub fn build() -> Result<(), anyhow::Error> {
+pub fn build(release: bool) -> Result<(), anyhow::Error> {
     let rootfs = crate::ROOTFS_DIR;
+    // Release builds keep debug info, so that crashes in userspace can still be symbolicated
+    let build_type = if release { "RelWithDebInfo" } else { "Debug" };
     // Build userspace binaries
-    cmd!("cmake -S {USERSPACE_DIR} -B {BUILD_DIR}/{USERSPACE_DIR} -DCMAKE_TOOLCHAIN_FILE=toolchain/aarch64.cmake -DCMAKE_SYSTEM_NAME=Generic").run()?;
+    cmd!("cmake -S {USERSPACE_DIR} -B {BUILD_DIR}/{USERSPACE_DIR} -DCMAKE_TOOLCHAIN_FILE=toolchain/aarch64.cmake -DCMAKE_SYSTEM_NAME=Generic -DCMAKE_BUILD_TYPE={build_type}").run()?;
     cmd!("cmake --build {BUILD_DIR}/{USERSPACE_DIR}").run()?;
     cmd!("cmake --install {BUILD_DIR}/{USERSPACE_DIR} --prefix {rootfs}").run()?;
     Ok(())